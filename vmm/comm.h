@@ -8,19 +8,33 @@
 
 struct comm_t;
 
+/* What the monitor process is blocked on; tells the receiver thread
+ * how to wake it up. */
+enum monitor_state {
+	MONITOR_RUNNING,	/* handles the messages at the next trap */
+	MONITOR_WAITING_MSG,	/* blocked in Comm_*_msg* () */
+	MONITOR_WAITING_GUEST,	/* blocked in waitpid () on the running guest */
+	MONITOR_HALTED,		/* sleeping in hlt () */
+};
+
 int connect_to_node ( const struct node_t *node );
 int listen_at_port ( int port );
 
-struct comm_t *Comm_create ( int cpuid, int pid, const struct config_t *config, bool_t is_resuming );
+struct comm_t *Comm_create ( int cpuid, int pid, struct event_t *event, const struct config_t *config, bool_t is_resuming );
 void           Comm_destroy ( struct comm_t *comm );
 void           Comm_send ( struct comm_t *comm, struct msg_t *msg, int dest_cpuid );
+void           Comm_sendv ( struct comm_t *comm, msg_kind_t kind, struct iovec *iov, int iovcnt, int dest_cpuid );
 void           Comm_bcast ( struct comm_t *comm, struct msg_t *msg );
 void           Comm_add_msg ( struct comm_t *comm, struct msg_t *msg, int src_id );
 struct msg_t  *Comm_remove_msg ( struct comm_t *comm );
 struct msg_t  *Comm_try_remove_msg ( struct comm_t *comm );
-struct msg_t  *Comm_remove_msg2 ( struct comm_t *comm, bool_t (*judge_func) ( struct msg_t * ) );
-struct msg_t  *Comm_try_remove_msg2 ( struct comm_t *comm, bool_t (*judge_func) ( struct msg_t * ) );
-void           Comm_wait_msg ( struct comm_t *comm, bool_t (*judge_func) ( struct msg_t * ), int sleep_time );
+struct msg_t  *Comm_remove_msg2 ( struct comm_t *comm, int (*defer_func) ( struct msg_t * ) );
+struct msg_t  *Comm_try_remove_msg2 ( struct comm_t *comm, int (*defer_func) ( struct msg_t * ) );
+void           Comm_wait_msg ( struct comm_t *comm, int (*defer_func) ( struct msg_t * ), int sleep_time );
+void           Comm_defer_msg ( struct comm_t *comm, struct msg_t *msg, int src_id, int key );
+void           Comm_release_deferred_msgs ( struct comm_t *comm, int key );
+void           Comm_recv_image_into ( struct comm_t *comm, void *base );
+void           Comm_set_monitor_state ( struct comm_t *comm, int state );
 void           Comm_shutdown ( struct comm_t *comm );
 void           Comm_pack_msgs ( struct comm_t *comm, int fd );
 void           Comm_unpack_msgs ( struct comm_t *comm, int fd );
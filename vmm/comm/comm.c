@@ -1,7 +1,9 @@
-#include "vmm/std.h"
-#include "vmm/comm/msg.h"
-#include "vmm/comm/conf.h"
+#include "vmm/common.h"
+#include "vmm/comm.h"
 #include <sys/socket.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 
 #ifdef ENABLE_MP
 
@@ -55,11 +57,236 @@ listen_at_port ( int port )
 
 /****************************************************************/
 
+/* Shared-memory pipes between the nodes on the same host.
+ *
+ * A pipe is a POSIX shared-memory object mapped by both nodes that
+ * holds one byte ring per direction.  The bytes of the messages are the
+ * same as on a socket, so the messages are received in the same way
+ * and in the same order.  The socket of the connection is kept: it
+ * carries the INIT message with the name of the pipe, tells that the
+ * peer has closed the connection, and carries a doorbell byte when the
+ * reader waits in select (), so that a single select () still waits for
+ * all the nodes.  A writer that finds the ring full sleeps on an
+ * eventfd; the peer rings the doorbell back once it has read from the
+ * ring, and the receiver thread signals the eventfd. */
+
+enum {
+	SHM_RING_SIZE = 0x40000	/* 256 KB per direction */
+};
+
+struct shm_pipe_t {
+	void			*base;
+	struct shm_ring_t	*tx;
+	struct shm_ring_t	*rx;
+	int			efd;	/* signaled when the peer has read from <tx> */
+	volatile bool_t		is_writer_sleeping;
+	volatile bool_t		is_closed;
+	char			name[MAX_SHM_NAME_LEN];	/* "" unless we created it and it is linked */
+};
+
+static bool_t
+use_shm_transport ( void )
+{
+	char *p = getenv ( "VMM_COMM_TRANSPORT" );
+
+	return ( ( p == NULL ) || ( strcmp ( p, "tcp" ) != 0 ) );
+}
+
+static bool_t
+nodes_are_colocated ( const struct node_t *x, const struct node_t *y )
+{
+	return ( InAddr_resolve ( x->hostname ) == InAddr_resolve ( y->hostname ) );
+}
+
+static size_t
+shm_pipe_size ( void )
+{
+	return 2 * ShmRing_sizeof ( SHM_RING_SIZE );
+}
+
+static struct shm_pipe_t *
+ShmPipe_map ( int fd, int cpuid, int peer_cpuid )
+{
+	struct shm_pipe_t *p;
+	struct shm_ring_t *rings[2];
+
+	p = Malloct ( struct shm_pipe_t );
+	p->base = Mmap ( NULL, shm_pipe_size ( ), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+	Close ( fd );
+
+	/* The lower cpuid writes to the first ring. */
+	rings[0] = ( struct shm_ring_t * ) p->base;
+	rings[1] = ( struct shm_ring_t * ) ( ( bit8u_t * ) p->base + ShmRing_sizeof ( SHM_RING_SIZE ) );
+	p->tx = ( cpuid < peer_cpuid ) ? rings[0] : rings[1];
+	p->rx = ( cpuid < peer_cpuid ) ? rings[1] : rings[0];
+	p->efd = Eventfd ( );
+	p->is_writer_sleeping = FALSE;
+	p->is_closed = FALSE;
+	p->name[0] = '\0';
+
+	return p;
+}
+
+/* The node that connects creates the pipe, and sends its name to the
+ * peer in the INIT message.  It owns the name, and unlinks it when the
+ * peer has opened the pipe (see ShmPipe_unlink ()). */
+static struct shm_pipe_t *
+ShmPipe_create ( int cpuid, int peer_cpuid, char *name, size_t n )
+{
+	struct shm_pipe_t *p;
+	int fd;
+
+	Snprintf ( name, n, "/vm_%s_pipe%d-%d.%d", Getenv ( "USER" ), cpuid, peer_cpuid, ( int ) Getpid ( ) );
+
+	fd = Shm_open ( name, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR );
+	Ftruncate ( fd, shm_pipe_size ( ) );
+
+	p = ShmPipe_map ( fd, cpuid, peer_cpuid );
+	ShmRing_init ( p->tx, SHM_RING_SIZE );
+	ShmRing_init ( p->rx, SHM_RING_SIZE );
+	Snprintf ( p->name, MAX_SHM_NAME_LEN, "%s", name );
+
+	return p;
+}
+
+/* The node that accepts opens the pipe, and then sends a byte through
+ * the socket to tell the creator that it may unlink the name. */
+static struct shm_pipe_t *
+ShmPipe_open ( int cpuid, int peer_cpuid, const char *name, int sockfd )
+{
+	struct shm_pipe_t *p;
+	const char c = 0;
+	int fd;
+
+	fd = Shm_open ( name, O_RDWR, 0 );
+	p = ShmPipe_map ( fd, cpuid, peer_cpuid );
+	Sendn ( sockfd, &c, sizeof ( c ), 0 );
+
+	return p;
+}
+
+static void
+ShmPipe_unlink ( struct shm_pipe_t *p )
+{
+	if ( p->name[0] != '\0' ) {
+		Shm_unlink ( p->name );
+		p->name[0] = '\0';
+	}
+}
+
+static void
+ShmPipe_destroy ( struct shm_pipe_t *p )
+{
+	ASSERT ( p != NULL );
+
+	ShmPipe_unlink ( p );
+	Munmap ( p->base, shm_pipe_size ( ) );
+	Close ( p->efd );
+	Free ( p );
+}
+
+/* Send a doorbell byte to the peer if it waits on <waiting> */
+static void
+ring_doorbell ( volatile int *waiting, int sockfd )
+{
+	const char c = 0;
+
+	__sync_synchronize ( );
+	if ( ( *waiting ) && ( __sync_bool_compare_and_swap ( waiting, 1, 0 ) ) ) {
+		Sendn ( sockfd, &c, sizeof ( c ), 0 );
+	}
+}
+
+static void
+ShmPipe_ring_doorbell ( struct shm_pipe_t *p, int sockfd )
+{
+	ring_doorbell ( &p->tx->waiting, sockfd );
+}
+
+/* Called by the receiver thread after it has read from the ring */
+static void
+ShmPipe_notify_room ( struct shm_pipe_t *p, int sockfd )
+{
+	ring_doorbell ( &p->rx->writer_waiting, sockfd );
+}
+
+/* Sleep until the peer reads from the full ring or the connection is
+ * closed.  The flags are raised before the ring is checked again, so
+ * that the peer cannot read without ringing the doorbell back. */
+static void
+ShmPipe_wait_for_room ( struct shm_pipe_t *p )
+{
+	p->is_writer_sleeping = TRUE;
+	p->tx->writer_waiting = 1;
+	__sync_synchronize ( );
+
+	if ( ( ShmRing_is_full ( p->tx ) ) && ( ! p->is_closed ) ) {
+		fd_set fds;
+
+		FD_ZERO ( &fds );
+		FD_SET ( p->efd, &fds );
+		Select ( p->efd + 1, &fds, NULL, NULL, NULL );
+	}
+
+	p->tx->writer_waiting = 0;
+	p->is_writer_sleeping = FALSE;
+	Eventfd_reset ( p->efd );
+}
+
+/* Wait for the reader while the ring is full, like a blocking send */
+static void
+ShmPipe_writev ( struct shm_pipe_t *p, int sockfd, const struct iovec *iov, int iovcnt )
+{
+	int i;
+
+	for ( i = 0; i < iovcnt; i++ ) {
+		const bit8u_t *buf = ( const bit8u_t * ) iov[i].iov_base;
+		size_t len = iov[i].iov_len;
+
+		for ( ; ; ) {
+			size_t n = ShmRing_write ( p->tx, buf, len );
+
+			buf += n;
+			len -= n;
+			if ( len == 0 ) {
+				break;
+			}
+			if ( p->is_closed ) {
+				Warning ( "ShmPipe_writev: the connection is closed\n" );
+				return;
+			}
+			ShmPipe_ring_doorbell ( p, sockfd );
+			ShmPipe_wait_for_room ( p );
+		}
+	}
+
+	ShmPipe_ring_doorbell ( p, sockfd );
+}
+
+/* Return TRUE if the reader can sleep in select (): the writer then
+ * rings the doorbell at the next write. */
+static bool_t
+ShmPipe_prepare_to_wait ( struct shm_pipe_t *p )
+{
+	p->rx->waiting = 1;
+	__sync_synchronize ( );
+
+	if ( ! ShmRing_is_empty ( p->rx ) ) {
+		p->rx->waiting = 0;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/****************************************************************/
+
 struct conn_t {
 	int 			sockfd;
+	struct shm_pipe_t	*pipe;	/* NULL if the messages go through <sockfd> */
 	struct msg_t *		recving_msg;
 	size_t			recv_offset;
 	bool_t			recving_header;
+	bool_t			recving_image;	/* the body is received into the image */
 	bool_t			is_sending;
 	bool_t			is_active;
 	
@@ -72,6 +299,7 @@ static void
 init_recv_info ( struct conn_t *conn )
 {
 	conn->recving_header = TRUE;
+	conn->recving_image = FALSE;
 	conn->recving_msg = Msg_create ( MSG_KIND_INVALID, 0, NULL );
 	conn->recv_offset = 0;
 }
@@ -82,6 +310,7 @@ init_conn ( struct conn_t *x )
 	x->is_active = FALSE;
 	x->is_sending = FALSE;
 	x->sockfd = -1;
+	x->pipe = NULL;
 
 	init_recv_info ( x );
 
@@ -151,8 +380,15 @@ close_conn ( struct conn_t *x )
 	Shutdown ( x->sockfd, SHUT_RDWR );
 	Close ( x->sockfd ); 
 	x->sockfd = -1;
+	if ( x->pipe != NULL ) {
+		ShmPipe_destroy ( x->pipe );
+		x->pipe = NULL;
+	}
 
 	assert ( x->recving_msg != NULL );
+	if ( x->recving_image ) {
+		x->recving_msg->body = NULL;
+	}
 	Msg_destroy ( x->recving_msg );
 	x->recving_msg = NULL;
 
@@ -171,15 +407,30 @@ wait_until_conn_becomes_inactive ( struct conn_t *x )
 
 /******************************************************/
 
+enum {
+	MSG_RING_SIZE = 1024	/* must be a power of two; the ring overflows into a list */
+};
+
 struct comm_t {
 	int			cpuid;
-	struct msg_list_t 	*msgs;
+	struct msg_ring_t	*ring;	/* filled by the receiver thread */
+	struct msg_list_t 	*msgs;	/* drained from <ring>; touched only by the monitor */
+	struct msg_defer_index_t *deferred; /* messages parked by the judges of the monitor */
 
 	pid_t			pid;	/* Process ID of which the process receives the SIGUSR2
-					   when a new message is arrived. */
+					   when a latency-critical message is arrived. */
+	struct event_t		*event;	/* signaled when a new message is arrived during hlt */
+	int			efd;	/* eventfd signaled when a new message is arrived
+					   while the monitor waits for messages */
+	volatile int		monitor_state;
+
+	bit8u_t * volatile	image_base;	/* see Comm_recv_image_into () */
+	size_t			image_offset;
+
 	pthread_t		tid;
 	int 			lsockfd;
-	struct conn_t		conns[NUM_OF_PROCS];
+	int			num_of_procs;
+	struct conn_t		*conns;	/* indexed by cpuid */
 };
 
 /* The prototype declaration */
@@ -189,16 +440,39 @@ void Comm_bcast ( struct comm_t *comm, struct msg_t *msg );
 struct msg_t *Comm_recv ( struct comm_t *comm );
 
 
+/* The INIT message goes through the socket; the following messages go
+ * through a shared-memory pipe if the peer is on the same host. */
 static void
-__init_socks_connect ( struct comm_t *comm, const struct node_t *node, int cpuid )
+__init_socks_connect ( struct comm_t *comm, const struct config_t *config, int cpuid )
 {
+	struct conn_t *conn = &comm->conns[cpuid];
+	struct shm_pipe_t *pipe = NULL;
+	char shm_name[MAX_SHM_NAME_LEN];
 	struct msg_t *msg;
    
-	conn_set_active ( &comm->conns[cpuid], connect_to_node ( node ) );
+	conn_set_active ( conn, connect_to_node ( &config->nodes[cpuid] ) );
+
+	if ( use_shm_transport ( ) && 
+	     nodes_are_colocated ( &config->nodes[comm->cpuid], &config->nodes[cpuid] ) ) {
+		pipe = ShmPipe_create ( comm->cpuid, cpuid, shm_name, MAX_SHM_NAME_LEN );
+	}
    
-	msg = Msg_create3 ( MSG_KIND_INIT, comm->cpuid );
+	msg = Msg_create3 ( MSG_KIND_INIT, comm->cpuid, ( pipe != NULL ) ? shm_name : NULL );
 	Comm_send ( comm, msg, cpuid );
 	Msg_destroy ( msg );   
+
+	if ( pipe != NULL ) {
+		char c;
+
+		/* Wait until the peer has opened the pipe (see ShmPipe_open ()) */
+		if ( Recvn2 ( conn->sockfd, &c, sizeof ( c ), 0 ) == -1 ) {
+			ShmPipe_destroy ( pipe );
+			Fatal_failure ( "__init_socks_connect: the peer did not open the pipe\n" );
+		}
+		ShmPipe_unlink ( pipe );
+	}
+
+	conn->pipe = pipe;
 }
 
 static void
@@ -208,14 +482,14 @@ init_socks_connect ( struct comm_t *comm, const struct config_t *config, bool_t
 
 	if ( is_resuming ) {
 		/* connect to all other processes */
-		for ( i = 0; i < NUM_OF_PROCS; i++ ) {
+		for ( i = 0; i < comm->num_of_procs; i++ ) {
 			if ( i != comm->cpuid ) {
-				__init_socks_connect ( comm, &config->nodes[i], i );
+				__init_socks_connect ( comm, config, i );
 			}
 		}
 	} else {
-		for ( i = comm->cpuid + 1; i < NUM_OF_PROCS; i++ ) {
-			__init_socks_connect ( comm, &config->nodes[i], i );
+		for ( i = comm->cpuid + 1; i < comm->num_of_procs; i++ ) {
+			__init_socks_connect ( comm, config, i );
 		}
 	}
 }
@@ -236,6 +510,9 @@ __init_socks_accept ( struct comm_t *comm )
 	msg = Msg_recv ( asockfd, UNKNOWN_SRC );
 	x = Msg_to_msg_init ( msg );
 	cpuid = x->cpuid;
+	if ( x->shm_name[0] != '\0' ) {
+		comm->conns[cpuid].pipe = ShmPipe_open ( comm->cpuid, cpuid, x->shm_name, asockfd );
+	}
 	conn_set_active ( &comm->conns[cpuid], asockfd );
 	Msg_destroy ( msg );
 
@@ -269,7 +546,7 @@ init_socks ( struct comm_t *comm, const struct config_t *config, bool_t is_resum
 }
 
 struct comm_t *
-Comm_create ( int cpuid, int pid, const struct config_t *config, bool_t is_resuming )
+Comm_create ( int cpuid, int pid, struct event_t *event, const struct config_t *config, bool_t is_resuming )
 {
 	struct comm_t * comm;
 	int i;
@@ -280,9 +557,18 @@ Comm_create ( int cpuid, int pid, const struct config_t *config, bool_t is_resum
 	comm = Malloct ( struct comm_t );
 	comm->cpuid = cpuid;
 	comm->pid = pid;
+	comm->event = event;
+	comm->ring = MsgRing_create ( MSG_RING_SIZE );
 	comm->msgs = MsgList_create ( );
+	comm->deferred = MsgDeferIndex_create ( );
+	comm->efd = Eventfd ( );
+	comm->monitor_state = MONITOR_RUNNING;
+	comm->image_base = NULL;
+	comm->image_offset = 0;
+	comm->num_of_procs = config->num_of_procs;
+	comm->conns = Calloct ( comm->num_of_procs, struct conn_t );
    
-	for ( i = 0; i < NUM_OF_PROCS; i++ ) {
+	for ( i = 0; i < comm->num_of_procs; i++ ) {
 		init_conn ( &comm->conns[i] );
 	}
 	init_socks ( comm, config, is_resuming );
@@ -304,32 +590,79 @@ Comm_destroy ( struct comm_t *comm )
 {
 	ASSERT ( comm != NULL );
 
+	MsgRing_destroy ( comm->ring );
 	MsgList_destroy ( comm->msgs );
+	MsgDeferIndex_destroy ( comm->deferred );
+	Close ( comm->efd );
 
 	/* TODO: close and shutdown the sockets. */
 
 	Pthread_join ( comm->tid, NULL );
+	Free ( comm->conns );
 	Free ( comm );
 }
 
+static long long next_msg_id = 0LL;
+
+/* Send the buffers of a message (see Msg_gather ()) through the
+ * transport of <conn> */
+static void
+conn_sendv ( struct conn_t *conn, struct iovec *iov, int iovcnt )
+{
+	if ( conn->pipe != NULL ) {
+		ShmPipe_writev ( conn->pipe, conn->sockfd, iov, iovcnt );
+	} else {
+		Sendvn ( conn->sockfd, iov, iovcnt );
+	}
+}
+
 void
 Comm_send ( struct comm_t *comm, struct msg_t *msg, int dest_cpuid )
 {
 	ASSERT ( comm != NULL );
 	ASSERT ( msg != NULL );
 	ASSERT ( comm->cpuid != dest_cpuid );
+	ASSERT ( ( 0 <= dest_cpuid ) && ( dest_cpuid < comm->num_of_procs ) );
 
-	static long long msg_id = 0LL;
-	msg->hdr.msg_id = msg_id;
-	msg_id++;
+	msg->hdr.msg_id = next_msg_id++;
 
 	// Print ( stderr, "Comm_send: " ); Msg_print ( stderr, msg );
 
 	struct conn_t *conn = &comm->conns[dest_cpuid];
+	struct iovec iov[2];
+
+	iov[0].iov_base = msg->body;
+	iov[0].iov_len = msg->hdr.len;
 
 	wait_until_conn_becomes_ready_to_send ( conn );
 
-	Msg_send ( msg, conn->sockfd );
+	conn_sendv ( conn, iov, Msg_gather ( &msg->hdr, iov, ( msg->hdr.len > 0 ) ? 1 : 0 ) );
+
+	notify_send_completion ( conn );
+}
+
+/* Send a message of <kind> whose body is gathered from <iov>, without
+ * copying it into a message (see Msg_sendv ()). */
+void
+Comm_sendv ( struct comm_t *comm, msg_kind_t kind, struct iovec *iov, int iovcnt, int dest_cpuid )
+{
+	struct msg_hdr_t hdr;
+	struct conn_t *conn;
+
+	ASSERT ( comm != NULL );
+	ASSERT ( iov != NULL );
+	ASSERT ( comm->cpuid != dest_cpuid );
+	ASSERT ( ( 0 <= dest_cpuid ) && ( dest_cpuid < comm->num_of_procs ) );
+
+	hdr.kind = kind;
+	hdr.src_id = comm->cpuid;
+	hdr.msg_id = next_msg_id++;
+
+	conn = &comm->conns[dest_cpuid];
+
+	wait_until_conn_becomes_ready_to_send ( conn );
+
+	conn_sendv ( conn, iov, Msg_gather ( &hdr, iov, iovcnt ) );
 
 	notify_send_completion ( conn );
 }
@@ -342,7 +675,7 @@ Comm_bcast ( struct comm_t *comm, struct msg_t *msg )
 	ASSERT ( comm != NULL );
 	ASSERT ( msg != NULL );
 
-	for ( i = 0; i < NUM_OF_PROCS; i++ ) {
+	for ( i = 0; i < comm->num_of_procs; i++ ) {
 		if ( i == comm->cpuid ) {
 			continue;
 		}
@@ -359,7 +692,7 @@ get_maxfds ( struct comm_t *comm )
 	int max_fds = 0;
 	int i;	
 
-  	for ( i = 0; i < NUM_OF_PROCS; i++ ) {
+  	for ( i = 0; i < comm->num_of_procs; i++ ) {
 		if ( ( i != comm->cpuid ) && ( comm->conns[i].sockfd + 1 > max_fds ) ) {
 			max_fds = comm->conns[i].sockfd + 1;
 		}
@@ -375,13 +708,53 @@ init_fds ( struct comm_t *comm, fd_set *fds )
 
 	FD_ZERO ( fds );
 
-	for ( i = 0; i < NUM_OF_PROCS; i++ ) {
+	for ( i = 0; i < comm->num_of_procs; i++ ) {
 		if ( ( i != comm->cpuid ) && ( comm->conns[i].sockfd != -1 ) ) { 
 			FD_SET ( comm->conns[i].sockfd, fds );
 		}
 	}
 }
 
+/* The bytes in the pipe come first: the peer may close the socket
+ * right after writing its last message. */
+static bool_t
+try_recv_from_pipe ( struct conn_t *conn, char *base, size_t len )
+{
+	enum { BUFSIZE = 64 };
+	char doorbell[BUFSIZE];
+	size_t n;
+	ssize_t m;
+
+	n = ShmRing_read ( conn->pipe->rx, ( bit8u_t * ) base + conn->recv_offset, len - conn->recv_offset );
+	conn->recv_offset += n;
+	if ( n > 0 ) {
+		ShmPipe_notify_room ( conn->pipe, conn->sockfd );
+	}
+
+	m = Recv ( conn->sockfd, doorbell, BUFSIZE, 0 );
+	if ( ( m > 0 ) && ( conn->pipe->is_writer_sleeping ) ) {
+		Eventfd_signal ( conn->pipe->efd );
+	}
+
+	if ( m == 0 ) {
+		if ( n > 0 ) {
+			/* close it when the pipe becomes empty */
+			return TRUE;
+		}
+		Warning ( "try_recv: the connection is closed\n" );
+
+		/* Let a writer that waits for room give up */
+		conn->pipe->is_closed = TRUE;
+		__sync_synchronize ( );
+		Eventfd_signal ( conn->pipe->efd );
+
+		close_conn ( conn );
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 static bool_t
 try_recv ( struct conn_t *conn, char *base, size_t len )
 {
@@ -390,6 +763,10 @@ try_recv ( struct conn_t *conn, char *base, size_t len )
 	assert ( base != NULL );
 	assert ( base + conn->recv_offset != NULL );
 
+	if ( conn->pipe != NULL ) {
+		return try_recv_from_pipe ( conn, base, len );
+	}
+
 	n = Recv ( conn->sockfd, base + conn->recv_offset, len - conn->recv_offset, 0 );
 	if ( n == -1 ) {
 		/* No resource temporarily available */
@@ -422,11 +799,35 @@ try_recv_msg_body ( struct comm_t *comm, int src_id )
 	if ( conn->recv_offset < m->hdr.len ) {
 		return NULL;
 	}
+
+	if ( conn->recving_image ) {
+		/* The body is already in place. */
+		m->body = NULL;
+	}
 		
 	init_recv_info ( conn );
 	return m;
 }
 
+/* Allocate the buffer that the body of the message is received into */
+static void
+set_recv_buffer ( struct comm_t *comm, struct conn_t *conn )
+{
+	struct msg_t *m = conn->recving_msg;
+
+	if ( ( m->hdr.kind == MSG_KIND_MEM_IMAGE_RESPONSE ) && ( comm->image_base != NULL ) ) {
+		m->body = comm->image_base + comm->image_offset;
+		comm->image_offset += m->hdr.len;
+		conn->recving_image = TRUE;
+		return;
+	}
+
+	/* Take a message of the size class of the body from the pools */
+	conn->recving_msg = Msg_alloc ( m->hdr.kind, m->hdr.len );
+	conn->recving_msg->hdr = m->hdr;
+	Msg_destroy ( m );
+}
+
 static struct msg_t *
 try_recv_msg_header ( struct comm_t *comm, int src_id )
 {
@@ -453,7 +854,7 @@ try_recv_msg_header ( struct comm_t *comm, int src_id )
 		return m;
 	} 
 	
-	m->body = Malloc ( m->hdr.len );
+	set_recv_buffer ( comm, conn );
 	conn->recving_header = FALSE;
 	conn->recv_offset = 0;
 	return try_recv_msg_body ( comm, src_id );		
@@ -478,20 +879,38 @@ __recv_loop ( struct comm_t *comm, fd_set *fds, int max_fds )
 	ASSERT ( fds != NULL );
 
 	while ( msg == NULL ) {
+		struct timeval tv = { 0, 0 };
+		bool_t can_wait = TRUE;
 		int i;
 
-		select ( max_fds, fds, NULL /* write */, NULL /* error */, NULL /* timeout */ );
+		/* Do not sleep on a pipe that has bytes to read, as its
+		 * socket does not become readable for them. */
+		for ( i = 0; i < comm->num_of_procs; i++ ) {
+			struct conn_t *conn = &comm->conns[i];
 
-		for ( i = 0; i < NUM_OF_PROCS; i++ ) {
-			if ( ( i == comm->cpuid ) || ( comm->conns[i].sockfd == -1 ) ) { 
-				continue;
+			if ( ( i != comm->cpuid ) && ( conn->sockfd != -1 ) && ( conn->pipe != NULL ) &&
+			     ( ! ShmPipe_prepare_to_wait ( conn->pipe ) ) ) {
+				can_wait = FALSE;
 			}
+		}
+
+		select ( max_fds, fds, NULL /* write */, NULL /* error */, can_wait ? NULL : &tv /* timeout */ );
 
-			if ( ! FD_ISSET ( comm->conns[i].sockfd, fds ) ) {
-				FD_SET ( comm->conns[i].sockfd, fds );
+		for ( i = 0; i < comm->num_of_procs; i++ ) {
+			struct conn_t *conn = &comm->conns[i];
+
+			if ( ( i == comm->cpuid ) || ( conn->sockfd == -1 ) ) { 
 				continue;
 			}
 
+			if ( ! FD_ISSET ( conn->sockfd, fds ) ) {
+				/* Keep waiting for the socket while reading the pipe */
+				FD_SET ( conn->sockfd, fds );
+				if ( ( conn->pipe == NULL ) || ( ShmRing_is_empty ( conn->pipe->rx ) ) ) {
+					continue;
+				}
+			}
+
 			msg = try_recv_msg ( comm, i );
 			if ( msg != NULL ) {
 				break;
@@ -516,6 +935,57 @@ accept_new_conn ( struct comm_t *comm, int src_id )
 	assert ( conn->sockfd != -1 );
 }
 
+static bool_t
+is_latency_critical_msg ( struct msg_t *msg )
+{
+	return MsgKind_is_latency_critical ( msg->hdr.kind );
+}
+
+/* Wake up the monitor in the way that matches what it is blocked on.
+ * The guest is stopped only for the messages that some processor may
+ * be spinning on; the others are handled at the next trap. */
+static void
+notify_monitor ( struct comm_t *comm, bool_t is_critical )
+{
+	/* Order the push before the read of <monitor_state> (see
+	 * Comm_set_monitor_state ()). */
+	__sync_synchronize ( );
+
+	switch ( comm->monitor_state ) {
+	case MONITOR_RUNNING:
+		break;
+	case MONITOR_WAITING_MSG:
+		Eventfd_signal ( comm->efd );
+		break;
+	case MONITOR_WAITING_GUEST:
+		if ( is_critical ) {
+			Kill ( comm->pid, SIGUSR2 );
+		}
+		break;
+	case MONITOR_HALTED:
+		Event_signal ( comm->event );
+		break;
+	default:
+		Match_failure ( "notify_monitor\n" );
+	}
+}
+
+/* Never wait for the monitor here: it may itself be blocked sending to
+ * a node whose receiver waits for us.  The message goes to the overflow
+ * list of the ring if the ring is full. */
+static void
+deliver_msg ( struct comm_t *comm, struct msg_t *msg )
+{
+	bool_t is_critical = MsgKind_is_latency_critical ( msg->hdr.kind );
+
+	if ( ! MsgRing_push ( comm->ring, msg ) ) {
+		/* Make sure that the monitor drains the ring. */
+		is_critical = TRUE;
+	}
+
+	notify_monitor ( comm, is_critical );
+}
+
 static void *
 recv_loop ( void *x )
 {
@@ -541,9 +1011,72 @@ recv_loop ( void *x )
 			/* Do not deliver the message to the monitor process */
 			Msg_destroy ( msg );
 		} else {
-			MsgList_add ( comm->msgs, msg );
+			deliver_msg ( comm, msg );
+		}
+	}
+}
+
+/* Move the arrived messages from the ring to the backlog, keeping
+ * their order. */
+static void
+drain_ring ( struct comm_t *comm )
+{
+	struct msg_t *msg;
+
+	while ( ( msg = MsgRing_try_pop ( comm->ring ) ) != NULL ) {
+		MsgList_add ( comm->msgs, msg );
+	}
+}
+
+/* Block until the receiver thread delivers a message or <sleep_time>
+ * nano seconds elapse (forever if <sleep_time> is negative). */
+static void
+wait_for_new_msgs ( struct comm_t *comm, long sleep_time )
+{
+	int saved_state = comm->monitor_state;
+
+	comm->monitor_state = MONITOR_WAITING_MSG;
+	__sync_synchronize ( );
+
+	if ( MsgRing_is_empty ( comm->ring ) ) {
+		fd_set fds;
+		struct timeval tv;
+
+		FD_ZERO ( &fds );
+		FD_SET ( comm->efd, &fds );
+		tv.tv_sec = sleep_time / 1000000000;
+		tv.tv_usec = ( sleep_time % 1000000000 ) / 1000;
+
+		Select ( comm->efd + 1, &fds, NULL, NULL, ( sleep_time < 0 ) ? NULL : &tv );
+	}
+
+	comm->monitor_state = saved_state;
+	Eventfd_reset ( comm->efd );
+}
+
+void
+Comm_set_monitor_state ( struct comm_t *comm, int state )
+{
+	ASSERT ( comm != NULL );
+
+	comm->monitor_state = state;
+	__sync_synchronize ( );
+
+	/* Catch the messages that arrived before the receiver thread
+	 * could see the new state. */
+	switch ( state ) {
+	case MONITOR_WAITING_GUEST:
+		if ( MsgRing_exists ( comm->ring, &is_latency_critical_msg ) ) {
 			Kill ( comm->pid, SIGUSR2 );
 		}
+		break;
+	case MONITOR_HALTED:
+		if ( ! MsgRing_is_empty ( comm->ring ) ) {
+			Event_signal ( comm->event );
+		}
+		break;
+	default:
+		break;
 	}
 }
 
@@ -553,6 +1086,7 @@ Comm_add_msg ( struct comm_t *comm, struct msg_t *msg, int src_id )
 	assert ( comm != NULL );
 	assert ( msg != NULL );
 
+	drain_ring ( comm );
 	msg->hdr.src_id = src_id;
 	MsgList_add ( comm->msgs, msg );
 }
@@ -562,6 +1096,7 @@ Comm_try_remove_msg ( struct comm_t *comm )
 {
 	ASSERT ( comm != NULL );
 
+	drain_ring ( comm );
 	return MsgList_try_remove ( comm->msgs );
 }
 
@@ -570,31 +1105,90 @@ Comm_remove_msg ( struct comm_t *comm )
 {
 	ASSERT ( comm != NULL );
 
-	return MsgList_remove ( comm->msgs );
+	for ( ; ; ) {
+		struct msg_t *msg;
+
+		msg = Comm_try_remove_msg ( comm );
+		if ( msg != NULL ) {
+			return msg;
+		}
+		wait_for_new_msgs ( comm, -1 );
+	}
 }
 
+/* Remove the oldest message for which <defer_func> returns
+ * MSG_DEFER_NONE.  The others are parked under the returned key until
+ * Comm_release_deferred_msgs () (see MsgList_try_remove3 ()). */
 struct msg_t *
-Comm_remove_msg2 ( struct comm_t *comm, bool_t (*judge_func) ( struct msg_t * ) )
+Comm_remove_msg2 ( struct comm_t *comm, int (*defer_func) ( struct msg_t * ) )
 {
 	ASSERT ( comm != NULL );
 
-	return MsgList_remove2 ( comm->msgs, judge_func );
+	for ( ; ; ) {
+		struct msg_t *msg;
+
+		msg = Comm_try_remove_msg2 ( comm, defer_func );
+		if ( msg != NULL ) {
+			return msg;
+		}
+		wait_for_new_msgs ( comm, -1 );
+	}
 }
 
 struct msg_t *
-Comm_try_remove_msg2 ( struct comm_t *comm, bool_t (*judge_func) ( struct msg_t * ) )
+Comm_try_remove_msg2 ( struct comm_t *comm, int (*defer_func) ( struct msg_t * ) )
+{
+	ASSERT ( comm != NULL );
+
+	drain_ring ( comm );
+	return MsgList_try_remove3 ( comm->msgs, comm->deferred, defer_func );
+}
+
+void
+Comm_wait_msg ( struct comm_t *comm, int (*defer_func) ( struct msg_t * ), int sleep_time )
+{
+	ASSERT ( comm != NULL );
+
+	drain_ring ( comm );
+	if ( MsgList_exists3 ( comm->msgs, comm->deferred, defer_func ) ) {
+		return;
+	}
+	wait_for_new_msgs ( comm, sleep_time );
+}
+
+/* Receive the bodies of the MEM_IMAGE_RESPONSE messages straight into
+ * <base>, one after another, instead of into the messages, which then
+ * have no body.  A NULL <base> stops it. */
+void
+Comm_recv_image_into ( struct comm_t *comm, void *base )
 {
 	ASSERT ( comm != NULL );
 
-	return MsgList_try_remove2 ( comm->msgs, judge_func );
+	comm->image_offset = 0;
+	__sync_synchronize ( );
+	comm->image_base = base;
+	__sync_synchronize ( );
 }
 
+/* Park <msg> under <key> without judging it again */
 void
-Comm_wait_msg ( struct comm_t *comm, bool_t (*judge_func) ( struct msg_t * ), int sleep_time )
+Comm_defer_msg ( struct comm_t *comm, struct msg_t *msg, int src_id, int key )
 {
 	ASSERT ( comm != NULL );
+	ASSERT ( msg != NULL );
 
-	MsgList_wait ( comm->msgs, judge_func, sleep_time );
+	msg->hdr.src_id = src_id;
+	MsgDeferIndex_add ( comm->deferred, msg, key );
+}
+
+/* Hand the messages parked under the page <key> back to the removals,
+ * ahead of the messages that have arrived since. */
+void
+Comm_release_deferred_msgs ( struct comm_t *comm, int key )
+{
+	ASSERT ( comm != NULL );
+
+	MsgDeferIndex_release ( comm->deferred, comm->msgs, key );
 }
 
 void
@@ -609,7 +1203,7 @@ Comm_shutdown ( struct comm_t *comm )
 	}
 
 	int i;
-	for ( i = 0; i < NUM_OF_PROCS; i++ ) {
+	for ( i = 0; i < comm->num_of_procs; i++ ) {
 		if ( i == comm->cpuid ) {
 			continue;
 		}
@@ -622,6 +1216,8 @@ Comm_pack_msgs ( struct comm_t *comm, int fd )
 {
 	ASSERT ( comm != NULL );
 
+	drain_ring ( comm );
+	MsgDeferIndex_release_all ( comm->deferred, comm->msgs );
 	MsgList_pack ( comm->msgs, fd );
 }
 
@@ -636,9 +1232,14 @@ Comm_unpack_msgs ( struct comm_t *comm, int fd )
 #else /* ! ENBLE_MP */
 
 struct comm_t *
-Comm_create ( int cpuid, int pid, const struct config_t *config, bool_t is_resuming )
+Comm_create ( int cpuid, int pid, struct event_t *event, const struct config_t *config, bool_t is_resuming )
 {
 	return NULL;
 }
 
+void
+Comm_set_monitor_state ( struct comm_t *comm, int state )
+{
+}
+
 #endif /* ENABLE_MP */
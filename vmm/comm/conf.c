@@ -20,8 +20,11 @@ init_config ( struct config_t *config, char * const argv[] )
 	config->memory = NULL;
 	config->snapshot = NULL;
 	config->dirname = dirname ( Strdup ( argv[0] ) );
+	config->num_of_multiple_writer_ranges = 0;
+	config->num_of_immutable_ranges = 0;
+	config->num_of_procs = 0;
 
-	for ( i = 0; i < NUM_OF_PROCS; i++ ) {
+	for ( i = 0; i < MAX_OF_PROCS; i++ ) {
 		config->nodes[i].hostname = NULL;
 		config->nodes[i].port = -1;
 	}
@@ -45,7 +48,7 @@ print_config ( const struct config_t *config )
 		config->disk, 
 		config->memory
 		);
-	for ( i = 0; i < NUM_OF_PROCS; i++ ) {
+	for ( i = 0; i < config->num_of_procs; i++ ) {
 		Print ( stdout,	"cpu[%d] = %s:%d\n", i, config->nodes[i].hostname, config->nodes[i].port );
 	}
 	
@@ -182,21 +185,43 @@ get_string ( struct fptr_t buf, size_t offset, char **str )
 	return current;
 }
 
+/* Skips the spaces at <*offset> and returns TRUE if no token is left on
+ * the line (the rest of <buf> is zero-filled). */
+static bool_t
+is_end_of_line ( struct fptr_t buf, int *offset )
+{
+	const char *line = ( const char * )buf.base;
+
+	while ( ( *offset < buf.offset ) && ( isspace ( line[*offset] ) ) ) {
+		( *offset )++;
+	}
+	return ( ( *offset >= buf.offset ) || ( line[*offset] == '\0' ) );
+}
+
 
 #include <netdb.h>
 #include <assert.h>
 
 
+/* Each node is given as <hostname>:<port>.  The nodes are numbered in the
+ * order they appear, and may be listed over several "cpu:" lines. */
 static void
 parse_cpu ( struct config_t *config, struct fptr_t buf, int line_no, int offset )
 {
-	int i, p;
+	int p;
 
 	p = offset;
-	for ( i = 0; i < NUM_OF_PROCS; i++ ) {
+	while ( ! is_end_of_line ( buf, &p ) ) {
+		struct node_t *node;
 		char *s;
 		char *q;
 
+		if ( config->num_of_procs == MAX_OF_PROCS ) {
+			Print ( stderr, "Error: line %d of file \"%s\": at most %d nodes can be given\n",
+				line_no, config->config_file, MAX_OF_PROCS );
+			exit ( 1 );
+		}
+
 		p = get_string ( buf, p, &s );
 		if ( p == -1 ) {
 			print_parse_failure ( config->config_file, line_no );
@@ -211,8 +236,10 @@ parse_cpu ( struct config_t *config, struct fptr_t buf, int line_no, int offset
 		
 		*q = '\0'; /* replace ':' with '\0' */
 		
-		config->nodes[i].hostname = Strdup ( s );
-		config->nodes[i].port = Atoi ( q + 1 ); 
+		node = &config->nodes[config->num_of_procs];
+		node->hostname = Strdup ( s );
+		node->port = Atoi ( q + 1 ); 
+		config->num_of_procs++;
 	}
 }
 
@@ -242,6 +269,61 @@ parse_disk ( struct config_t *config, struct fptr_t buf, int line_no, int offset
 	config->disk = Strdup ( s );
 }
 
+/* Each range is given as <from>-<to> (page numbers, in decimal or hex). */
+static int
+parse_page_ranges ( const char *filename, struct fptr_t buf, int line_no, int offset,
+		    struct page_range_t ranges[MAX_OF_PAGE_RANGES] )
+{
+	int n = 0;
+
+	while ( ! is_end_of_line ( buf, &offset ) ) {
+		char *s, *p, *q;
+
+		if ( n == MAX_OF_PAGE_RANGES ) {
+			print_parse_failure ( filename, line_no );
+			break;
+		}
+
+		offset = get_string ( buf, offset, &s );
+		if ( offset == -1 ) {
+			print_parse_failure ( filename, line_no );
+			break;
+		}
+
+		ranges[n].from = strtoul ( s, &p, 0 );
+		if ( ( p == s ) || ( *p != '-' ) ) {
+			print_parse_failure ( filename, line_no );
+			break;
+		}
+
+		ranges[n].to = strtoul ( p + 1, &q, 0 );
+		if ( ( q == p + 1 ) || ( *q != '\0' ) || ( ranges[n].to < ranges[n].from ) ) {
+			print_parse_failure ( filename, line_no );
+			break;
+		}
+
+		n++;
+	}
+
+	return n;
+}
+
+static void
+parse_multiple_writer ( struct config_t *config, struct fptr_t buf, int line_no, int offset )
+{
+	config->num_of_multiple_writer_ranges = 
+		parse_page_ranges ( config->config_file, buf, line_no, offset, 
+				    config->multiple_writer_ranges );
+}
+
+static void
+parse_immutable ( struct config_t *config, struct fptr_t buf, int line_no, int offset )
+{
+	config->num_of_immutable_ranges = 
+		parse_page_ranges ( config->config_file, buf, line_no, offset, 
+				    config->immutable_ranges );
+}
+
 typedef void parse_func_t ( struct config_t *, struct fptr_t, int, int );
 
 struct keyword_t {
@@ -255,7 +337,9 @@ get_parse_func ( const char *s )
 	struct keyword_t keyword_map [] = 
 		{ { "cpu:", &parse_cpu },
 		  { "memory:", &parse_memory },
-		  { "disk:", &parse_disk }
+		  { "disk:", &parse_disk },
+		  { "multiple_writer:", &parse_multiple_writer },
+		  { "immutable:", &parse_immutable }
 		};
 	const size_t N = sizeof ( keyword_map ) / sizeof ( struct keyword_t );
 	int i;
@@ -332,16 +416,16 @@ parse_config_file ( struct config_t *config )
 /****************************************************************/
 
 static void
-assert_cpuid ( int cpuid )
+assert_cpuid ( int cpuid, int num_of_procs )
 {
-	if ( ( cpuid >= 0 ) && ( cpuid < NUM_OF_PROCS ) )
+	if ( ( cpuid >= 0 ) && ( cpuid < num_of_procs ) )
 		return;
 
 	Print ( stderr,
 		"Error: invalid cpuid: %d:"
 		" cpuid must be in [%d,%d)\n", 
 		cpuid,
-		0, NUM_OF_PROCS );
+		0, num_of_procs );
 	exit ( 1 );
 }
 
@@ -371,11 +455,11 @@ is_invalid_node ( struct node_t *node )
 }
 
 static void
-assert_nodes ( struct node_t nodes[NUM_OF_PROCS] )
+assert_nodes ( struct node_t nodes[MAX_OF_PROCS], int num_of_procs )
 {
 	int i;
 
-	for ( i = 0; i < NUM_OF_PROCS; i++ ) {
+	for ( i = 0; i < num_of_procs; i++ ) {
 		if ( ! is_invalid_node ( &nodes[i] ) )
 			continue;
 
@@ -387,7 +471,7 @@ assert_nodes ( struct node_t nodes[NUM_OF_PROCS] )
 #else /* ! ENABLE_MP */
 
 static void
-assert_nodes ( struct node_t nodes[NUM_OF_PROCS] )
+assert_nodes ( struct node_t nodes[MAX_OF_PROCS], int num_of_procs )
 {
 }
 
@@ -398,10 +482,10 @@ assert_config ( struct config_t *config, char * const argv[] )
 {
 	ASSERT ( config != NULL );
 
-	assert_cpuid ( config->cpuid );
+	assert_cpuid ( config->cpuid, config->num_of_procs );
 	assert_filestat ( "disk", config->disk );
 	assert_filestat ( "memory", config->memory );
-	assert_nodes ( config->nodes );
+	assert_nodes ( config->nodes, config->num_of_procs );
 #if 0
 	print_config ( config );
 #endif
@@ -409,6 +493,15 @@ assert_config ( struct config_t *config, char * const argv[] )
 
 /****************************************************************/
 
+/* The number of the nodes, set when the config is created */
+static int num_of_procs = 1;
+
+int
+get_num_of_procs ( void )
+{
+	return num_of_procs;
+}
+
 struct config_t *
 Config_create ( int argc, char * const argv[] )
 {
@@ -421,7 +514,12 @@ Config_create ( int argc, char * const argv[] )
 	init_config ( config, argv );
 	parse_option ( config, argc, argv );
 	parse_config_file ( config );
+#ifndef ENABLE_MP
+	/* a uniprocessor does not need the "cpu:" line */
+	config->num_of_procs = 1;
+#endif
 	assert_config ( config, argv );
+	num_of_procs = config->num_of_procs;
 	
 	return config;
 }
@@ -5,6 +5,7 @@
 #include "vmm/comm/conf_common.h"
 
 struct config_t *Config_create ( int argc, char * const argv[] );
+int              get_num_of_procs ( void );
 
 
 #endif /* _VMM_COMM_CONF_H */
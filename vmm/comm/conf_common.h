@@ -3,23 +3,36 @@
 
 
 #include "vmm/std.h"
+#include "vmm/ia32/cpu_common.h"
 
 
+/* The actual number of the nodes is given by the "cpu:" lines of the
+ * config file (see get_num_of_procs ()).  A node's APIC ID is its
+ * cpuid, and the physical destination 0xff of an IPI is a broadcast, so
+ * at most 255 nodes can be addressed. */
 enum {
 #ifdef ENABLE_MP 
-//       NUM_OF_PROCS = 8
-//       NUM_OF_PROCS = 4
-       NUM_OF_PROCS = 2
+       MAX_OF_PROCS = MAX_OF_CPUIDS - 1
 #else
-     NUM_OF_PROCS = 1
+       MAX_OF_PROCS = 1
 #endif
 };
 
+enum {
+	MAX_OF_PAGE_RANGES = 16
+};
+
 struct node_t {
 	char 		*hostname;
 	int		port; 
 };
 
+/* page numbers in [from, to] */
+struct page_range_t {
+	int		from;
+	int		to;
+};
+
 struct config_t {
 	int		cpuid;
 	char		*config_file;
@@ -30,7 +43,16 @@ struct config_t {
 	char		*dirname;
 	char		*snapshot;
 
-	struct node_t 	nodes[NUM_OF_PROCS]; 
+	struct node_t 	nodes[MAX_OF_PROCS]; 
+	int		num_of_procs;
+
+	/* pages initially shared with the multiple-writer protocol */
+	struct page_range_t multiple_writer_ranges[MAX_OF_PAGE_RANGES];
+	int		num_of_multiple_writer_ranges;
+
+	/* pages never written after boot (e.g. the kernel text and rodata) */
+	struct page_range_t immutable_ranges[MAX_OF_PAGE_RANGES];
+	int		num_of_immutable_ranges;
 };
 
 #endif /* _VMM_COMM_CONF_COMMON_H */
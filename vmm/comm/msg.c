@@ -27,25 +27,212 @@ MsgKind_to_string ( msg_kind_t x )
 
 	case MSG_KIND_SHUTDOWN :		return "SHUTDOWN";
 
+	case MSG_KIND_PAGE_PREFETCH_REJECT:   	return "PAGE_PREFETCH_REJECT";
+	case MSG_KIND_PAGE_DIFF:   		return "PAGE_DIFF";
+	case MSG_KIND_PAGE_DIFF_ACK:   		return "PAGE_DIFF_ACK";
+	case MSG_KIND_PAGE_MODE_CHANGE:   	return "PAGE_MODE_CHANGE";
+	case MSG_KIND_REMOTE_ATOMIC:   		return "REMOTE_ATOMIC";
+	case MSG_KIND_REMOTE_ATOMIC_ACK:   	return "REMOTE_ATOMIC_ACK";
+	case MSG_KIND_IMMUTABLE_PAGES: 		return "IMMUTABLE_PAGES";
+	case MSG_KIND_PAGE_HOME_MIGRATE:   	return "PAGE_HOME_MIGRATE";
+
 	default: 		        	Match_failure ( "MsgKind_to_string: %d\n", x );
 	}
 	Match_failure ( "MsgKind_to_string\n" );
 	return "";
 };
 
+/****************************************************************/
+
+/* Pools of the messages and of the list elements.
+ *
+ * A message of the small class or of the page class is a single block
+ * holding the msg_t and its body, so that neither a control message nor
+ * a page calls malloc () once the pools are warm.  Each thread keeps a
+ * cache of free blocks; since the receiver thread allocates the
+ * messages and the monitor frees them, the blocks go back through a
+ * depot shared by the threads, MSG_POOL_BATCH blocks at a time.  The
+ * caches of a thread are not returned when it exits, as the threads
+ * live as long as the process. */
+
+struct msg_list_elem_t {
+	struct msg_t		*msg;
+	struct msg_list_elem_t 	*next;
+};
+
+enum msg_pool_id {
+	MSG_POOL_SMALL,	/* headers and control messages */
+	MSG_POOL_PAGE,	/* a page and the header of its fetch ack */
+	MSG_POOL_ELEM,	/* elements of the message lists */
+	NR_MSG_POOLS
+};
+
+enum {
+	MSG_POOL_SMALL_BODY = 256,
+	MSG_POOL_PAGE_BODY = sizeof ( struct msg_page_fetch_ack_t ) + PAGE_SIZE_4K,
+	MSG_POOL_BATCH = 32,		/* # of blocks moved from/to the depot at once */
+	MSG_POOL_DEPOT_MAX = 1024	/* more free blocks than this are freed */
+};
+
+struct msg_block_t {
+	struct msg_t		msg;
+	int			pool;		/* MSG_POOL_SMALL or MSG_POOL_PAGE */
+	long long		data[0];	/* the body, if it fits in the block */
+};
+
+struct msg_free_block_t {
+	struct msg_free_block_t	*next;
+};
+
+struct msg_pool_t {
+	size_t			size;	/* of a block */
+	pthread_mutex_t		mp;
+	struct msg_free_block_t	*depot;
+	int			nr_depot;
+};
+
+struct msg_pool_cache_t {
+	struct msg_free_block_t	*head;
+	int			n;
+};
+
+static struct msg_pool_t msg_pools[NR_MSG_POOLS] = {
+	{ sizeof ( struct msg_block_t ) + MSG_POOL_SMALL_BODY, PTHREAD_MUTEX_INITIALIZER, NULL, 0 },
+	{ sizeof ( struct msg_block_t ) + MSG_POOL_PAGE_BODY, PTHREAD_MUTEX_INITIALIZER, NULL, 0 },
+	{ sizeof ( struct msg_list_elem_t ), PTHREAD_MUTEX_INITIALIZER, NULL, 0 }
+};
+
+static __thread struct msg_pool_cache_t msg_pool_caches[NR_MSG_POOLS];
+
+static void
+refill_pool_cache ( struct msg_pool_t *p, struct msg_pool_cache_t *c )
+{
+	Pthread_mutex_lock ( &p->mp );
+	while ( ( p->depot != NULL ) && ( c->n < MSG_POOL_BATCH ) ) {
+		struct msg_free_block_t *x = p->depot;
+
+		p->depot = x->next;
+		p->nr_depot--;
+		x->next = c->head;
+		c->head = x;
+		c->n++;
+	}
+	Pthread_mutex_unlock ( &p->mp );
+}
+
+static void
+flush_pool_cache ( struct msg_pool_t *p, struct msg_pool_cache_t *c )
+{
+	struct msg_free_block_t *garbage = NULL;
+
+	Pthread_mutex_lock ( &p->mp );
+	while ( c->n > MSG_POOL_BATCH ) {
+		struct msg_free_block_t *x = c->head;
+
+		c->head = x->next;
+		c->n--;
+		if ( p->nr_depot < MSG_POOL_DEPOT_MAX ) {
+			x->next = p->depot;
+			p->depot = x;
+			p->nr_depot++;
+		} else {
+			x->next = garbage;
+			garbage = x;
+		}
+	}
+	Pthread_mutex_unlock ( &p->mp );
+
+	while ( garbage != NULL ) {
+		struct msg_free_block_t *next = garbage->next;
+
+		Free ( garbage );
+		garbage = next;
+	}
+}
+
+static void *
+MsgPool_alloc ( enum msg_pool_id id )
+{
+	struct msg_pool_cache_t *c = &msg_pool_caches[id];
+	struct msg_free_block_t *x;
+
+	if ( c->head == NULL ) {
+		refill_pool_cache ( &msg_pools[id], c );
+		if ( c->head == NULL ) {
+			return Malloc ( msg_pools[id].size );
+		}
+	}
+
+	x = c->head;
+	c->head = x->next;
+	c->n--;
+	return x;
+}
+
+static void
+MsgPool_free ( enum msg_pool_id id, void *p )
+{
+	struct msg_pool_cache_t *c = &msg_pool_caches[id];
+	struct msg_free_block_t *x = ( struct msg_free_block_t * ) p;
+
+	ASSERT ( p != NULL );
+
+	x->next = c->head;
+	c->head = x;
+	c->n++;
+
+	if ( c->n >= 2 * MSG_POOL_BATCH ) {
+		flush_pool_cache ( &msg_pools[id], c );
+	}
+}
+
+/* Allocate a message whose body has room for <len> bytes.  The body
+ * is left uninitialized, and is NULL if <len> is 0. */
+struct msg_t *
+Msg_alloc ( msg_kind_t kind, size_t len )
+{
+	struct msg_block_t *b;
+	size_t room;
+
+	if ( len <= MSG_POOL_SMALL_BODY ) {
+		b = MsgPool_alloc ( MSG_POOL_SMALL );
+		b->pool = MSG_POOL_SMALL;
+		room = MSG_POOL_SMALL_BODY;
+	} else if ( len <= MSG_POOL_PAGE_BODY ) {
+		b = MsgPool_alloc ( MSG_POOL_PAGE );
+		b->pool = MSG_POOL_PAGE;
+		room = MSG_POOL_PAGE_BODY;
+	} else {
+		/* Only the header comes from the pool. */
+		b = MsgPool_alloc ( MSG_POOL_SMALL );
+		b->pool = MSG_POOL_SMALL;
+		room = 0;
+	}
+
+	b->msg.hdr.kind = kind;
+	b->msg.hdr.len = len;
+	if ( len == 0 ) {
+		b->msg.body = NULL;
+	} else if ( len <= room ) {
+		b->msg.body = ( void * ) b->data;
+	} else {
+		b->msg.body = Malloc ( len );
+	}
+
+	return &b->msg;
+}
+
 struct msg_t *
 Msg_create ( msg_kind_t kind, size_t len, void *body )
 {   
 	struct msg_t *x;
    
-	x = Malloct ( struct msg_t );
-	x->hdr.kind = kind;
-	x->hdr.len = len;
 	if ( body != NULL ) {
-		x->body = Malloc ( len );
+		x = Msg_alloc ( kind, len );
 		Mmove ( x->body, body, len );
 	} else {
-		x->body = NULL;
+		x = Msg_alloc ( kind, 0 );
+		x->hdr.len = len;
 	}
 	return x;
 }
@@ -64,20 +251,134 @@ struct msg_t *
 Msg_create2 ( struct msg_hdr_t hdr, void *body )
 {   
 	struct msg_t *x;
-	x = Malloct ( struct msg_t );
+	x = Msg_alloc ( hdr.kind, 0 );
 	x->hdr = hdr;
 	x->body = body;
 	return x;
 }
 
+/* Typed constructors of the frequent messages.  They fill the body in
+ * the pooled message, without the copy and the va_list of
+ * Msg_create3 (). */
+
+struct msg_t *
+Msg_create_ipi ( const struct interrupt_command_t *ic )
+{
+	struct msg_t *msg;
+	struct msg_ipi_t *x;
+
+	ASSERT ( ic != NULL );
+
+	msg = Msg_alloc ( MSG_KIND_IPI, sizeof ( struct msg_ipi_t ) );
+	x = ( struct msg_ipi_t * ) msg->body;
+	x->ic = *ic;
+
+	return msg;
+}
+
+struct msg_t *
+Msg_create_fetch_ack_ack ( int page_no, mem_access_kind_t kind, int src_id, long long seq )
+{
+	struct msg_t *msg;
+	struct msg_page_fetch_ack_ack_t *x;
+
+	msg = Msg_alloc ( MSG_KIND_PAGE_FETCH_ACK_ACK, sizeof ( struct msg_page_fetch_ack_ack_t ) );
+	x = ( struct msg_page_fetch_ack_ack_t * ) msg->body;
+	x->page_no = page_no;
+	x->kind = kind;
+	x->src_id = src_id;
+	x->seq = seq;
+
+	return msg;
+}
+
+struct msg_t *
+Msg_create_page_home_migrate ( int page_no, int home_id, int epoch, long long seq )
+{
+	struct msg_t *msg;
+	struct msg_page_home_migrate_t *x;
+
+	msg = Msg_alloc ( MSG_KIND_PAGE_HOME_MIGRATE, sizeof ( struct msg_page_home_migrate_t ) );
+	x = ( struct msg_page_home_migrate_t * ) msg->body;
+	x->page_no = page_no;
+	x->home_id = home_id;
+	x->epoch = epoch;
+	x->seq = seq;
+
+	return msg;
+}
+
+struct msg_t *
+Msg_create_input_port ( int addr, size_t len )
+{
+	struct msg_t *msg;
+	struct msg_input_port_t *x;
+
+	msg = Msg_alloc ( MSG_KIND_INPUT_PORT, sizeof ( struct msg_input_port_t ) );
+	x = ( struct msg_input_port_t * ) msg->body;
+	x->addr = addr;
+	x->len = len;
+
+	return msg;
+}
+
+struct msg_t *
+Msg_create_input_port_ack ( int addr, int val, size_t len, int irq )
+{
+	struct msg_t *msg;
+	struct msg_input_port_ack_t *x;
+
+	msg = Msg_alloc ( MSG_KIND_INPUT_PORT_ACK, sizeof ( struct msg_input_port_ack_t ) );
+	x = ( struct msg_input_port_ack_t * ) msg->body;
+	x->addr = addr;
+	x->val = val;
+	x->len = len;
+	x->irq = irq;
+
+	return msg;
+}
+
+struct msg_t *
+Msg_create_output_port ( int addr, int val, size_t len )
+{
+	struct msg_t *msg;
+	struct msg_output_port_t *x;
+
+	msg = Msg_alloc ( MSG_KIND_OUTPUT_PORT, sizeof ( struct msg_output_port_t ) );
+	x = ( struct msg_output_port_t * ) msg->body;
+	x->addr = addr;
+	x->val = val;
+	x->len = len;
+
+	return msg;
+}
+
+struct msg_t *
+Msg_create_output_port_ack ( int addr, size_t len, int irq )
+{
+	struct msg_t *msg;
+	struct msg_output_port_ack_t *x;
+
+	msg = Msg_alloc ( MSG_KIND_OUTPUT_PORT_ACK, sizeof ( struct msg_output_port_ack_t ) );
+	x = ( struct msg_output_port_ack_t * ) msg->body;
+	x->addr = addr;
+	x->len = len;
+	x->irq = irq;
+
+	return msg;
+}
+
 static struct fptr_t
 Msg_create3_sub_init ( va_list ap )
 {
 	struct msg_init_t *x;
 	const size_t LEN = sizeof ( struct msg_init_t );
+	const char *shm_name;
 
 	x = Malloct ( struct msg_init_t ); 
 	x->cpuid = ( int )va_arg ( ap, int );
+	shm_name = ( const char * )va_arg ( ap, const char * );
+	Snprintf ( x->shm_name, MAX_SHM_NAME_LEN, "%s", ( shm_name != NULL ) ? shm_name : "" );
 
 	return Fptr_create ( ( void * )x, LEN );
 }
@@ -95,19 +396,13 @@ Msg_create3_sub_apic_logical_id ( va_list ap )
 	return Fptr_create ( ( void * )x, LEN );
 }
 
-static struct fptr_t
+static struct msg_t *
 Msg_create3_sub_ipi ( va_list ap )
 {
-	struct msg_ipi_t *x;
 	struct interrupt_command_t *p;
-	const size_t LEN = sizeof ( struct msg_ipi_t );
 
-	x = Malloct ( struct msg_ipi_t );
 	p = ( struct interrupt_command_t * )va_arg ( ap, struct interrupt_command_t * );
-	ASSERT ( p != NULL );
-	x->ic = *p;
-   
-	return Fptr_create ( ( void * )x, LEN );
+	return Msg_create_ipi ( p );
 } 
 
 static struct fptr_t
@@ -120,6 +415,10 @@ Msg_create3_sub_fetch_request ( va_list ap )
 	x->page_no = ( int )va_arg ( ap, int );
 	x->kind = ( mem_access_kind_t )va_arg ( ap, mem_access_kind_t );
 	x->src_id = ( int )va_arg ( ap, int );
+	x->is_prefetch = FALSE;
+	x->no_data = FALSE;
+	x->base_seq = -1LL;
+	x->hops = 0;
 
 	return Fptr_create ( ( void * )x, LEN );
 }
@@ -129,14 +428,18 @@ Msg_create3_sub_fetch_ack ( va_list ap )
 {
 	struct msg_page_fetch_ack_t *x;
 	bit8u_t *p;
-	const size_t LEN = sizeof ( struct msg_page_fetch_ack_t );
+	const size_t LEN = sizeof ( struct msg_page_fetch_ack_t ) + PAGE_SIZE_4K;
 
-	x = Malloct ( struct msg_page_fetch_ack_t );
+	x = Malloc ( LEN );
 	x->page_no = ( int )va_arg ( ap, int );
 	x->kind = ( mem_access_kind_t )va_arg ( ap, mem_access_kind_t );
 	p = ( bit8u_t * )va_arg ( ap, bit8u_t * );
 	Mmove ( x->data, p, PAGE_SIZE_4K );
 	x->seq = ( long long )va_arg ( ap, long long );
+	x->hops = 0;
+	x->encoding = PAGE_ENCODING_RAW;
+	x->base_seq = -1LL;
+	x->data_len = PAGE_SIZE_4K;
 
 	return Fptr_create ( ( void * )x, LEN );
 }
@@ -152,79 +455,108 @@ Msg_create3_sub_invalidate_request ( va_list ap )
 	x->kind = ( mem_access_kind_t )va_arg ( ap, mem_access_kind_t );
 	x->src_id = ( int )va_arg ( ap, int );
 	x->seq = ( long long )va_arg ( ap, long long );
+	x->no_data = FALSE;
+	x->base_seq = -1LL;
+	x->hops = 0;
 
 	return Fptr_create ( ( void* )x, LEN );
 }
 
-static struct fptr_t
+static struct msg_t *
 Msg_create3_sub_fetch_ack_ack ( va_list ap )
 {
-	struct msg_page_fetch_ack_ack_t *x;
-	const size_t LEN = sizeof ( struct msg_page_fetch_ack_ack_t );
+	int page_no, src_id;
+	mem_access_kind_t kind;
+	long long seq;
 
-	x = Malloct ( struct msg_page_fetch_ack_ack_t );
-	x->page_no = ( int )va_arg ( ap, int );
-	x->kind = ( mem_access_kind_t )va_arg ( ap, mem_access_kind_t );
+	page_no = ( int )va_arg ( ap, int );
+	kind = ( mem_access_kind_t )va_arg ( ap, mem_access_kind_t );
+	src_id = ( int )va_arg ( ap, int );
+	seq = ( long long )va_arg ( ap, long long );
+
+	return Msg_create_fetch_ack_ack ( page_no, kind, src_id, seq );
+}
+
+static struct fptr_t
+Msg_create3_sub_page_mode_change ( va_list ap )
+{
+	struct msg_page_mode_change_t *x;
+	const size_t LEN = sizeof ( struct msg_page_mode_change_t );
+
+	x = Malloct ( struct msg_page_mode_change_t );
+	x->phase = ( page_mode_phase_t )va_arg ( ap, page_mode_phase_t );
+	x->from_page_no = ( int )va_arg ( ap, int );
+	x->to_page_no = ( int )va_arg ( ap, int );
+	x->is_multiple_writer = ( bool_t )va_arg ( ap, bool_t );
 	x->src_id = ( int )va_arg ( ap, int );
-	x->seq = ( long long )va_arg ( ap, long long );
 
 	return Fptr_create ( ( void* )x, LEN );
 }
 
-static struct fptr_t
+static struct msg_t *
+Msg_create3_sub_page_home_migrate ( va_list ap )
+{
+	int page_no, home_id, epoch;
+	long long seq;
+
+	page_no = ( int )va_arg ( ap, int );
+	home_id = ( int )va_arg ( ap, int );
+	epoch = ( int )va_arg ( ap, int );
+	seq = ( long long )va_arg ( ap, long long );
+
+	return Msg_create_page_home_migrate ( page_no, home_id, epoch, seq );
+}
+
+static struct msg_t *
 Msg_create3_sub_input_port ( va_list ap )
 {
-	struct msg_input_port_t *x;
-	const size_t LEN = sizeof ( struct msg_input_port_t );
+	int addr;
+	size_t len;
 
-	x = Malloct ( struct msg_input_port_t );
-	x->addr = ( int )va_arg ( ap, int );
-	x->len = ( size_t )va_arg ( ap, size_t );
+	addr = ( int )va_arg ( ap, int );
+	len = ( size_t )va_arg ( ap, size_t );
 
-	return Fptr_create ( ( void* )x, LEN );
+	return Msg_create_input_port ( addr, len );
 }
 
-static struct fptr_t
+static struct msg_t *
 Msg_create3_sub_input_port_ack ( va_list ap )
 {
-	struct msg_input_port_ack_t *x;
-	const size_t LEN = sizeof ( struct msg_input_port_ack_t );
+	int addr, val, irq;
+	size_t len;
 
-	x = Malloct ( struct msg_input_port_ack_t );
-	x->addr = ( int )va_arg ( ap, int );
-	x->val = ( int )va_arg ( ap, int );
-	x->len = ( size_t )va_arg ( ap, size_t );
-	x->irq = ( int )va_arg ( ap, int );
+	addr = ( int )va_arg ( ap, int );
+	val = ( int )va_arg ( ap, int );
+	len = ( size_t )va_arg ( ap, size_t );
+	irq = ( int )va_arg ( ap, int );
 
-	return Fptr_create ( ( void* )x, LEN );
+	return Msg_create_input_port_ack ( addr, val, len, irq );
 }
 
-static struct fptr_t
+static struct msg_t *
 Msg_create3_sub_output_port ( va_list ap )
 {
-	struct msg_output_port_t *x;
-	const size_t LEN = sizeof ( struct msg_output_port_t );
+	int addr, val;
+	size_t len;
 
-	x = Malloct ( struct msg_output_port_t );
-	x->addr = ( int )va_arg ( ap, int );
-	x->val = ( int )va_arg ( ap, int );
-	x->len = ( size_t )va_arg ( ap, size_t );
+	addr = ( int )va_arg ( ap, int );
+	val = ( int )va_arg ( ap, int );
+	len = ( size_t )va_arg ( ap, size_t );
 
-	return Fptr_create ( ( void* )x, LEN );
+	return Msg_create_output_port ( addr, val, len );
 }
 
-static struct fptr_t
+static struct msg_t *
 Msg_create3_sub_output_port_ack ( va_list ap )
 {
-	struct msg_output_port_ack_t *x;
-	const size_t LEN = sizeof ( struct msg_output_port_ack_t );
+	int addr, irq;
+	size_t len;
 
-	x = Malloct ( struct msg_output_port_ack_t );
-	x->addr = ( int )va_arg ( ap, int );
-	x->len = ( size_t )va_arg ( ap, size_t );
-	x->irq = ( int )va_arg ( ap, int );
+	addr = ( int )va_arg ( ap, int );
+	len = ( size_t )va_arg ( ap, size_t );
+	irq = ( int )va_arg ( ap, int );
 
-	return Fptr_create ( ( void* )x, LEN );
+	return Msg_create_output_port_ack ( addr, len, irq );
 }
 
 static struct fptr_t
@@ -250,25 +582,29 @@ Msg_create3_sub_stat_request_ack ( va_list ap )
 	return Fptr_create ( ( void* )x, LEN );
 }
 
-static struct fptr_t
+static struct msg_t *
 Msg_create3_sub ( msg_kind_t kind, va_list ap )
 {
 	struct fptr_t body = Fptr_null ( );
+	struct msg_hdr_t hdr;
 
 	switch ( kind ) {
 	case MSG_KIND_INIT: 			body = Msg_create3_sub_init ( ap ); break;
 	case MSG_KIND_APIC_LOGICAL_ID: 		body = Msg_create3_sub_apic_logical_id ( ap ); break;
-	case MSG_KIND_IPI: 			body = Msg_create3_sub_ipi ( ap ); break;
+	case MSG_KIND_IPI: 			return Msg_create3_sub_ipi ( ap );
 		
 	case MSG_KIND_PAGE_FETCH_REQUEST: 	body = Msg_create3_sub_fetch_request ( ap ); break;
 	case MSG_KIND_PAGE_FETCH_ACK: 		body = Msg_create3_sub_fetch_ack ( ap ); break;
 	case MSG_KIND_PAGE_INVALIDATE_REQUEST: 	body = Msg_create3_sub_invalidate_request ( ap ); break;
-	case MSG_KIND_PAGE_FETCH_ACK_ACK:	body = Msg_create3_sub_fetch_ack_ack ( ap ); break;
+	case MSG_KIND_PAGE_FETCH_ACK_ACK:	return Msg_create3_sub_fetch_ack_ack ( ap );
+	case MSG_KIND_PAGE_DIFF_ACK:		body = Fptr_null ( ); break;
+	case MSG_KIND_PAGE_MODE_CHANGE:		body = Msg_create3_sub_page_mode_change ( ap ); break;
+	case MSG_KIND_PAGE_HOME_MIGRATE:	return Msg_create3_sub_page_home_migrate ( ap );
 		
-	case MSG_KIND_INPUT_PORT:		body = Msg_create3_sub_input_port ( ap ); break;
-	case MSG_KIND_INPUT_PORT_ACK:		body = Msg_create3_sub_input_port_ack ( ap ); break;
-	case MSG_KIND_OUTPUT_PORT:		body = Msg_create3_sub_output_port ( ap ); break;
-	case MSG_KIND_OUTPUT_PORT_ACK:		body = Msg_create3_sub_output_port_ack ( ap ); break;
+	case MSG_KIND_INPUT_PORT:		return Msg_create3_sub_input_port ( ap );
+	case MSG_KIND_INPUT_PORT_ACK:		return Msg_create3_sub_input_port_ack ( ap );
+	case MSG_KIND_OUTPUT_PORT:		return Msg_create3_sub_output_port ( ap );
+	case MSG_KIND_OUTPUT_PORT_ACK:		return Msg_create3_sub_output_port_ack ( ap );
 		
 	case MSG_KIND_STAT_REQUEST:		body = Msg_create3_sub_stat_request ( ap ); break;
 	case MSG_KIND_STAT_REQUEST_ACK:		body = Msg_create3_sub_stat_request_ack ( ap ); break;
@@ -277,36 +613,37 @@ Msg_create3_sub ( msg_kind_t kind, va_list ap )
 
 	default:				Match_failure ( "Msg_create3_sub: kind=%#x", kind );
 	}
-	return body;
+
+	hdr.kind = kind;
+	hdr.len = body.offset;
+	return Msg_create2 ( hdr, body.base );
 }
 
 struct msg_t *
 Msg_create3 ( msg_kind_t kind, ... )
 {
 	va_list ap;
-	struct msg_hdr_t hdr;
-	struct fptr_t body;
+	struct msg_t *msg;
    
 	va_start ( ap, kind );
-	body = Msg_create3_sub ( kind, ap );
-	// assert ( ! Fptr_is_null ( body ) );
+	msg = Msg_create3_sub ( kind, ap );
 	va_end ( ap );
 
-	hdr.kind = kind;
-	hdr.len = body.offset;
-	return Msg_create2 ( hdr, body.base );
+	return msg;
 }
 
 void 
 Msg_destroy ( struct msg_t *x )
 {
+	struct msg_block_t *b = ( struct msg_block_t * ) x;
+
 	ASSERT ( x != NULL );
 	
-	if ( x->body != NULL ) {
+	if ( ( x->body != NULL ) && ( x->body != ( void * ) b->data ) ) {
 		Free ( x->body );
 	}
 	
-	Free ( x );
+	MsgPool_free ( b->pool, b );
 }
 
 struct msg_init_t *
@@ -365,6 +702,46 @@ Msg_to_msg_page_fetch_ack_ack ( struct msg_t *msg )
 	return ( struct msg_page_fetch_ack_ack_t * ) ( msg->body );	
 }
 
+struct msg_page_diff_t *
+Msg_to_msg_page_diff ( struct msg_t *msg )
+{
+	ASSERT ( msg != NULL );
+	ASSERT ( msg->hdr.kind == MSG_KIND_PAGE_DIFF );
+	return ( struct msg_page_diff_t * ) ( msg->body );
+}
+
+struct msg_page_mode_change_t *
+Msg_to_msg_page_mode_change ( struct msg_t *msg )
+{
+	ASSERT ( msg != NULL );
+	ASSERT ( msg->hdr.kind == MSG_KIND_PAGE_MODE_CHANGE );
+	return ( struct msg_page_mode_change_t * ) ( msg->body );
+}
+
+struct msg_page_home_migrate_t *
+Msg_to_msg_page_home_migrate ( struct msg_t *msg )
+{
+	ASSERT ( msg != NULL );
+	ASSERT ( msg->hdr.kind == MSG_KIND_PAGE_HOME_MIGRATE );
+	return ( struct msg_page_home_migrate_t * ) ( msg->body );
+}
+
+struct msg_remote_atomic_t *
+Msg_to_msg_remote_atomic ( struct msg_t *msg )
+{
+	ASSERT ( msg != NULL );
+	ASSERT ( msg->hdr.kind == MSG_KIND_REMOTE_ATOMIC );
+	return ( struct msg_remote_atomic_t * ) ( msg->body );
+}
+
+struct msg_remote_atomic_ack_t *
+Msg_to_msg_remote_atomic_ack ( struct msg_t *msg )
+{
+	ASSERT ( msg != NULL );
+	ASSERT ( msg->hdr.kind == MSG_KIND_REMOTE_ATOMIC_ACK );
+	return ( struct msg_remote_atomic_ack_t * ) ( msg->body );
+}
+
 struct msg_input_port_t *
 Msg_to_msg_input_port ( struct msg_t *msg )
 {
@@ -424,7 +801,8 @@ Msg_print_fetch_request ( FILE *stream, struct msg_page_fetch_request_t *x )
 static void
 Msg_print_fetch_ack ( FILE *stream, struct msg_page_fetch_ack_t *x )
 {
-	Print ( stream, "page_no=%#x, kind=%s", x->page_no, MemAccessKind_to_string ( x->kind ) );
+	Print ( stream, "page_no=%#x, kind=%s, encoding=%d, data_len=%#x", 
+		x->page_no, MemAccessKind_to_string ( x->kind ), x->encoding, x->data_len );
 }
 
 static void
@@ -441,6 +819,33 @@ Msg_print_fetch_ack_ack ( FILE *stream, struct msg_page_fetch_ack_ack_t *x )
 		x->page_no, MemAccessKind_to_string ( x->kind ), x->src_id );
 }
 
+static void
+Msg_print_page_mode_change ( FILE *stream, struct msg_page_mode_change_t *x )
+{
+	Print ( stream, "phase=%d, pages=[%#x,%#x], multiple_writer=%d, src_id=%#x",
+		x->phase, x->from_page_no, x->to_page_no, x->is_multiple_writer, x->src_id );
+}
+
+static void
+Msg_print_page_home_migrate ( FILE *stream, struct msg_page_home_migrate_t *x )
+{
+	Print ( stream, "page_no=%#x, home_id=%#x, epoch=%d, seq=%lld",
+		x->page_no, x->home_id, x->epoch, x->seq );
+}
+
+static void
+Msg_print_remote_atomic ( FILE *stream, struct msg_remote_atomic_t *x )
+{
+	Print ( stream, "op=%d, page_no=%#x, offset=%#x, len=%d, src=%#x, cmp=%#x",
+		x->op, x->page_no, x->offset, ( int ) x->len, x->src, x->cmp );
+}
+
+static void
+Msg_print_remote_atomic_ack ( FILE *stream, struct msg_remote_atomic_ack_t *x )
+{
+	Print ( stream, "is_done=%d, old_val=%#x", x->is_done, x->old_val );
+}
+
 void
 Msg_print ( FILE *stream, struct msg_t *msg )
 {
@@ -457,6 +862,7 @@ Msg_print ( FILE *stream, struct msg_t *msg )
 	case MSG_KIND_IPI:
 	case MSG_KIND_MEM_IMAGE_REQUEST:
 	case MSG_KIND_MEM_IMAGE_RESPONSE:
+	case MSG_KIND_IMMUTABLE_PAGES:
 	case MSG_KIND_IOAPIC_DUMP:
 		break;
 
@@ -472,6 +878,22 @@ Msg_print ( FILE *stream, struct msg_t *msg )
 	case MSG_KIND_PAGE_FETCH_ACK_ACK:
 		Msg_print_fetch_ack_ack ( stream, ( struct msg_page_fetch_ack_ack_t * ) ( msg->body ) );
 		break;
+	case MSG_KIND_PAGE_PREFETCH_REJECT:
+	case MSG_KIND_PAGE_DIFF:
+	case MSG_KIND_PAGE_DIFF_ACK:
+		break;
+	case MSG_KIND_PAGE_MODE_CHANGE:
+		Msg_print_page_mode_change ( stream, ( struct msg_page_mode_change_t * ) ( msg->body ) );
+		break;
+	case MSG_KIND_PAGE_HOME_MIGRATE:
+		Msg_print_page_home_migrate ( stream, ( struct msg_page_home_migrate_t * ) ( msg->body ) );
+		break;
+	case MSG_KIND_REMOTE_ATOMIC:
+		Msg_print_remote_atomic ( stream, ( struct msg_remote_atomic_t * ) ( msg->body ) );
+		break;
+	case MSG_KIND_REMOTE_ATOMIC_ACK:
+		Msg_print_remote_atomic_ack ( stream, ( struct msg_remote_atomic_ack_t * ) ( msg->body ) );
+		break;
 
 	case MSG_KIND_INPUT_PORT:
 	case MSG_KIND_INPUT_PORT_ACK:
@@ -518,62 +940,87 @@ struct msg_t *
 Msg_unpack ( int fd )
 {
 	struct msg_hdr_t hdr;
-	void *body;
+	struct msg_t *msg;
 
 	Unpack ( &hdr, sizeof ( struct msg_hdr_t ), fd );
 
+	msg = Msg_alloc ( hdr.kind, hdr.len );
+	msg->hdr = hdr;
 	if ( hdr.len > 0 ) {
-		body = Malloc ( hdr.len );
-		Unpack ( body, hdr.len, fd );
-	} else {
-		body = NULL; 
+		Unpack ( msg->body, hdr.len, fd );
 	}
 
-	return Msg_create2 ( hdr, body );
+	return msg;
 }
 
 /************************************/
 
+/* Prepend <hdr> to the body gathered from the <iovcnt> buffers of
+ * <iov> (e.g. pages in pmem), and set <hdr->len>.  Return the number
+ * of the buffers of the message.  [Note] <iov> must have a room for
+ * one more entry. */
+int
+Msg_gather ( struct msg_hdr_t *hdr, struct iovec *iov, int iovcnt )
+{
+	int i;
+
+	ASSERT ( hdr != NULL );
+	ASSERT ( iov != NULL );
+
+	hdr->len = 0;
+	for ( i = iovcnt; i > 0; i-- ) {
+		iov[i] = iov[i - 1];
+		hdr->len += iov[i].iov_len;
+	}
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof ( struct msg_hdr_t );
+
+	return iovcnt + 1;
+}
+
+/* Send a message without copying its body (see Msg_gather ()) */
+void
+Msg_sendv ( struct msg_hdr_t *hdr, struct iovec *iov, int iovcnt, int fd )
+{
+	Sendvn ( fd, iov, Msg_gather ( hdr, iov, iovcnt ) );
+}
+
+/* The header and the body go in a single system call, so that they
+ * are not split into two segments. */
 void
 Msg_send ( struct msg_t *msg, int fd )
 {
-	ASSERT ( msg != NULL );
+	struct iovec iov[2];
 
-	Sendn ( fd, &msg->hdr, sizeof ( struct msg_hdr_t ), 0 );
+	ASSERT ( msg != NULL );
 
-	if ( msg->hdr.len > 0 ) {
-		Sendn ( fd, msg->body, msg->hdr.len, 0 );
-	}
+	iov[0].iov_base = msg->body;
+	iov[0].iov_len = msg->hdr.len;
+	Msg_sendv ( &msg->hdr, iov, ( msg->hdr.len > 0 ) ? 1 : 0, fd );
 }
 
 struct msg_t *
 Msg_recv ( int fd, int src_id )
 {
 	struct msg_hdr_t hdr;
-	void *body;
+	struct msg_t *msg;
 
 	Recvn ( fd, &hdr, sizeof ( struct msg_hdr_t ), 0 );
 
 	hdr.src_id = src_id;
 	DPRINT ( " ( comm )\t" "Msg_recv: src_id=%#x, len=%#x\n", hdr.src_id, hdr.len );
 
+	msg = Msg_alloc ( hdr.kind, hdr.len );
+	msg->hdr = hdr;
 	if ( hdr.len > 0 ) {
-		body = Malloc ( hdr.len );
-		Recvn ( fd, body, hdr.len, 0 );
-	} else {
-		body = NULL;
+		Recvn ( fd, msg->body, hdr.len, 0 );
 	}
 
-	return Msg_create2 ( hdr, body );
+	return msg;
 }
 
 /****************************************************************/
 
-struct msg_list_elem_t {
-	struct msg_t		*msg;
-	struct msg_list_elem_t 	*next;
-};
-
 struct msg_list_elem_t *
 MsgListElem_create ( struct msg_t *msg, struct msg_list_elem_t *next )
 {
@@ -581,7 +1028,7 @@ MsgListElem_create ( struct msg_t *msg, struct msg_list_elem_t *next )
 	
 	ASSERT ( msg == NULL );
 
-	x = Malloct ( struct msg_list_elem_t );
+	x = MsgPool_alloc ( MSG_POOL_ELEM );
 	x->msg = msg;
 	x->next = next;
 	
@@ -597,14 +1044,14 @@ MsgListElem_destroy ( struct msg_list_elem_t *x )
 		Msg_destroy ( x->msg );
 	}
 
-	Free ( x );
+	MsgPool_free ( MSG_POOL_ELEM, x );
 }
 
 void
 MsgListElem_destroy2 ( struct msg_list_elem_t *x )
 {
 	ASSERT ( x != NULL );
-	Free ( x );
+	MsgPool_free ( MSG_POOL_ELEM, x );
 }
 
 /****************************************************************/
@@ -657,7 +1104,7 @@ MsgList_add ( struct msg_list_t *l, struct msg_t *msg )
 	ASSERT ( l != NULL );
 	ASSERT ( msg != NULL );
 
-	x = Malloct ( struct msg_list_elem_t );
+	x = MsgPool_alloc ( MSG_POOL_ELEM );
 	x->msg = msg;
 	x->next = NULL;
 
@@ -914,3 +1361,679 @@ MsgList_unpack ( struct msg_list_t *l, int fd )
 		MsgList_add ( l, msg );
 	}
 }
+
+/****************************************************************/
+
+/* Index of the messages that cannot be handled yet.  The judge of
+ * MsgList_try_remove3 () gives each message a key: MSG_DEFER_NONE if
+ * it can be handled now, a page number if it waits for the state of
+ * that page, or MSG_DEFER_BY_KIND otherwise.  A deferred message is
+ * parked in the bucket of its key so that it is not judged again at
+ * each removal.  The buckets of the pages are released in bulk by
+ * MsgDeferIndex_release (); the buckets of the kinds only hold a few
+ * messages (at most one I/O request or mode change per node) and are
+ * judged again at each removal. */
+
+enum {
+	MSG_DEFER_HASH_SIZE = 256	/* must be a power of two */
+};
+
+struct msg_defer_bucket_t {
+	int				key;
+	struct msg_list_elem_t		*head, *tail;
+	struct msg_defer_bucket_t	*next;
+};
+
+struct msg_defer_index_t {
+	struct msg_defer_bucket_t	*pages[MSG_DEFER_HASH_SIZE];
+	struct msg_defer_bucket_t	kinds[NR_MSG_KINDS];
+	int				nr_msgs;
+};
+
+static void
+init_defer_bucket ( struct msg_defer_bucket_t *b, int key )
+{
+	b->key = key;
+	b->head = NULL;
+	b->tail = NULL;
+	b->next = NULL;
+}
+
+struct msg_defer_index_t *
+MsgDeferIndex_create ( void )
+{
+	struct msg_defer_index_t *d;
+	int i;
+
+	d = Malloct ( struct msg_defer_index_t );
+	for ( i = 0; i < MSG_DEFER_HASH_SIZE; i++ ) {
+		d->pages[i] = NULL;
+	}
+	for ( i = 0; i < NR_MSG_KINDS; i++ ) {
+		init_defer_bucket ( &d->kinds[i], MSG_DEFER_BY_KIND );
+	}
+	d->nr_msgs = 0;
+
+	return d;
+}
+
+static void
+destroy_defer_bucket_elems ( struct msg_defer_bucket_t *b )
+{
+	struct msg_list_elem_t *p, *next;
+
+	for ( p = b->head; p != NULL; p = next ) {
+		next = p->next;
+		MsgListElem_destroy ( p );
+	}
+}
+
+void
+MsgDeferIndex_destroy ( struct msg_defer_index_t *d )
+{
+	int i;
+
+	ASSERT ( d != NULL );
+
+	for ( i = 0; i < MSG_DEFER_HASH_SIZE; i++ ) {
+		struct msg_defer_bucket_t *b, *next;
+
+		for ( b = d->pages[i]; b != NULL; b = next ) {
+			next = b->next;
+			destroy_defer_bucket_elems ( b );
+			Free ( b );
+		}
+	}
+	for ( i = 0; i < NR_MSG_KINDS; i++ ) {
+		destroy_defer_bucket_elems ( &d->kinds[i] );
+	}
+	Free ( d );
+}
+
+static inline int
+defer_hash ( int key )
+{
+	return key & ( MSG_DEFER_HASH_SIZE - 1 );
+}
+
+static struct msg_defer_bucket_t *
+lookup_page_bucket ( struct msg_defer_index_t *d, int key, bool_t create )
+{
+	struct msg_defer_bucket_t *b;
+
+	for ( b = d->pages[defer_hash ( key )]; b != NULL; b = b->next ) {
+		if ( b->key == key ) {
+			return b;
+		}
+	}
+
+	if ( ! create ) {
+		return NULL;
+	}
+
+	b = Malloct ( struct msg_defer_bucket_t );
+	init_defer_bucket ( b, key );
+	b->next = d->pages[defer_hash ( key )];
+	d->pages[defer_hash ( key )] = b;
+
+	return b;
+}
+
+static void
+park_elem ( struct msg_defer_index_t *d, struct msg_list_elem_t *x, int key )
+{
+	struct msg_defer_bucket_t *b;
+
+	ASSERT ( key != MSG_DEFER_NONE );
+
+	b = ( key == MSG_DEFER_BY_KIND
+	      ? &d->kinds[x->msg->hdr.kind]
+	      : lookup_page_bucket ( d, key, TRUE ) );
+
+	x->next = NULL;
+	if ( b->tail == NULL ) {
+		b->head = x;
+	} else {
+		b->tail->next = x;
+	}
+	b->tail = x;
+
+	d->nr_msgs++;
+}
+
+void
+MsgDeferIndex_add ( struct msg_defer_index_t *d, struct msg_t *msg, int key )
+{
+	struct msg_list_elem_t *x;
+
+	ASSERT ( d != NULL );
+	ASSERT ( msg != NULL );
+
+	x = MsgPool_alloc ( MSG_POOL_ELEM );
+	x->msg = msg;
+	park_elem ( d, x, key );
+}
+
+/* Move the messages of <b> to the head of <l>.  They have been parked
+ * before any message in <l> was judged, so they keep precedence. */
+static void
+unpark_bucket ( struct msg_defer_index_t *d, struct msg_defer_bucket_t *b, struct msg_list_t *l )
+{
+	struct msg_list_elem_t *p;
+
+	if ( b->head == NULL ) {
+		return;
+	}
+
+	for ( p = b->head; p != NULL; p = p->next ) {
+		d->nr_msgs--;
+	}
+
+	Pthread_mutex_lock ( &l->mp );
+	b->tail->next = l->head;
+	if ( l->tail == NULL ) {
+		l->tail = b->tail;
+	}
+	l->head = b->head;
+	Pthread_mutex_unlock ( &l->mp );
+
+	b->head = NULL;
+	b->tail = NULL;
+}
+
+/* Release the messages parked under the page <key> */
+void
+MsgDeferIndex_release ( struct msg_defer_index_t *d, struct msg_list_t *l, int key )
+{
+	struct msg_defer_bucket_t **pp;
+
+	ASSERT ( d != NULL );
+	ASSERT ( l != NULL );
+	ASSERT ( key >= 0 );
+
+	for ( pp = &d->pages[defer_hash ( key )]; *pp != NULL; pp = &( *pp )->next ) {
+		struct msg_defer_bucket_t *b = *pp;
+
+		if ( b->key == key ) {
+			*pp = b->next;
+			unpark_bucket ( d, b, l );
+			Free ( b );
+			return;
+		}
+	}
+}
+
+void
+MsgDeferIndex_release_all ( struct msg_defer_index_t *d, struct msg_list_t *l )
+{
+	int i;
+
+	ASSERT ( d != NULL );
+	ASSERT ( l != NULL );
+
+	for ( i = 0; i < MSG_DEFER_HASH_SIZE; i++ ) {
+		while ( d->pages[i] != NULL ) {
+			MsgDeferIndex_release ( d, l, d->pages[i]->key );
+		}
+	}
+	for ( i = 0; i < NR_MSG_KINDS; i++ ) {
+		unpark_bucket ( d, &d->kinds[i], l );
+	}
+	assert ( d->nr_msgs == 0 );
+}
+
+/* Find a message in the buckets of the kinds that can be handled now,
+ * and unlink it if <remove> is TRUE.  A message that now waits for the
+ * state of a page is moved to the bucket of that page, so that it is
+ * not judged again until the page is released. */
+static struct msg_t *
+find_in_kind_buckets ( struct msg_defer_index_t *d, int (*defer_func) ( struct msg_t * ), bool_t remove )
+{
+	int i;
+
+	for ( i = 0; i < NR_MSG_KINDS; i++ ) {
+		struct msg_defer_bucket_t *b = &d->kinds[i];
+		struct msg_list_elem_t *p, *prev, *next;
+
+		prev = NULL;
+		for ( p = b->head; p != NULL; p = next ) {
+			struct msg_t *ret = p->msg;
+			int key;
+
+			next = p->next;
+			key = (*defer_func) ( ret );
+			if ( key == MSG_DEFER_BY_KIND ) {
+				prev = p;
+				continue;
+			}
+
+			if ( ( key == MSG_DEFER_NONE ) && ( ! remove ) ) {
+				return ret;
+			}
+
+			if ( prev == NULL ) {
+				b->head = next;
+			} else {
+				prev->next = next;
+			}
+			if ( p == b->tail ) {
+				b->tail = prev;
+			}
+			d->nr_msgs--;
+
+			if ( key != MSG_DEFER_NONE ) {
+				park_elem ( d, p, key );
+				continue;
+			}
+
+			MsgListElem_destroy2 ( p );
+			return ret;
+		}
+	}
+
+	return NULL;
+}
+
+/* Park the messages at the head of <l> that cannot be handled now,
+ * and return TRUE if the one left at the head can. */
+static bool_t
+park_deferred_msgs ( struct msg_list_t *l, struct msg_defer_index_t *d, int (*defer_func) ( struct msg_t * ) )
+{
+	while ( l->head != NULL ) {
+		struct msg_list_elem_t *x = l->head;
+		int key;
+
+		key = (*defer_func) ( x->msg );
+		if ( key == MSG_DEFER_NONE ) {
+			return TRUE;
+		}
+
+		l->head = x->next;
+		if ( l->head == NULL ) {
+			l->tail = NULL;
+		}
+		park_elem ( d, x, key );
+	}
+
+	return FALSE;
+}
+
+/* Remove the oldest message that can be handled now according to
+ * <defer_func>, parking the others in <d> on the way. */
+struct msg_t *
+MsgList_try_remove3 ( struct msg_list_t *l, struct msg_defer_index_t *d, int (*defer_func) ( struct msg_t * ) )
+{
+	struct msg_t *ret;
+
+	ASSERT ( l != NULL );
+	ASSERT ( d != NULL );
+	ASSERT ( defer_func != NULL );
+
+	ret = find_in_kind_buckets ( d, defer_func, TRUE );
+	if ( ret != NULL ) {
+		return ret;
+	}
+
+	Pthread_mutex_lock ( &l->mp );
+	ret = ( park_deferred_msgs ( l, d, defer_func ) ) ? __msg_list_remove ( l ) : NULL;
+	Pthread_mutex_unlock ( &l->mp );
+
+	return ret;
+}
+
+bool_t
+MsgList_exists3 ( struct msg_list_t *l, struct msg_defer_index_t *d, int (*defer_func) ( struct msg_t * ) )
+{
+	bool_t ret;
+
+	ASSERT ( l != NULL );
+	ASSERT ( d != NULL );
+	ASSERT ( defer_func != NULL );
+
+	if ( find_in_kind_buckets ( d, defer_func, FALSE ) != NULL ) {
+		return TRUE;
+	}
+
+	Pthread_mutex_lock ( &l->mp );
+	ret = park_deferred_msgs ( l, d, defer_func );
+	Pthread_mutex_unlock ( &l->mp );
+
+	return ret;
+}
+
+/****************************************************************/
+
+/* Messages that some processor may be spinning on: they are worth
+ * stopping the guest for. */
+bool_t
+MsgKind_is_latency_critical ( msg_kind_t kind )
+{
+	switch ( kind ) {
+	case MSG_KIND_IPI:
+	case MSG_KIND_MEM_IMAGE_REQUEST:
+	case MSG_KIND_PAGE_FETCH_REQUEST:
+	case MSG_KIND_PAGE_INVALIDATE_REQUEST:
+	case MSG_KIND_PAGE_FETCH_ACK_ACK:
+	case MSG_KIND_PAGE_DIFF:
+	case MSG_KIND_PAGE_MODE_CHANGE:
+	case MSG_KIND_REMOTE_ATOMIC:
+	case MSG_KIND_INPUT_PORT:
+	case MSG_KIND_OUTPUT_PORT:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+/****************************************************************/
+
+/* A bounded multi-producer single-consumer ring of messages.  Each
+ * slot carries a sequence number: a slot at position <pos> is free
+ * for the producer when seq == pos, and holds a message for the
+ * consumer when seq == pos + 1.
+ *
+ * MsgRing_push () never waits for the consumer: when the ring is full,
+ * the message goes to an overflow list instead, and so do the messages
+ * pushed after it until the consumer has taken them all.  The consumer
+ * takes the messages of the ring first, as they were pushed before
+ * the overflow began. */
+
+struct msg_ring_slot_t {
+	volatile unsigned long	seq;
+	struct msg_t		*msg;
+};
+
+struct msg_ring_t {
+	struct msg_ring_slot_t	*slots;
+	unsigned long		mask;
+	volatile unsigned long	tail;	/* advanced by the producers */
+	unsigned long		head;	/* owned by the consumer */
+	struct msg_list_t	*overflow; /* messages pushed while the ring was full */
+	volatile int		nr_overflow;
+};
+
+struct msg_ring_t *
+MsgRing_create ( size_t size )
+{
+	struct msg_ring_t *r;
+	size_t i;
+
+	ASSERT ( ( size > 0 ) && ( ( size & ( size - 1 ) ) == 0 ) );
+
+	r = Malloct ( struct msg_ring_t );
+	r->slots = Calloct ( size, struct msg_ring_slot_t );
+	r->mask = size - 1;
+	r->tail = 0;
+	r->head = 0;
+	r->overflow = MsgList_create ( );
+	r->nr_overflow = 0;
+
+	for ( i = 0; i < size; i++ ) {
+		r->slots[i].seq = i;
+		r->slots[i].msg = NULL;
+	}
+
+	return r;
+}
+
+/* Return FALSE if the ring is full.  May be called by any thread. */
+bool_t
+MsgRing_try_push ( struct msg_ring_t *r, struct msg_t *msg )
+{
+	struct msg_ring_slot_t *slot;
+	unsigned long pos;
+
+	ASSERT ( r != NULL );
+	ASSERT ( msg != NULL );
+
+	for ( ; ; ) {
+		long d;
+
+		pos = r->tail;
+		slot = &r->slots[pos & r->mask];
+		d = ( long ) ( slot->seq - pos );
+
+		if ( d < 0 ) {
+			/* The consumer has not released the slot yet. */
+			return FALSE;
+		}
+
+		if ( ( d == 0 ) && 
+		     ( __sync_bool_compare_and_swap ( &r->tail, pos, pos + 1 ) ) ) {
+			break;
+		}
+	}
+
+	slot->msg = msg;
+	__sync_synchronize ( );
+	slot->seq = pos + 1;
+
+	return TRUE;
+}
+
+/* Push <msg> without blocking.  Return FALSE if it went to the
+ * overflow list.  May be called by any thread, and the messages of each
+ * thread are popped in the order it pushed them.  Do not mix it with
+ * MsgRing_try_push () on the same ring. */
+bool_t
+MsgRing_push ( struct msg_ring_t *r, struct msg_t *msg )
+{
+	ASSERT ( r != NULL );
+	ASSERT ( msg != NULL );
+
+	if ( ( r->nr_overflow == 0 ) && ( MsgRing_try_push ( r, msg ) ) ) {
+		return TRUE;
+	}
+
+	MsgList_add ( r->overflow, msg );
+	__sync_fetch_and_add ( &r->nr_overflow, 1 );
+	return FALSE;
+}
+
+static struct msg_t *
+pop_slot ( struct msg_ring_t *r )
+{
+	struct msg_ring_slot_t *slot;
+	struct msg_t *msg;
+
+	slot = &r->slots[r->head & r->mask];
+	if ( slot->seq != r->head + 1 ) {
+		return NULL;
+	}
+	__sync_synchronize ( );
+
+	msg = slot->msg;
+	slot->msg = NULL;
+	__sync_synchronize ( );
+	slot->seq = r->head + r->mask + 1;
+	r->head++;
+
+	return msg;
+}
+
+/* Return NULL if the ring is empty.  Only the consumer may call this. */
+struct msg_t *
+MsgRing_try_pop ( struct msg_ring_t *r )
+{
+	struct msg_t *msg;
+
+	ASSERT ( r != NULL );
+
+	msg = pop_slot ( r );
+	if ( ( msg != NULL ) || ( r->nr_overflow == 0 ) ) {
+		return msg;
+	}
+	__sync_synchronize ( );
+
+	/* A producer completes its pushes to the ring before it adds to
+	 * the overflow list, so that the ring is drained first.  A slot
+	 * may have been claimed but not yet filled by another producer,
+	 * and a message of the overflow list may be newer than the one
+	 * that producer pushed before; wait for the slot in that case. */
+	msg = pop_slot ( r );
+	if ( ( msg != NULL ) || ( r->tail != r->head ) ) {
+		return msg;
+	}
+
+	msg = MsgList_try_remove ( r->overflow );
+	assert ( msg != NULL );
+	__sync_fetch_and_sub ( &r->nr_overflow, 1 );
+
+	return msg;
+}
+
+void
+MsgRing_destroy ( struct msg_ring_t *r )
+{
+	struct msg_t *msg;
+
+	ASSERT ( r != NULL );
+
+	while ( ( msg = MsgRing_try_pop ( r ) ) != NULL ) {
+		Msg_destroy ( msg );
+	}
+	MsgList_destroy ( r->overflow );
+	Free ( r->slots );
+	Free ( r );
+}
+
+bool_t
+MsgRing_is_empty ( struct msg_ring_t *r )
+{
+	ASSERT ( r != NULL );
+
+	return ( ( r->slots[r->head & r->mask].seq != r->head + 1 ) && ( r->nr_overflow == 0 ) );
+}
+
+/* Return TRUE if the ring holds a message that satisfies <judge_func>
+ * without removing it.  Only the consumer may call this. */
+bool_t
+MsgRing_exists ( struct msg_ring_t *r, bool_t (*judge_func) ( struct msg_t * ) )
+{
+	unsigned long pos;
+
+	ASSERT ( r != NULL );
+	ASSERT ( judge_func != NULL );
+
+	for ( pos = r->head; ; pos++ ) {
+		struct msg_ring_slot_t *slot = &r->slots[pos & r->mask];
+
+		if ( slot->seq != pos + 1 ) {
+			break;
+		}
+		__sync_synchronize ( );
+
+		if ( (*judge_func) ( slot->msg ) ) {
+			return TRUE;
+		}
+	}
+
+	if ( r->nr_overflow > 0 ) {
+		bool_t ret;
+
+		Pthread_mutex_lock ( &r->overflow->mp );
+		ret = exists_recvable_msgs ( r->overflow, judge_func );
+		Pthread_mutex_unlock ( &r->overflow->mp );
+		return ret;
+	}
+
+	return FALSE;
+}
+
+/****************************************************************/
+
+/* A single-producer single-consumer ring of bytes, laid out in a
+ * shared-memory pipe between two nodes.  <head> and <tail> count the
+ * bytes read and written so far; the writer only advances <tail>, and
+ * the reader only advances <head>. */
+
+size_t
+ShmRing_sizeof ( size_t size )
+{
+	return sizeof ( struct shm_ring_t ) + size;
+}
+
+void
+ShmRing_init ( struct shm_ring_t *r, size_t size )
+{
+	ASSERT ( r != NULL );
+	ASSERT ( ( size > 0 ) && ( ( size & ( size - 1 ) ) == 0 ) );
+
+	r->head = 0;
+	r->tail = 0;
+	r->waiting = 0;
+	r->writer_waiting = 0;
+	r->mask = size - 1;
+}
+
+bool_t
+ShmRing_is_empty ( struct shm_ring_t *r )
+{
+	return ( r->head == r->tail );
+}
+
+bool_t
+ShmRing_is_full ( struct shm_ring_t *r )
+{
+	return ( r->tail - r->head > r->mask );
+}
+
+/* Write as many bytes of <buf> as the ring has room for, and return
+ * the number of them.  Only the writer may call this. */
+size_t
+ShmRing_write ( struct shm_ring_t *r, const bit8u_t *buf, size_t len )
+{
+	const size_t size = r->mask + 1;
+	const unsigned long tail = r->tail;
+	const size_t off = tail & r->mask;
+	size_t n, first;
+
+	n = size - ( tail - r->head );
+	if ( n > len ) {
+		n = len;
+	}
+	__sync_synchronize ( );
+	first = ( n < size - off ) ? n : size - off;
+
+	if ( first > 0 ) {
+		Mmove ( &r->data[off], buf, first );
+	}
+	if ( n > first ) {
+		Mmove ( &r->data[0], buf + first, n - first );
+	}
+
+	__sync_synchronize ( );
+	r->tail = tail + n;
+
+	return n;
+}
+
+/* Read at most <len> bytes into <buf>, and return the number of them.
+ * Only the reader may call this. */
+size_t
+ShmRing_read ( struct shm_ring_t *r, bit8u_t *buf, size_t len )
+{
+	const size_t size = r->mask + 1;
+	const unsigned long head = r->head;
+	const size_t off = head & r->mask;
+	size_t n, first;
+
+	n = r->tail - head;
+	if ( n > len ) {
+		n = len;
+	}
+	__sync_synchronize ( );
+	first = ( n < size - off ) ? n : size - off;
+
+	if ( first > 0 ) {
+		Mmove ( buf, &r->data[off], first );
+	}
+	if ( n > first ) {
+		Mmove ( buf + first, &r->data[0], n - first );
+	}
+
+	__sync_synchronize ( );
+	r->head = head + n;
+
+	return n;
+}
@@ -8,11 +8,21 @@ struct msg_t *Msg_create(msg_kind_t kind, size_t len, void *body);
 struct msg_t *Msg_dup ( struct msg_t *msg );
 struct msg_t *Msg_create2(struct msg_hdr_t hdr, void *body);
 struct msg_t *Msg_create3(msg_kind_t kind, ...);
+struct msg_t *Msg_alloc ( msg_kind_t kind, size_t len );
+struct msg_t *Msg_create_ipi ( const struct interrupt_command_t *ic );
+struct msg_t *Msg_create_fetch_ack_ack ( int page_no, mem_access_kind_t kind, int src_id, long long seq );
+struct msg_t *Msg_create_page_home_migrate ( int page_no, int home_id, int epoch, long long seq );
+struct msg_t *Msg_create_input_port ( int addr, size_t len );
+struct msg_t *Msg_create_input_port_ack ( int addr, int val, size_t len, int irq );
+struct msg_t *Msg_create_output_port ( int addr, int val, size_t len );
+struct msg_t *Msg_create_output_port_ack ( int addr, size_t len, int irq );
 void          Msg_destroy(struct msg_t *x);
 void          Msg_print(FILE *stream, struct msg_t *x);
 void          MSG_DPRINT(struct msg_t *x);
 void          Msg_send(struct msg_t *msg, int fd);
 struct msg_t *Msg_recv(int fd, int src_id);
+int           Msg_gather ( struct msg_hdr_t *hdr, struct iovec *iov, int iovcnt );
+void          Msg_sendv ( struct msg_hdr_t *hdr, struct iovec *iov, int iovcnt, int fd );
 
 struct msg_init_t               *Msg_to_msg_init(struct msg_t *msg);
 struct msg_apic_logical_id_t    *Msg_to_msg_apic_logical_id(struct msg_t *msg);
@@ -22,6 +32,11 @@ struct msg_page_fetch_ack_t     *Msg_to_msg_page_fetch_ack(struct msg_t *msg);
 struct msg_page_invalidate_request_t *Msg_to_msg_page_invalidate_request(struct msg_t *msg);
 struct msg_page_fetch_ack_ack_t *Msg_to_msg_page_fetch_ack_ack(struct msg_t *msg);
 struct msg_page_seq_update_t *Msg_to_msg_page_seq_update(struct msg_t *msg);
+struct msg_page_diff_t *Msg_to_msg_page_diff ( struct msg_t *msg );
+struct msg_page_mode_change_t *Msg_to_msg_page_mode_change ( struct msg_t *msg );
+struct msg_page_home_migrate_t *Msg_to_msg_page_home_migrate ( struct msg_t *msg );
+struct msg_remote_atomic_t *Msg_to_msg_remote_atomic ( struct msg_t *msg );
+struct msg_remote_atomic_ack_t *Msg_to_msg_remote_atomic_ack ( struct msg_t *msg );
 struct msg_input_port_t *Msg_to_msg_input_port ( struct msg_t *msg );
 struct msg_input_port_ack_t *Msg_to_msg_input_port_ack ( struct msg_t *msg );
 struct msg_output_port_t *Msg_to_msg_output_port ( struct msg_t *msg );
@@ -44,4 +59,33 @@ void               MsgList_wait ( struct msg_list_t *l, bool_t (*judge_func) ( s
 void               MsgList_pack ( struct msg_list_t *l, int fd );
 void               MsgList_unpack ( struct msg_list_t *l, int fd );
 
+struct msg_defer_index_t;
+
+struct msg_defer_index_t *MsgDeferIndex_create ( void );
+void                      MsgDeferIndex_destroy ( struct msg_defer_index_t *d );
+void                      MsgDeferIndex_add ( struct msg_defer_index_t *d, struct msg_t *msg, int key );
+void                      MsgDeferIndex_release ( struct msg_defer_index_t *d, struct msg_list_t *l, int key );
+void                      MsgDeferIndex_release_all ( struct msg_defer_index_t *d, struct msg_list_t *l );
+struct msg_t *            MsgList_try_remove3 ( struct msg_list_t *l, struct msg_defer_index_t *d, int (*defer_func) ( struct msg_t * ) );
+bool_t                    MsgList_exists3 ( struct msg_list_t *l, struct msg_defer_index_t *d, int (*defer_func) ( struct msg_t * ) );
+
+bool_t MsgKind_is_latency_critical ( msg_kind_t kind );
+
+struct msg_ring_t;
+
+struct msg_ring_t *MsgRing_create ( size_t size );
+void               MsgRing_destroy ( struct msg_ring_t *r );
+bool_t             MsgRing_try_push ( struct msg_ring_t *r, struct msg_t *msg );
+bool_t             MsgRing_push ( struct msg_ring_t *r, struct msg_t *msg );
+struct msg_t *     MsgRing_try_pop ( struct msg_ring_t *r );
+bool_t             MsgRing_is_empty ( struct msg_ring_t *r );
+bool_t             MsgRing_exists ( struct msg_ring_t *r, bool_t (*judge_func) ( struct msg_t * ) );
+
+size_t ShmRing_sizeof ( size_t size );
+void   ShmRing_init ( struct shm_ring_t *r, size_t size );
+bool_t ShmRing_is_empty ( struct shm_ring_t *r );
+bool_t ShmRing_is_full ( struct shm_ring_t *r );
+size_t ShmRing_write ( struct shm_ring_t *r, const bit8u_t *buf, size_t len );
+size_t ShmRing_read ( struct shm_ring_t *r, bit8u_t *buf, size_t len );
+
 #endif /* _VMM_COMM_MSG_H */
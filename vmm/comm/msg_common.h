@@ -27,7 +27,27 @@ enum msg_kind {
 	MSG_KIND_STAT_REQUEST_ACK,
 
 	MSG_KIND_SHUTDOWN,
+
+	/* [Note] Add new kinds here so that the values of the others,
+	 * which go on the wire, stay the same. */
+	MSG_KIND_PAGE_PREFETCH_REJECT,	/* page numbers of the prefetches a manager dropped */
+	MSG_KIND_PAGE_DIFF,
+	MSG_KIND_PAGE_DIFF_ACK,
+	MSG_KIND_PAGE_MODE_CHANGE,
+	MSG_KIND_REMOTE_ATOMIC,
+	MSG_KIND_REMOTE_ATOMIC_ACK,
+	MSG_KIND_IMMUTABLE_PAGES,	/* bitmap of the pages granted with the memory image */
+	MSG_KIND_PAGE_HOME_MIGRATE,
+
+	NR_MSG_KINDS
+};
+
+/* Keys of the deferred messages other than page numbers */
+enum {
+	MSG_DEFER_NONE = -1,	/* can be handled now */
+	MSG_DEFER_BY_KIND = -2	/* waits for a state other than that of a page */
 };
+
 typedef enum msg_kind	msg_kind_t;
 
 const char *MsgKind_to_string(msg_kind_t x);
@@ -44,8 +64,14 @@ struct msg_t {
 	void 			*body; // union $B$NJ}$,<+A3!)(B
 };
 
+enum {
+	MAX_SHM_NAME_LEN = 64
+};
+
 struct msg_init_t {
 	int			cpuid;
+	char			shm_name[MAX_SHM_NAME_LEN];	/* the shared-memory pipe of the connection,
+								 * or "" if it goes through the socket */
 };
 
 struct msg_apic_logical_id_t {
@@ -57,17 +83,38 @@ struct msg_ipi_t {
 	struct interrupt_command_t ic;
 };
 
+/* The bodies of PAGE_FETCH_REQUEST, PAGE_INVALIDATE_REQUEST and
+ * PAGE_FETCH_ACK may hold several entries back to back: the entries
+ * that follow the first one are pages prefetched together with it.
+ * Each entry of PAGE_FETCH_ACK is followed by <data_len> bytes of the
+ * page image encoded as <encoding>. */
+enum page_encoding {
+	PAGE_ENCODING_NONE,	/* no data (the ownership only) */
+	PAGE_ENCODING_RAW,	/* the page image */
+	PAGE_ENCODING_ZERO,	/* no data (the page is filled with zeros) */
+	PAGE_ENCODING_DELTA	/* runs of the page image XORed with the version <base_seq> */
+};
+typedef enum page_encoding		page_encoding_t;
+
 struct msg_page_fetch_request_t {
 	int			page_no;
 	mem_access_kind_t	kind;
 	int			src_id;
+	bool_t			is_prefetch; /* the manager may drop this page */
+	bool_t			no_data; /* the requestor overwrites the whole page */
+	long long		base_seq; /* the version the requestor keeps, or -1 */
+	int			hops;	/* # of messages so far (for statistics) */
 };
 
 struct msg_page_fetch_ack_t {
 	int			page_no;
 	mem_access_kind_t	kind;
-	bit8u_t 		data[PAGE_SIZE_4K];
 	long long		seq;
+	int			hops;
+	page_encoding_t		encoding;
+	long long		base_seq; /* for PAGE_ENCODING_DELTA */
+	int			data_len;
+	bit8u_t 		data[0];
 };
 
 struct msg_page_fetch_ack_ack_t {
@@ -82,6 +129,77 @@ struct msg_page_invalidate_request_t {
 	mem_access_kind_t	kind;
 	int			src_id;
 	long long		seq;
+	bool_t			no_data;
+	long long		base_seq;
+	int			hops;
+};
+
+/* The body of PAGE_DIFF is a sequence of page diffs.  Each one is a
+ * msg_page_diff_t followed by <len> bytes of runs, and each run is a
+ * msg_page_diff_run_t followed by the <len> modified bytes. */
+struct msg_page_diff_t {
+	int			page_no;
+	int			len;
+};
+
+struct msg_page_diff_run_t {
+	bit16u_t		offset;
+	bit16u_t		len;
+};
+
+enum page_mode_phase {
+	PAGE_MODE_REQUEST,	/* any node --> BSP */
+	PAGE_MODE_PREPARE,	/* BSP --> all */
+	PAGE_MODE_PREPARE_ACK,	/* all --> BSP */
+	PAGE_MODE_COMMIT	/* BSP --> all */
+};
+typedef enum page_mode_phase	page_mode_phase_t;
+
+struct msg_page_mode_change_t {
+	page_mode_phase_t	phase;
+	int			from_page_no;
+	int			to_page_no;
+	bool_t			is_multiple_writer;
+	int			src_id;	/* the node that requested the change */
+};
+
+/* Sent by the home of a page to the node it hands the page over to, and
+ * then by the new home to the other nodes. */
+struct msg_page_home_migrate_t {
+	int			page_no;
+	int			home_id;	/* the new home */
+	int			epoch;		/* # of the handoffs of the page */
+	long long		seq;
+};
+
+/* A LOCK-prefixed read-modify-write on a page owned by another node may
+ * be shipped to the owner and executed there on its copy. */
+enum atomic_op {
+	ATOMIC_OP_XCHG,
+	ATOMIC_OP_CMPXCHG,
+	ATOMIC_OP_XADD,
+	ATOMIC_OP_ADD,
+	ATOMIC_OP_OR,
+	ATOMIC_OP_AND,
+	ATOMIC_OP_INC,
+	ATOMIC_OP_DEC,
+	ATOMIC_OP_BTS,
+	ATOMIC_OP_BTR
+};
+typedef enum atomic_op	atomic_op_t;
+
+struct msg_remote_atomic_t {
+	atomic_op_t		op;
+	int			page_no;
+	bit32u_t		offset;	/* offset of the operand in the page */
+	size_t			len;	/* 1, 2 or 4 */
+	bit32u_t		src;	/* source operand (bit number for BTS/BTR) */
+	bit32u_t		cmp;	/* accumulator (CMPXCHG only) */
+};
+
+struct msg_remote_atomic_ack_t {
+	bool_t			is_done; /* FALSE if the destination was not the owner */
+	bit32u_t		old_val;
 };
 
 struct msg_input_port_t {
@@ -116,4 +234,14 @@ struct msg_stat_request_ack_t {
 	bool_t			start_flag;
 };
 
+/* A byte ring of a shared-memory pipe */
+struct shm_ring_t {
+	volatile unsigned long	head;		/* bytes read; advanced by the reader */
+	volatile unsigned long	tail;		/* bytes written; advanced by the writer */
+	volatile int		waiting;	/* the reader waits for the doorbell */
+	volatile int		writer_waiting;	/* the writer waits for room */
+	unsigned long		mask;		/* the size of <data> - 1 */
+	bit8u_t			data[0];
+};
+
 #endif /* _VMM_COMM_MSG_COMMON_H */
@@ -0,0 +1,242 @@
+/* Microbenchmark of the page transfer: the round trip of a FETCH_ACK
+ * of 1 to 16 pages and of its FETCH_ACK_ACK over a loopback TCP
+ * connection, for the three ways of sending the FETCH_ACK:
+ *
+ *   copy+send	the pages are copied into the message, and the header
+ *		and the body go in two send calls (the former Msg_send)
+ *   copy+writev	the pages are copied into the message, and the message
+ *		goes in a single writev (Msg_send)
+ *   gather	the acks and the pages are gathered by Msg_sendv without
+ *		being copied (Comm_sendv)
+ *
+ * Usage: msg_page_bench [nr_iterations] */
+
+#include "vmm/comm.h"
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+enum {
+	MAX_PAGES_PER_MSG = 16,
+	NR_PAGES = 256,		/* the pages sent in turn */
+	DEFAULT_NR_ITERATIONS = 10000
+};
+
+enum bench_kind {
+	BENCH_COPY_SEND = 0,
+	BENCH_COPY_WRITEV,
+	BENCH_GATHER,
+	NR_BENCH_KINDS
+};
+typedef enum bench_kind	bench_kind_t;
+
+static const char *bench_names[NR_BENCH_KINDS] = { "copy+send", "copy+writev", "gather" };
+
+static bit8u_t *pmem;
+static struct msg_page_fetch_ack_t acks[MAX_PAGES_PER_MSG];
+
+static void
+connect_loopback ( int *sfd, int *rfd )
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof ( sin );
+	int lfd;
+
+	lfd = Socket ( AF_INET, SOCK_STREAM, 0 );
+	sin = Inet_sockaddr_create ( htonl ( INADDR_LOOPBACK ), 0 );
+	Bind ( lfd, ( struct sockaddr * )&sin, sizeof ( sin ) );
+	Listen ( lfd, 1 );
+	if ( getsockname ( lfd, ( struct sockaddr * )&sin, &len ) != 0 ) {
+		Sys_failure ( "getsockname" );
+	}
+
+	*sfd = Socket ( AF_INET, SOCK_STREAM, 0 );
+	Connect ( *sfd, ( struct sockaddr * )&sin, sizeof ( sin ) );
+	*rfd = Accept ( lfd, NULL, NULL );
+	Close ( lfd );
+
+	Setsockopt_nodelay ( *sfd );
+	Setsockopt_nodelay ( *rfd );
+}
+
+/* The requestor: receive a FETCH_ACK, check it, and answer with a
+ * FETCH_ACK_ACK, until a SHUTDOWN arrives. */
+static void *
+recv_main ( void *arg )
+{
+	int fd = * ( int * ) arg;
+
+	for ( ; ; ) {
+		struct msg_t *msg, *reply;
+		struct msg_page_fetch_ack_t *x;
+		int nr_pages;
+
+		msg = Msg_recv ( fd, 0 );
+		if ( msg->hdr.kind == MSG_KIND_SHUTDOWN ) {
+			Msg_destroy ( msg );
+			break;
+		}
+
+		x = Msg_to_msg_page_fetch_ack ( msg );
+		nr_pages = msg->hdr.len / ( sizeof ( struct msg_page_fetch_ack_t ) + PAGE_SIZE_4K );
+		if ( ( nr_pages < 1 ) ||
+		     ( msg->hdr.len != nr_pages * ( sizeof ( struct msg_page_fetch_ack_t ) + PAGE_SIZE_4K ) ) ||
+		     ( x->data_len != PAGE_SIZE_4K ) ||
+		     ( x->data[PAGE_SIZE_4K - 1] != ( bit8u_t ) x->page_no ) ) {
+			Fatal_failure ( "msg_page_bench: a broken FETCH_ACK (len=%#x)\n", msg->hdr.len );
+		}
+
+		reply = Msg_create_fetch_ack_ack ( x->page_no, x->kind, 0, x->seq );
+		Msg_send ( reply, fd );
+		Msg_destroy ( reply );
+		Msg_destroy ( msg );
+	}
+
+	return NULL;
+}
+
+static void
+set_acks ( int first_page, int nr_pages, long long seq )
+{
+	int i;
+
+	for ( i = 0; i < nr_pages; i++ ) {
+		struct msg_page_fetch_ack_t *x = &acks[i];
+
+		x->page_no = ( first_page + i ) % NR_PAGES;
+		x->kind = MEM_ACCESS_READ;
+		x->seq = seq;
+		x->hops = 0;
+		x->encoding = PAGE_ENCODING_RAW;
+		x->base_seq = -1LL;
+		x->data_len = PAGE_SIZE_4K;
+	}
+}
+
+/* The FETCH_ACK of <nr_pages> pages with the pages copied after the
+ * acks, as the former Msg_create3 () made it */
+static struct msg_t *
+create_copied_msg ( int nr_pages )
+{
+	const size_t LEN = sizeof ( struct msg_page_fetch_ack_t ) + PAGE_SIZE_4K;
+	struct msg_t *msg;
+	int i;
+
+	msg = Msg_alloc ( MSG_KIND_PAGE_FETCH_ACK, nr_pages * LEN );
+	for ( i = 0; i < nr_pages; i++ ) {
+		bit8u_t *p = ( bit8u_t * ) msg->body + i * LEN;
+
+		Mmove ( p, &acks[i], sizeof ( struct msg_page_fetch_ack_t ) );
+		Mmove ( p + sizeof ( struct msg_page_fetch_ack_t ),
+			pmem + acks[i].page_no * PAGE_SIZE_4K, PAGE_SIZE_4K );
+	}
+	return msg;
+}
+
+static void
+send_fetch_ack ( bench_kind_t kind, int nr_pages, int fd )
+{
+	struct iovec iov[2 * MAX_PAGES_PER_MSG + 1];
+	struct msg_hdr_t hdr;
+	struct msg_t *msg;
+	int i;
+
+	switch ( kind ) {
+	case BENCH_COPY_SEND:
+		msg = create_copied_msg ( nr_pages );
+		Sendn ( fd, &msg->hdr, sizeof ( struct msg_hdr_t ), 0 );
+		Sendn ( fd, msg->body, msg->hdr.len, 0 );
+		Msg_destroy ( msg );
+		break;
+	case BENCH_COPY_WRITEV:
+		msg = create_copied_msg ( nr_pages );
+		Msg_send ( msg, fd );
+		Msg_destroy ( msg );
+		break;
+	case BENCH_GATHER:
+		for ( i = 0; i < nr_pages; i++ ) {
+			iov[2 * i].iov_base = &acks[i];
+			iov[2 * i].iov_len = sizeof ( struct msg_page_fetch_ack_t );
+			iov[2 * i + 1].iov_base = pmem + acks[i].page_no * PAGE_SIZE_4K;
+			iov[2 * i + 1].iov_len = PAGE_SIZE_4K;
+		}
+		Mzero ( &hdr, sizeof ( hdr ) );
+		hdr.kind = MSG_KIND_PAGE_FETCH_ACK;
+		Msg_sendv ( &hdr, iov, 2 * nr_pages, fd );
+		break;
+	default:
+		Match_failure ( "send_fetch_ack\n" );
+	}
+}
+
+/* Return the time of a round trip in micro seconds */
+static double
+bench ( bench_kind_t kind, int nr_pages, int n, int fd )
+{
+	struct timespec start;
+	int i;
+
+	start = Timespec_current ( );
+	for ( i = 0; i < n; i++ ) {
+		struct msg_t *reply;
+
+		set_acks ( i * nr_pages, nr_pages, ( long long ) i );
+		send_fetch_ack ( kind, nr_pages, fd );
+
+		reply = Msg_recv ( fd, 0 );
+		if ( ( reply->hdr.kind != MSG_KIND_PAGE_FETCH_ACK_ACK ) ||
+		     ( Msg_to_msg_page_fetch_ack_ack ( reply )->seq != ( long long ) i ) ) {
+			Fatal_failure ( "msg_page_bench: a broken FETCH_ACK_ACK\n" );
+		}
+		Msg_destroy ( reply );
+	}
+	return Timespec_elapsed ( start ) * 1000000.0 / n;
+}
+
+int
+main ( int argc, char *argv[] )
+{
+	int nr_iterations = DEFAULT_NR_ITERATIONS;
+	int sfd, rfd, nr_pages, i;
+	pthread_t tid;
+	struct msg_t *msg;
+
+	if ( argc > 1 ) {
+		nr_iterations = atoi ( argv[1] );
+	}
+
+	/* The receiver checks the bytes of a page against its number. */
+	pmem = Malloc ( NR_PAGES * PAGE_SIZE_4K );
+	for ( i = 0; i < NR_PAGES; i++ ) {
+		Memset ( pmem + i * PAGE_SIZE_4K, i, PAGE_SIZE_4K );
+	}
+
+	connect_loopback ( &sfd, &rfd );
+	Pthread_create ( &tid, NULL, &recv_main, &rfd );
+
+	Print ( stdout, "%8s %12s %12s %12s  (usec per round trip)\n",
+		"pages", bench_names[BENCH_COPY_SEND], bench_names[BENCH_COPY_WRITEV],
+		bench_names[BENCH_GATHER] );
+
+	for ( nr_pages = 1; nr_pages <= MAX_PAGES_PER_MSG; nr_pages *= 4 ) {
+		double t[NR_BENCH_KINDS];
+		int k;
+
+		for ( k = 0; k < NR_BENCH_KINDS; k++ ) {
+			t[k] = bench ( ( bench_kind_t ) k, nr_pages, nr_iterations, sfd );
+		}
+
+		Print ( stdout, "%8d %12.2f %12.2f %12.2f\n",
+			nr_pages, t[BENCH_COPY_SEND], t[BENCH_COPY_WRITEV], t[BENCH_GATHER] );
+	}
+
+	msg = Msg_create ( MSG_KIND_SHUTDOWN, 0, NULL );
+	Msg_send ( msg, sfd );
+	Msg_destroy ( msg );
+	Pthread_join ( tid, NULL );
+
+	Close ( sfd );
+	Close ( rfd );
+	Free ( pmem );
+
+	return 0;
+}
@@ -0,0 +1,209 @@
+/* Test of the message pools: a producer thread allocates messages with
+ * bodies of all the size classes and hands them to the consumer thread
+ * through a message list, and the consumer checks and destroys them.
+ * The blocks of the messages and of the list elements are therefore
+ * allocated on one thread and freed on the other, and go back through
+ * the depots.
+ *
+ * Each round hands over more messages of each class than a depot keeps,
+ * once while the consumer destroys them as they come, and once after
+ * the producer has handed them all over, so that the depots fill up and
+ * the blocks beyond them are freed.  The two threads swap their roles
+ * every round.  The bodies larger than a page are malloc'd, and only
+ * their headers come from the pools.
+ *
+ * Usage: msg_pool_test [nr_rounds] [nr_msgs_per_class] */
+
+#include "vmm/comm.h"
+
+enum {
+	DEFAULT_NR_ROUNDS = 8,
+	DEFAULT_NR_MSGS = 3 * 1024,	/* 3 times MSG_POOL_DEPOT_MAX of msg.c */
+	PAGE_BODY = sizeof ( struct msg_page_fetch_ack_t ) + PAGE_SIZE_4K,
+	MAX_LARGE_EXTRA = 2 * PAGE_SIZE_4K
+};
+
+/* The classes of the bodies, in the order of the messages */
+enum body_class {
+	BODY_NONE,
+	BODY_SMALL,	/* up to 256 bytes, in the block */
+	BODY_PAGE,	/* up to a fetch ack with its page, in the block */
+	BODY_LARGE,	/* malloc'd */
+	NR_BODY_CLASSES
+};
+
+enum test_mode {
+	MODE_STREAM,	/* the consumer destroys the messages as they come */
+	MODE_STALLED	/* the consumer waits until all have been handed over */
+};
+
+struct worker_t {
+	pthread_t		thread;
+	int			id;
+};
+
+static struct worker_t workers[2];
+static struct msg_list_t *msgs;
+static pthread_barrier_t barrier;
+static int nr_rounds = DEFAULT_NR_ROUNDS;
+static long nr_msgs = DEFAULT_NR_MSGS;
+
+static size_t
+body_len ( long seq )
+{
+	const unsigned long r = ( ( unsigned long ) seq * 2654435761UL ) >> 7;
+
+	switch ( seq % NR_BODY_CLASSES ) {
+	case BODY_NONE:		return 0;
+	case BODY_SMALL:	return 1 + r % 256;
+	case BODY_PAGE:		return 257 + r % ( PAGE_BODY - 256 );
+	case BODY_LARGE:	return PAGE_BODY + 1 + r % MAX_LARGE_EXTRA;
+	default:		Match_failure ( "body_len\n" );
+	}
+	return 0;
+}
+
+/* The byte at <i> of the body of the message <seq> */
+static bit8u_t
+byte_at ( long seq, size_t i )
+{
+	return ( bit8u_t ) ( ( seq * 7 + i ) % 251 );
+}
+
+static void
+produce ( void )
+{
+	long seq;
+
+	for ( seq = 0; seq < nr_msgs * NR_BODY_CLASSES; seq++ ) {
+		const size_t len = body_len ( seq );
+		struct msg_t *msg;
+		bit8u_t *p;
+		size_t i;
+
+		msg = Msg_alloc ( MSG_KIND_PAGE_DIFF, len );
+		msg->hdr.msg_id = seq;
+		p = ( bit8u_t * ) msg->body;
+		for ( i = 0; i < len; i++ ) {
+			p[i] = byte_at ( seq, i );
+		}
+
+		MsgList_add ( msgs, msg );
+	}
+}
+
+static void
+check_msg ( struct msg_t *msg, long seq )
+{
+	const size_t len = body_len ( seq );
+	const bit8u_t *p = ( const bit8u_t * ) msg->body;
+	size_t i;
+
+	if ( ( msg->hdr.kind != MSG_KIND_PAGE_DIFF ) || ( msg->hdr.msg_id != seq ) || ( msg->hdr.len != len ) ) {
+		Fatal_failure ( "msg_pool_test: expected message %ld (%lu bytes), got %lld (%lu bytes)\n",
+				seq, ( unsigned long ) len, msg->hdr.msg_id, ( unsigned long ) msg->hdr.len );
+	}
+	if ( ( len == 0 ) != ( p == NULL ) ) {
+		Fatal_failure ( "msg_pool_test: message %ld: bad body\n", seq );
+	}
+
+	for ( i = 0; i < len; i++ ) {
+		if ( p[i] != byte_at ( seq, i ) ) {
+			Fatal_failure ( "msg_pool_test: message %ld: byte %lu is broken\n",
+					seq, ( unsigned long ) i );
+		}
+	}
+}
+
+static void
+consume ( void )
+{
+	long seq;
+
+	for ( seq = 0; seq < nr_msgs * NR_BODY_CLASSES; seq++ ) {
+		struct msg_t *msg;
+
+		msg = MsgList_remove ( msgs );
+		check_msg ( msg, seq );
+		Msg_destroy ( msg );
+	}
+
+	if ( MsgList_try_remove ( msgs ) != NULL ) {
+		Fatal_failure ( "msg_pool_test: messages left in the list\n" );
+	}
+}
+
+static void
+run_round ( struct worker_t *w, int round, enum test_mode mode )
+{
+	const bool_t is_producer = ( ( round % 2 ) == w->id );
+
+	if ( is_producer ) {
+		produce ( );
+	}
+
+	if ( mode == MODE_STALLED ) {
+		pthread_barrier_wait ( &barrier );
+	}
+
+	if ( ! is_producer ) {
+		consume ( );
+	}
+
+	pthread_barrier_wait ( &barrier );
+}
+
+static void *
+worker_main ( void *arg )
+{
+	struct worker_t *w = ( struct worker_t * ) arg;
+	int round;
+
+	for ( round = 0; round < nr_rounds; round++ ) {
+		run_round ( w, round, MODE_STREAM );
+		run_round ( w, round, MODE_STALLED );
+	}
+
+	return NULL;
+}
+
+int
+main ( int argc, char *argv[] )
+{
+	struct timespec start;
+	double t;
+	int i;
+
+	if ( argc > 1 ) {
+		nr_rounds = atoi ( argv[1] );
+	}
+	if ( argc > 2 ) {
+		nr_msgs = atol ( argv[2] );
+	}
+	if ( ( nr_rounds < 1 ) || ( nr_msgs < 1 ) ) {
+		Fatal_failure ( "msg_pool_test: nr_rounds and nr_msgs_per_class must be positive\n" );
+	}
+
+	msgs = MsgList_create ( );
+	pthread_barrier_init ( &barrier, NULL, 2 );
+
+	start = Timespec_current ( );
+
+	for ( i = 0; i < 2; i++ ) {
+		workers[i].id = i;
+		Pthread_create ( &workers[i].thread, NULL, &worker_main, &workers[i] );
+	}
+	for ( i = 0; i < 2; i++ ) {
+		Pthread_join ( workers[i].thread, NULL );
+	}
+
+	t = Timespec_elapsed ( start );
+
+	pthread_barrier_destroy ( &barrier );
+	MsgList_destroy ( msgs );
+
+	Print ( stdout, "msg_pool_test: %d rounds of %ld messages in %.3f sec\n",
+		nr_rounds, 2 * nr_msgs * NR_BODY_CLASSES, t );
+
+	return 0;
+}
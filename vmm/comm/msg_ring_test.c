@@ -0,0 +1,244 @@
+/* Stress test of MsgRing: producer threads push messages into a small
+ * ring as fast as they can while the consumer pops them and scans the
+ * ring with MsgRing_exists ().  Each message carries its producer and
+ * its number, and the consumer checks that the messages of each
+ * producer come out once and in order, and that none is left.
+ *
+ * The test runs three times: with MsgRing_try_push (), with
+ * MsgRing_push () while the consumer is stalled until all the
+ * producers have finished, so that most of the messages overflow, and
+ * with MsgRing_push () while the consumer runs, so that the ring may
+ * go in and out of the overflow.
+ *
+ * Usage: msg_ring_test [nr_producers] [nr_msgs_per_producer] [ring_size] */
+
+#include "vmm/comm.h"
+#include <sched.h>
+
+enum {
+	MAX_PRODUCERS = 32,
+	DEFAULT_NR_PRODUCERS = 4,
+	DEFAULT_NR_MSGS = 1000000,
+	DEFAULT_RING_SIZE = 64,
+	MAGIC = 0x52494e47	/* "RING" */
+};
+
+struct item_t {
+	int		magic;
+	int		producer_id;
+	long		no;
+};
+
+enum test_mode {
+	MODE_TRY_PUSH,		/* retry MsgRing_try_push () while the ring is full */
+	MODE_PUSH_STALLED,	/* MsgRing_push (); pop after the producers finish */
+	MODE_PUSH		/* MsgRing_push () */
+};
+
+struct producer_t {
+	pthread_t		thread;
+	int			id;
+	long			nr_msgs;
+	enum test_mode		mode;
+	struct msg_ring_t	*ring;
+	long			nr_full;	/* # of pushes that found the ring full */
+};
+
+static struct producer_t producers[MAX_PRODUCERS];
+
+/* Set by the main thread once all the producers have been created */
+static volatile bool_t is_started;
+
+static void *
+producer_main ( void *arg )
+{
+	struct producer_t *p = ( struct producer_t * ) arg;
+	long i;
+
+	while ( ! is_started ) {
+		sched_yield ( );
+	}
+
+	for ( i = 0; i < p->nr_msgs; i++ ) {
+		struct item_t item;
+		struct msg_t *msg;
+
+		item.magic = MAGIC;
+		item.producer_id = p->id;
+		item.no = i;
+		msg = Msg_create ( MSG_KIND_INVALID, sizeof ( item ), &item );
+
+		if ( p->mode != MODE_TRY_PUSH ) {
+			if ( ! MsgRing_push ( p->ring, msg ) ) {
+				p->nr_full++;
+			}
+			continue;
+		}
+
+		while ( ! MsgRing_try_push ( p->ring, msg ) ) {
+			/* Let the consumer run. */
+			p->nr_full++;
+			sched_yield ( );
+		}
+	}
+
+	return NULL;
+}
+
+static bool_t
+is_broken_msg ( struct msg_t *msg )
+{
+	const struct item_t *x = ( const struct item_t * ) msg->body;
+
+	return ( ( msg->hdr.len != sizeof ( struct item_t ) ) || ( x->magic != MAGIC ) );
+}
+
+static const char *
+mode_to_string ( enum test_mode mode )
+{
+	switch ( mode ) {
+	case MODE_TRY_PUSH:		return "try_push";
+	case MODE_PUSH_STALLED:		return "push, stalled consumer";
+	case MODE_PUSH:			return "push";
+	default:			Match_failure ( "mode_to_string\n" );
+	}
+	return "";
+}
+
+static void
+run_test ( enum test_mode mode, int nr_producers, long nr_msgs, size_t ring_size )
+{
+	long next_no[MAX_PRODUCERS];
+	long total, nr_recvd = 0, nr_empty = 0, nr_full = 0;
+	struct msg_ring_t *ring;
+	struct timespec start;
+	double t;
+	int i;
+
+	ring = MsgRing_create ( ring_size );
+	total = nr_producers * nr_msgs;
+	is_started = FALSE;
+
+	for ( i = 0; i < nr_producers; i++ ) {
+		struct producer_t *p = &producers[i];
+
+		p->id = i;
+		p->nr_msgs = nr_msgs;
+		p->mode = mode;
+		p->ring = ring;
+		p->nr_full = 0;
+		next_no[i] = 0;
+		Pthread_create ( &p->thread, NULL, &producer_main, p );
+	}
+
+	start = Timespec_current ( );
+	is_started = TRUE;
+
+	if ( mode == MODE_PUSH_STALLED ) {
+		/* The producers must not wait for the consumer. */
+		for ( i = 0; i < nr_producers; i++ ) {
+			Pthread_join ( producers[i].thread, NULL );
+		}
+		if ( MsgRing_exists ( ring, &is_broken_msg ) ) {
+			Fatal_failure ( "msg_ring_test: a broken message in the overflow\n" );
+		}
+	}
+
+	while ( nr_recvd < total ) {
+		const struct item_t *x;
+		struct msg_t *msg;
+
+		/* The producers may fill the slots behind the scan.  The
+		 * scan of the overflow list takes longer. */
+		if ( ( nr_recvd % ( ( mode == MODE_TRY_PUSH ) ? 64 : 65536 ) ) == 0 ) {
+			if ( MsgRing_exists ( ring, &is_broken_msg ) ) {
+				Fatal_failure ( "msg_ring_test: a broken message in the ring\n" );
+			}
+		}
+
+		msg = MsgRing_try_pop ( ring );
+		if ( msg == NULL ) {
+			if ( mode == MODE_PUSH_STALLED ) {
+				Fatal_failure ( "msg_ring_test: %ld of %ld messages\n", nr_recvd, total );
+			}
+			nr_empty++;
+			sched_yield ( );
+			continue;
+		}
+
+		if ( is_broken_msg ( msg ) ) {
+			Fatal_failure ( "msg_ring_test: a broken message (%ld)\n", nr_recvd );
+		}
+
+		x = ( const struct item_t * ) msg->body;
+		if ( ( x->producer_id < 0 ) || ( x->producer_id >= nr_producers ) ) {
+			Fatal_failure ( "msg_ring_test: bad producer %d\n", x->producer_id );
+		}
+		if ( x->no != next_no[x->producer_id] ) {
+			Fatal_failure ( "msg_ring_test: producer %d: expected %ld, got %ld\n",
+					x->producer_id, next_no[x->producer_id], x->no );
+		}
+		next_no[x->producer_id]++;
+		nr_recvd++;
+
+		Msg_destroy ( msg );
+	}
+
+	t = Timespec_elapsed ( start );
+
+	for ( i = 0; i < nr_producers; i++ ) {
+		if ( mode != MODE_PUSH_STALLED ) {
+			Pthread_join ( producers[i].thread, NULL );
+		}
+		nr_full += producers[i].nr_full;
+
+		if ( next_no[i] != nr_msgs ) {
+			Fatal_failure ( "msg_ring_test: producer %d: %ld of %ld messages\n",
+					i, next_no[i], nr_msgs );
+		}
+	}
+
+	if ( ( ! MsgRing_is_empty ( ring ) ) || ( MsgRing_try_pop ( ring ) != NULL ) ) {
+		Fatal_failure ( "msg_ring_test: messages left in the ring\n" );
+	}
+	if ( ( mode == MODE_PUSH_STALLED ) && ( nr_full != total - ( long ) ring_size ) ) {
+		Fatal_failure ( "msg_ring_test: %ld of %ld messages overflowed\n",
+				nr_full, total - ( long ) ring_size );
+	}
+	MsgRing_destroy ( ring );
+
+	Print ( stdout, "msg_ring_test (%s): %d producers, %ld messages in %.3f sec (%.0f msgs/sec)\n",
+		mode_to_string ( mode ), nr_producers, total, t, total / t );
+	Print ( stdout, "  ring size = %d, full = %ld, empty = %ld\n",
+		( int ) ring_size, nr_full, nr_empty );
+}
+
+int
+main ( int argc, char *argv[] )
+{
+	int nr_producers = DEFAULT_NR_PRODUCERS;
+	long nr_msgs = DEFAULT_NR_MSGS;
+	size_t ring_size = DEFAULT_RING_SIZE;
+
+	if ( argc > 1 ) {
+		nr_producers = atoi ( argv[1] );
+	}
+	if ( argc > 2 ) {
+		nr_msgs = atol ( argv[2] );
+	}
+	if ( argc > 3 ) {
+		ring_size = atoi ( argv[3] );
+	}
+	if ( ( nr_producers < 1 ) || ( nr_producers > MAX_PRODUCERS ) ) {
+		Fatal_failure ( "msg_ring_test: 1 <= nr_producers <= %d\n", MAX_PRODUCERS );
+	}
+	if ( ( ring_size == 0 ) || ( ( ring_size & ( ring_size - 1 ) ) != 0 ) ) {
+		Fatal_failure ( "msg_ring_test: ring_size must be a power of 2\n" );
+	}
+
+	run_test ( MODE_TRY_PUSH, nr_producers, nr_msgs, ring_size );
+	run_test ( MODE_PUSH_STALLED, nr_producers, ring_size * 16, ring_size );
+	run_test ( MODE_PUSH, nr_producers, nr_msgs / 4, ring_size );
+
+	return 0;
+}
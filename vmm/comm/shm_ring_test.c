@@ -0,0 +1,190 @@
+/* Stress test of ShmRing: a writer thread pushes a stream of bytes into
+ * a small ring in chunks of random lengths, up to a few times the size
+ * of the ring, while the reader pulls them out in chunks of other
+ * random lengths.  The writes are then often partial and the copies
+ * often wrap around the end of the ring.  The reader checks that the
+ * bytes come out once and in order, and that none is left.
+ *
+ * Usage: shm_ring_test [nr_bytes] [ring_size] */
+
+#include "vmm/comm.h"
+#include <sched.h>
+
+enum {
+	DEFAULT_NR_BYTES = 16 * 1024 * 1024,
+	DEFAULT_RING_SIZE = 64,
+	MAX_CHUNK_RATIO = 3	/* a chunk is at most 3 times the ring */
+};
+
+struct writer_t {
+	pthread_t		thread;
+	struct shm_ring_t	*ring;
+	long			nr_bytes;
+	size_t			max_chunk;
+	long			nr_partial;	/* # of writes that did not fit */
+	long			nr_wrapped;	/* # of writes that wrapped around */
+};
+
+/* Set by the main thread once the writer has been created */
+static volatile bool_t is_started = FALSE;
+
+/* The byte at <pos> of the stream; 251 is a prime, so that the pattern
+ * does not repeat at the size of the ring. */
+static bit8u_t
+byte_at ( long pos )
+{
+	return ( bit8u_t ) ( pos % 251 );
+}
+
+static bool_t
+wraps_around ( struct shm_ring_t *r, unsigned long pos, size_t n )
+{
+	return ( ( pos & r->mask ) + n > r->mask + 1 );
+}
+
+static void *
+writer_main ( void *arg )
+{
+	struct writer_t *w = ( struct writer_t * ) arg;
+	unsigned int seed = 1;
+	bit8u_t *buf;
+	long pos = 0;
+
+	buf = Malloc ( w->max_chunk );
+
+	while ( ! is_started ) {
+		sched_yield ( );
+	}
+
+	while ( pos < w->nr_bytes ) {
+		size_t len = 1 + rand_r ( &seed ) % w->max_chunk;
+		size_t done = 0;
+		size_t i;
+
+		if ( len > ( size_t ) ( w->nr_bytes - pos ) ) {
+			len = w->nr_bytes - pos;
+		}
+		for ( i = 0; i < len; i++ ) {
+			buf[i] = byte_at ( pos + i );
+		}
+
+		for ( ; ; ) {
+			unsigned long tail = w->ring->tail;
+			size_t n;
+
+			n = ShmRing_write ( w->ring, buf + done, len - done );
+			if ( wraps_around ( w->ring, tail, n ) ) {
+				w->nr_wrapped++;
+			}
+			done += n;
+			if ( done == len ) {
+				break;
+			}
+			/* Let the reader run, as ShmPipe_writev () does. */
+			w->nr_partial++;
+			sched_yield ( );
+		}
+		pos += len;
+	}
+
+	Free ( buf );
+	return NULL;
+}
+
+int
+main ( int argc, char *argv[] )
+{
+	long nr_bytes = DEFAULT_NR_BYTES;
+	size_t ring_size = DEFAULT_RING_SIZE;
+	long pos = 0, nr_empty = 0, nr_wrapped = 0;
+	struct shm_ring_t *ring;
+	struct writer_t writer;
+	struct timespec start;
+	unsigned int seed = 2;
+	size_t max_chunk;
+	bit8u_t *buf;
+	double t;
+
+	if ( argc > 1 ) {
+		nr_bytes = atol ( argv[1] );
+	}
+	if ( argc > 2 ) {
+		ring_size = atoi ( argv[2] );
+	}
+	if ( ( ring_size == 0 ) || ( ( ring_size & ( ring_size - 1 ) ) != 0 ) ) {
+		Fatal_failure ( "shm_ring_test: ring_size must be a power of 2\n" );
+	}
+
+	ring = Malloc ( ShmRing_sizeof ( ring_size ) );
+	ShmRing_init ( ring, ring_size );
+	max_chunk = MAX_CHUNK_RATIO * ring_size;
+	buf = Malloc ( max_chunk );
+
+	writer.ring = ring;
+	writer.nr_bytes = nr_bytes;
+	writer.max_chunk = max_chunk;
+	writer.nr_partial = 0;
+	writer.nr_wrapped = 0;
+	Pthread_create ( &writer.thread, NULL, &writer_main, &writer );
+
+	start = Timespec_current ( );
+	is_started = TRUE;
+
+	while ( pos < nr_bytes ) {
+		size_t len = 1 + rand_r ( &seed ) % max_chunk;
+		unsigned long head = ring->head;
+		size_t n, i;
+
+		n = ShmRing_read ( ring, buf, len );
+		if ( n == 0 ) {
+			nr_empty++;
+			sched_yield ( );
+			continue;
+		}
+		if ( n > len ) {
+			Fatal_failure ( "shm_ring_test: read %d bytes for %d\n", ( int ) n, ( int ) len );
+		}
+		if ( wraps_around ( ring, head, n ) ) {
+			nr_wrapped++;
+		}
+
+		for ( i = 0; i < n; i++ ) {
+			if ( buf[i] != byte_at ( pos + i ) ) {
+				Fatal_failure ( "shm_ring_test: byte %ld: expected %#x, got %#x\n",
+						pos + i, byte_at ( pos + i ), buf[i] );
+			}
+		}
+		pos += n;
+
+		/* Let the writer run while the ring is partly full, so that
+		 * the writes do not always start at the beginning of it. */
+		sched_yield ( );
+	}
+
+	t = Timespec_elapsed ( start );
+	Pthread_join ( writer.thread, NULL );
+
+	if ( ( ! ShmRing_is_empty ( ring ) ) || ( ShmRing_read ( ring, buf, max_chunk ) != 0 ) ) {
+		Fatal_failure ( "shm_ring_test: bytes left in the ring\n" );
+	}
+	if ( ( ring->head != ( unsigned long ) nr_bytes ) || ( ring->tail != ( unsigned long ) nr_bytes ) ) {
+		Fatal_failure ( "shm_ring_test: head=%lu, tail=%lu for %ld bytes\n",
+				ring->head, ring->tail, nr_bytes );
+	}
+	/* The test is meaningless if these paths have not been taken
+	 * (a copy can not wrap around a ring of a single byte). */
+	if ( ( ring_size > 1 ) && ( nr_bytes >= 16 * ( long ) ring_size ) &&
+	     ( ( writer.nr_partial == 0 ) || ( writer.nr_wrapped == 0 ) || ( nr_wrapped == 0 ) ) ) {
+		Fatal_failure ( "shm_ring_test: no partial write or no wraparound\n" );
+	}
+
+	Free ( buf );
+	Free ( ring );
+
+	Print ( stdout, "shm_ring_test: %ld bytes in %.3f sec (%.1f MB/sec)\n",
+		nr_bytes, t, nr_bytes / t / 1000000.0 );
+	Print ( stdout, "  ring size = %d, partial writes = %ld, wrapped writes = %ld, wrapped reads = %ld, empty = %ld\n",
+		( int ) ring_size, writer.nr_partial, writer.nr_wrapped, nr_wrapped, nr_empty );
+
+	return 0;
+}
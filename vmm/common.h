@@ -108,7 +108,25 @@ enum vm_handler_kind {
 typedef enum vm_handler_kind 	vm_handler_kind_t;
 
 enum {
-	NR_HANDLER_KINDS	= 5
+	NR_HANDLER_KINDS	= 7
+};
+
+enum {
+	PAGE_PROT_RING_SIZE	= 64
+};
+
+/* [Note] The monitor appends the physical addresses of the pages whose
+ * state has changed at <tail> while the guest process is stopped.  The
+ * guest process consumes them from <head> on the next entry to the
+ * emulation code, and gives all the linear addresses that map each
+ * page the protection of its current state (see CHANGE_PAGE_PROT).
+ * If the ring fills up while the guest process is in the emulation
+ * code, <is_overflowed> is set and all the pages are updated. */
+struct page_prot_ring_t {
+     unsigned int	head;
+     unsigned int	tail;
+     bool_t		is_overflowed;
+     bit32u_t		paddrs[PAGE_PROT_RING_SIZE];
 };
 
 struct set_cntl_reg_t {
@@ -123,11 +141,17 @@ struct shared_info_t {
 
      union {
 	     struct set_cntl_reg_t 	set_cntl_reg; /* for SET_CNTL_REG */
-	     int			page_no; /* for CHANGE_PAGE_PROT */
 	     bit32u_t			cr2; /* for HANDLE_PAGEFAULT */
      } args;
 
      struct sigcontext retval;
+
+     struct page_prot_ring_t	prot_ring; /* for CHANGE_PAGE_PROT */
+
+     /* [STAT] updated by the guest process */
+     int		nr_mmaps;	/* # of mmap calls */
+     int		nr_mmaps_saved;	/* # of mmap calls saved by mapping runs of pages */
+     int		nr_mmapped_pages; /* # of pages mapped by the mmap calls */
 };
 
 #endif /* _VMM_COMMON_H */
@@ -1,7 +1,170 @@
 #include "vmm/ia32/cpu_common.h"
+#include "vmm/ia32/cpu.h"
+#include <strings.h>
 
 proc_class_t
 ProcClass_of_cpuid ( int cpuid )
 {
 	return ( cpuid == BSP_CPUID ) ? BOOTSTRAP_PROC : APPLICATION_PROC;
 }
+
+/****************************************************************/
+
+enum {
+	CPUSET_WORDS = MAX_OF_CPUIDS / 32
+};
+
+void
+Cpuset_clear ( struct cpuset_t *x )
+{
+	int i;
+
+	ASSERT ( x != NULL );
+
+	for ( i = 0; i < CPUSET_WORDS; i++ ) {
+		x->bits[i] = 0;
+	}
+}
+
+/* x = { 0, 1, ..., num_of_cpuids - 1 } */
+void
+Cpuset_fill ( struct cpuset_t *x, int num_of_cpuids )
+{
+	int i;
+
+	ASSERT ( x != NULL );
+	assert ( ( 0 <= num_of_cpuids ) && ( num_of_cpuids <= MAX_OF_CPUIDS ) );
+
+	Cpuset_clear ( x );
+	for ( i = 0; i < num_of_cpuids / 32; i++ ) {
+		x->bits[i] = ~0U;
+	}
+	if ( num_of_cpuids % 32 != 0 ) {
+		x->bits[i] = BIT_MASK ( num_of_cpuids % 32 );
+	}
+}
+
+void
+Cpuset_set_single ( struct cpuset_t *x, int cpuid )
+{
+	Cpuset_clear ( x );
+	Cpuset_add ( x, cpuid );
+}
+
+void
+Cpuset_add ( struct cpuset_t *x, int cpuid )
+{
+	ASSERT ( x != NULL );
+	assert ( ( 0 <= cpuid ) && ( cpuid < MAX_OF_CPUIDS ) );
+
+	SET_BIT ( x->bits[cpuid / 32], cpuid % 32 );
+}
+
+void
+Cpuset_remove ( struct cpuset_t *x, int cpuid )
+{
+	ASSERT ( x != NULL );
+	assert ( ( 0 <= cpuid ) && ( cpuid < MAX_OF_CPUIDS ) );
+
+	CLEAR_BIT ( x->bits[cpuid / 32], cpuid % 32 );
+}
+
+bool_t
+Cpuset_contains ( const struct cpuset_t *x, int cpuid )
+{
+	ASSERT ( x != NULL );
+
+	if ( ( cpuid < 0 ) || ( cpuid >= MAX_OF_CPUIDS ) ) {
+		return FALSE;
+	}
+	return TEST_BIT ( x->bits[cpuid / 32], cpuid % 32 );
+}
+
+bool_t
+Cpuset_is_empty ( const struct cpuset_t *x )
+{
+	return ( Cpuset_next ( x, -1 ) == -1 );
+}
+
+bool_t
+Cpuset_equal ( const struct cpuset_t *x, const struct cpuset_t *y )
+{
+	int i;
+
+	ASSERT ( x != NULL );
+	ASSERT ( y != NULL );
+
+	for ( i = 0; i < CPUSET_WORDS; i++ ) {
+		if ( x->bits[i] != y->bits[i] ) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/* Returns the smallest member greater than <cpuid>, or -1 if there is
+ * none.  Empty words are skipped, so that walking a set costs O(members)
+ * rather than O(MAX_OF_CPUIDS). */
+int
+Cpuset_next ( const struct cpuset_t *x, int cpuid )
+{
+	int i, n;
+	bit32u_t w;
+
+	ASSERT ( x != NULL );
+
+	n = cpuid + 1;
+	if ( n >= MAX_OF_CPUIDS ) {
+		return -1;
+	}
+
+	i = n / 32;
+	w = x->bits[i] & ~BIT_MASK ( n % 32 );
+
+	for ( ; ; ) {
+		if ( w != 0 ) {
+			return i * 32 + ffs ( w ) - 1;
+		}
+		i++;
+		if ( i == CPUSET_WORDS ) {
+			return -1;
+		}
+		w = x->bits[i];
+	}
+}
+
+/* [Note] The result is held in a static buffer. */
+const char *
+Cpuset_to_string ( const struct cpuset_t *x )
+{
+	static char buf[CPUSET_WORDS * 9 + 3];
+	char *p = buf;
+	int i;
+
+	ASSERT ( x != NULL );
+
+	for ( i = CPUSET_WORDS - 1; ( i > 0 ) && ( x->bits[i] == 0 ); i-- ) {
+		;
+	}
+
+	p += sprintf ( p, "%#lx", x->bits[i] );
+	for ( i--; i >= 0; i-- ) {
+		p += sprintf ( p, "_%08lx", x->bits[i] );
+	}
+
+	return buf;
+}
+
+void
+Cpuset_pack ( const struct cpuset_t *x, int fd )
+{
+	ASSERT ( x != NULL );
+	Bit32uArray_pack ( x->bits, CPUSET_WORDS, fd );
+}
+
+void
+Cpuset_unpack ( struct cpuset_t *x, int fd )
+{
+	ASSERT ( x != NULL );
+	Bit32uArray_unpack ( x->bits, CPUSET_WORDS, fd );
+}
@@ -5,6 +5,22 @@
 
 proc_class_t ProcClass_of_cpuid ( int cpuid );
 
+void         Cpuset_clear ( struct cpuset_t *x );
+void         Cpuset_fill ( struct cpuset_t *x, int num_of_cpuids );
+void         Cpuset_set_single ( struct cpuset_t *x, int cpuid );
+void         Cpuset_add ( struct cpuset_t *x, int cpuid );
+void         Cpuset_remove ( struct cpuset_t *x, int cpuid );
+bool_t       Cpuset_contains ( const struct cpuset_t *x, int cpuid );
+bool_t       Cpuset_is_empty ( const struct cpuset_t *x );
+bool_t       Cpuset_equal ( const struct cpuset_t *x, const struct cpuset_t *y );
+int          Cpuset_next ( const struct cpuset_t *x, int cpuid );
+const char * Cpuset_to_string ( const struct cpuset_t *x );
+void         Cpuset_pack ( const struct cpuset_t *x, int fd );
+void         Cpuset_unpack ( struct cpuset_t *x, int fd );
+
+/* Iterate over the members of <set> in ascending order */
+#define CPUSET_FOR_EACH(cpuid, set) \
+	for ( ( cpuid ) = Cpuset_next ( ( set ), -1 ); ( cpuid ) != -1; ( cpuid ) = Cpuset_next ( ( set ), ( cpuid ) ) )
 
 
 #endif /* _VMM_IA32_CPU_H */
@@ -12,6 +12,17 @@ enum {
 #endif
 };
 
+enum {
+	MAX_OF_CPUIDS	= 256
+};
+
+/* A set of cpuids.  The capacity is fixed since the set is embedded in
+ * the page descriptors, which are shared between the monitor and the VM
+ * process. */
+struct cpuset_t {
+	bit32u_t	bits[MAX_OF_CPUIDS / 32];
+};
+
 enum proc_class {
 	BOOTSTRAP_PROC,
 	APPLICATION_PROC 
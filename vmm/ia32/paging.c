@@ -297,7 +297,7 @@ PageDescr_init ( struct page_descr_t *x, int cpuid )
 
 	x->state = ( cpuid == BSP_CPUID ) ? PAGE_STATE_EXCLUSIVELY_SHARED : PAGE_STATE_INVALID;
 	x->owner = BSP_CPUID;
-	x->copyset = 1 << BSP_CPUID;
+	Cpuset_set_single ( &x->copyset, BSP_CPUID );
 	x->num_of_laddrs = 0;
 
 	x->requesting = FALSE;
@@ -318,7 +318,7 @@ PageDescr_pack ( struct page_descr_t *x, int fd )
 #endif
 
 	Bit32u_pack ( ( bit32u_t ) x->state, fd );
-	Bit32u_pack ( ( bit32u_t ) x->copyset, fd );
+	Cpuset_pack ( &x->copyset, fd );
 	Bit32u_pack ( ( bit32u_t ) x->owner, fd );
 	Bit64u_pack ( ( bit64u_t ) x->seq, fd );
 	Bool_pack ( x->requesting, fd );
@@ -339,7 +339,7 @@ PageDescr_unpack ( struct page_descr_t *x, int fd )
 #endif
 
 	x->state = ( page_state_t ) Bit32u_unpack ( fd );
-	x->copyset = ( bit32u_t ) Bit32u_unpack ( fd );
+	Cpuset_unpack ( &x->copyset, fd );
 	x->owner = ( bit32u_t ) Bit32u_unpack ( fd );
 	x->seq   = ( bit64u_t ) Bit64u_unpack ( fd );
 	x->requesting = Bool_unpack ( fd );
@@ -367,10 +367,10 @@ PageDescr_print ( FILE *stream, struct page_descr_t *x )
 	ASSERT ( x != NULL );
 
 	Print ( stream,
-		" { state=%s, owner=%#x, copyset=%#x",
+		" { state=%s, owner=%#x, copyset=%s",
 		PageState_to_string ( x->state ),
 		x->owner,
-		x->copyset );
+		Cpuset_to_string ( &x->copyset ) );
 	
 	Print ( stream, ", laddrs=" );
 	
@@ -489,5 +489,5 @@ bool_t
 PageDescr_cpuid_is_in_copyset ( const struct page_descr_t *x, int cpuid )
 {
 	ASSERT ( x != NULL );
-	return TEST_BIT ( x->copyset, cpuid );
+	return Cpuset_contains ( &x->copyset, cpuid );
 }
@@ -4,6 +4,7 @@
 #include "vmm/std.h"
 #include "vmm/ia32/maccess.h"
 #include "vmm/ia32/regs.h"
+#include "vmm/ia32/cpu_common.h"
 
 
 enum {
@@ -77,8 +78,9 @@ struct page_descr_t {
 
 	int			num_of_laddrs;
 	page_state_t	 	state;
-	bit32u_t		copyset;
-	bit32u_t		owner;
+	struct cpuset_t		copyset;
+	bit32u_t		owner;	/* a probable owner unless this node is
+					 * the owner or the (static) manager */
 	
 	long long		seq;
 
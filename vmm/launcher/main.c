@@ -115,7 +115,11 @@ init_termios ( void )
 	atexit(term_exit);
 }
 
-static pid_t pids[NUM_OF_PROCS];
+static char *MON_PROGRAM = "/home/kaneda/vm/vmm/mon/mon";
+static char *CONFIG_FILE = "/home/kaneda/vm/vmm/mon/config.txt";
+
+static int num_of_procs;
+static pid_t *pids;
 
 static void
 kill_proc ( int cpuid, char *prog_name )
@@ -141,7 +145,7 @@ __kill_all_procs ( char *prog_name )
 
 	Print_color ( stderr, GREEN, "KILL %s\n", prog_name );
 
-	for ( i = 0; i < NUM_OF_PROCS; i++ ) {
+	for ( i = 0; i < num_of_procs; i++ ) {
 		pid_t pid;
 
 		pid= Fork ( );
@@ -175,8 +179,6 @@ fork_proc ( int cpuid )
 	char ssh_option[BUF_SIZE];
 	char id[BUF_SIZE];
 	char host[BUF_SIZE];
-	char *MON_PROGRAM = "/home/kaneda/vm/vmm/mon/mon";
-	char *CONFIG_FILE = "/home/kaneda/vm/vmm/mon/config.txt";
 	int ret;
 	char *argv[9];
 	int i = 0;
@@ -212,11 +214,18 @@ fork_proc ( int cpuid )
 int
 main ( int argc, char *argv[] )
 {
+	/* parsed as the BSP monitor does, to get the nodes on its "cpu:" lines */
+	char *conf_argv[] = { argv[0], "--config", CONFIG_FILE,
+			      "--id", "0", NULL };
 	int i;
 
+	Config_create ( 5, conf_argv );
+	num_of_procs = get_num_of_procs ( );
+	pids = Calloct ( num_of_procs, pid_t );
+
 	init_termios ( );
 
-	for ( i = 0; i < NUM_OF_PROCS; i++ ) {
+	for ( i = 0; i < num_of_procs; i++ ) {
 		pids[i] = Fork ( );
 
 		if ( pids[i] == 0 ) {
@@ -228,7 +237,7 @@ main ( int argc, char *argv[] )
 
 	Signal ( SIGINT, &handle_sigint );
 
-	for ( i = 0; i < NUM_OF_PROCS; i++ ) {
+	for ( i = 0; i < num_of_procs; i++ ) {
 		Waitpid ( pids[i], NULL, 0 );
 	}
 
@@ -132,7 +132,7 @@ LocalApic_init ( struct local_apic_t *x )
 }
 
 struct local_apic_t *
-LocalApic_create ( int id, struct comm_t *comm, pid_t pid )
+LocalApic_create ( int id, struct comm_t *comm, pid_t pid, struct event_t *event )
 {
 	int i;
 	struct local_apic_t *x;
@@ -140,9 +140,10 @@ LocalApic_create ( int id, struct comm_t *comm, pid_t pid )
 	x = Malloct ( struct local_apic_t );
 
 	x->gapic = GenericApic_create ( id, VM_LOCAL_APIC_DEFAULT_PHYS_BASE, comm );
-	for ( i = 0; i < NUM_OF_PROCS; i++ )
+	for ( i = 0; i < MAX_OF_PROCS; i++ )
 		x->logical_id_map[i] = 0;
 	x->pid = pid;
+	x->event = event;
 	LocalApic_init ( x );
 
 	{
@@ -166,7 +167,7 @@ LocalApic_pack ( struct local_apic_t *x, int fd )
 	
 	Bit8u_pack ( x->task_priority, fd );
 	Bit8u_pack ( x->arb_priority, fd );
-	Bit8uArray_pack ( x->logical_id_map, NUM_OF_PROCS, fd );
+	Bit8uArray_pack ( x->logical_id_map, MAX_OF_PROCS, fd );
 	Bit32u_pack ( ( bit32u_t ) x->model, fd );
 	Bit32u_pack ( x->spurious_vector, fd );
 	Bit32u_pack ( x->error_status, fd );
@@ -192,7 +193,7 @@ LocalApic_unpack ( struct local_apic_t *x, int fd )
 	
 	x->task_priority = Bit8u_unpack ( fd );
 	x->arb_priority = Bit8u_unpack ( fd );
-	Bit8uArray_unpack ( x->logical_id_map, NUM_OF_PROCS, fd );
+	Bit8uArray_unpack ( x->logical_id_map, MAX_OF_PROCS, fd );
 	x->model = ( model_t ) Bit32u_unpack ( fd );
 	x->spurious_vector = Bit32u_unpack ( fd );
 	x->error_status = Bit32u_unpack ( fd );
@@ -477,11 +478,18 @@ LocalApic_notify_logical_id ( struct local_apic_t *apic )
 #endif /* ENABLE_MP */
 
 
-static bit8u_t
-get_ipi_dest_with_physical_mode ( bit8u_t dest )
+static void
+get_ipi_dest_with_physical_mode ( bit8u_t dest, struct cpuset_t *dests )
 {
-	const bit8u_t BCAST_MASK = 0xff;
-	return ( dest == BCAST_MASK ) ? BCAST_MASK : ( 1 << dest );
+	const bit8u_t BCAST_ID = 0xff;
+
+	if ( dest == BCAST_ID ) {
+		Cpuset_fill ( dests, get_num_of_procs ( ) );
+	} else if ( dest < get_num_of_procs ( ) ) {
+		Cpuset_set_single ( dests, dest );
+	} else {
+		Cpuset_clear ( dests );
+	}
 }
 
 static bool_t
@@ -508,35 +516,32 @@ match_logical_dest ( struct local_apic_t *apic, bit8u_t id, bit8u_t dest )
 	return retval;
 }
 
-static int
-get_ipi_dest_with_logical_mode ( struct local_apic_t *apic, bit8u_t dest )
+static void
+get_ipi_dest_with_logical_mode ( struct local_apic_t *apic, bit8u_t dest, struct cpuset_t *dests )
 {
-	int retval = 0;
 	int i;
 
 	ASSERT ( apic != NULL );
 
-	for ( i = 0; i < NUM_OF_PROCS; i++ ) {
+	Cpuset_clear ( dests );
+	for ( i = 0; i < get_num_of_procs ( ); i++ ) {
 		if ( match_logical_dest ( apic, i, dest ) ) 
-			retval |= ( 1 << i );
+			Cpuset_add ( dests, i );
 	}
-	return retval;
 }
 
-static int
-get_ipi_dest_with_no_shorthand ( struct local_apic_t *apic, struct interrupt_command_t *ic )
+static void
+get_ipi_dest_with_no_shorthand ( struct local_apic_t *apic, struct interrupt_command_t *ic, 
+				 struct cpuset_t *dests )
 {
-	int retval = 0;
-
 	ASSERT ( apic != NULL );
 	ASSERT ( ic != NULL );
 
 	switch ( ic->dest_mode ) {
-	case DEST_MODE_PHYSICAL: retval = get_ipi_dest_with_physical_mode ( ic->dest ); break;
-	case DEST_MODE_LOGICAL:  retval = get_ipi_dest_with_logical_mode ( apic, ic->dest ); break;
+	case DEST_MODE_PHYSICAL: get_ipi_dest_with_physical_mode ( ic->dest, dests ); break;
+	case DEST_MODE_LOGICAL:  get_ipi_dest_with_logical_mode ( apic, ic->dest, dests ); break;
 	default: 		 Match_failure ( "get_ipi_dest_with_no_shorthand" );
 	}
-	return retval;
 }
 
 /* [TODO] */
@@ -546,23 +551,22 @@ get_lowest_priority_cpuid ( void )
 	return BSP_CPUID; 
 }
 
-static int
-modify_dest_with_delivery_mode ( struct local_apic_t *apic, struct interrupt_command_t *ic, int ipi_dest )
+static void
+modify_dest_with_delivery_mode ( struct local_apic_t *apic, struct interrupt_command_t *ic, 
+				 struct cpuset_t *dests )
 {
-	int retval = ipi_dest;
-
 	ASSERT ( apic != NULL );
 	ASSERT ( ic != NULL );
 
 	switch ( ic->delivery_mode ) {
 	case DELIVERY_MODE_LOWEST_PRIORITY: {
-		retval = 1 << get_lowest_priority_cpuid ( );
+		Cpuset_set_single ( dests, get_lowest_priority_cpuid ( ) );
 		break;
 	}
 	case DELIVERY_MODE_INIT: 
 		if ( ( ic->level == LEVEL_DEASSERT ) && ( ic->trig_mode == TRIG_MODE_LEVEL ) ) { 
 			/* INIT DEASSERTED */
-			retval = BIT_MASK ( NUM_OF_PROCS );
+			Cpuset_fill ( dests, get_num_of_procs ( ) );
 			// $B<+J,$r4^$a$k$+!$$=$&$G$J$$$+(B
 		}
 		break;
@@ -570,45 +574,43 @@ modify_dest_with_delivery_mode ( struct local_apic_t *apic, struct interrupt_com
 		/* do nothing */ 
 		break;
 	}
-	return retval;
 }
 
 /* [Reference] IA-32 manual. Vol.3 8-27 */
-static int
-LocalApic_get_ipi_dest ( struct local_apic_t *apic, struct interrupt_command_t *ic )
+static void
+LocalApic_get_ipi_dest ( struct local_apic_t *apic, struct interrupt_command_t *ic, 
+			 struct cpuset_t *dests )
 {
-	const int ALL_MASK = BIT_MASK ( NUM_OF_PROCS );
-	int retval = 0;
-
 	ASSERT ( apic != NULL );
 	ASSERT ( apic->gapic != NULL );
 	ASSERT ( ic != NULL );
+	ASSERT ( dests != NULL );
+
+	Cpuset_clear ( dests );
 
 	switch ( ic->dest_shorthand ) {
 	case DEST_SHORTHAND_NO:
-		retval = get_ipi_dest_with_no_shorthand ( apic, ic );
+		get_ipi_dest_with_no_shorthand ( apic, ic, dests );
 		break;
 
 	case DEST_SHORTHAND_SELF:
-		retval = ( 1 << apic->gapic->id );
+		Cpuset_set_single ( dests, apic->gapic->id );
 		break;
 
 	case DEST_SHORTHAND_ALL_INCLUDING_SELF:
-		retval = ALL_MASK; 
+		Cpuset_fill ( dests, get_num_of_procs ( ) );
 		break;
 
 	case DEST_SHORTHAND_ALL_EXCLUDING_SELF:
-		retval = ALL_MASK; 
-		CLEAR_BIT ( retval, apic->gapic->id );
+		Cpuset_fill ( dests, get_num_of_procs ( ) );
+		Cpuset_remove ( dests, apic->gapic->id );
 		break;
 
 	default:
                 Match_failure ( "LocalApic_get_ipi_dest" );
 	}
    
-	retval = modify_dest_with_delivery_mode ( apic, ic, retval );
-
-	return retval;
+	modify_dest_with_delivery_mode ( apic, ic, dests );
 }
 
 static void
@@ -713,7 +715,7 @@ LocalApic_deliver_to_remote ( struct local_apic_t *apic, struct interrupt_comman
 		 ic->vector );
 */
 
-	msg = Msg_create3 ( MSG_KIND_IPI, ( void * )ic );
+	msg = Msg_create_ipi ( ic );
 	Comm_send ( apic->gapic->comm, msg, dest_id );
 	Msg_destroy ( msg );
 }
@@ -730,25 +732,22 @@ LocalApic_deliver_to_remote ( struct local_apic_t *apic, struct interrupt_comman
 static void
 LocalApic_deliver_sub ( struct local_apic_t *apic, struct interrupt_command_t *ic )
 {
-	int bitmask;
+	struct cpuset_t dests;
 	int i;
 
 	ASSERT ( apic != NULL );
 	ASSERT ( ic != NULL );   
 
-	bitmask = LocalApic_get_ipi_dest ( apic, ic );
+	LocalApic_get_ipi_dest ( apic, ic, &dests );
 
-	if ( bitmask == 0 ) {
+	if ( Cpuset_is_empty ( &dests ) ) {
 		LocalApic_print ( stderr, apic );
 		Fatal_failure ( "LocalApic_deliver_sub: failed\n" );
 		apic->error_status |= ERROR_SEND_ACCEPT; 
 		return; 
 	}
 
-	for ( i = 0; i < NUM_OF_PROCS; i++ ) {
-		if ( ! TEST_BIT ( bitmask, i ) ) 
-			continue;
-	    
+	CPUSET_FOR_EACH ( i, &dests ) {
 		if ( i == apic->gapic->id ) { 
 			LocalApic_handle_request ( apic, ic );
 		} else {
@@ -1046,6 +1045,7 @@ LocalApic_timer_update ( struct local_apic_t *apic )
 		/* [TODO] */
 //		if ( ( is_native_mode ( mon ) ) && ( Pit_check_irq ( pit ) ) ) {
 		Kill ( apic->pid, SIGALRM );
+		Event_signal ( apic->event );
 	}
 	
 	if ( TEST_BIT ( v, 17 ) ) {
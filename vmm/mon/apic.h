@@ -46,7 +46,7 @@ struct local_apic_t {
 
      bit8u_t			task_priority;
      bit8u_t			arb_priority;
-     bit8u_t			logical_id_map[NUM_OF_PROCS];
+     bit8u_t			logical_id_map[MAX_OF_PROCS];
      model_t			model;		/* 0000B ==> flat, 1111B ==> cluster */
      bit32u_t			spurious_vector;
      bit32u_t			error_status;
@@ -65,10 +65,11 @@ struct local_apic_t {
      pthread_cond_t		cond;
      bit32u_t 			sleep_time;
      pid_t pid;
+     struct event_t		*event;
 };
 
 
-struct local_apic_t *LocalApic_create(int id, struct comm_t *comm, pid_t pid);
+struct local_apic_t *LocalApic_create(int id, struct comm_t *comm, pid_t pid, struct event_t *event);
 void                 LocalApic_pack ( struct local_apic_t *x, int fd );
 void                 LocalApic_unpack ( struct local_apic_t *x, int fd );
 void                 LocalApic_print(FILE *stream, struct local_apic_t *apic);
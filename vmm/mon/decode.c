@@ -1424,8 +1424,195 @@ verify_decode ( struct decode_state_t *state )
 	}
 }
    
-struct instruction_t
-decode_instruction ( bit32u_t eip )
+/********************************************************************/
+
+/* 
+ * Decoded-instruction cache
+ *
+ * The same few hundred trap sites are decoded over and over again.
+ * A decoded instruction depends only on the instruction bytes and on
+ * the code segment, so we keep the result of decode_instruction ()
+ * keyed by ( CR3, linear eip, CS base, CS D-bit ).
+ *
+ * [Note]
+ * The guest writes its own code pages natively, i.e., without any
+ * trap.  A hit is therefore accepted only if the instruction bytes
+ * in the physical memory are still the same as the cached ones.
+ * Writes done by the monitor itself are caught by
+ * DecodeCache_invalidate_paddr ().
+ */
+
+enum {
+	DECODE_CACHE_SIZE	= 1024, /* must be a power of 2 */
+	MAX_INSTR_LEN		= 16
+};
+
+struct decode_cache_entry_t {
+	bool_t			is_valid;
+	bit32u_t		cr3;
+	bit32u_t		laddr;
+	bit32u_t		cs_base;
+	bool_t			cs_d;
+	bit32u_t		paddr;
+	bit8u_t			bytes[MAX_INSTR_LEN];
+	struct instruction_t	instr;
+};
+
+static struct decode_cache_entry_t decode_cache[DECODE_CACHE_SIZE];
+
+/* non-zero if some entry of the decode cache refers to the page */
+static bit8u_t decode_cache_pages[PMEM_SIZE / PAGE_SIZE_4K];
+
+static int
+decode_cache_index ( bit32u_t laddr )
+{
+	return ( laddr ^ ( laddr >> 10 ) ) & ( DECODE_CACHE_SIZE - 1 );
+}
+
+static bool_t
+code_seg_d_bit ( struct mon_t *mon )
+{
+	ASSERT ( mon != NULL );
+
+	/* D/B flag: bit 22 of the upper dword of the descriptor */
+	return SUB_BIT ( mon->regs->segs[SEG_REG_CS].cache.vals[1], 22, 1 );
+}
+
+#ifdef ENABLE_MP
+
+static bool_t
+is_valid_code_page ( struct mon_t *mon, bit32u_t paddr )
+{
+	ASSERT ( mon != NULL );
+	return ( mon->page_descrs[paddr_to_page_no ( paddr )].state != PAGE_STATE_INVALID );
+}
+
+#else /* ! ENABLE_MP */
+
+static bool_t
+is_valid_code_page ( struct mon_t *mon, bit32u_t paddr )
+{
+	return TRUE;
+}
+
+#endif /* ENABLE_MP */
+
+static bool_t
+is_cacheable_code ( struct mon_t *mon, bit32u_t paddr, size_t len )
+{
+	ASSERT ( mon != NULL );
+
+	return ( ( len <= MAX_INSTR_LEN ) &&
+		 ( paddr + len <= mon->pmem.ram_offset ) &&
+		 ( paddr_to_page_no ( paddr ) == paddr_to_page_no ( paddr + len - 1 ) ) );
+}
+
+static struct decode_cache_entry_t *
+lookup_decode_cache ( struct mon_t *mon, bit32u_t laddr )
+{
+	struct decode_cache_entry_t *e;
+	bit32u_t paddr;
+	bool_t is_ok;
+
+	ASSERT ( mon != NULL );
+
+	e = &decode_cache[decode_cache_index ( laddr )];
+
+	if ( ( ! e->is_valid ) ||
+	     ( e->laddr != laddr ) ||
+	     ( e->cr3 != mon->regs->sys.cr3.val ) ||
+	     ( e->cs_base != Descr_base ( &mon->regs->segs[SEG_REG_CS].cache ) ) ||
+	     ( e->cs_d != code_seg_d_bit ( mon ) ) )
+		return NULL;
+
+	paddr = Monitor_try_laddr_to_paddr ( laddr, &is_ok );
+	if ( ( ! is_ok ) || ( paddr != e->paddr ) || ( ! is_valid_code_page ( mon, paddr ) ) )
+		return NULL;
+
+	if ( Memcmp ( e->bytes, ( void * ) Monitor_paddr_to_raddr ( paddr ), e->instr.len ) != 0 )
+		return NULL;
+
+	return e;
+}
+
+static void
+insert_decode_cache ( struct mon_t *mon, bit32u_t laddr, const struct instruction_t *instr )
+{
+	struct decode_cache_entry_t *e;
+	bit32u_t paddr;
+	bool_t is_ok;
+
+	ASSERT ( mon != NULL );
+	ASSERT ( instr != NULL );
+
+	if ( instr->opcode == INVALID_OPCODE )
+		return;
+
+	paddr = Monitor_try_laddr_to_paddr ( laddr, &is_ok );
+	if ( ( ! is_ok ) || ( ! is_cacheable_code ( mon, paddr, instr->len ) ) )
+		return;
+
+	e = &decode_cache[decode_cache_index ( laddr )];
+	e->is_valid = TRUE;
+	e->cr3 = mon->regs->sys.cr3.val;
+	e->laddr = laddr;
+	e->cs_base = Descr_base ( &mon->regs->segs[SEG_REG_CS].cache );
+	e->cs_d = code_seg_d_bit ( mon );
+	e->paddr = paddr;
+	Mmove ( e->bytes, ( void * ) Monitor_paddr_to_raddr ( paddr ), instr->len );
+	e->instr = *instr;
+
+	decode_cache_pages[paddr_to_page_no ( paddr )] = 1;
+}
+
+void
+DecodeCache_flush ( void )
+{
+	int i;
+
+	for ( i = 0; i < DECODE_CACHE_SIZE; i++ ) {
+		decode_cache[i].is_valid = FALSE;
+	}
+	Mzero ( decode_cache_pages, sizeof ( decode_cache_pages ) );
+}
+
+/* Invalidate the entries whose instruction lies in the same linear page as <laddr> (INVLPG) */
+void
+DecodeCache_invalidate_laddr ( bit32u_t laddr )
+{
+	int i;
+
+	for ( i = 0; i < DECODE_CACHE_SIZE; i++ ) {
+		struct decode_cache_entry_t *e = &decode_cache[i];
+
+		if ( ( e->is_valid ) && ( BIT_ALIGN ( e->laddr, 12 ) == BIT_ALIGN ( laddr, 12 ) ) )
+			e->is_valid = FALSE;
+	}
+}
+
+/* Invalidate the entries whose instruction lies in the physical page of <paddr> */
+void
+DecodeCache_invalidate_paddr ( bit32u_t paddr )
+{
+	int page_no = paddr_to_page_no ( paddr );
+	int i;
+
+	if ( ( page_no >= PMEM_SIZE / PAGE_SIZE_4K ) || ( decode_cache_pages[page_no] == 0 ) )
+		return;
+
+	for ( i = 0; i < DECODE_CACHE_SIZE; i++ ) {
+		struct decode_cache_entry_t *e = &decode_cache[i];
+
+		if ( ( e->is_valid ) && ( paddr_to_page_no ( e->paddr ) == page_no ) )
+			e->is_valid = FALSE;
+	}
+	decode_cache_pages[page_no] = 0;
+}
+
+/********************************************************************/
+
+static struct instruction_t
+decode_instruction_sub ( bit32u_t eip )
 {
 	static bool_t is_inited = FALSE;
 	struct decode_state_t state;
@@ -1463,6 +1650,30 @@ decode_instruction ( bit32u_t eip )
 	return state.instr;
 }
 
+struct instruction_t
+decode_instruction ( struct mon_t *mon, bit32u_t eip )
+{
+	struct decode_cache_entry_t *e;
+	struct instruction_t instr;
+	bit32u_t laddr;
+
+	ASSERT ( mon != NULL );
+
+	laddr = Monitor_vaddr_to_laddr ( SEG_REG_CS, eip );
+
+	e = lookup_decode_cache ( mon, laddr );
+	if ( e != NULL ) {
+		mon->stat.nr_decode_cache_hits++;
+		return e->instr;
+	}
+
+	mon->stat.nr_decode_cache_misses++;
+	instr = decode_instruction_sub ( eip );
+	insert_decode_cache ( mon, laddr, &instr );
+
+	return instr;
+}
+
 unsigned long int vm_time[2], mon_time [2];
 
 static void
@@ -1481,6 +1692,9 @@ start_profile2 ( struct mon_t *mon )
 	Get_utime_and_stime ( mon->pid,  &vm_time[0], &vm_time[1] );
 
 	Stat_init ( stat );
+	mon->shi->nr_mmaps = 0;
+	mon->shi->nr_mmaps_saved = 0;
+	mon->shi->nr_mmapped_pages = 0;
 	start_time_counter ( &stat->vmm_counter );
 	start_time_counter ( &stat->shandler_counter );
 	if ( b ) {
@@ -1553,6 +1767,8 @@ stop_profile2 ( struct mon_t *mon )
 		Print ( fp, "# of traps = %d\n", stat->nr_traps );
 		Print ( fp, "# of other signals = %d\n", stat->nr_other_sigs );
 		Print ( fp, "# of instr emu = %d\n", stat->nr_instr_emu );
+		Print ( fp, "# of mmaps = %d (pages = %d, saved = %d)\n",
+			mon->shi->nr_mmaps, mon->shi->nr_mmapped_pages, mon->shi->nr_mmaps_saved );
 	}
 	fclose (fp);
 	
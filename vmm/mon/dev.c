@@ -261,7 +261,7 @@ init_devices ( struct mon_t *mon, const struct config_t *config )
 	Pic_init ( &x->pic );
 	Rtc_init ( &x->rtc );
 	Pit_init ( &x->pit, mon );
-	Coms_init ( x->coms, mon->pid, is_bootstrap_proc ( mon ) );
+	Coms_init ( x->coms, mon->pid, &mon->halt_event, is_bootstrap_proc ( mon ) );
 	Pci_init ( &x->pci );
 
 	HardDrive_init ( &x->hard_drive, config->disk );
@@ -289,7 +289,7 @@ send_inp_request ( struct mon_t *mon, bit16u_t addr, size_t len )
 
 //	Print ( stdout, "[CPU%d] SEND INP REQUEST to %#x\n", mon->cpuid, BSP_CPUID );
 
-	msg = Msg_create3 ( MSG_KIND_INPUT_PORT, ( int ) addr, len );
+	msg = Msg_create_input_port ( ( int ) addr, len );
 	Comm_send ( mon->comm, msg, BSP_CPUID );
 	Msg_destroy ( msg );
 }
@@ -515,7 +515,7 @@ send_outp_request ( struct mon_t *mon, bit16u_t addr, bit32u_t val, size_t len )
 
 //	Print ( stdout, "[CPU%d] SEND OUTP REQUEST to %#x\n", mon->cpuid, BSP_CPUID );
 
-	msg = Msg_create3 ( MSG_KIND_OUTPUT_PORT, ( int ) addr, ( int ) val, len );
+	msg = Msg_create_output_port ( ( int ) addr, ( int ) val, len );
 	Comm_send ( mon->comm, msg, BSP_CPUID );
 	Msg_destroy ( msg );
 }
@@ -252,25 +252,34 @@ send_mem_image_request ( struct mon_t *mon )
 	
 	ASSERT ( mon != NULL );
 	
+	/* The image is received straight into pmem */
+	Comm_recv_image_into ( mon->comm, ( void * ) mon->pmem.base );
+
 	msg = Msg_create ( MSG_KIND_MEM_IMAGE_REQUEST, 0, NULL );
 	Comm_send ( mon->comm, msg, BSP_CPUID );
 	Msg_destroy ( msg );	
 }
 
 static void
-recv_mem_image_response_sub ( struct mon_t *mon, struct msg_t *msg, int *offset_p )
+recv_mem_image_response_sub ( struct mon_t *mon, struct msg_t *msg, int *offset_p,
+			      bool_t *has_immutable_pages )
 {
-	int offset = *offset_p;
-
 	ASSERT ( mon != NULL );
 	ASSERT ( msg != NULL );	
 
+	if ( msg->hdr.kind == MSG_KIND_IMMUTABLE_PAGES ) {
+		accept_immutable_pages ( mon, msg );
+		*has_immutable_pages = TRUE;
+		return;
+	}
+
 	if ( msg->hdr.kind != MSG_KIND_MEM_IMAGE_RESPONSE ) {
 		handle_msg ( mon, msg );
 		return;
 	}
 
-	Mmove ( ( void * )mon->pmem.base + offset, msg->body, msg->hdr.len );
+	/* The body has been received in place (see send_mem_image_request ()). */
+	ASSERT ( msg->body == NULL );
 	*offset_p += msg->hdr.len;
 
 	Print ( stdout, "%#x / %#lx\r", *offset_p, mon->pmem.ram_offset );
@@ -280,17 +289,20 @@ static void
 recv_mem_image_response ( struct mon_t *mon )
 {
 	int i;
+	bool_t has_immutable_pages = FALSE;
 
 	ASSERT ( mon != NULL );
 
+	/* The image is followed by the list of the immutable pages */
 	i = 0;
-	while ( i < mon->pmem.ram_offset ) {
+	while ( ( i < mon->pmem.ram_offset ) || ( ! has_immutable_pages ) ) {
 		struct msg_t *msg;
 
 		msg = Comm_remove_msg ( mon->comm );
-		recv_mem_image_response_sub ( mon, msg, &i );
+		recv_mem_image_response_sub ( mon, msg, &i, &has_immutable_pages );
 		Msg_destroy ( msg );
 	}
+	Comm_recv_image_into ( mon->comm, NULL );
 	DPRINT2 ( "\n" );
 	Print ( stdout, "\n" );
 }
@@ -398,7 +410,7 @@ init_comm ( struct mon_t *mon, const struct config_t *config )
 {
 	struct comm_t *comm;
 
-	comm = Comm_create ( mon->cpuid, mon->pid, config, ( config->snapshot != NULL ) );
+	comm = Comm_create ( mon->cpuid, mon->pid, &mon->halt_event, config, ( config->snapshot != NULL ) );
 #ifdef ENABLE_MP
 	mon->comm = comm;
 #endif	
@@ -424,7 +436,9 @@ Monitor_create ( const struct config_t *config )
 	mon->cpuid = config->cpuid;
 	mon->wait_ipi = TRUE;
 	mon->mode = NATIVE_MODE;
+	mon->fp_regs_is_saved = FALSE;
 	mon->pid  = fork_vm ( config );
+	Event_init ( &mon->halt_event );
 
 	Monitor_init_mem ( mon );
 
@@ -435,8 +449,9 @@ Monitor_create ( const struct config_t *config )
 	}
 
 	comm = init_comm ( mon, config );
+	init_page_modes ( mon, config );
 
-	mon->local_apic = LocalApic_create ( mon->cpuid, comm, mon->pid );
+	mon->local_apic = LocalApic_create ( mon->cpuid, comm, mon->pid, &mon->halt_event );
 	mon->io_apic = IoApic_create ( mon->cpuid, comm, mon->local_apic );
 	init_devices ( mon, config );
 
@@ -32,6 +32,7 @@ MemAccess_create_read ( seg_reg_index_t sreg_index, bit32u_t vaddr, size_t len )
 	x->vaddr = vaddr;
 	x->len = len;
 	x->kind = MEM_ACCESS_READ;
+	x->overwrites_page = FALSE;
 	x->next = NULL;
 
 	return x;
@@ -47,6 +48,7 @@ MemAccess_create_write ( seg_reg_index_t sreg_index, bit32u_t vaddr, size_t len
 	x->vaddr = vaddr;
 	x->len = len;
 	x->kind = MEM_ACCESS_WRITE;
+	x->overwrites_page = FALSE;
 	x->next = NULL;
 
 	return x;
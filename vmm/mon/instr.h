@@ -19,6 +19,7 @@ struct mem_access_t {
      bit32u_t			vaddr;
      size_t			len;
      mem_access_kind_t		kind;
+     bool_t			overwrites_page; /* the instruction writes the whole page before reading it */
      struct mem_access_t 	*next;
 };
 
@@ -136,8 +136,82 @@ check_idt_permission ( struct mon_t *mon, int ivector )
 	emulate_shared_memory_with_paddr ( mon, MEM_ACCESS_READ, paddr + 4 );
 }
 
+/* [Note]
+ * check_pgtable_permission() makes the page directory and the page
+ * tables of <cr3> readable on this node.  The result is cached per
+ * page directory: once validated, a page table page stays readable
+ * until it is invalidated by a write of another node, which bumps
+ * <pgtable_gen> and is logged in <pgtable_log>.  On the next load of
+ * the same CR3, only the logged pages that belong to the page
+ * directory are validated again.  A change of the page directory
+ * itself is detected by comparing its entries with the copy saved
+ * at the validation.
+ */
+enum {
+	PGTABLE_CACHE_SIZE	= 16,
+	PGTABLE_LOG_SIZE	= 256,
+	PGTABLE_BITMAP_SIZE	= ( PMEM_SIZE / PAGE_SIZE_4K ) / 32
+};
+
+struct pgtable_cache_entry_t {
+	bool_t		is_valid;
+	bit32u_t	cr3_base;
+	bit32u_t	gen;		/* value of <pgtable_gen> at the validation */
+	bit32u_t	*pdir;		/* the page directory entries (see read_pdir ()) */
+	bit32u_t	*pages;		/* bitmap of the page table pages */
+};
+
+struct pgtable_log_entry_t {
+	int		page_no;
+	bit32u_t	gen;
+};
+
+static struct pgtable_cache_entry_t pgtable_cache[PGTABLE_CACHE_SIZE];
+static struct pgtable_log_entry_t pgtable_log[PGTABLE_LOG_SIZE];
+static bit32u_t pgtable_gen = 0;
+static bit32u_t pgtable_pages[PGTABLE_BITMAP_SIZE]; /* pages validated as page tables */
+
+/* Called when the page <page_no> becomes invalid on this node. */
+void
+notify_pgtable_page_invalidated ( int page_no )
+{
+	struct pgtable_log_entry_t *x;
+
+	if ( ! TEST_BIT ( pgtable_pages[page_no / 32], page_no % 32 ) ) 
+		return;
+
+	pgtable_gen++;
+	x = &pgtable_log[pgtable_gen % PGTABLE_LOG_SIZE];
+	x->page_no = page_no;
+	x->gen = pgtable_gen;
+}
+
+void
+flush_pgtable_permission_cache ( void )
+{
+	int i;
+
+	for ( i = 0; i < PGTABLE_CACHE_SIZE; i++ ) {
+		pgtable_cache[i].is_valid = FALSE;
+	}
+}
+
 static void
-__check_pgtable_permission ( struct mon_t *mon, struct linear_addr_t addr, struct pdir_entry_t pde )
+validate_pgtable_page ( struct mon_t *mon, struct pgtable_cache_entry_t *e, bit32u_t paddr )
+{
+	int page_no = paddr_to_page_no ( paddr );
+
+	emulate_shared_memory_with_paddr ( mon, MEM_ACCESS_READ, paddr );
+
+	if ( page_no >= mon->num_of_pages )
+		return;
+
+	SET_BIT ( pgtable_pages[page_no / 32], page_no % 32 );
+	SET_BIT ( e->pages[page_no / 32], page_no % 32 );
+}
+
+static void
+__check_pgtable_permission ( struct mon_t *mon, struct pgtable_cache_entry_t *e, struct pdir_entry_t pde )
 {
 	int i;
 
@@ -153,15 +227,69 @@ __check_pgtable_permission ( struct mon_t *mon, struct linear_addr_t addr, struc
 		bit32u_t paddr;
 
 		paddr = ( pde.base.ptbl + i ) << 12;		
-		emulate_shared_memory_with_paddr ( mon, MEM_ACCESS_READ, paddr );
+		validate_pgtable_page ( mon, e, paddr );
+	}
+}
+
+static void
+read_pdir ( bit32u_t pdir_paddr, bit32u_t *pdir )
+{
+	int i;
+
+	for ( i = 0; i < NUM_OF_PDIR_ENTRIES; i++ ) {
+		bit32u_t v = Monitor_read_dword_with_paddr ( pdir_paddr + i * PDIR_ENTRY_SIZE );
+
+		/* only the base address and the present and page size flags matter */
+		pdir[i] = v & 0xfffff081;
 	}
 }
 
+static void
+check_pgtable_permission_all ( struct mon_t *mon, struct pgtable_cache_entry_t *e )
+{
+	struct linear_addr_t addr;
+
+	Mzero ( e->pages, PGTABLE_BITMAP_SIZE * sizeof ( bit32u_t ) );
+
+	addr.offset = 0;
+	for ( addr.dir = 0; addr.dir < NUM_OF_PDIR_ENTRIES; addr.dir++ ) {	
+		struct pdir_entry_t pde;
+		pde = Monitor_lookup_page_directory ( mon->regs, addr.dir );
+		__check_pgtable_permission ( mon, e, pde );
+	}
+
+	mon->stat.nr_pgtable_checks_full++; /* [STAT] */
+}
+
+/* Validate the pages of <e> invalidated in the generations ( e->gen, gen ].
+ * Return FALSE if the log has already been overwritten. */
+static bool_t
+check_pgtable_permission_diff ( struct mon_t *mon, struct pgtable_cache_entry_t *e, bit32u_t gen )
+{
+	bit32u_t g;
+
+	for ( g = e->gen + 1; g != gen + 1; g++ ) {
+		struct pgtable_log_entry_t *x = &pgtable_log[g % PGTABLE_LOG_SIZE];
+
+		if ( x->gen != g ) 
+			return FALSE;
+
+		if ( TEST_BIT ( e->pages[x->page_no / 32], x->page_no % 32 ) ) {
+			emulate_shared_memory_with_paddr ( mon, MEM_ACCESS_READ, page_no_to_paddr ( x->page_no ) );
+		}
+	}
+
+	mon->stat.nr_pgtable_checks_diff++; /* [STAT] */
+	return TRUE;
+}
+
 void
 check_pgtable_permission ( struct mon_t *mon, bit32u_t cr3 )
 {
 	struct cr3_t bkup;
-	struct linear_addr_t addr;
+	static bit32u_t pdir[NUM_OF_PDIR_ENTRIES];
+	struct pgtable_cache_entry_t *e;
+	bit32u_t gen;
 	int i;
 
 	ASSERT ( mon != NULL );
@@ -176,12 +304,34 @@ check_pgtable_permission ( struct mon_t *mon, bit32u_t cr3 )
 		emulate_shared_memory_with_paddr ( mon, MEM_ACCESS_READ, paddr );
 	}
 
-	addr.offset = 0;
-	for ( addr.dir = 0; addr.dir < NUM_OF_PDIR_ENTRIES; addr.dir++ ) {	
-		struct pdir_entry_t pde;
-		pde = Monitor_lookup_page_directory ( mon->regs, addr.dir );
-		__check_pgtable_permission ( mon, addr, pde );
+	/* [Note] The pages invalidated while validating are logged with
+	 * the generations after <gen>, so they are validated next time. */
+	gen = pgtable_gen;
+	read_pdir ( mon->regs->sys.cr3.base << 12, pdir );
+
+	e = &pgtable_cache[mon->regs->sys.cr3.base % PGTABLE_CACHE_SIZE];
+	if ( e->pages == NULL ) {
+		e->pages = Calloct ( PGTABLE_BITMAP_SIZE, bit32u_t );
+		e->pdir = Calloct ( NUM_OF_PDIR_ENTRIES, bit32u_t );
 	}
+
+	if ( ( e->is_valid ) && 
+	     ( e->cr3_base == mon->regs->sys.cr3.base ) &&
+	     ( Memcmp ( e->pdir, pdir, sizeof ( pdir ) ) == 0 ) && 
+	     ( gen - e->gen < PGTABLE_LOG_SIZE ) ) {
+		if ( e->gen == gen ) {
+			mon->stat.nr_pgtable_checks_skipped++; /* [STAT] */
+		} else if ( ! check_pgtable_permission_diff ( mon, e, gen ) ) {
+			check_pgtable_permission_all ( mon, e );
+		}
+	} else {
+		check_pgtable_permission_all ( mon, e );
+	}
+
+	e->is_valid = TRUE;
+	e->cr3_base = mon->regs->sys.cr3.base;
+	e->gen = gen;
+	Mmove ( e->pdir, pdir, sizeof ( pdir ) );
  
 	mon->regs->sys.cr3 = bkup;
 }
@@ -200,6 +350,14 @@ void
 check_pgtable_permission ( struct mon_t *mon, bit32u_t cr3 )
 { /* do nothing */ }
 
+void
+notify_pgtable_page_invalidated ( int page_no )
+{ /* do nothing */ }
+
+void
+flush_pgtable_permission_cache ( void )
+{ /* do nothing */ }
+
 #endif /* ENABLE_MP */
 
 static void
@@ -209,8 +367,10 @@ Monitor_raise_interrupt ( struct mon_t *mon, unsigned int ivector )
 
 	ASSERT ( mon != NULL );
 
+	begin_shared_memory_batch ( mon );
 	check_stack_permission_for_interrupt ( mon );
 	check_idt_permission ( mon, ivector );
+	end_shared_memory_batch ( mon );
 
 	saved_uregs = mon->regs->user; /* [STAT] */
 
@@ -246,12 +406,47 @@ VmHandlerKind_to_string ( vm_handler_kind_t kind )
 	return "";
 }
 
+/* [Note]
+ * The FPU state of the guest is transferred lazily.  Emulated
+ * instructions do not touch x87/SSE registers, but the emulation code
+ * in the guest process runs as a signal handler and clobbers them.
+ * The FPU state is therefore fetched only before entering the
+ * emulation mode and written back only before the guest resumes the
+ * native execution.
+ */
+static void
+save_fp_regs ( struct mon_t *mon )
+{
+	ASSERT ( mon != NULL );
+
+	if ( mon->fp_regs_is_saved )
+		return;
+
+	Ptrace_getfpregs ( mon->pid, &mon->fp_regs );
+	mon->fp_regs_is_saved = TRUE;
+	mon->stat.nr_fp_regs_fetches++;
+}
+
+static void
+restore_fp_regs ( struct mon_t *mon )
+{
+	ASSERT ( mon != NULL );
+
+	if ( ! mon->fp_regs_is_saved )
+		return;
+
+	Ptrace_setfpregs ( mon->pid, &mon->fp_regs );
+	mon->fp_regs_is_saved = FALSE;
+}
+
 static void
 setup_emulation_mode ( struct mon_t *mon, vm_handler_kind_t kind, va_list ap )
 {
 	ASSERT ( mon != NULL );
 	ASSERT ( mon->mode == NATIVE_MODE );
 
+	save_fp_regs ( mon );
+
 	mon->mode = EMULATION_MODE;
 
 	mon->shi->saved_esp = mon->regs->user.esp;
@@ -270,12 +465,7 @@ setup_emulation_mode ( struct mon_t *mon, vm_handler_kind_t kind, va_list ap )
 		break;
 		
 	case INVALIDATE_TLB:
-		break;
-		
 	case CHANGE_PAGE_PROT:
-		mon->shi->args.page_no = (int) va_arg ( ap, int );
-		break;
-
 	case UNMAP_ALL:
 	case RAISE_INT:
 	case PRINT_CR2:
@@ -297,7 +487,8 @@ wait_emulation ( struct mon_t *mon, int signo )
 		restart_vm ( mon, signo );
 		signo = trap_vm ( mon );
 
-		assert ( mon->regs->user.eip > VM_PMEM_BASE );
+		/* [Note] On SIGSTOP, the registers have already been handed over. */
+		assert ( ( signo == SIGSTOP ) || ( mon->regs->user.eip > VM_PMEM_BASE ) );
 		assert ( signo != SIGSEGV );
 			
 		handle_signal ( mon, signo );
@@ -351,18 +542,80 @@ run_emulation_code_of_vm2 ( struct mon_t *mon, int signo, vm_handler_kind_t kind
 	va_end ( ap );
 }
 
+/* [Note]
+ * The protection changes of the DSM are not applied one by one.  They
+ * are queued in <mon->shi->prot_ring> and the guest process applies
+ * all of them in a single entry to the emulation code, at the latest
+ * before the guest resumes the native execution.
+ */
+static void
+flush_page_prot_changes ( struct mon_t *mon )
+{
+	struct page_prot_ring_t *r;
+
+	ASSERT ( mon != NULL );
+
+	r = &mon->shi->prot_ring;
+	if ( ( r->head == r->tail ) && ( ! r->is_overflowed ) )
+		return;
+
+	run_emulation_code_of_vm ( mon, CHANGE_PAGE_PROT );
+	ASSERT ( r->head == r->tail );
+	ASSERT ( ! r->is_overflowed );
+}
+
+void
+queue_page_prot_change ( struct mon_t *mon, bit32u_t paddr )
+{
+	struct page_prot_ring_t *r;
+	unsigned int i;
+
+	ASSERT ( mon != NULL );
+
+	r = &mon->shi->prot_ring;
+
+	if ( r->is_overflowed ) {
+		/* all the pages are going to be updated */
+		mon->stat.nr_page_prot_changes_merged++; /* [STAT] */
+		return;
+	}
+
+	/* The guest process reads the state of the page when it applies
+	 * the change, so a page is queued only once. */
+	for ( i = r->head; i != r->tail; i++ ) {
+		if ( r->paddrs[i % PAGE_PROT_RING_SIZE] == paddr ) {
+			mon->stat.nr_page_prot_changes_merged++; /* [STAT] */
+			return;
+		}
+	}
+
+	if ( r->tail - r->head == PAGE_PROT_RING_SIZE ) {
+		/* [Note] The emulation code cannot be entered again while
+		 * the guest process is in it. */
+		if ( is_emulation_mode ( mon ) ) {
+			r->is_overflowed = TRUE;
+			mon->stat.nr_page_prot_changes++; /* [STAT] */
+			return;
+		}
+		flush_page_prot_changes ( mon );
+	}
+
+	r->paddrs[r->tail % PAGE_PROT_RING_SIZE] = paddr;
+	r->tail++;
+
+	mon->stat.nr_page_prot_changes++; /* [STAT] */
+}
+
 /****************************************************************/
 
 static bit16u_t saved_seg_reg_ds = 0x20, saved_seg_reg_es = 0x20;
 static bit32u_t saved_cr0 = 0x60000011;
 
 static void
-get_vm_regs ( struct mon_t *mon )
+sync_vm_regs ( struct mon_t *mon )
 {
 	ASSERT ( mon != NULL );
 
-	Ptrace_getregs ( mon->pid, &mon->regs->user );
-
 	/* [NOTE]
 	 * The flags of EFLGAS register are classified into two categories.
 	 * Some flags of the VM's EFLAGS register have the same value
@@ -389,6 +642,40 @@ get_vm_regs ( struct mon_t *mon )
 	}
 }
 
+static void
+get_vm_regs ( struct mon_t *mon )
+{
+	ASSERT ( mon != NULL );
+
+	Ptrace_getregs ( mon->pid, &mon->regs->user );
+	sync_vm_regs ( mon );
+}
+
+/* [Note]
+ * When the emulation code of the guest process finishes, it stores
+ * the register state of the interrupted context at <mon->shi->retval>
+ * and raises SIGSTOP (see quit_emulation() in vm/main.c).  The
+ * registers of the signal handler itself are never used, so we take
+ * the registers from the shared info instead of PTRACE_GETREGS.
+ */
+static bool_t
+is_regs_handed_over ( struct mon_t *mon, int signo )
+{
+	ASSERT ( mon != NULL );
+	return ( ( is_emulation_mode ( mon ) ) && ( signo == SIGSTOP ) );
+}
+
+static void
+get_handed_over_vm_regs ( struct mon_t *mon )
+{
+	ASSERT ( mon != NULL );
+
+	UserRegs_set_from_sigcontext ( &mon->regs->user, &mon->shi->retval );
+	sync_vm_regs ( mon );
+
+	mon->stat.nr_getregs_avoided++; /* [STAT] */
+}
+
 static void
 set_vm_regs ( struct mon_t *mon )
 {
@@ -415,7 +702,13 @@ trap_vm ( struct mon_t *mon )
 	ASSERT ( mon != NULL );
 
 	for ( ; ; ) {
+#ifdef ENABLE_MP
+		Comm_set_monitor_state ( mon->comm, MONITOR_WAITING_GUEST );
+		signo = Ptrace_trap ( mon->pid );
+		Comm_set_monitor_state ( mon->comm, MONITOR_RUNNING );
+#else
 		signo = Ptrace_trap ( mon->pid );
+#endif
 
 		if ( signo != SIGUSR1 ) 
 			break;
@@ -425,7 +718,11 @@ trap_vm ( struct mon_t *mon )
 		__restart_vm ( mon, signo );
 	}
 
-	get_vm_regs ( mon );
+	if ( is_regs_handed_over ( mon, signo ) ) {
+		get_handed_over_vm_regs ( mon );
+	} else {
+		get_vm_regs ( mon );
+	}
 
 	if ( mon->mode == NATIVE_MODE ) {
 		Pit_stop_timer ( &mon->devs.pit );
@@ -463,9 +760,14 @@ restart_vm ( struct mon_t *mon, int signo )
 {
 	ASSERT ( mon != NULL );
 
+	if ( mon->mode == NATIVE_MODE ) {
+		flush_page_prot_changes ( mon );
+	}
+
 	set_vm_regs ( mon );
 
 	if ( mon->mode == NATIVE_MODE ) {
+		restore_fp_regs ( mon );
 		Pit_restart_timer ( &mon->devs.pit ); 
 	}
 
@@ -504,7 +806,9 @@ deliver_pagefault_to_guest_process ( struct mon_t *mon, bit32u_t cr2 )
 	ASSERT ( mon != NULL );
 
 #if 1
+	begin_shared_memory_batch ( mon );
 	check_stack_permission_for_interrupt ( mon ); 
+	end_shared_memory_batch ( mon );
 	check_pgtable_permission ( mon, mon->regs->sys.cr3.val ); // ??? 
 #endif
 
@@ -628,7 +932,9 @@ to_ram ( struct mon_t *mon, struct mem_access_t *x, bit32u_t paddr, bool_t read_
 	}
 		
 	bool_t f;
-	f = emulate_shared_memory_with_vaddr ( mon, x->kind, paddr, x->vaddr );
+	f = ( ( x->overwrites_page )
+	      ? emulate_shared_memory_to_overwrite_page ( mon, paddr, x->vaddr )
+	      : emulate_shared_memory_with_vaddr ( mon, x->kind, paddr, x->vaddr ) );
 	if ( f ) { return SHMEM_EMULATION; }
 	
 	if ( is_write_privilege_violation ( x->kind, read_write ) ) {
@@ -746,6 +1052,9 @@ try_handle_signal_by_mem_access ( struct mon_t *mon, struct instruction_t *i )
 	p = i->maccess ( mon, i );;
 	p = MemAccess_add_instruction_fetch ( p, i->len, mon->regs->user.eip ); // $B$$$i$J$$!)(B
 
+	/* the pages of all the accesses are fetched in parallel */
+	begin_shared_memory_batch ( mon );
+
 	while ( p != NULL ) {
 		struct mem_access_t *next;
 		struct segv_info_t x;
@@ -765,6 +1074,8 @@ try_handle_signal_by_mem_access ( struct mon_t *mon, struct instruction_t *i )
 		p = next;
 	}
 
+	end_shared_memory_batch ( mon );
+
 	return ret;
 }
 
@@ -951,10 +1262,14 @@ handle_sigill ( struct mon_t *mon, int signo )
      
 	saved_eip = mon->regs->user.eip;
 	skip_undefined_instruction ( mon );
-	i = decode_instruction ( mon->regs->user.eip );
+	i = decode_instruction ( mon, mon->regs->user.eip );
 
 	ASSERT ( ( i.is_sensitive ) || ( i.is_locked ) );
 
+	if ( ( i.is_locked ) && ( try_execute_atomic_remotely ( mon, &i ) ) ) {
+		return;
+	}
+
 	b = check_instr_fetch ( mon, &i, saved_eip );
 	if ( b ) { return; }
 
@@ -1009,7 +1324,7 @@ __handle_other_signals ( struct mon_t *mon, int signo )
 	struct instruction_t i;
 	struct segv_info_t si;
 
-	i = decode_instruction ( mon->regs->user.eip );
+	i = decode_instruction ( mon, mon->regs->user.eip );
 
 	assert ( i.opcode != INVALID_OPCODE );
 
@@ -1039,8 +1354,13 @@ __handle_other_signals ( struct mon_t *mon, int signo )
 		/* necessary emulation procedure has been done. */
 		break;
 
-	case HDMEM_EMULATION:
 	case APIC_EMULATION:
+		/* may send an IPI */
+		flush_page_diffs ( mon );
+		emulate_instruction ( mon, &i );
+		break;
+
+	case HDMEM_EMULATION:
 		emulate_instruction ( mon, &i );
 		break;
 
@@ -1204,6 +1524,7 @@ try_generate_interrupt ( struct mon_t *mon )
 	ivec = __try_generate_interrupt ( mon );
 
 	if ( ivec >= 0 ) {
+		flush_page_diffs ( mon );
 		Monitor_raise_interrupt ( mon, ivec );
 	}
 }
@@ -1224,6 +1545,7 @@ Monitor_finalize ( int status, void *arg )
 	struct mon_t *mon = (struct mon_t *) arg;
 
 	Vga_destroy ( &mon->devs.vga );
+	close_home_trace ( );
 
 #if 0
 	Stat_print ( stdout, &mon->stat );
@@ -1388,23 +1710,21 @@ __monitor_run ( struct mon_t *mon )
 {
 	int signo;
 	static bool_t is_kernel_mode = FALSE;
-	struct user_i387_struct fp_regs;
 
 	{ 
 		signo = trap_vm ( mon );
 		ASSERT ( mon->regs->user.eip <= VM_PMEM_BASE );
 		
 		__monitor_run_stat_pre ( mon, is_kernel_mode ); /* [STAT] */
-		
-		Ptrace_getfpregs ( mon->pid, &fp_regs );
 	}
 
 	____monitor_run ( mon, signo );
 
 	{
-		Ptrace_setfpregs ( mon->pid, &fp_regs );
-		
 		/* [STAT] */
+		if ( ! mon->fp_regs_is_saved ) {
+			mon->stat.nr_fp_regs_fetches_avoided++;
+		}
 		is_kernel_mode = cpl_is_supervisor_mode ( mon->regs );
 		__monitor_run_stat_post ( mon, is_kernel_mode );
 		
@@ -11,7 +11,7 @@ handle_msg_apic_logical_id ( struct mon_t *mon, struct msg_t *msg )
 	ASSERT ( mon->local_apic != NULL );
 	ASSERT ( x != NULL );
 
-	assert ( ( 0 <= x->src_apic_id ) && ( x->src_apic_id < NUM_OF_PROCS ) );
+	assert ( ( 0 <= x->src_apic_id ) && ( x->src_apic_id < get_num_of_procs ( ) ) );
 	mon->local_apic->logical_id_map[x->src_apic_id] = x->logical_id;
 }
 
@@ -43,17 +43,20 @@ handle_msg_mem_image_request ( struct mon_t *mon, struct msg_t *msg )
 
 	for ( i = 0; i < mon->pmem.ram_offset; i += LEN ) {
 		size_t n;
-		struct msg_t *msg;
+		struct iovec iov[2];
 	 
 		n = ( i + LEN < mon->pmem.ram_offset ) ? LEN : mon->pmem.ram_offset - i;
-		msg = Msg_create ( MSG_KIND_MEM_IMAGE_RESPONSE, 
-				   n, ( void * ) ( mon->pmem.base + i ) );
-		Comm_send ( mon->comm, msg, src_id );
-		Msg_destroy ( msg );
+
+		/* sent straight from pmem */
+		iov[0].iov_base = ( void * ) ( mon->pmem.base + i );
+		iov[0].iov_len = n;
+		Comm_sendv ( mon->comm, MSG_KIND_MEM_IMAGE_RESPONSE, iov, 1, src_id );
 
 		DPRINT2 ( "%#x / %#lx\r", i + n, mon->pmem.ram_offset ); 
 	}
 	DPRINT2 ( "\n" ); 
+
+	grant_immutable_pages ( mon, src_id );
 }
 
 /****************************************************************/
@@ -88,7 +91,7 @@ send_input_port_ack ( struct mon_t *mon, struct msg_input_port_t *x, bit32u_t va
 #else
 	irq = IRQ_INVALID;
 #endif
-	msg = Msg_create3 ( MSG_KIND_INPUT_PORT_ACK, x->addr, ( int )val, x->len, irq );
+	msg = Msg_create_input_port_ack ( x->addr, ( int )val, x->len, irq );
 	Comm_send ( mon->comm, msg, src_id );
 	Msg_destroy ( msg );
 }
@@ -125,7 +128,7 @@ send_output_port_ack ( struct mon_t *mon, struct msg_output_port_t *x, int src_i
 #else
 	irq = IRQ_INVALID;
 #endif
-	msg = Msg_create3 ( MSG_KIND_OUTPUT_PORT_ACK, x->addr, x->len, irq );
+	msg = Msg_create_output_port_ack ( x->addr, x->len, irq );
 	Comm_send ( mon->comm, msg, src_id );
 	Msg_destroy ( msg );
 }
@@ -188,6 +191,13 @@ static struct mhandler_entry_t mhandler_map[] =
   { MSG_KIND_PAGE_FETCH_ACK, &handle_fetch_ack },
   { MSG_KIND_PAGE_INVALIDATE_REQUEST, &handle_invalidate_request },
   { MSG_KIND_PAGE_FETCH_ACK_ACK, &handle_fetch_ack_ack },  
+  { MSG_KIND_PAGE_PREFETCH_REJECT, &handle_prefetch_reject },
+  { MSG_KIND_PAGE_DIFF, &handle_page_diff },
+  { MSG_KIND_PAGE_DIFF_ACK, &handle_page_diff_ack },
+  { MSG_KIND_PAGE_MODE_CHANGE, &handle_page_mode_change },
+  { MSG_KIND_PAGE_HOME_MIGRATE, &handle_page_home_migrate },
+  { MSG_KIND_REMOTE_ATOMIC, &handle_remote_atomic },
+  { MSG_KIND_REMOTE_ATOMIC_ACK, &handle_remote_atomic_ack },
 
   { MSG_KIND_INPUT_PORT, &handle_msg_input_port },
   { MSG_KIND_OUTPUT_PORT, &handle_msg_output_port },
@@ -26,6 +26,9 @@ struct mon_t {
 	int			cpuid;
 	struct pmem_t		pmem; 	/* physical memory */
 	struct regs_t 		*regs; 	/* general register file */
+	struct user_i387_struct	fp_regs;	/* FPU state of the guest process
+						 * (valid only if <fp_regs_is_saved>) */
+	bool_t			fp_regs_is_saved;
 	struct devices_t	devs;
 	
 	struct local_apic_t	*local_apic;
@@ -45,6 +48,8 @@ struct mon_t {
 	struct stat_t		stat;
 
 	bool_t 			wait_ipi;
+	struct event_t		halt_event;	/* signaled on events that may
+						 * wake up the halted processor */
 	bit32u_t 		emu_stack_base;
 };
 
@@ -64,7 +69,11 @@ inline void     Monitor_write_word_with_paddr(bit32u_t paddr, bit16u_t value);
 inline void     Monitor_write_dword_with_paddr(bit32u_t paddr, bit32u_t value);
 inline void     Monitor_write_with_paddr(bit32u_t paddr, bit32u_t value, size_t len);
 
+bit32u_t        Monitor_try_laddr_to_paddr ( bit32u_t laddr, bool_t *is_ok );
+bit32u_t        Monitor_try_laddr_to_paddr2 ( bit32u_t laddr, bool_t *is_ok, bool_t *read_write );
 inline bit32u_t Monitor_laddr_to_paddr ( bit32u_t laddr );
+void            Monitor_flush_tlb ( void );
+void            Monitor_invalidate_tlb_entry ( bit32u_t laddr );
 inline bit32u_t Monitor_paddr_to_raddr ( bit32u_t paddr );
 inline bit32u_t Monitor_laddr_to_raddr ( bit32u_t laddr );
 inline bit32u_t Monitor_vaddr_to_raddr ( seg_reg_index_t i, bit32u_t vaddr );
@@ -117,7 +126,10 @@ void Monitor_mmove_wr ( bit32u_t paddr, void *from_addr, size_t len );
 void mem_check_for_dma_access ( bit32u_t paddr );
 
 /*** decode.c ***/
-struct instruction_t decode_instruction(bit32u_t eip);
+struct instruction_t decode_instruction(struct mon_t *mon, bit32u_t eip);
+void DecodeCache_flush ( void );
+void DecodeCache_invalidate_laddr ( bit32u_t laddr );
+void DecodeCache_invalidate_paddr ( bit32u_t paddr );
 
 /* arith.c */
 enum arith_kind {
@@ -404,13 +416,31 @@ void Monitor_migrate ( struct mon_t *mon, struct node_t dest, char *new_config )
 /*** shmem.c ***/
 bool_t emulate_shared_memory_with_vaddr ( struct mon_t *mon, mem_access_kind_t kind, bit32u_t paddr, bit32u_t vaddr );
 bool_t emulate_shared_memory_with_paddr ( struct mon_t *mon, mem_access_kind_t kind, bit32u_t paddr );
+bool_t emulate_shared_memory_to_overwrite_page ( struct mon_t *mon, bit32u_t paddr, bit32u_t vaddr );
+void begin_shared_memory_batch ( struct mon_t *mon );
+void end_shared_memory_batch ( struct mon_t *mon );
+void grant_immutable_pages ( struct mon_t *mon, int dest_id );
+void accept_immutable_pages ( struct mon_t *mon, struct msg_t *msg );
 void sync_shared_memory(struct mon_t *mon, struct instruction_t *i);
+bool_t try_execute_atomic_remotely ( struct mon_t *mon, struct instruction_t *i );
 void try_handle_pending_fetch_requests ( struct mon_t *mon );
 
 void handle_fetch_ack_ack ( struct mon_t *mon, struct msg_t *msg );
 void handle_fetch_ack ( struct mon_t *mon, struct msg_t *msg );
 void handle_invalidate_request ( struct mon_t *mon, struct msg_t *msg );
 void handle_fetch_request ( struct mon_t *mon, struct msg_t *msg );
+void handle_prefetch_reject ( struct mon_t *mon, struct msg_t *msg );
+void handle_page_diff ( struct mon_t *mon, struct msg_t *msg );
+void handle_page_diff_ack ( struct mon_t *mon, struct msg_t *msg );
+void handle_page_mode_change ( struct mon_t *mon, struct msg_t *msg );
+void handle_page_home_migrate ( struct mon_t *mon, struct msg_t *msg );
+void close_home_trace ( void );
+void handle_remote_atomic ( struct mon_t *mon, struct msg_t *msg );
+void handle_remote_atomic_ack ( struct mon_t *mon, struct msg_t *msg );
+
+void init_page_modes ( struct mon_t *mon, const struct config_t *config );
+void set_page_mode ( struct mon_t *mon, int from_page_no, int to_page_no, bool_t is_multiple_writer );
+void flush_page_diffs ( struct mon_t *mon );
 
 void wait_recvable_msg ( struct mon_t *mon, int sleep_time );
 
@@ -423,8 +453,11 @@ inline bool_t is_application_proc(struct mon_t* mon);
 inline void cancel_signal_delivery(struct mon_t *mon);
 
 void check_pgtable_permission ( struct mon_t *mon, bit32u_t cr3 );
+void notify_pgtable_page_invalidated ( int page_no );
+void flush_pgtable_permission_cache ( void );
 
 void run_emulation_code_of_vm(struct mon_t *mon, vm_handler_kind_t kind, ...);
+void queue_page_prot_change ( struct mon_t *mon, bit32u_t paddr );
 void emulate_fault(struct mon_t *mon);
 int  trap_vm(struct mon_t *mon);
 void handle_msg(struct mon_t *mon, struct msg_t *msg);
@@ -5,6 +5,8 @@
 
 static struct mon_t *static_mon = NULL;
 
+void notify_write_with_paddr ( bit32u_t paddr );
+
 static struct pmem_t 
 pmem_init ( int cpuid )
 {
@@ -234,6 +236,7 @@ Monitor_write_ ## unit ## _with_paddr ( bit32u_t paddr, value_type value ) \
 	if ( paddr < mon->pmem.ram_offset ) { \
 		check_write ( mon, paddr, len ); \
 		write_ ## unit ( paddr, value, &Monitor_paddr_to_raddr ); \
+		notify_write_with_paddr ( paddr ); \
 		return; \
 	} \
 \
@@ -246,13 +249,188 @@ DEFINE_MONITOR_WRITE_PADDR_FUNC(dword, bit32u_t, 4)
 
 /***********************************/
 
-inline bit32u_t
-Monitor_laddr_to_paddr ( bit32u_t laddr )
+/*
+ * Software TLB
+ *
+ * Every Monitor_*_with_laddr/vaddr access used to walk the page
+ * directory and the page table of the guest.  The translation of the
+ * recently used pages is cached here, together with the R/W bit.
+ *
+ * [Note]
+ * As with the real hardware, the guest has to reload CR3 or execute
+ * INVLPG after it modifies a present page table entry.  The only
+ * exception is a read-only entry that is made writable, for which the
+ * hardware re-walks the page tables on the page fault.  So a cached
+ * read-only entry is never trusted when the R/W bit is asked for.
+ */
+
+enum {
+	SOFT_TLB_SIZE		= 512 /* must be a power of 2 */
+};
+
+struct soft_tlb_entry_t {
+	bool_t		is_valid;
+	bit32u_t	cr3;
+	bit32u_t	lpage;		/* linear page number */
+	bit32u_t	ppage;		/* physical page number */
+	bool_t		read_write;
+	int		ptbl_page_no;	/* -1 if the page is a 4MB page */
+};
+
+static struct soft_tlb_entry_t soft_tlb[SOFT_TLB_SIZE];
+
+/* non-zero if some entry of the TLB was filled from the page-table page */
+static bit8u_t soft_tlb_pgtable_pages[PMEM_SIZE / PAGE_SIZE_4K];
+
+static struct soft_tlb_entry_t *
+soft_tlb_entry ( bit32u_t laddr )
+{
+	return &soft_tlb[SUB_BIT ( laddr, 12, 20 ) & ( SOFT_TLB_SIZE - 1 )];
+}
+
+static void
+mark_pgtable_page ( bit32u_t paddr )
+{
+	int page_no = paddr_to_page_no ( paddr );
+
+	if ( page_no < PMEM_SIZE / PAGE_SIZE_4K ) 
+		soft_tlb_pgtable_pages[page_no] = 1;
+}
+
+static void
+fill_soft_tlb ( struct mon_t *mon, bit32u_t laddr, bit32u_t paddr, bool_t read_write )
+{
+	struct soft_tlb_entry_t *e;
+	struct pdir_entry_t pde;
+
+	ASSERT ( mon != NULL );
+
+	pde = lookup_page_directory ( mon->regs, SUB_BIT ( laddr, 22, 10 ), &Monitor_paddr_to_raddr );
+
+	e = soft_tlb_entry ( laddr );
+	e->is_valid = TRUE;
+	e->cr3 = mon->regs->sys.cr3.val;
+	e->lpage = SUB_BIT ( laddr, 12, 20 );
+	e->ppage = SUB_BIT ( paddr, 12, 20 );
+	e->read_write = read_write;
+	e->ptbl_page_no = ( pde.page_size ) ? -1 : pde.base.ptbl;
+
+	mark_pgtable_page ( pde.paddr );
+	if ( ! pde.page_size ) 
+		mark_pgtable_page ( pde.base.ptbl << 12 );
+}
+
+static bit32u_t
+try_laddr_to_paddr_with_tlb ( bit32u_t laddr, bool_t *is_ok, bool_t *read_write, bool_t need_read_write )
 {
 	struct mon_t *mon = static_mon;
+	struct soft_tlb_entry_t *e;
+	bit32u_t paddr;
 
 	ASSERT ( mon != NULL );
-	return translate_laddr_to_paddr ( mon->regs, laddr, &Monitor_paddr_to_raddr );
+	ASSERT ( is_ok != NULL );
+	ASSERT ( read_write != NULL );
+
+	if ( ! paging_is_enabled ( mon->regs ) ) {
+		*is_ok = TRUE;
+		*read_write = TRUE;
+		return laddr;
+	}
+
+	e = soft_tlb_entry ( laddr );
+	if ( ( e->is_valid ) &&
+	     ( e->lpage == SUB_BIT ( laddr, 12, 20 ) ) && 
+	     ( e->cr3 == mon->regs->sys.cr3.val ) &&
+	     ( ( e->read_write ) || ( ! need_read_write ) ) ) {
+		mon->stat.nr_soft_tlb_hits++; /* [STAT] */
+		*is_ok = TRUE;
+		*read_write = e->read_write;
+		return ( e->ppage << 12 ) | SUB_BIT ( laddr, 0, 12 );
+	}
+
+	mon->stat.nr_soft_tlb_misses++; /* [STAT] */
+	paddr = try_translate_laddr_to_paddr2 ( mon->regs, laddr, &Monitor_paddr_to_raddr, is_ok, read_write );
+	if ( *is_ok ) {
+		fill_soft_tlb ( mon, laddr, paddr, *read_write );
+	}
+	return paddr;
+}
+
+void
+Monitor_flush_tlb ( void )
+{
+	int i;
+
+	for ( i = 0; i < SOFT_TLB_SIZE; i++ ) {
+		soft_tlb[i].is_valid = FALSE;
+	}
+	Mzero ( soft_tlb_pgtable_pages, sizeof ( soft_tlb_pgtable_pages ) );
+}
+
+void
+Monitor_invalidate_tlb_entry ( bit32u_t laddr )
+{
+	struct soft_tlb_entry_t *e = soft_tlb_entry ( laddr );
+
+	if ( e->lpage == SUB_BIT ( laddr, 12, 20 ) )
+		e->is_valid = FALSE;
+}
+
+/* called whenever the monitor writes to the page of <paddr> */
+static void
+invalidate_tlb_by_pgtable_write ( bit32u_t paddr )
+{
+	int page_no = paddr_to_page_no ( paddr );
+	int i;
+
+	if ( ( page_no >= PMEM_SIZE / PAGE_SIZE_4K ) || ( soft_tlb_pgtable_pages[page_no] == 0 ) )
+		return;
+
+	/* [Note] A write to a page directory invalidates all the entries. */
+	for ( i = 0; i < SOFT_TLB_SIZE; i++ ) {
+		struct soft_tlb_entry_t *e = &soft_tlb[i];
+
+		if ( ( e->ptbl_page_no == page_no ) || ( ( e->cr3 >> 12 ) == page_no ) )
+			e->is_valid = FALSE;
+	}
+	soft_tlb_pgtable_pages[page_no] = 0;
+}
+
+/* [Note] not static, as the inline Monitor_write_*_with_paddr () call it. */
+void
+notify_write_with_paddr ( bit32u_t paddr )
+{
+	invalidate_tlb_by_pgtable_write ( paddr );
+	DecodeCache_invalidate_paddr ( paddr );
+}
+
+bit32u_t
+Monitor_try_laddr_to_paddr ( bit32u_t laddr, bool_t *is_ok )
+{
+	bool_t read_write;
+
+	return try_laddr_to_paddr_with_tlb ( laddr, is_ok, &read_write, FALSE );
+}
+
+bit32u_t
+Monitor_try_laddr_to_paddr2 ( bit32u_t laddr, bool_t *is_ok, bool_t *read_write )
+{
+	return try_laddr_to_paddr_with_tlb ( laddr, is_ok, read_write, TRUE );
+}
+
+inline bit32u_t
+Monitor_laddr_to_paddr ( bit32u_t laddr )
+{
+	bit32u_t paddr;
+	bool_t is_ok;
+
+	paddr = Monitor_try_laddr_to_paddr ( laddr, &is_ok );
+
+	if ( ! is_ok )
+		Fatal_failure ( "Monitor_laddr_to_paddr: "
+				"pde/pte is not present: laddr=%#x\n", laddr );
+
+	return paddr;
 }
 
 inline bit32u_t
@@ -375,41 +553,34 @@ Monitor_vaddr_to_laddr ( seg_reg_index_t index, bit32u_t vaddr )
 inline bit32u_t
 Monitor_try_vaddr_to_paddr ( seg_reg_index_t index, bit32u_t vaddr, bool_t *is_ok )
 {
-	struct mon_t *mon = static_mon;     
 	bit32u_t laddr;
 
-	ASSERT ( mon != NULL );
 	ASSERT ( is_ok != NULL );
 
 	laddr = Monitor_vaddr_to_laddr ( index, vaddr );
-	return try_translate_laddr_to_paddr ( mon->regs, laddr, &Monitor_paddr_to_raddr, is_ok );
+	return Monitor_try_laddr_to_paddr ( laddr, is_ok );
 }
 
 inline bit32u_t
 Monitor_try_vaddr_to_paddr2 ( seg_reg_index_t index, bit32u_t vaddr, bool_t *is_ok, bool_t *read_write )
 {
-	struct mon_t *mon = static_mon;     
 	bit32u_t laddr;
 
-	ASSERT ( mon != NULL );
 	ASSERT ( is_ok != NULL );
 	ASSERT ( read_write != NULL );
 
 	laddr = Monitor_vaddr_to_laddr ( index, vaddr );
-	return try_translate_laddr_to_paddr2 ( mon->regs, laddr, &Monitor_paddr_to_raddr, is_ok, read_write );
+	return Monitor_try_laddr_to_paddr2 ( laddr, is_ok, read_write );
 }
 
 
 inline bit32u_t
 Monitor_vaddr_to_paddr ( seg_reg_index_t index, bit32u_t vaddr )
 {
-	struct mon_t *mon = static_mon;     
 	bit32u_t laddr;
 
-	ASSERT ( mon != NULL );
-
 	laddr = Monitor_vaddr_to_laddr ( index, vaddr );
-	return translate_laddr_to_paddr ( mon->regs, laddr, &Monitor_paddr_to_raddr );
+	return Monitor_laddr_to_paddr ( laddr );
 }
 
 static seg_reg_index_t 	trans_arg_index;
@@ -641,8 +812,15 @@ Monitor_set_seg_reg2 ( struct regs_t *regs, seg_reg_index_t index, bit16u_t val
 bool_t
 Monitor_check_mem_access_with_laddr ( const struct regs_t *regs, bit32u_t laddr )
 {
+	bool_t is_ok;
+
 	ASSERT ( regs != NULL );
-	return check_mem_access ( regs, laddr, &Monitor_paddr_to_raddr );
+
+	if ( regs != static_mon->regs )
+		return check_mem_access ( regs, laddr, &Monitor_paddr_to_raddr );
+
+	( void ) Monitor_try_laddr_to_paddr ( laddr, &is_ok );
+	return is_ok;
 }
 
 bool_t
@@ -729,6 +907,7 @@ Monitor_mmove ( bit32u_t paddr, void *addr, size_t len, mem_access_kind_t kind )
 			break;
 		case MEM_ACCESS_WRITE:
 			Mmove ( (void *)(mon->pmem.base + p ), addr + offset, n );
+			notify_write_with_paddr ( p );
 			break;
 		default:
 			Match_failure ( "Monitor_mmove" );
@@ -762,7 +941,13 @@ void
 Monitor_mmove_wr ( bit32u_t paddr, void *from_addr, size_t len )
 {
 	struct mon_t *mon = static_mon;	
+	bit32u_t p;
+
 	Mmove ( (void *)(mon->pmem.base + paddr ), from_addr, len );
+
+	for ( p = BIT_ALIGN ( paddr, 12 ); p < paddr + len; p += PAGE_SIZE_4K ) {
+		notify_write_with_paddr ( p );
+	}
 }
 
 #endif /* ENABLE_MP */
@@ -743,6 +743,7 @@ __pit_poll ( struct mon_t *mon )
 
 	if ( ( is_native_mode ( mon ) ) && ( Pit_check_irq ( pit ) ) ) {
 		Kill ( mon->pid, SIGALRM );
+		Event_signal ( &mon->halt_event );
 	}
 }
 
@@ -17,6 +17,11 @@ need_wakeup ( struct mon_t *mon )
 void
 hlt ( struct mon_t *mon, struct instruction_t *instr )
 { 
+#ifdef ENABLE_MP
+	bool_t is_signaled = FALSE;
+	bit64u_t signaled_at = 0;
+#endif /* ENABLE_MP */
+
 	Pit_restart_timer ( &mon->devs.pit );
 
 #ifdef ENABLE_MP
@@ -28,18 +33,38 @@ hlt ( struct mon_t *mon, struct instruction_t *instr )
 
 	mon->wait_ipi = TRUE;
 
+	/* [Note] The processor sleeps on <mon->halt_event>, which is
+	 * signaled by the message receiver, the timers and the serial
+	 * receiver.  The timeout only covers the wake-up conditions that
+	 * are not signaled (e.g. the IRQ of the hard drive).  The
+	 * devices signal it whether the processor is halted or not, so a
+	 * signal left from before the halt is dropped first; otherwise
+	 * the first wait returns at once and the wake-up latency is
+	 * counted from that stale signal.  The messages that arrived
+	 * before the reset are handled next, since their signal is gone
+	 * and they would otherwise wait for the timeout. */
+	Event_reset ( &mon->halt_event );
+	Comm_set_monitor_state ( mon->comm, MONITOR_HALTED );
+	try_handle_msgs ( mon );
 	while ( ! need_wakeup ( mon ) ) {
-#if 0
-		/* kernel 2.6 $B$@$H;_$^$C$F$7$^$&(B */
-		/* [???] Should sleep_time be same as timer interrupt interval? */
-		enum { SLEEP_TIME = 10000 }; /*  10,000 nano seconds = 10 milli seconds */
-		wait_recvable_msg ( mon, SLEEP_TIME );
-		try_handle_msgs ( mon );
-#else
-		/* [DEBUG] */
-		usleep ( 1 );
+		enum { HALT_TIMEOUT = 1000 }; /* 1,000 micro seconds = 1 milli second */
+
+		is_signaled = Event_timedwait ( &mon->halt_event, HALT_TIMEOUT, &signaled_at );
 		try_handle_msgs ( mon );
-#endif
+	}
+	Comm_set_monitor_state ( mon->comm, MONITOR_RUNNING );
+
+	/* [STAT] */
+	if ( is_signaled ) {
+		bit64u_t now, d;
+
+		rdtsc ( now );
+		d = now - signaled_at;
+		mon->stat.nr_halt_wakeups++;
+		mon->stat.halt_wakeup_latency_count += d;
+		if ( d > mon->stat.max_halt_wakeup_latency_count ) {
+			mon->stat.max_halt_wakeup_latency_count = d;
+		}
 	}
 
 	stop_time_counter ( &mon->stat.halt_counter );
@@ -212,11 +237,15 @@ mov_cd_rd ( struct mon_t *mon, struct instruction_t *instr )
 	case 0: 
 		check_pgtable_permission ( mon, mon->regs->sys.cr3.val );
 		run_emulation_code_of_vm ( mon, SET_CNTL_REG, instr->reg, val_32 );
+		Monitor_flush_tlb ( );
+		DecodeCache_flush ( );
 		break;
 
 	case 3: 
 		check_pgtable_permission ( mon, val_32 );
 		run_emulation_code_of_vm ( mon, SET_CNTL_REG, instr->reg, val_32 );
+		Monitor_flush_tlb ( );
+		DecodeCache_flush ( );
 		break;
 	case 1:
 		ASSERT ( 0 ); 
@@ -226,6 +255,8 @@ mov_cd_rd ( struct mon_t *mon, struct instruction_t *instr )
 		break;
 	case 4:
 		mon->regs->sys.cr4 = Cr4_of_bit32u ( val_32 ); 
+		Monitor_flush_tlb ( );
+		DecodeCache_flush ( );
 		break;
 	default: 
 		Match_failure ( "mon_cd_rd\n" );
@@ -199,9 +199,16 @@ void verw_ew(struct mon_t *mon, struct instruction_t *instr) { assert(0); }
 void
 invlpg(struct mon_t *mon, struct instruction_t *instr)
 {
+     bit32u_t vaddr, laddr;
+
      ASSERT(mon != NULL);
      ASSERT(instr != NULL);
 
+     vaddr = instr->resolve ( instr, &mon->regs->user );
+     laddr = Monitor_vaddr_to_laddr ( instr->sreg_index, vaddr );
+     Monitor_invalidate_tlb_entry ( laddr );
+     DecodeCache_invalidate_laddr ( laddr );
+
      check_pgtable_permission ( mon, mon->regs->sys.cr3.val );
      run_emulation_code_of_vm(mon, INVALIDATE_TLB);
      skip_instr(mon, instr); 
@@ -39,6 +39,7 @@ Com_receiver_sub ( struct com_t *com )
 
 //	Print_color ( stdout, CYAN, "read = \"%c\"\n", c ); // [DEBUG] 
 	Kill ( com->pid, SIGUSR2 );
+	Event_signal ( com->event );
 }
 
 static void *
@@ -58,7 +59,7 @@ Com_receiver ( void *arg )
 /****************************************************************/
 
 static void
-Com_init ( struct com_t *com, pid_t pid, int i, bool_t is_bootstrap )
+Com_init ( struct com_t *com, pid_t pid, struct event_t *event, int i, bool_t is_bootstrap )
 {
 	ASSERT ( com != NULL );
 
@@ -92,20 +93,21 @@ Com_init ( struct com_t *com, pid_t pid, int i, bool_t is_bootstrap )
 	Pthread_mutex_init ( &com->mp, NULL );
 	Pthread_cond_init ( &com->cond, NULL );
 	com->pid = pid;
+	com->event = event;
 
 	if ( com->is_enabled )
 		Pthread_create ( &com->tid, NULL, &Com_receiver, ( void *) com );
 }
 	
 void
-Coms_init ( struct com_t coms[], pid_t pid, bool_t is_bootstrap )
+Coms_init ( struct com_t coms[], pid_t pid, struct event_t *event, bool_t is_bootstrap )
 {
 	int i;
 
 	ASSERT ( coms != NULL );
 
 	for ( i = 0; i < NUM_OF_COMS; i++ )
-		Com_init ( &coms[i], pid, i, is_bootstrap );
+		Com_init ( &coms[i], pid, event, i, is_bootstrap );
 }
 
 
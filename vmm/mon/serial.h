@@ -39,9 +39,10 @@ struct com_t {
 	pthread_mutex_t		mp;
 	pthread_cond_t		cond;
 	pid_t			pid;
+	struct event_t		*event;
 };
 
-void    Coms_init ( struct com_t coms[], pid_t pid, bool_t is_bootstrap );
+void    Coms_init ( struct com_t coms[], pid_t pid, struct event_t *event, bool_t is_bootstrap );
 void    Coms_pack ( struct com_t coms[], int fd );
 void    Coms_unpack ( struct com_t coms[], int fd );
 bit8u_t Coms_read ( struct com_t coms[], bit16u_t addr, size_t len );
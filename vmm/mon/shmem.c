@@ -1,4 +1,5 @@
 #include "vmm/mon/mon.h"
+#include <string.h>
 
 #ifdef ENABLE_MP
 
@@ -6,6 +7,7 @@ struct shm_arg_t {
 	mem_access_kind_t 	kind;
 	int 			page_no;
 	struct page_descr_t 	*pdescr;
+	bool_t			no_data; /* the whole page is about to be overwritten */
 };
 
 #if 1
@@ -58,7 +60,7 @@ page_is_accesible ( const struct page_descr_t *pdescr, mem_access_kind_t kind )
 static int 
 get_manager_id ( int page_no )
 {
-	return page_no % NUM_OF_PROCS;
+	return page_no % get_num_of_procs ( );
 }
 
 static struct page_descr_t *
@@ -67,6 +69,135 @@ get_pdescr ( struct mon_t *mon, int page_no )
 	return & ( mon->page_descrs[page_no] );
 }
 
+/* Page managers
+ *
+ * By default the manager of a page is its current owner (Li and Hudak's
+ * dynamic distributed manager).  The owner field of a page descriptor is
+ * a probable owner on the other nodes, updated on FETCH_ACK and
+ * INVALIDATE_REQUEST.  A FETCH_REQUEST is sent to the probable owner and
+ * forwarded along the probable owners until it reaches the owner, which
+ * replies to the requestor directly.  VMM_PAGE_MANAGER=static selects the
+ * fixed manager get_manager_id ( ) instead.
+ */
+
+enum {
+	PAGE_MANAGER_UNKNOWN = -1,
+	PAGE_MANAGER_STATIC,
+	PAGE_MANAGER_DYNAMIC
+};
+
+static int page_manager = PAGE_MANAGER_UNKNOWN;
+
+static bool_t
+page_manager_is_static ( void )
+{
+	if ( page_manager == PAGE_MANAGER_UNKNOWN ) {
+		char *p = getenv ( "VMM_PAGE_MANAGER" );
+		page_manager = ( ( p != NULL ) && ( strcmp ( p, "static" ) == 0 ) 
+				 ? PAGE_MANAGER_STATIC 
+				 : PAGE_MANAGER_DYNAMIC );
+	}
+
+	return ( page_manager == PAGE_MANAGER_STATIC );
+}
+
+/* Home migration
+ *
+ * A static manager (the home of a page) starts at get_manager_id ( ), and
+ * may be handed over to a node that dominates the FETCH_REQUESTs for the
+ * page (see try_migrate_home ( )).  On the other nodes the home is a
+ * hint: a FETCH_REQUEST or FETCH_ACK_ACK that reaches a former home is
+ * forwarded to the home it handed the page over to.  Since each handoff
+ * increments the epoch of the page, and an announcement of an older
+ * epoch is ignored, the hints never lead back to a former home.
+ *
+ * [Note] Only a static manager is migrated.  The dynamic manager (the
+ * default) is the owner, which already moves to the node that writes
+ * the page, so there is no fixed home to hand over.
+ */
+
+enum {
+	HOME_DEFAULT_WINDOW	= 16,
+	HOME_MAX_WINDOW		= 32
+};
+
+struct page_home_t {
+	int		home_id;	/* a hint unless this node is the home */
+	int		epoch;
+
+	/* the requestors of the last FETCH_REQUESTs served by the home */
+	bit8u_t		requestors[HOME_MAX_WINDOW];
+	int		next;
+	int		nr_requestors;
+};
+
+static struct page_home_t *page_homes = NULL;
+static int home_window = -1;
+
+/* The window is taken from VMM_HOME_WINDOW (0 disables home migration). */
+static int
+get_home_window ( void )
+{
+	char *p;
+
+	if ( home_window >= 0 ) {
+		return home_window;
+	}
+
+	p = getenv ( "VMM_HOME_WINDOW" );
+	home_window = ( p != NULL ) ? Atoi ( p ) : HOME_DEFAULT_WINDOW;
+	if ( home_window > HOME_MAX_WINDOW ) {
+		home_window = HOME_MAX_WINDOW;
+	}
+
+	return home_window;
+}
+
+static struct page_home_t *
+get_page_home ( struct mon_t *mon, int page_no )
+{
+	ASSERT ( ( 0 <= page_no ) && ( page_no < mon->num_of_pages ) );
+
+	if ( page_homes == NULL ) {
+		int i;
+
+		page_homes = Calloct ( mon->num_of_pages, struct page_home_t );
+		for ( i = 0; i < mon->num_of_pages; i++ ) {
+			page_homes[i].home_id = get_manager_id ( i );
+		}
+	}
+
+	return &page_homes[page_no];
+}
+
+static int
+get_home_id ( struct mon_t *mon, int page_no )
+{
+	return get_page_home ( mon, page_no )->home_id;
+}
+
+/* Return TRUE if this node serves the FETCH_REQUESTs for the page */
+static bool_t
+is_manager ( struct mon_t *mon, int page_no )
+{
+	const struct page_descr_t *pdescr = get_pdescr ( mon, page_no );
+
+	if ( page_manager_is_static ( ) ) {
+		return ( get_home_id ( mon, page_no ) == mon->cpuid );
+	}
+
+	return ( ( pdescr->owner == mon->cpuid ) && ( pdescr->state != PAGE_STATE_INVALID ) );
+}
+
+/* Return the node to which a FETCH_REQUEST for the page is sent */
+static int
+get_request_dest_id ( struct mon_t *mon, int page_no )
+{
+	return ( ( page_manager_is_static ( ) )
+		 ? get_home_id ( mon, page_no )
+		 : ( int ) get_pdescr ( mon, page_no )->owner );
+}
+
 bit32u_t
 get_page_paddr ( struct mon_t *mon, int page_no )
 {
@@ -75,8 +206,96 @@ get_page_paddr ( struct mon_t *mon, int page_no )
 
 static struct mon_t *static_mon = NULL;
 
+/* State of the multiple-writer protocol (see below) */
+
+enum page_mode {
+	PAGE_MODE_SINGLE_WRITER,
+	PAGE_MODE_MULTIPLE_WRITER,
+	PAGE_MODE_IMMUTABLE	/* single-writer, replicated at boot (see below) */
+};
+
+static bit8u_t *page_modes = NULL;
+static bit8u_t *locked_pages = NULL;	/* switched back by a LOCK-prefixed instruction */
+static bit8u_t **twins = NULL;
+static int *dirty_pages = NULL; 	/* pages that have a twin */
+static int nr_dirty_pages = 0;
+static int nr_diff_acks = 0;
+static bool_t fetching_page = FALSE;
+static bool_t flushing_page_diffs = FALSE;
+
+struct page_mode_change_t {
+	bool_t	is_pending;		/* between PREPARE and COMMIT */
+	bool_t	is_coordinating;	/* (BSP only) */
+	bool_t	is_waiting_commit;	/* for a change requested by this node */
+	int	nr_acks;
+	int	from_page_no;
+	int	to_page_no;
+};
+
+static struct page_mode_change_t page_mode_change = { FALSE, FALSE, FALSE, 0, 0, 0 };
+
+static bool_t
+is_multiple_writer_page ( int page_no )
+{
+	ASSERT ( page_modes != NULL );
+	return ( page_modes[page_no] == PAGE_MODE_MULTIPLE_WRITER );
+}
+
+static bool_t
+is_immutable_page ( int page_no )
+{
+	ASSERT ( page_modes != NULL );
+	return ( page_modes[page_no] == PAGE_MODE_IMMUTABLE );
+}
+
+static bool_t
+page_mode_is_changing ( int page_no )
+{
+	const struct page_mode_change_t *x = &page_mode_change;
+
+	return ( ( x->is_pending ) && 
+		 ( x->from_page_no <= page_no ) && ( page_no <= x->to_page_no ) );
+}
+
+static bool_t
+has_requesting_page ( struct mon_t *mon, int from_page_no, int to_page_no )
+{
+	int i;
+
+	for ( i = from_page_no; i <= to_page_no; i++ ) {
+		if ( get_pdescr ( mon, i )->requesting ) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/* A PREPARE is held until no transaction of the old protocol on the
+ * pages is in progress at this node (only a manager sets
+ * <requesting>), and a REQUEST is held until the BSP can coordinate
+ * it. */
 static bool_t
-is_not_requesting_page ( struct msg_t *msg )
+page_mode_change_is_deferred ( struct mon_t *mon, struct msg_page_mode_change_t *x )
+{
+	switch ( x->phase ) {
+	case PAGE_MODE_REQUEST:
+		return ( fetching_page || flushing_page_diffs || page_mode_change.is_coordinating );
+	case PAGE_MODE_PREPARE:
+		return ( fetching_page || flushing_page_diffs ||
+			 has_requesting_page ( mon, x->from_page_no, x->to_page_no ) );
+	default:
+		return FALSE;
+	}
+}
+
+static void apply_held_page_diffs ( struct mon_t *mon );
+
+/* Return MSG_DEFER_NONE if <msg> can be handled now.  Otherwise
+ * return the key under which it waits: the page number for a request
+ * on a page that is being requested (released by
+ * handle_fetch_ack_ack ()), or MSG_DEFER_BY_KIND. */
+static int
+get_defer_key ( struct msg_t *msg )
 {
 	struct mon_t *mon = static_mon;
 	struct msg_page_fetch_request_t *x;
@@ -89,17 +308,34 @@ is_not_requesting_page ( struct msg_t *msg )
 
 	if ( ( msg->hdr.kind == MSG_KIND_INPUT_PORT ) || 
 	     ( msg->hdr.kind == MSG_KIND_OUTPUT_PORT ) ) {
-		return ! accessing_io ( mon );
+		return accessing_io ( mon ) ? MSG_DEFER_BY_KIND : MSG_DEFER_NONE;
+	}
+
+	if ( msg->hdr.kind == MSG_KIND_PAGE_MODE_CHANGE ) {
+		return ( page_mode_change_is_deferred ( mon, Msg_to_msg_page_mode_change ( msg ) ) 
+			 ? MSG_DEFER_BY_KIND : MSG_DEFER_NONE );
+	}
+
+	/* no page is handed over while the diffs of this node are on the
+	 * way (see handle_invalidate_request ()) */
+	if ( ( flushing_page_diffs ) &&
+	     ( ( msg->hdr.kind == MSG_KIND_PAGE_FETCH_REQUEST ) ||
+	       ( msg->hdr.kind == MSG_KIND_PAGE_INVALIDATE_REQUEST ) ) ) {
+		return MSG_DEFER_BY_KIND;
 	}
 
 	if ( msg->hdr.kind != MSG_KIND_PAGE_FETCH_REQUEST ) {
-		return TRUE;
+		return MSG_DEFER_NONE;
 	}
 
 	x = Msg_to_msg_page_fetch_request ( msg );
+	if ( x->is_prefetch ) {
+		return MSG_DEFER_NONE;
+	}
+
 	pdescr = get_pdescr ( mon, x->page_no );
 	
-	return ( ! pdescr->requesting );
+	return ( pdescr->requesting ) ? x->page_no : MSG_DEFER_NONE;
 }
 
 static void
@@ -113,12 +349,25 @@ send_or_handle ( struct mon_t *mon, struct msg_t *msg, int dest_id,
 	}
 }
 
+/* Block until a message can be handled, and handle it */
+static void
+handle_next_msg ( struct mon_t *mon )
+{
+	struct msg_t *msg;
+
+	static_mon = mon;
+
+	msg = Comm_remove_msg2 ( mon->comm, &get_defer_key );
+	handle_msg ( mon, msg );
+	Msg_destroy ( msg );
+}
+
 /*******************************************************************/
 
 void
 wait_recvable_msg ( struct mon_t *mon, int sleep_time )
 {
-	Comm_wait_msg ( mon->comm, &is_not_requesting_page, sleep_time );
+	Comm_wait_msg ( mon->comm, &get_defer_key, sleep_time );
 }
 
 void
@@ -131,7 +380,7 @@ try_handle_msgs ( struct mon_t *mon )
 	for ( ; ; ) {
 		struct msg_t *msg;
 
-		msg = Comm_try_remove_msg2 ( mon->comm, &is_not_requesting_page );
+		msg = Comm_try_remove_msg2 ( mon->comm, &get_defer_key );
 		if ( msg == NULL ) {
 			break;
 		}
@@ -151,388 +400,2312 @@ try_handle_msgs_with_stat ( struct mon_t *mon )
 
 /*******************************************************************/
 
-void
-handle_fetch_ack_ack ( struct mon_t *mon, struct msg_t *msg )
-{
-	struct msg_page_fetch_ack_ack_t *x = Msg_to_msg_page_fetch_ack_ack ( msg );
-	struct page_descr_t *pdescr = get_pdescr ( mon, x->page_no );
+/* A per-node detector recognizes sequential and strided page faults.  The
+ * pages predicted to be touched next are requested together with the
+ * faulting page, and the owner sends back all of them that it holds in a
+ * single FETCH_ACK. */
 
-	DP ( stderr, "handle fetch_ack_ack (no=%#x,seq=%lld, copyset=%#x,%s)\n", 
-		x->page_no, pdescr->seq, pdescr->copyset,
-		MemAccessKind_to_string ( x->kind ) );
+enum {
+	PREFETCH_MAX_WINDOW 	= 16,
+	PREFETCH_DEFAULT_WINDOW = 8,
+	PREFETCH_MAX_STRIDE 	= 4
+};
 
-	switch ( x->kind ) {
-	case MEM_ACCESS_READ:
-		DP ( stderr, "update(man)(rd): (no=%#x)  (%d->%d) (%#x->%#x)\n", 
-			x->page_no,
-			pdescr->owner,
-			pdescr->owner,
-			pdescr->copyset,
-			pdescr->copyset | ( 1 << x->src_id ) );
+enum prefetch_state {
+	PREFETCH_NONE,
+	PREFETCH_REQUESTED,
+	PREFETCH_ARRIVED	/* not yet known to be used */
+};
 
-		SET_BIT ( pdescr->copyset, x->src_id );
-		break;
-	 
-	case MEM_ACCESS_WRITE:
-		DP ( stderr, "update(man)(wr): (no=%#x)  (%d->%d) (%#x->%#x)\n", 
-			x->page_no,
-			pdescr->owner,
-			x->src_id,
-			pdescr->copyset,
-			1 << x->src_id );
+struct prefetch_detector_t {
+	int	last_page_no;
+	int	last_delta;
+	int	stride; 	/* 0 if no stream is detected */
+	int	window; 	/* # of pages prefetched ahead of a fault */
+};
 
-		pdescr->owner = x->src_id;
-		pdescr->copyset = ( 1 << x->src_id );
-		break;
-	 
-	default:
-		Match_failure ( "send_invalidate_request\n" );
+static struct prefetch_detector_t prefetch_detector = { -1, 0, 0, 0 };
+static int prefetch_max_window = -1;
+static bit8u_t *prefetch_states = NULL;
+
+/* The maximum window is taken from VMM_PREFETCH_WINDOW (0 disables
+ * prefetching). */
+static int
+get_prefetch_max_window ( void )
+{
+	char *p;
+
+	if ( prefetch_max_window >= 0 ) {
+		return prefetch_max_window;
 	}
 
-	DP ( stderr, "requesting: FALSE %#x (pdescr->seq=%lld, x->seq=%lld)\n", 
-		x->page_no, pdescr->seq, x->seq );
-	assert ( pdescr->seq == x->seq );
-	pdescr->requesting = FALSE;
+	p = getenv ( "VMM_PREFETCH_WINDOW" );
+	prefetch_max_window = ( p != NULL ) ? Atoi ( p ) : PREFETCH_DEFAULT_WINDOW;
+	if ( prefetch_max_window > PREFETCH_MAX_WINDOW ) {
+		prefetch_max_window = PREFETCH_MAX_WINDOW;
+	}
+
+	return prefetch_max_window;
 }
 
-/*************************************/	
+static bit8u_t *
+get_prefetch_state ( struct mon_t *mon, int page_no )
+{
+	ASSERT ( ( 0 <= page_no ) && ( page_no < mon->num_of_pages ) );
+
+	if ( prefetch_states == NULL ) {
+		prefetch_states = Calloct ( mon->num_of_pages, bit8u_t );
+	}
+
+	return &prefetch_states[page_no];
+}
 
+/* A fault that lands at most (window + 1) strides ahead of the previous
+ * one continues the stream: the prefetched pages skipped over have been
+ * used, and the window is doubled.  Two equal deltas in a row start a new
+ * stream. */
 static void
-update_pdescr_with_fetch_ack ( struct mon_t *mon, struct msg_page_fetch_ack_t *x, int src_id )
+detect_access_pattern ( struct mon_t *mon, int page_no )
 {
-	struct page_descr_t *pdescr = get_pdescr ( mon, x->page_no );
-	
-	switch ( x->kind ) {
-	case MEM_ACCESS_READ:
-		DP ( stderr, "update(rd): (no=%#x) (%s->%s) (%d->%d) (%#x->%#x)\n", 
-			x->page_no,
-			PageState_to_string ( pdescr->state ),
-			PageState_to_string ( PAGE_STATE_READ_ONLY_SHARED ),
-			pdescr->owner,
-			src_id,
-			pdescr->copyset,
-			pdescr->copyset );
+	struct prefetch_detector_t *d = &prefetch_detector;
+	const int max_window = get_prefetch_max_window ( );
+	const int delta = page_no - d->last_page_no;
+
+	if ( ( d->stride != 0 ) &&
+	     ( delta % d->stride == 0 ) &&
+	     ( delta / d->stride >= 1 ) &&
+	     ( delta / d->stride <= d->window + 1 ) ) {
+		int i;
+
+		for ( i = d->last_page_no + d->stride; i != page_no; i += d->stride ) {
+			bit8u_t *state = get_prefetch_state ( mon, i );
+
+			if ( *state == PREFETCH_ARRIVED ) {
+				*state = PREFETCH_NONE;
+				mon->stat.nr_prefetch_hits++;
+			}
+		}
+		d->window = ( 2 * d->window < max_window ) ? 2 * d->window : max_window;
 
-		pdescr->state = PAGE_STATE_READ_ONLY_SHARED;
-		pdescr->owner = src_id;
-		/* copyset do not need to hold the correct value since 
-		 * the local node is not owner */
-		break;
-	 
-	case MEM_ACCESS_WRITE:
-		DP ( stderr, "update(wr): (no=%#x) (%s->%s) (%d->%d) (%#x->%#x)\n", 
-			x->page_no,
-			PageState_to_string ( pdescr->state ),
-			PageState_to_string ( PAGE_STATE_EXCLUSIVELY_SHARED ),
-			pdescr->owner,
-			mon->cpuid,
-			pdescr->copyset,
-			( 1 << mon->cpuid  ) );
+	} else if ( ( delta != 0 ) && ( delta == d->last_delta ) &&
+		    ( -PREFETCH_MAX_STRIDE <= delta ) && ( delta <= PREFETCH_MAX_STRIDE ) ) {
+		d->stride = delta;
+		d->window = ( max_window > 0 ) ? 1 : 0;
 
-		pdescr->state = PAGE_STATE_EXCLUSIVELY_SHARED;
-		pdescr->owner = mon->cpuid;
-		pdescr->copyset = ( 1 << mon->cpuid );
-		break;
-	 
-	default:
-		Match_failure ( "update_pdescr_with_fetch_ack\n" );
+	} else {
+		d->stride = 0;
+		d->window = 0;
 	}
+
+	d->last_delta = delta;
+	d->last_page_no = page_no;
+	*get_prefetch_state ( mon, page_no ) = PREFETCH_NONE;
 }
 
 static void
-update_mem_image_with_fetch_ack ( struct mon_t *mon, struct msg_page_fetch_ack_t *x )
+mark_prefetched_page_arrived ( struct mon_t *mon, int page_no )
 {
-	bit32u_t addr = get_page_paddr ( mon, x->page_no );
-	Mmove ( ( void * ) addr, x->data, PAGE_SIZE_4K );
+	bit8u_t *state = get_prefetch_state ( mon, page_no );
+
+	if ( *state == PREFETCH_REQUESTED ) {
+		*state = PREFETCH_ARRIVED;
+	}
 }
 
 static void
-send_or_handle_fetch_ack_ack ( struct mon_t *mon, struct msg_page_fetch_ack_t *x )
+mark_prefetched_page_invalidated ( struct mon_t *mon, int page_no )
 {
-	const int mid = get_manager_id ( x->page_no );
-	struct msg_t *msg;
+	bit8u_t *state = get_prefetch_state ( mon, page_no );
 
-	msg = Msg_create3 ( MSG_KIND_PAGE_FETCH_ACK_ACK,
-			    x->page_no, x->kind, mon->cpuid, x->seq );
-	send_or_handle ( mon, msg, mid, &handle_fetch_ack_ack );
-	Msg_destroy ( msg );
+	if ( *state == PREFETCH_ARRIVED ) {
+		mon->stat.nr_prefetch_wastes++;
+	}
+	*state = PREFETCH_NONE;
 }
 
-static void
-__handle_fetch_ack ( struct mon_t *mon, struct msg_page_fetch_ack_t *x,
-		     int src_id )
+/*******************************************************************/
+
+/* A page filled with zeros is sent with no data.  Otherwise, if the
+ * requestor keeps a version of the page that this node also keeps, the
+ * page is sent as runs of the words that differ from that version, XORed
+ * with it, unless the runs are not shorter than the page.
+ *
+ * A version is identified by the seq of the FETCH_ACK that carried it.
+ * Each node keeps a snapshot of the last version of the page it sent or
+ * received, apart from its local copy, which may have been written
+ * since.  Snapshots are never dropped, so at most VMM_PAGE_SNAPSHOTS
+ * pages (0 disables the delta encoding) have one.
+ *
+ * [Note] Each snapshot takes a page of the monitor's heap, which is not
+ * freed until the monitor exits.  The default of 4096 snapshots costs
+ * up to 16MB per monitor, in addition to the guest memory. */
+
+enum {
+	PAGE_SNAPSHOT_DEFAULT_MAX = 4096
+};
+
+struct page_snapshot_t {
+	long long	seq;
+	bit8u_t		data[PAGE_SIZE_4K];
+};
+
+static struct page_snapshot_t **snapshots = NULL;
+static int nr_snapshots = 0;
+static int max_snapshots = -1;
+
+static int
+get_max_snapshots ( void )
 {
-	struct page_descr_t *pdescr = get_pdescr ( mon, x->page_no );
+	char *p;
 
-	DP ( stderr, "handle fetch_ack (no=%#x,seq=%lld)\n", 
-		x->page_no, pdescr->seq );
+	if ( max_snapshots >= 0 ) {
+		return max_snapshots;
+	}
 
-	update_pdescr_with_fetch_ack ( mon, x, src_id );
-	if ( mon->cpuid != src_id ) {
-		update_mem_image_with_fetch_ack ( mon, x );
+	p = getenv ( "VMM_PAGE_SNAPSHOTS" );
+	max_snapshots = ( p != NULL ) ? Atoi ( p ) : PAGE_SNAPSHOT_DEFAULT_MAX;
+
+	return max_snapshots;
+}
+
+static struct page_snapshot_t **
+get_snapshot ( struct mon_t *mon, int page_no )
+{
+	ASSERT ( ( 0 <= page_no ) && ( page_no < mon->num_of_pages ) );
+
+	if ( snapshots == NULL ) {
+		snapshots = Calloct ( mon->num_of_pages, struct page_snapshot_t * );
 	}
-	run_emulation_code_of_vm ( mon, CHANGE_PAGE_PROT, x->page_no );
 
-	send_or_handle_fetch_ack_ack ( mon, x );		
+	return &snapshots[page_no];
 }
 
-void
-handle_fetch_ack ( struct mon_t *mon, struct msg_t *msg )
+/* Return the seq of the version kept by this node, or -1 */
+static long long
+get_snapshot_seq ( struct mon_t *mon, int page_no )
 {
-	struct msg_page_fetch_ack_t *x = Msg_to_msg_page_fetch_ack ( msg );
-	__handle_fetch_ack ( mon, x, msg->hdr.src_id );
+	struct page_snapshot_t *s = *get_snapshot ( mon, page_no );
+
+	return ( s != NULL ) ? s->seq : -1LL;
 }
 
 static void
-handle_fetch_ack_local ( struct mon_t *mon,
-			 struct msg_page_invalidate_request_t *x )
+save_snapshot ( struct mon_t *mon, int page_no, long long seq )
 {
-	struct msg_page_fetch_ack_t xx;
+	struct page_snapshot_t **s = get_snapshot ( mon, page_no );
 
-	xx.page_no = x->page_no;
-	xx.kind = x->kind;
-	xx.seq = x->seq;
+	if ( *s == NULL ) {
+		if ( nr_snapshots >= get_max_snapshots ( ) ) {
+			return;
+		}
+		*s = Malloct ( struct page_snapshot_t );
+		nr_snapshots++;
+	}
 
-	__handle_fetch_ack ( mon, &xx, mon->cpuid );
+	( *s )->seq = seq;
+	Mmove ( ( *s )->data, ( void * ) get_page_paddr ( mon, page_no ), PAGE_SIZE_4K );
 }
 
-/*************************************/	
+static bool_t
+is_zero_page ( const bit8u_t *page )
+{
+	const bit32u_t *p = ( const bit32u_t * ) page;
+	const int N = PAGE_SIZE_4K / sizeof ( bit32u_t );
+	int i;
 
-static void
-update_pdescr_with_invalidate_request ( struct mon_t *mon, struct msg_page_invalidate_request_t *x )
+	for ( i = 0; i < N; i++ ) {
+		if ( p[i] != 0 ) {
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/* Encode the words of <page> that differ from <base> into <buf> as
+ * msg_page_diff_run_t runs of their XORs.  Return the number of bytes
+ * written, or -1 if the runs would not be shorter than the page. */
+static int
+encode_page_delta ( const bit8u_t *page, const bit8u_t *base, bit8u_t *buf )
 {
-	struct page_descr_t *pdescr = get_pdescr ( mon, x->page_no );
+	const bit32u_t *p = ( const bit32u_t * ) page;
+	const bit32u_t *b = ( const bit32u_t * ) base;
+	const int N = PAGE_SIZE_4K / sizeof ( bit32u_t );
+	int len = 0;
+	int i = 0;
+
+	while ( i < N ) {
+		struct msg_page_diff_run_t run;
+		int j;
+
+		if ( p[i] == b[i] ) {
+			i++;
+			continue;
+		}
 
-	switch ( x->kind ) {
-	case MEM_ACCESS_READ:
-		DP ( stderr, "update(rd): (no=%#x) (%s->%s) (%d->%d) (%#x->%#x)\n", 
-			x->page_no,
-			PageState_to_string ( pdescr->state ),
-			PageState_to_string ( PAGE_STATE_READ_ONLY_SHARED ),
-			pdescr->owner,
-			pdescr->owner,
-			pdescr->copyset,
-			pdescr->copyset | ( 1 << x->src_id ) );
+		for ( j = i; ( j < N ) && ( p[j] != b[j] ); j++ ) {
+			;
+		}
 
-		assert ( pdescr->state != PAGE_STATE_INVALID );
-		pdescr->state = PAGE_STATE_READ_ONLY_SHARED;
-		SET_BIT ( pdescr->copyset, x->src_id ); 
-		break;
-	 
-	case MEM_ACCESS_WRITE:
-		DP ( stderr, "update(wr): (no=%#x) (%s->%s) (%d->%d) (%#x->%#x)\n", 
-			x->page_no,
-			PageState_to_string ( pdescr->state ),
-			PageState_to_string ( PAGE_STATE_INVALID ),
-			pdescr->owner,
-			x->src_id,
-			pdescr->copyset,
-			( 1 << x->src_id ) );
+		run.offset = i * sizeof ( bit32u_t );
+		run.len = ( j - i ) * sizeof ( bit32u_t );
+		if ( len + sizeof ( run ) + run.len >= PAGE_SIZE_4K ) {
+			return -1;
+		}
 
-		assert ( pdescr->state != PAGE_STATE_INVALID );
-		pdescr->state = PAGE_STATE_INVALID;
-		pdescr->owner = x->src_id;
-		pdescr->copyset = ( 1 << x->src_id );
-		break;
-	 
-	default:
-		Match_failure ( "handle_invalidate_request\n" );
+		Mmove ( buf + len, &run, sizeof ( run ) );
+		len += sizeof ( run );
+		for ( ; i < j; i++ ) {
+			bit32u_t d = p[i] ^ b[i];
+			Mmove ( buf + len, &d, sizeof ( d ) );
+			len += sizeof ( d );
+		}
 	}
+
+	return len;
 }
 
 static void
-send_fetch_ack ( struct mon_t *mon, struct msg_page_invalidate_request_t *x )
+decode_page_delta ( bit8u_t *page, const bit8u_t *base, const bit8u_t *buf, size_t len )
 {
-	bit8u_t *addr = ( bit8u_t * ) get_page_paddr ( mon, x->page_no );
-	struct msg_t *msg;
+	size_t i = 0;
 
-	msg = Msg_create3 ( MSG_KIND_PAGE_FETCH_ACK,
-			    x->page_no,
-			    x->kind,
-			    addr,
-			    x->seq );
+	Mmove ( page, base, PAGE_SIZE_4K );
 
-	send_or_handle ( mon, msg, x->src_id, &handle_fetch_ack );
-	Msg_destroy ( msg );
-}
+	while ( i < len ) {
+		struct msg_page_diff_run_t run;
+		int j;
 
-int nr_recv_invalidates[NUM_OF_PROCS];
+		Mmove ( &run, buf + i, sizeof ( run ) );
+		i += sizeof ( run );
+		ASSERT ( run.offset + run.len <= PAGE_SIZE_4K );
 
-void
-handle_invalidate_request ( struct mon_t *mon, struct msg_t *msg )
-{
-	struct msg_page_invalidate_request_t *x = Msg_to_msg_page_invalidate_request ( msg );
+		for ( j = 0; j < run.len; j++ ) {
+			page[run.offset + j] ^= buf[i + j];
+		}
+		i += run.len;
+	}
+}
+
+/* <base_seq> is the version kept by the requestor */
+static void
+encode_fetch_ack ( struct mon_t *mon, struct msg_page_fetch_ack_t *ack, long long base_seq )
+{
+	const bit8u_t *page = ( const bit8u_t * ) get_page_paddr ( mon, ack->page_no );
+	struct page_snapshot_t *s = *get_snapshot ( mon, ack->page_no );
+	int len = -1;
+
+	if ( ( base_seq >= 0 ) && ( s != NULL ) && ( s->seq == base_seq ) ) {
+		len = encode_page_delta ( page, s->data, ack->data );
+	}
+
+	ack->base_seq = -1LL;
+	if ( is_zero_page ( page ) ) {
+		ack->encoding = PAGE_ENCODING_ZERO;
+		ack->data_len = 0;
+		mon->stat.nr_zero_page_acks++;
+	} else if ( len >= 0 ) {
+		ack->encoding = PAGE_ENCODING_DELTA;
+		ack->base_seq = base_seq;
+		ack->data_len = len;
+		mon->stat.nr_delta_page_acks++;
+	} else {
+		/* The page itself is sent from pmem (see set_fetch_ack ()). */
+		ack->encoding = PAGE_ENCODING_RAW;
+		ack->data_len = PAGE_SIZE_4K;
+		mon->stat.nr_raw_page_acks++;
+	}
+
+	/* [STAT] */
+	mon->stat.nr_page_ack_bytes_saved += PAGE_SIZE_4K - ack->data_len;
+
+	save_snapshot ( mon, ack->page_no, ack->seq );
+}
+
+static void
+decode_fetch_ack ( struct mon_t *mon, struct msg_page_fetch_ack_t *x )
+{
+	bit8u_t *page = ( bit8u_t * ) get_page_paddr ( mon, x->page_no );
+	struct page_snapshot_t *s = *get_snapshot ( mon, x->page_no );
+
+	switch ( x->encoding ) {
+	case PAGE_ENCODING_RAW:
+		ASSERT ( x->data_len == PAGE_SIZE_4K );
+		Mmove ( page, x->data, PAGE_SIZE_4K );
+		break;
+
+	case PAGE_ENCODING_ZERO:
+		Mzero ( page, PAGE_SIZE_4K );
+		break;
+
+	case PAGE_ENCODING_DELTA:
+		/* set_fetch_request () advertises a version only when no
+		 * other FETCH_ACK of the page can replace it on the way.  A
+		 * delta applied to another version would corrupt the page. */
+		if ( ( s == NULL ) || ( s->seq != x->base_seq ) ) {
+			Fatal_failure ( "decode_fetch_ack: page %d: the delta is against version %lld, but %lld is kept\n",
+					x->page_no, x->base_seq, ( s != NULL ) ? s->seq : -1LL );
+		}
+		decode_page_delta ( page, s->data, x->data, x->data_len );
+		break;
+
+	default:
+		Match_failure ( "decode_fetch_ack\n" );
+	}
+
+	save_snapshot ( mon, x->page_no, x->seq );
+}
+
+/*******************************************************************/
+
+/* The pages that an instruction touches are fetched in a batch (see
+ * begin_shared_memory_batch ()). */
+
+enum {
+	MAX_BATCHED_FETCHES = 16
+};
+
+struct batched_fetch_t {
+	struct shm_arg_t	arg;
+	bit32u_t		vaddr;
+	bool_t			is_paddr_access;
+	bool_t			is_sent;
+	bool_t			has_arrived;
+};
+
+struct fetch_batch_t {
+	bool_t			is_active;
+	int			n;
+	struct batched_fetch_t	fetches[MAX_BATCHED_FETCHES];
+};
+
+static struct fetch_batch_t fetch_batch;
+
+/* Record the fetch of <x> in the batch.  Return FALSE if it has to be
+ * fetched at once. */
+static bool_t
+add_batched_fetch ( struct shm_arg_t *x, bit32u_t vaddr, bool_t is_paddr_access )
+{
+	struct fetch_batch_t *b = &fetch_batch;
+	struct batched_fetch_t *f;
+	int i;
+
+	if ( ! b->is_active ) {
+		return FALSE;
+	}
+
+	for ( i = 0; i < b->n; i++ ) {
+		f = &b->fetches[i];
+		if ( f->arg.page_no == x->page_no ) {
+			if ( x->kind == MEM_ACCESS_WRITE ) {
+				f->arg.kind = MEM_ACCESS_WRITE;
+			}
+			f->arg.no_data = ( f->arg.no_data && x->no_data );
+			return TRUE;
+		}
+	}
+
+	if ( b->n == MAX_BATCHED_FETCHES ) {
+		return FALSE;
+	}
+
+	f = &b->fetches[b->n++];
+	f->arg = *x;
+	f->vaddr = vaddr;
+	f->is_paddr_access = is_paddr_access;
+	f->is_sent = FALSE;
+	f->has_arrived = FALSE;
+
+	return TRUE;
+}
+
+static void
+mark_batched_fetch_arrived ( int page_no )
+{
+	struct fetch_batch_t *b = &fetch_batch;
+	int i;
+
+	for ( i = 0; i < b->n; i++ ) {
+		struct batched_fetch_t *f = &b->fetches[i];
+
+		if ( ( f->is_sent ) && ( f->arg.page_no == page_no ) ) {
+			f->has_arrived = TRUE;
+		}
+	}
+}
+
+/*******************************************************************/
+
+/* Called by the home on each FETCH_REQUEST that it serves */
+static void
+record_home_request ( struct mon_t *mon, int page_no, int src_id )
+{
+	const int window = get_home_window ( );
+	struct page_home_t *h;
+
+	if ( ( ! page_manager_is_static ( ) ) || ( window == 0 ) ) {
+		return;
+	}
+
+	h = get_page_home ( mon, page_no );
+	h->requestors[h->next] = src_id;
+	h->next = ( h->next + 1 ) % window;
+	if ( h->nr_requestors < window ) {
+		h->nr_requestors++;
+	}
+}
+
+static FILE *home_trace_fp = NULL;
+
+/* One line per migration: tsc, page_no, old home, new home, and the
+ * requests of the new home in the window */
+static void
+trace_home_migration ( struct mon_t *mon, int page_no, int dest_id, int n, int window )
+{
+	bit64u_t t;
+
+	if ( home_trace_fp == NULL ) {
+		home_trace_fp = Fopen_fmt ( "w+", "/tmp/home%d", mon->cpuid );
+	}
+
+	rdtsc ( t );
+	Print ( home_trace_fp, "%llu\t" "%#x\t" "%d\t" "%d\t" "%d/%d\n", 
+		t, page_no, mon->cpuid, dest_id, n, window );
+	fflush ( home_trace_fp );
+}
+
+/* Called when the monitor exits */
+void
+close_home_trace ( void )
+{
+	if ( home_trace_fp != NULL ) {
+		fclose ( home_trace_fp );
+		home_trace_fp = NULL;
+	}
+}
+
+/* Called by the home when <dest_id> has become the owner of the page on a
+ * write.  If <dest_id> has issued at least three quarters of the last
+ * <window> requests, the home is handed over to it.  No request for the
+ * page is in progress, and <dest_id> already holds the owner's state, so
+ * the handoff carries only the epoch and the seq.  The requests that
+ * reach this node afterwards are forwarded, and arrive at <dest_id> after
+ * the handoff. */
+static void
+try_migrate_home ( struct mon_t *mon, int page_no, int dest_id, long long seq )
+{
+	const int window = get_home_window ( );
+	struct page_home_t *h;
+	struct msg_t *msg;
+	int i, n = 0;
+
+	if ( ( window == 0 ) || ( dest_id == mon->cpuid ) ) {
+		return;
+	}
+
+	/* the pages out of the ordinary single-writer protocol stay */
+	if ( is_multiple_writer_page ( page_no ) || page_mode_is_changing ( page_no ) ||
+	     is_immutable_page ( page_no ) ) {
+		return;
+	}
+
+	h = get_page_home ( mon, page_no );
+	if ( h->nr_requestors < window ) {
+		return;
+	}
+
+	for ( i = 0; i < window; i++ ) {
+		if ( h->requestors[i] == dest_id ) {
+			n++;
+		}
+	}
+	if ( n * 4 < window * 3 ) {
+		return;
+	}
+
+	trace_home_migration ( mon, page_no, dest_id, n, window );
+
+	h->home_id = dest_id;
+	h->epoch++;
+	h->next = 0;
+	h->nr_requestors = 0;
+
+	msg = Msg_create_page_home_migrate ( page_no, dest_id, h->epoch, seq );
+	Comm_send ( mon->comm, msg, dest_id );
+	Msg_destroy ( msg );
+
+	mon->stat.nr_home_migrations++; /* [STAT] */
+}
+
+/* The new home takes over the page on the handoff, and announces itself to
+ * the other nodes. */
+void
+handle_page_home_migrate ( struct mon_t *mon, struct msg_t *msg )
+{
+	struct msg_page_home_migrate_t *x = Msg_to_msg_page_home_migrate ( msg );
+	struct page_home_t *h = get_page_home ( mon, x->page_no );
+
+	ASSERT ( page_manager_is_static ( ) );
+
+	if ( x->epoch <= h->epoch ) {
+		/* an announcement overtaken by a later handoff */
+		return;
+	}
+
+	h->home_id = x->home_id;
+	h->epoch = x->epoch;
+
+	if ( x->home_id != mon->cpuid ) {
+		return;
+	}
+
+	assert ( get_pdescr ( mon, x->page_no )->owner == mon->cpuid );
+	assert ( get_pdescr ( mon, x->page_no )->seq == x->seq );
+	assert ( ! get_pdescr ( mon, x->page_no )->requesting );
+
+	h->next = 0;
+	h->nr_requestors = 0;
+	Comm_bcast ( mon->comm, msg );
+}
+
+/* A FETCH_ACK_ACK sent to a former home follows the FETCH_REQUEST to the
+ * home. */
+static void
+forward_fetch_ack_ack ( struct mon_t *mon, struct msg_t *msg )
+{
+	const struct msg_page_fetch_ack_ack_t *x = Msg_to_msg_page_fetch_ack_ack ( msg );
+	const int dest_id = get_home_id ( mon, x->page_no );
+	
+	ASSERT ( dest_id != mon->cpuid );
+
+	Comm_send ( mon->comm, msg, dest_id );
+}
+
+void
+handle_fetch_ack_ack ( struct mon_t *mon, struct msg_t *msg )
+{
+	struct msg_page_fetch_ack_ack_t *x = Msg_to_msg_page_fetch_ack_ack ( msg );
+	struct page_descr_t *pdescr = get_pdescr ( mon, x->page_no );
+
+	if ( page_manager_is_static ( ) && ( ! is_manager ( mon, x->page_no ) ) ) {
+		forward_fetch_ack_ack ( mon, msg );
+		return;
+	}
+
+	DP ( stderr, "handle fetch_ack_ack (no=%#x,seq=%lld, copyset=%s,%s)\n", 
+		x->page_no, pdescr->seq, Cpuset_to_string ( &pdescr->copyset ),
+		MemAccessKind_to_string ( x->kind ) );
+
+	/* A dynamic manager was the owner, and has updated the owner and the
+	 * copyset on its own invalidate request. */
+	if ( page_manager_is_static ( ) ) {
+		switch ( x->kind ) {
+		case MEM_ACCESS_READ:
+			DP ( stderr, "update(man)(rd): (no=%#x)  (%d->%d) (%s+%d)\n", 
+				x->page_no,
+				pdescr->owner,
+				pdescr->owner,
+				Cpuset_to_string ( &pdescr->copyset ),
+				x->src_id );
+
+			Cpuset_add ( &pdescr->copyset, x->src_id );
+			break;
+	 
+		case MEM_ACCESS_WRITE:
+			DP ( stderr, "update(man)(wr): (no=%#x)  (%d->%d) (%s->{%d})\n", 
+				x->page_no,
+				pdescr->owner,
+				x->src_id,
+				Cpuset_to_string ( &pdescr->copyset ),
+				x->src_id );
+
+			pdescr->owner = x->src_id;
+			Cpuset_set_single ( &pdescr->copyset, x->src_id );
+			break;
+	 
+		default:
+			Match_failure ( "send_invalidate_request\n" );
+		}
+	}
+
+	DP ( stderr, "requesting: FALSE %#x (pdescr->seq=%lld, x->seq=%lld)\n", 
+		x->page_no, pdescr->seq, x->seq );
+	assert ( pdescr->seq == x->seq );
+	pdescr->requesting = FALSE;
+	Comm_release_deferred_msgs ( mon->comm, x->page_no );
+
+	if ( page_manager_is_static ( ) && ( x->kind == MEM_ACCESS_WRITE ) ) {
+		try_migrate_home ( mon, x->page_no, x->src_id, x->seq );
+	}
+}
+
+/*************************************/	
+
+static void
+update_pdescr_with_fetch_ack ( struct mon_t *mon, struct msg_page_fetch_ack_t *x, int src_id )
+{
+	struct page_descr_t *pdescr = get_pdescr ( mon, x->page_no );
+	
+	switch ( x->kind ) {
+	case MEM_ACCESS_READ:
+		DP ( stderr, "update(rd): (no=%#x) (%s->%s) (%d->%d) (%s)\n", 
+			x->page_no,
+			PageState_to_string ( pdescr->state ),
+			PageState_to_string ( PAGE_STATE_READ_ONLY_SHARED ),
+			pdescr->owner,
+			src_id,
+			Cpuset_to_string ( &pdescr->copyset ) );
+
+		pdescr->state = PAGE_STATE_READ_ONLY_SHARED;
+		pdescr->owner = src_id;
+		/* copyset do not need to hold the correct value since 
+		 * the local node is not owner */
+		break;
+	 
+	case MEM_ACCESS_WRITE:
+		DP ( stderr, "update(wr): (no=%#x) (%s->%s) (%d->%d) (%s->{%d})\n", 
+			x->page_no,
+			PageState_to_string ( pdescr->state ),
+			PageState_to_string ( PAGE_STATE_EXCLUSIVELY_SHARED ),
+			pdescr->owner,
+			mon->cpuid,
+			Cpuset_to_string ( &pdescr->copyset ),
+			mon->cpuid );
+
+		pdescr->state = PAGE_STATE_EXCLUSIVELY_SHARED;
+		pdescr->owner = mon->cpuid;
+		Cpuset_set_single ( &pdescr->copyset, mon->cpuid );
+		/* a dynamic manager numbers the versions on from here, which
+		 * keeps the seq unique to each version */
+		pdescr->seq = x->seq;
+		break;
+	 
+	default:
+		Match_failure ( "update_pdescr_with_fetch_ack\n" );
+	}
+}
+
+static void
+update_mem_image_with_fetch_ack ( struct mon_t *mon, struct msg_page_fetch_ack_t *x )
+{
+	if ( x->encoding == PAGE_ENCODING_NONE ) {
+		/* only the ownership has been transferred */
+		return;
+	}
+
+	decode_fetch_ack ( mon, x );
+}
+
+/* The guest process gives the mappings of the page the protection of
+ * its state (see get_page_prot () of vm_maccess.c). */
+static void
+change_page_prot ( struct mon_t *mon, int page_no )
+{
+	queue_page_prot_change ( mon, page_no_to_paddr ( page_no ) );
+}
+
+/* <src_id> is the node that sent the FETCH_ACK, which is the dynamic
+ * manager that served the request. */
+static void
+send_or_handle_fetch_ack_ack ( struct mon_t *mon, struct msg_page_fetch_ack_t *x, int src_id )
+{
+	const int mid = ( page_manager_is_static ( ) ) ? get_home_id ( mon, x->page_no ) : src_id;
+	struct msg_t *msg;
+
+	msg = Msg_create_fetch_ack_ack ( x->page_no, x->kind, mon->cpuid, x->seq );
+	send_or_handle ( mon, msg, mid, &handle_fetch_ack_ack );
+	Msg_destroy ( msg );
+}
+
+static void
+__handle_fetch_ack ( struct mon_t *mon, struct msg_page_fetch_ack_t *x,
+		     int src_id )
+{
 	struct page_descr_t *pdescr = get_pdescr ( mon, x->page_no );
 
-	DP ( stderr, "handle invalidate_request (no=%#x,seq=%lld,owner=%d)\n", 
-		x->page_no, pdescr->seq, pdescr->owner );
+	DP ( stderr, "handle fetch_ack (no=%#x,seq=%lld)\n", 
+		x->page_no, pdescr->seq );
+
+	update_pdescr_with_fetch_ack ( mon, x, src_id );
+	if ( mon->cpuid != src_id ) {
+		update_mem_image_with_fetch_ack ( mon, x );
+	}
+	change_page_prot ( mon, x->page_no );
+
+	/* [STAT] */
+	if ( *get_prefetch_state ( mon, x->page_no ) != PREFETCH_REQUESTED ) {
+		mon->stat.nr_fetch_hops += x->hops;
+		mon->stat.nr_demand_fetches++;
+	}
+	mark_prefetched_page_arrived ( mon, x->page_no );
+	mark_batched_fetch_arrived ( x->page_no );
+
+	send_or_handle_fetch_ack_ack ( mon, x, src_id );		
+}
+
+void
+handle_fetch_ack ( struct mon_t *mon, struct msg_t *msg )
+{
+	bit8u_t *p = ( bit8u_t * ) Msg_to_msg_page_fetch_ack ( msg );
+	bit8u_t *end = p + msg->hdr.len;
+
+	while ( p < end ) {
+		struct msg_page_fetch_ack_t *x = ( struct msg_page_fetch_ack_t * ) p;
+
+		__handle_fetch_ack ( mon, x, msg->hdr.src_id );
+		p += sizeof ( struct msg_page_fetch_ack_t ) + x->data_len;
+	}
+
+	apply_held_page_diffs ( mon );
+}
+
+static void
+handle_fetch_ack_local ( struct mon_t *mon,
+			 struct msg_page_invalidate_request_t *x )
+{
+	struct msg_page_fetch_ack_t xx;
+
+	xx.page_no = x->page_no;
+	xx.kind = x->kind;
+	xx.seq = x->seq;
+	xx.hops = x->hops;
+	xx.encoding = PAGE_ENCODING_NONE;
+	xx.base_seq = -1LL;
+	xx.data_len = 0;
+
+	__handle_fetch_ack ( mon, &xx, mon->cpuid );
+}
+
+/*************************************/	
+
+static void
+update_pdescr_with_invalidate_request ( struct mon_t *mon, struct msg_page_invalidate_request_t *x )
+{
+	struct page_descr_t *pdescr = get_pdescr ( mon, x->page_no );
+
+	switch ( x->kind ) {
+	case MEM_ACCESS_READ:
+		DP ( stderr, "update(rd): (no=%#x) (%s->%s) (%d->%d) (%s+%d)\n", 
+			x->page_no,
+			PageState_to_string ( pdescr->state ),
+			PageState_to_string ( PAGE_STATE_READ_ONLY_SHARED ),
+			pdescr->owner,
+			pdescr->owner,
+			Cpuset_to_string ( &pdescr->copyset ),
+			x->src_id );
+
+		assert ( pdescr->state != PAGE_STATE_INVALID );
+		pdescr->state = PAGE_STATE_READ_ONLY_SHARED;
+		Cpuset_add ( &pdescr->copyset, x->src_id ); 
+		break;
+	 
+	case MEM_ACCESS_WRITE:
+		DP ( stderr, "update(wr): (no=%#x) (%s->%s) (%d->%d) (%s->{%d})\n", 
+			x->page_no,
+			PageState_to_string ( pdescr->state ),
+			PageState_to_string ( PAGE_STATE_INVALID ),
+			pdescr->owner,
+			x->src_id,
+			Cpuset_to_string ( &pdescr->copyset ),
+			x->src_id );
+
+		assert ( pdescr->state != PAGE_STATE_INVALID );
+		assert ( twins[x->page_no] == NULL );
+		pdescr->state = PAGE_STATE_INVALID;
+		pdescr->owner = x->src_id;
+		Cpuset_set_single ( &pdescr->copyset, x->src_id );
+		notify_pgtable_page_invalidated ( x->page_no );
+		mark_prefetched_page_invalidated ( mon, x->page_no );
+		break;
+	 
+	default:
+		Match_failure ( "handle_invalidate_request\n" );
+	}
+}
+
+/* Fill <ack> and append it to <iov>.  The data of a raw ack is not
+ * copied after <ack> but gathered from pmem when the message is sent.
+ * Return the size of <ack> in its buffer. */
+static size_t
+set_fetch_ack ( struct mon_t *mon, struct msg_page_fetch_ack_t *ack,
+		struct msg_page_invalidate_request_t *x, struct iovec *iov, int *nr_iov )
+{
+	size_t len;
+
+	ack->page_no = x->page_no;
+	ack->kind = x->kind;
+	ack->seq = x->seq;
+	ack->hops = x->hops + ( ( x->src_id != mon->cpuid ) ? 1 : 0 );
+
+	if ( x->no_data ) {
+		ack->encoding = PAGE_ENCODING_NONE;
+		ack->base_seq = -1LL;
+		ack->data_len = 0;
+	} else {
+		encode_fetch_ack ( mon, ack, x->base_seq );
+	}
+
+	len = sizeof ( struct msg_page_fetch_ack_t );
+	if ( ack->encoding != PAGE_ENCODING_RAW ) {
+		len += ack->data_len;
+	}
+
+	iov[*nr_iov].iov_base = ack;
+	iov[*nr_iov].iov_len = len;
+	( *nr_iov )++;
+
+	if ( ack->encoding == PAGE_ENCODING_RAW ) {
+		iov[*nr_iov].iov_base = ( void * ) get_page_paddr ( mon, ack->page_no );
+		iov[*nr_iov].iov_len = PAGE_SIZE_4K;
+		( *nr_iov )++;
+	}
+
+	return len;
+}
+
+/* A requestor never asks itself for the data of a page (see
+ * handle_fetch_ack_local ()), so the acks always go to a remote node. */
+static void
+send_fetch_ack ( struct mon_t *mon, struct iovec *iov, int nr_iov, int dest_id )
+{
+	ASSERT ( dest_id != mon->cpuid );
+
+	Comm_sendv ( mon->comm, MSG_KIND_PAGE_FETCH_ACK, iov, nr_iov, dest_id );
+}
+
+/* Return TRUE if this node sends the requestor the state of a page */
+static bool_t
+has_fetch_ack_to_send ( struct mon_t *mon, struct msg_page_invalidate_request_t *invs, int n )
+{
+	int i;
+
+	for ( i = 0; i < n; i++ ) {
+		if ( ( mon->cpuid != invs[i].src_id ) && 
+		     ( mon->cpuid == get_pdescr ( mon, invs[i].page_no )->owner ) ) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/* Handing a page over is a release point of the multiple-writer
+ * protocol: the page may hold a lock that the guest has released with a
+ * plain store, which the monitor never sees.  So the diffs of this node
+ * are flushed before the FETCH_ACK is sent. */
+void
+handle_invalidate_request ( struct mon_t *mon, struct msg_t *msg )
+{
+	struct msg_page_invalidate_request_t *invs = Msg_to_msg_page_invalidate_request ( msg );
+	const int n = msg->hdr.len / sizeof ( struct msg_page_invalidate_request_t );
+	bit8u_t *acks = NULL;
+	size_t len = 0;
+	struct iovec *iov = NULL;
+	int nr_iov = 0;
+	int i;
+
+	if ( has_fetch_ack_to_send ( mon, invs, n ) ) {
+		flush_page_diffs ( mon );
+	}
+
+	for ( i = 0; i < n; i++ ) {
+		struct msg_page_invalidate_request_t *x = &invs[i];
+		struct page_descr_t *pdescr = get_pdescr ( mon, x->page_no );
+
+		DP ( stderr, "handle invalidate_request (no=%#x,seq=%lld,owner=%d)\n", 
+			x->page_no, pdescr->seq, pdescr->owner );
+
+		if ( ( mon->cpuid == x->src_id ) && ( mon->cpuid == pdescr->owner ) ) { 
+			handle_fetch_ack_local ( mon, x );
+			continue;
+		}
+
+		if ( mon->cpuid == pdescr->owner ) {
+			/* send the up-to-date state of the page to the requestor */
+			DP ( stderr, "owner = %d, x->src_id = %d\n", pdescr->owner, x->src_id  );
+			if ( acks == NULL ) {
+				acks = Malloc ( n * ( sizeof ( struct msg_page_fetch_ack_t ) + PAGE_SIZE_4K ) );
+				/* two entries per ack and one for the header */
+				iov = Calloct ( 2 * n + 1, struct iovec );
+			}
+			len += set_fetch_ack ( mon, ( struct msg_page_fetch_ack_t * ) ( acks + len ), 
+					       x, iov, &nr_iov );
+		} else {
+			DP ( stderr, "skip sending fetch_ack\n" );
+		}
+
+		update_pdescr_with_invalidate_request ( mon, x );
+		change_page_prot ( mon, x->page_no );
+	}
+
+	if ( acks != NULL ) {
+		send_fetch_ack ( mon, iov, nr_iov, invs[0].src_id );
+		Free ( iov );
+		Free ( acks );
+	}
+}
+
+/*************************************/
+
+static void
+__send_invalidate_request ( struct mon_t *mon, struct msg_t *msg, int dest_id )
+{
+	send_or_handle ( mon, msg, dest_id, &handle_invalidate_request );
+}
+
+/* Only the members of <copyset> are visited, so the fan-out does not grow
+ * with the number of the nodes. */
+static void
+send_invalidate_request_to_copyset ( struct mon_t *mon, struct msg_t *msg, 
+				     const struct cpuset_t *copyset, int src_id, int owner )
+{
+	int i;
+	
+	CPUSET_FOR_EACH ( i, copyset ) {
+		if ( ( i == src_id ) && ( i != mon->cpuid ) && ( i != owner ) ) {
+			DP ( stderr,
+				"not send invalidate request to %d: src_id=%d, copyset=%s\n",
+				i , src_id, Cpuset_to_string ( copyset ) );
+			continue;
+		}
+
+		__send_invalidate_request ( mon, msg, i );
+	}
+}
+
+static void
+send_invalidate_request ( struct mon_t *mon, struct msg_page_fetch_request_t *x,
+			  struct page_descr_t *pdescr,
+			  struct msg_page_invalidate_request_t *invs, int n )
+{
+	struct msg_t *msg;
+
+	msg = Msg_create ( MSG_KIND_PAGE_INVALIDATE_REQUEST,
+			   n * sizeof ( struct msg_page_invalidate_request_t ),
+			   invs );
+	
+	switch ( x->kind ) {
+	case MEM_ACCESS_READ:
+		assert ( x->src_id != pdescr->owner );
+		__send_invalidate_request ( mon, msg, pdescr->owner );
+		break;
+	 
+	case MEM_ACCESS_WRITE:
+		send_invalidate_request_to_copyset ( mon, msg, &pdescr->copyset, x->src_id, pdescr->owner );
+		break;
+	 
+	default:
+		Match_failure ( "send_invalidate_request\n" );
+	}
+
+	Msg_destroy ( msg );	
+}
+
+/* A prefetched page can share the invalidate request of <lead> only if
+ * the nodes that <lead> involves hold it in the same roles.  Otherwise
+ * it is left to the ordinary protocol. */
+static bool_t
+can_prefetch_page ( struct mon_t *mon, struct msg_page_fetch_request_t *y,
+		    struct msg_page_fetch_request_t *lead )
+{
+	struct page_descr_t *pdescr = get_pdescr ( mon, y->page_no );
+
+	if ( ( pdescr->requesting ) || ( ! is_manager ( mon, y->page_no ) ) ) {
+		return FALSE;
+	}
+
+	/* never invalidate the twins of the multiple-writer protocol */
+	if ( ( y->kind == MEM_ACCESS_WRITE ) &&
+	     ( is_multiple_writer_page ( y->page_no ) || page_mode_is_changing ( y->page_no ) ) ) {
+		return FALSE;
+	}
+
+	if ( lead != NULL ) {
+		struct page_descr_t *lead_pdescr = get_pdescr ( mon, lead->page_no );
+
+		if ( ( y->kind != lead->kind ) || ( pdescr->owner != lead_pdescr->owner ) ) {
+			return FALSE;
+		}
+
+		if ( ( y->kind == MEM_ACCESS_WRITE ) && ( ! Cpuset_equal ( &pdescr->copyset, &lead_pdescr->copyset ) ) ) {
+			return FALSE;
+		}
+	}
+
+	return ( ( y->kind == MEM_ACCESS_WRITE ) ||
+		 ( ( y->src_id != pdescr->owner ) && ( ! Cpuset_contains ( &pdescr->copyset, y->src_id ) ) ) );
+}
+
+/* Forward a request that has reached a node other than the manager to
+ * the probable owner (or to the home that a static manager handed the
+ * page over to).  The prefetched pages go along with it. */
+static void
+forward_fetch_request ( struct mon_t *mon, struct msg_t *msg )
+{
+	const struct msg_page_fetch_request_t *x = Msg_to_msg_page_fetch_request ( msg );
+	const int dest_id = get_request_dest_id ( mon, x->page_no );
+	struct msg_t *m;
+
+	ASSERT ( dest_id != mon->cpuid );
+
+	m = Msg_dup ( msg );
+	Msg_to_msg_page_fetch_request ( m )->hops++;
+	Comm_send ( mon->comm, m, dest_id );
+	Msg_destroy ( m );
+
+	mon->stat.nr_fetch_forwards++; /* [STAT] */
+}
+
+static void send_prefetch_reject ( struct mon_t *mon, int *page_nos, int n, int dest_id );
+
+void
+handle_fetch_request ( struct mon_t *mon, struct msg_t *msg )
+{
+	struct msg_page_fetch_request_t *reqs = Msg_to_msg_page_fetch_request ( msg );
+	const int n = msg->hdr.len / sizeof ( struct msg_page_fetch_request_t );
+	struct msg_page_invalidate_request_t invs[PREFETCH_MAX_WINDOW + 1];
+	struct msg_page_fetch_request_t *x = NULL;
+	int rejects[PREFETCH_MAX_WINDOW + 1];
+	int nr_invs = 0, nr_rejects = 0;
+	int i;
+
+	ASSERT ( ( 1 <= n ) && ( n <= PREFETCH_MAX_WINDOW + 1 ) );
+
+	if ( ( ! reqs[0].is_prefetch ) && get_pdescr ( mon, reqs[0].page_no )->requesting ) {
+		struct page_descr_t *pdescr = get_pdescr ( mon, reqs[0].page_no );
+		struct msg_t *m = Msg_dup ( msg );
+		Comm_defer_msg ( mon->comm, m, reqs[0].src_id, reqs[0].page_no );
+
+		DP ( stderr, 
+		     "save: (no=%#x,seq=%lld,owner=%d,copyset=%s,%s), from=%d,%d\n",
+		     reqs[0].page_no, pdescr->seq, pdescr->owner, Cpuset_to_string ( &pdescr->copyset ),
+		     MemAccessKind_to_string ( reqs[0].kind ),
+		     reqs[0].src_id, m->hdr.src_id );
+
+		return;
+	}
+
+	if ( ( ! reqs[0].is_prefetch ) && ( ! is_manager ( mon, reqs[0].page_no ) ) ) {
+		forward_fetch_request ( mon, msg );
+		return;
+	}
+
+	for ( i = 0; i < n; i++ ) {
+		struct msg_page_fetch_request_t *y = &reqs[i];
+		struct page_descr_t *pdescr = get_pdescr ( mon, y->page_no );
+
+		if ( ( y->is_prefetch ) && ( ! can_prefetch_page ( mon, y, x ) ) ) {
+			rejects[nr_rejects++] = y->page_no;
+			continue;
+		}
+
+		if ( x == NULL ) {
+			x = y;
+		}
+
+		DP ( stderr, "requesting: TRUE %#x (%lld --> %lld)\n", y->page_no, 
+			pdescr->seq, pdescr->seq + 1LL );
+		pdescr->seq++;
+		pdescr->requesting = TRUE;
+
+		if ( ! y->is_prefetch ) {
+			record_home_request ( mon, y->page_no, y->src_id );
+		}
+	
+		DP ( stderr, "handle fetch_request: (no=%#x,seq=%lld,owner=%d,copyset=%s,%s), from=%d,%d\n",
+			y->page_no, pdescr->seq, pdescr->owner, Cpuset_to_string ( &pdescr->copyset ),
+			MemAccessKind_to_string ( y->kind ),
+			y->src_id, msg->hdr.src_id );
+
+		invs[nr_invs].page_no = y->page_no;
+		invs[nr_invs].kind = y->kind;
+		invs[nr_invs].src_id = y->src_id;
+		invs[nr_invs].seq = pdescr->seq;
+		invs[nr_invs].no_data = y->no_data;
+		invs[nr_invs].base_seq = y->base_seq;
+		invs[nr_invs].hops = y->hops + ( ( pdescr->owner != mon->cpuid ) ? 1 : 0 );
+		nr_invs++;
+	}
+
+	if ( nr_rejects > 0 ) {
+		send_prefetch_reject ( mon, rejects, nr_rejects, reqs[0].src_id );
+	}
+
+	if ( x == NULL ) {
+		return;
+	}
+
+	send_invalidate_request ( mon, x, get_pdescr ( mon, x->page_no ), invs, nr_invs );
+}
+
+/* The requestor of a prefetch that the manager dropped would
+ * otherwise keep it PREFETCH_REQUESTED: the page would not be
+ * prefetched again, nor fetched with a delta. */
+static void
+send_prefetch_reject ( struct mon_t *mon, int *page_nos, int n, int dest_id )
+{
+	struct msg_t *msg;
+
+	msg = Msg_create ( MSG_KIND_PAGE_PREFETCH_REJECT, n * sizeof ( int ), page_nos );
+	send_or_handle ( mon, msg, dest_id, &handle_prefetch_reject );
+	Msg_destroy ( msg );
+}
+
+/* [Note] A reject may arrive after the page has been faulted in and
+ * requested again.  Dropping the state of that newer request only makes
+ * it count as a demand fetch, as for a page faulted while prefetched. */
+void
+handle_prefetch_reject ( struct mon_t *mon, struct msg_t *msg )
+{
+	const int *page_nos = ( const int * ) msg->body;
+	const int n = msg->hdr.len / sizeof ( int );
+	int i;
+
+	for ( i = 0; i < n; i++ ) {
+		bit8u_t *state = get_prefetch_state ( mon, page_nos[i] );
+
+		if ( *state == PREFETCH_REQUESTED ) {
+			*state = PREFETCH_NONE;
+			mon->stat.nr_prefetch_rejects++;
+		}
+	}
+}
+
+/*************************************/
+
+static void
+set_fetch_request ( struct mon_t *mon, struct msg_page_fetch_request_t *req,
+		    int page_no, mem_access_kind_t kind, bool_t is_prefetch, int dest_id )
+{
+	req->page_no = page_no;
+	req->kind = kind;
+	req->src_id = mon->cpuid; /* requestor's cpuid */
+	req->is_prefetch = is_prefetch;
+	req->no_data = FALSE;
+	req->hops = ( dest_id != mon->cpuid ) ? 1 : 0;
+
+	/* A delta is decoded against the version advertised here, so it is
+	 * advertised only when no other FETCH_ACK of the page is on the way. */
+	req->base_seq = ( ( ( is_prefetch ) || ( *get_prefetch_state ( mon, page_no ) == PREFETCH_REQUESTED ) )
+			  ? -1LL
+			  : get_snapshot_seq ( mon, page_no ) );
+}
+
+/* The destinations of the faulting page and of the <window> pages
+ * predicted by the detector, the former first.  Each appears once. */
+static int
+get_fetch_request_dests ( struct mon_t *mon, struct shm_arg_t *x, int window, 
+			  int dests[PREFETCH_MAX_WINDOW + 1] )
+{
+	const struct prefetch_detector_t *d = &prefetch_detector;
+	int n = 0;
+	int j;
+
+	dests[n++] = get_request_dest_id ( mon, x->page_no );
+
+	for ( j = 1; ( j <= window ) && ( ! x->no_data ); j++ ) {
+		const int page_no = x->page_no + j * d->stride;
+		int dest_id, k;
+
+		if ( ( page_no < 0 ) || ( page_no >= mon->num_of_pages ) ) {
+			break;
+		}
+
+		dest_id = get_request_dest_id ( mon, page_no );
+		for ( k = 0; ( k < n ) && ( dests[k] != dest_id ); k++ ) {
+			;
+		}
+		if ( k == n ) {
+			dests[n++] = dest_id;
+		}
+	}
+
+	return n;
+}
+
+/* The <window> pages predicted by the detector are grouped by manager:
+ * those of the manager of the faulting page follow it in its
+ * FETCH_REQUEST, and the others are sent in one prefetch-only request
+ * per manager. */
+static void
+send_or_handle_fetch_request ( struct mon_t *mon, struct shm_arg_t *x, int window )
+{
+	const struct prefetch_detector_t *d = &prefetch_detector;
+	int dests[PREFETCH_MAX_WINDOW + 1];
+	const int nr_dests = get_fetch_request_dests ( mon, x, window, dests );
+	const int mid = dests[0];
+	int i;
+
+	for ( i = 0; i < nr_dests; i++ ) {
+		struct msg_page_fetch_request_t reqs[PREFETCH_MAX_WINDOW + 1];
+		const int dest_id = dests[i];
+		struct msg_t *msg;
+		int n = 0;
+		int j;
+
+		if ( dest_id == mid ) {
+			set_fetch_request ( mon, &reqs[n++], x->page_no, x->kind, FALSE, dest_id );
+			reqs[0].no_data = x->no_data;
+		}
+
+		/* the pages that follow an overwritten page are likely to be
+		 * overwritten too */
+		for ( j = 1; ( j <= window ) && ( ! x->no_data ); j++ ) {
+			const int page_no = x->page_no + j * d->stride;
+			bit8u_t *state;
+
+			if ( ( page_no < 0 ) || ( page_no >= mon->num_of_pages ) ) {
+				break;
+			}
+
+			if ( ( get_request_dest_id ( mon, page_no ) != dest_id ) ||
+			     ( page_is_accesible ( get_pdescr ( mon, page_no ), x->kind ) ) ) {
+				continue;
+			}
+
+			if ( ( x->kind == MEM_ACCESS_WRITE ) &&
+			     ( is_multiple_writer_page ( page_no ) || page_mode_is_changing ( page_no ) ) ) {
+				continue;
+			}
+
+			state = get_prefetch_state ( mon, page_no );
+			if ( *state == PREFETCH_REQUESTED ) {
+				continue;
+			}
+
+			*state = PREFETCH_REQUESTED;
+			set_fetch_request ( mon, &reqs[n++], page_no, x->kind, TRUE, dest_id );
+			mon->stat.nr_prefetches++;
+		}
+
+		if ( n == 0 ) {
+			continue;
+		}
+
+		msg = Msg_create ( MSG_KIND_PAGE_FETCH_REQUEST,
+				   n * sizeof ( struct msg_page_fetch_request_t ),
+				   reqs );
+		send_or_handle ( mon, msg, dest_id, &handle_fetch_request );
+		Msg_destroy ( msg );     	
+	}
+}
+
+/********************/
+ 
+static void
+recv_and_handle_fetch_ack ( struct mon_t *mon, struct shm_arg_t *x )
+{
+	DP ( stderr, "wait for fetch_ack: begin (no=%#x, kind=%s)\n",
+		x->page_no, MemAccessKind_to_string ( x->kind ) );
+//	Print ( stderr, "wait for fetch_ack: begin (no=%#x, kind=%s)\n", x->page_no, MemAccessKind_to_string ( x->kind ) );
+
+	while ( ! page_is_accesible ( x->pdescr, x->kind ) ) {
+		handle_next_msg ( mon );
+	}
+
+	DP ( stderr, "wake up fetch_ack: end (no=%#x, kind=%s)\n",
+		x->page_no, MemAccessKind_to_string ( x->kind ) );
+//	Print ( stderr, "wake up fetch_ack: end (no=%#x, kind=%s)\n",x->page_no, MemAccessKind_to_string ( x->kind ) );
+}
+
+/********************/
+
+/* Demand fetches are counted per page, and the counts are halved every
+ * FETCH_COUNT_EPOCH demand fetches of this node.  A page with a high count
+ * keeps being taken away by other nodes. */
+
+enum {
+	FETCH_COUNT_EPOCH = 256
+};
+
+struct fetch_count_t {
+	int	epoch;
+	int	count;
+};
+
+static struct fetch_count_t *fetch_counts = NULL;
+static int nr_demand_fetches = 0;
+
+static struct fetch_count_t *
+get_fetch_count ( struct mon_t *mon, int page_no )
+{
+	struct fetch_count_t *c;
+	int elapsed;
+
+	ASSERT ( ( 0 <= page_no ) && ( page_no < mon->num_of_pages ) );
+
+	if ( fetch_counts == NULL ) {
+		fetch_counts = Calloct ( mon->num_of_pages, struct fetch_count_t );
+	}
+
+	c = &fetch_counts[page_no];
+	elapsed = nr_demand_fetches / FETCH_COUNT_EPOCH - c->epoch;
+	c->count = ( elapsed < 31 ) ? ( c->count >> elapsed ) : 0;
+	c->epoch += elapsed;
+
+	return c;
+}
+
+static void
+fetch_page ( struct mon_t *mon, struct shm_arg_t *x )
+{
+	DP_color ( stderr, GREEN, "fetch_page: begin (no=%#x, kind=%s)\n",
+		   x->page_no, MemAccessKind_to_string ( x->kind ) );
+//	Print_color ( stderr, GREEN, "fetch_page: begin (no=%#x, kind=%s)\n",     x->page_no, MemAccessKind_to_string ( x->kind ) );
+
+	fetching_page = TRUE;
+	get_fetch_count ( mon, x->page_no )->count++;
+	nr_demand_fetches++;
+	detect_access_pattern ( mon, x->page_no );
+	send_or_handle_fetch_request ( mon, x, prefetch_detector.window );
+	recv_and_handle_fetch_ack ( mon, x );
+	fetching_page = FALSE;
+	apply_held_page_diffs ( mon );
+
+	DP_color ( stderr, GREEN, "fetch_page: end (no=%#x, kind=%s)\n",
+		   x->page_no, MemAccessKind_to_string ( x->kind ) );
+//	Print_color ( stderr, GREEN, "fetch_page: end (no=%#x, kind=%s)\n",     x->page_no, MemAccessKind_to_string ( x->kind ) );
+}
+
+/****************************************************************/
+
+/* Multiple-writer protocol
+ *
+ * Falsely shared pages can be switched to a multiple-writer protocol.  A
+ * write to a READ_ONLY_SHARED copy of such a page does not invalidate the
+ * other copies: the writer saves a twin of the page and upgrades its copy
+ * locally.  At synchronization points (LOCK-prefixed instructions,
+ * accesses to the local APIC, interrupt delivery, and the handover of a
+ * page to another node) each node encodes the words that differ from the
+ * twins as runs, sends them to the other nodes, and waits until they have
+ * been acknowledged.  A node acknowledges a diff at once; the diff of a
+ * page that is being fetched is held until the page has been installed.
+ *
+ * The ranges of the config file are switched at boot.  At run time, a
+ * write to a page that this node keeps fetching switches the page (see
+ * is_falsely_shared_page ()), and a LOCK-prefixed instruction on a page
+ * switches it back for good.  The protocol of a page range is switched in
+ * two phases coordinated by the BSP.  On PREPARE, each node flushes its
+ * diffs and stops writing to the pages; it acknowledges only after the
+ * fetches of the old protocol on them have completed.  On COMMIT, the new
+ * protocol takes effect.  As a result, a twin is never invalidated by a
+ * write of the single-writer protocol.
+ */
+
+enum {
+	MAX_PAGE_DIFF_LEN = PAGE_SIZE_4K + PAGE_SIZE_4K / 2 /* runs of one word */
+};
+
+void
+init_page_modes ( struct mon_t *mon, const struct config_t *config )
+{
+	int i;
+
+	ASSERT ( mon != NULL );
+	ASSERT ( config != NULL );
+
+	page_modes = Calloct ( mon->num_of_pages, bit8u_t );
+	locked_pages = Calloct ( mon->num_of_pages, bit8u_t );
+	twins = Calloct ( mon->num_of_pages, bit8u_t * );
+	dirty_pages = Calloct ( mon->num_of_pages, int );
+
+	for ( i = 0; i < config->num_of_multiple_writer_ranges; i++ ) {
+		const struct page_range_t *r = &config->multiple_writer_ranges[i];
+		int j;
+
+		for ( j = r->from; ( j <= r->to ) && ( j < mon->num_of_pages ); j++ ) {
+			page_modes[j] = PAGE_MODE_MULTIPLE_WRITER;
+		}
+	}
+
+	for ( i = 0; i < config->num_of_immutable_ranges; i++ ) {
+		const struct page_range_t *r = &config->immutable_ranges[i];
+		int j;
+
+		for ( j = r->from; ( j <= r->to ) && ( j < mon->num_of_pages ); j++ ) {
+			if ( page_modes[j] == PAGE_MODE_SINGLE_WRITER ) {
+				page_modes[j] = PAGE_MODE_IMMUTABLE;
+			}
+		}
+	}
+}
+
+/* A page that this node has fetched VMM_FALSE_SHARING_THRESHOLD times
+ * recently keeps being taken away by the writes of other nodes, and is
+ * assumed to be falsely shared unless a LOCK-prefixed instruction has
+ * accessed it (0, the default, disables the switch at run time). */
+
+static int false_sharing_threshold = -1;
+
+static int
+get_false_sharing_threshold ( void )
+{
+	char *p;
+
+	if ( false_sharing_threshold >= 0 ) {
+		return false_sharing_threshold;
+	}
+
+	p = getenv ( "VMM_FALSE_SHARING_THRESHOLD" );
+	false_sharing_threshold = ( p != NULL ) ? Atoi ( p ) : 0;
+
+	return false_sharing_threshold;
+}
+
+static bool_t
+is_falsely_shared_page ( struct mon_t *mon, int page_no )
+{
+	const int threshold = get_false_sharing_threshold ( );
+
+	return ( ( threshold > 0 ) &&
+		 ( page_modes[page_no] == PAGE_MODE_SINGLE_WRITER ) &&
+		 ( ! locked_pages[page_no] ) &&
+		 ( get_fetch_count ( mon, page_no )->count >= threshold ) );
+}
+
+/* Encode the words of <page> that differ from <twin> into <buf>, and
+ * return the number of bytes written. */
+static size_t
+encode_page_diff ( const bit8u_t *page, const bit8u_t *twin, bit8u_t *buf )
+{
+	const bit32u_t *p = ( const bit32u_t * ) page;
+	const bit32u_t *t = ( const bit32u_t * ) twin;
+	const int N = PAGE_SIZE_4K / sizeof ( bit32u_t );
+	size_t len = 0;
+	int i = 0;
+
+	while ( i < N ) {
+		struct msg_page_diff_run_t run;
+		int j;
+
+		if ( p[i] == t[i] ) {
+			i++;
+			continue;
+		}
 
-	if ( ( mon->cpuid == x->src_id ) && ( mon->cpuid == pdescr->owner ) ) { 
-		handle_fetch_ack_local ( mon, x );
-	} else {
-		if ( mon->cpuid == pdescr->owner ) {
-			/* send the up-to-date state of the page to the requestor */
-			DP ( stderr, "owner = %d, x->src_id = %d\n", pdescr->owner, x->src_id  );
-			send_fetch_ack ( mon, x );
+		for ( j = i; ( j < N ) && ( p[j] != t[j] ); j++ ) {
+			;
+		}
+
+		run.offset = i * sizeof ( bit32u_t );
+		run.len = ( j - i ) * sizeof ( bit32u_t );
+		Mmove ( buf + len, &run, sizeof ( run ) );
+		len += sizeof ( run );
+		Mmove ( buf + len, page + run.offset, run.len );
+		len += run.len;
+
+		i = j;
+	}
+
+	ASSERT ( len <= MAX_PAGE_DIFF_LEN );
+	return len;
+}
+
+static void
+apply_page_diff ( struct mon_t *mon, int page_no, const bit8u_t *buf, size_t len )
+{
+	bit8u_t *page = ( bit8u_t * ) get_page_paddr ( mon, page_no );
+	bit8u_t *twin = twins[page_no];
+	size_t i = 0;
+
+	if ( get_pdescr ( mon, page_no )->state == PAGE_STATE_INVALID ) {
+		/* no fetch is on the way (see page_diff_is_held ()), so
+		 * the next fetch brings the up-to-date page */
+		return;
+	}
+
+	while ( i < len ) {
+		struct msg_page_diff_run_t run;
+
+		Mmove ( &run, buf + i, sizeof ( run ) );
+		i += sizeof ( run );
+		ASSERT ( run.offset + run.len <= PAGE_SIZE_4K );
+
+		Mmove ( page + run.offset, buf + i, run.len );
+		if ( twin != NULL ) {
+			/* keep the remote writes out of the local diff */
+			Mmove ( twin + run.offset, buf + i, run.len );
+		}
+		i += run.len;
+	}
+
+	notify_pgtable_page_invalidated ( page_no );
+}
+
+static void
+make_twin ( struct mon_t *mon, struct shm_arg_t *x )
+{
+	if ( x->pdescr->state == PAGE_STATE_INVALID ) {
+		struct shm_arg_t y = *x;
+
+		y.kind = MEM_ACCESS_READ;
+		y.no_data = FALSE;
+		fetch_page ( mon, &y );
+	}
+	assert ( x->pdescr->state == PAGE_STATE_READ_ONLY_SHARED );
+
+	if ( twins[x->page_no] == NULL ) {
+		twins[x->page_no] = Malloc ( PAGE_SIZE_4K );
+		Mmove ( twins[x->page_no], ( void * ) get_page_paddr ( mon, x->page_no ), PAGE_SIZE_4K );
+		dirty_pages[nr_dirty_pages++] = x->page_no;
+		mon->stat.nr_twins++;
+	}
+
+	/* the other copies stay valid */
+	x->pdescr->state = PAGE_STATE_EXCLUSIVELY_SHARED;
+	change_page_prot ( mon, x->page_no );
+}
+
+static void
+drop_twin ( struct mon_t *mon, int page_no )
+{
+	struct page_descr_t *pdescr = get_pdescr ( mon, page_no );
+
+	Free ( twins[page_no] );
+	twins[page_no] = NULL;
+
+	if ( pdescr->state == PAGE_STATE_EXCLUSIVELY_SHARED ) {
+		pdescr->state = PAGE_STATE_READ_ONLY_SHARED;
+		change_page_prot ( mon, page_no );
+	}
+}
+
+/* A diff of an invalid page is dropped, since the next fetch brings the
+ * page with the diff applied.  But a FETCH_ACK that is already on the
+ * way may carry the image of the owner from before the diff: the ack
+ * and the diff come from different nodes and arrive in either order.
+ * So the diff is held until the fetches of this node have completed,
+ * and is then applied to the installed page.  The diffs of a page are
+ * applied in the order of their arrival.  [Note] While a demand fetch is
+ * in progress, the diffs of all the invalid pages are held.
+ *
+ * The diff is acknowledged when it is held: the guest cannot read the
+ * page before it has been installed, and the diff is applied then.  The
+ * writer thus never waits for a node that waits for the writer to hand
+ * it a page (see handle_invalidate_request ()). */
+
+struct held_page_diff_t {
+	struct held_page_diff_t	*next;
+	int			page_no;
+	size_t			len;
+	bit8u_t			data[0];
+};
+
+static struct held_page_diff_t *held_page_diffs = NULL;
+
+static bool_t
+page_diff_is_held ( struct mon_t *mon, int page_no )
+{
+	return ( ( get_pdescr ( mon, page_no )->state == PAGE_STATE_INVALID ) &&
+		 ( ( fetching_page ) || ( *get_prefetch_state ( mon, page_no ) == PREFETCH_REQUESTED ) ) );
+}
+
+static bool_t
+has_held_page_diff ( int page_no )
+{
+	struct held_page_diff_t *h;
+
+	for ( h = held_page_diffs; h != NULL; h = h->next ) {
+		if ( h->page_no == page_no ) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static void
+hold_page_diff ( int page_no, const bit8u_t *buf, size_t len )
+{
+	struct held_page_diff_t *h, **pp;
+
+	h = Malloc ( sizeof ( struct held_page_diff_t ) + len );
+	h->next = NULL;
+	h->page_no = page_no;
+	h->len = len;
+	Mmove ( h->data, buf, len );
+
+	for ( pp = &held_page_diffs; *pp != NULL; pp = &( *pp )->next ) {
+		;
+	}
+	*pp = h;
+}
+
+/* Called when a page has been installed and when the fetches of this
+ * node have completed */
+static void
+apply_held_page_diffs ( struct mon_t *mon )
+{
+	struct held_page_diff_t **pp = &held_page_diffs;
+
+	while ( *pp != NULL ) {
+		struct held_page_diff_t *h = *pp;
+
+		if ( page_diff_is_held ( mon, h->page_no ) ) {
+			pp = &h->next;
+			continue;
+		}
+
+		apply_page_diff ( mon, h->page_no, h->data, h->len );
+		*pp = h->next;
+		Free ( h );
+	}
+}
+
+void
+handle_page_diff ( struct mon_t *mon, struct msg_t *msg )
+{
+	bit8u_t *p = ( bit8u_t * ) Msg_to_msg_page_diff ( msg );
+	bit8u_t *end = p + msg->hdr.len;
+	struct msg_t *ack;
+
+	while ( p < end ) {
+		struct msg_page_diff_t d;
+
+		Mmove ( &d, p, sizeof ( d ) );
+		p += sizeof ( d );
+		if ( page_diff_is_held ( mon, d.page_no ) || has_held_page_diff ( d.page_no ) ) {
+			hold_page_diff ( d.page_no, p, d.len );
 		} else {
-			DP ( stderr, "skip sending fetch_ack\n" );
+			apply_page_diff ( mon, d.page_no, p, d.len );
 		}
+		p += d.len;
+	}
 
-		update_pdescr_with_invalidate_request ( mon, x );
-		run_emulation_code_of_vm ( mon, CHANGE_PAGE_PROT, x->page_no );
+	ack = Msg_create3 ( MSG_KIND_PAGE_DIFF_ACK );
+	Comm_send ( mon->comm, ack, msg->hdr.src_id );
+	Msg_destroy ( ack );
+}
+
+void
+handle_page_diff_ack ( struct mon_t *mon, struct msg_t *msg )
+{
+	ASSERT ( msg->hdr.kind == MSG_KIND_PAGE_DIFF_ACK );
+	ASSERT ( msg->hdr.src_id != mon->cpuid );
+	ASSERT ( flushing_page_diffs );
+
+	nr_diff_acks++;
+}
+
+static void
+send_page_diffs ( struct mon_t *mon, bit8u_t *buf, size_t len )
+{
+	struct msg_t *msg;
+
+	flushing_page_diffs = TRUE;
+	nr_diff_acks = 0;
+
+	msg = Msg_create ( MSG_KIND_PAGE_DIFF, len, buf );
+	Comm_bcast ( mon->comm, msg );
+	Msg_destroy ( msg );
+
+	while ( nr_diff_acks < get_num_of_procs ( ) - 1 ) {
+		handle_next_msg ( mon );
 	}
+
+	flushing_page_diffs = FALSE;
+}
+
+/* Called at synchronization points */
+void
+flush_page_diffs ( struct mon_t *mon )
+{
+	bit8u_t *buf;
+	size_t len = 0;
+	int i;
+
+	ASSERT ( mon != NULL );
+
+	if ( nr_dirty_pages == 0 ) {
+		return;
+	}
+
+	buf = Malloc ( nr_dirty_pages * ( sizeof ( struct msg_page_diff_t ) + MAX_PAGE_DIFF_LEN ) );
+
+	for ( i = 0; i < nr_dirty_pages; i++ ) {
+		const int page_no = dirty_pages[i];
+		struct msg_page_diff_t d;
+
+		d.page_no = page_no;
+		d.len = encode_page_diff ( ( bit8u_t * ) get_page_paddr ( mon, page_no ),
+					   twins[page_no],
+					   buf + len + sizeof ( d ) );
+		if ( d.len > 0 ) {
+			Mmove ( buf + len, &d, sizeof ( d ) );
+			len += sizeof ( d ) + d.len;
+
+			mon->stat.nr_page_diffs++;
+			mon->stat.nr_page_diff_bytes += d.len;
+		}
+
+		drop_twin ( mon, page_no );
+	}
+	nr_dirty_pages = 0;
+
+	if ( len > 0 ) {
+		send_page_diffs ( mon, buf, len );
+	}
+
+	Free ( buf );
 }
 
 /*************************************/
 
 static void
-__send_invalidate_request ( struct mon_t *mon, struct msg_t *msg, int dest_id )
+prepare_page_mode_change ( struct mon_t *mon, struct msg_page_mode_change_t *x )
 {
-	send_or_handle ( mon, msg, dest_id, &handle_invalidate_request );
+	struct page_mode_change_t *c = &page_mode_change;
+
+	if ( ! x->is_multiple_writer ) {
+		flush_page_diffs ( mon );
+	}
+
+	c->is_pending = TRUE;
+	c->from_page_no = x->from_page_no;
+	c->to_page_no = x->to_page_no;
 }
 
 static void
-send_invalidate_request_to_copyset ( struct mon_t *mon, struct msg_t *msg, 
-					   bit32u_t copyset, int src_id, int owner )
+commit_page_mode_change ( struct mon_t *mon, struct msg_page_mode_change_t *x )
 {
+	struct page_mode_change_t *c = &page_mode_change;
 	int i;
-	
-	for ( i = 0; i < NUM_OF_PROCS; i++ ) {
-		if ( TEST_BIT ( copyset, i ) ) {
 
-			if ( ( i == src_id ) && ( i != mon->cpuid ) && ( i != owner ) ) {
-				continue;
-			}
+	for ( i = x->from_page_no; i <= x->to_page_no; i++ ) {
+		if ( ! x->is_multiple_writer ) {
+			page_modes[i] = PAGE_MODE_SINGLE_WRITER;
+			locked_pages[i] = TRUE;
+		} else if ( ! locked_pages[i] ) {
+			/* a request may have been overtaken by a LOCK-prefixed
+			 * instruction; every node sees the commits in the same order */
+			page_modes[i] = PAGE_MODE_MULTIPLE_WRITER;
+		}
+	}
+
+	c->is_pending = FALSE;
+	if ( x->src_id == mon->cpuid ) {
+		c->is_waiting_commit = FALSE;
+	}
+
+	mon->stat.nr_page_mode_changes++;
+}
+
+static void
+bcast_page_mode_change ( struct mon_t *mon, struct msg_page_mode_change_t *x, page_mode_phase_t phase )
+{
+	struct msg_t *msg;
+
+	msg = Msg_create3 ( MSG_KIND_PAGE_MODE_CHANGE, phase, 
+			    x->from_page_no, x->to_page_no, x->is_multiple_writer, x->src_id );
+	Comm_bcast ( mon->comm, msg );
+	Msg_destroy ( msg );
+}
+
+static void
+coordinate_page_mode_change ( struct mon_t *mon, struct msg_page_mode_change_t *x )
+{
+	struct page_mode_change_t *c = &page_mode_change;
+
+	assert ( mon->cpuid == BSP_CPUID );
+
+	c->is_coordinating = TRUE;
+
+	while ( has_requesting_page ( mon, x->from_page_no, x->to_page_no ) ) {
+		handle_next_msg ( mon );
+	}
+	prepare_page_mode_change ( mon, x );
+
+	c->nr_acks = 0;
+	bcast_page_mode_change ( mon, x, PAGE_MODE_PREPARE );
+	while ( c->nr_acks < get_num_of_procs ( ) - 1 ) {
+		handle_next_msg ( mon );
+	}
+
+	commit_page_mode_change ( mon, x );
+	bcast_page_mode_change ( mon, x, PAGE_MODE_COMMIT );
+
+	c->is_coordinating = FALSE;
+}
+
+void
+handle_page_mode_change ( struct mon_t *mon, struct msg_t *msg )
+{
+	struct msg_page_mode_change_t *x = Msg_to_msg_page_mode_change ( msg );
+	struct msg_t *ack;
+
+	switch ( x->phase ) {
+	case PAGE_MODE_REQUEST:
+		coordinate_page_mode_change ( mon, x );
+		break;
+
+	case PAGE_MODE_PREPARE:
+		prepare_page_mode_change ( mon, x );
+		ack = Msg_create3 ( MSG_KIND_PAGE_MODE_CHANGE, PAGE_MODE_PREPARE_ACK, 
+				    x->from_page_no, x->to_page_no, x->is_multiple_writer, x->src_id );
+		Comm_send ( mon->comm, ack, BSP_CPUID );
+		Msg_destroy ( ack );
+		break;
+
+	case PAGE_MODE_PREPARE_ACK:
+		page_mode_change.nr_acks++;
+		break;
+
+	case PAGE_MODE_COMMIT:
+		commit_page_mode_change ( mon, x );
+		break;
+
+	default:
+		Match_failure ( "handle_page_mode_change\n" );
+	}
+}
+
+/* Switch the protocol of the pages in [from_page_no, to_page_no], and
+ * return after the switch has taken effect on every node. */
+void
+set_page_mode ( struct mon_t *mon, int from_page_no, int to_page_no, bool_t is_multiple_writer )
+{
+	struct msg_page_mode_change_t x;
+	struct msg_t *msg;
+
+	ASSERT ( mon != NULL );
+	ASSERT ( ( 0 <= from_page_no ) && ( from_page_no <= to_page_no ) );
+	ASSERT ( to_page_no < mon->num_of_pages );
+
+	x.phase = PAGE_MODE_REQUEST;
+	x.from_page_no = from_page_no;
+	x.to_page_no = to_page_no;
+	x.is_multiple_writer = is_multiple_writer;
+	x.src_id = mon->cpuid;
+
+	if ( mon->cpuid == BSP_CPUID ) {
+		coordinate_page_mode_change ( mon, &x );
+		return;
+	}
+
+	page_mode_change.is_waiting_commit = TRUE;
+
+	msg = Msg_create3 ( MSG_KIND_PAGE_MODE_CHANGE, x.phase, 
+			    x.from_page_no, x.to_page_no, x.is_multiple_writer, x.src_id );
+	Comm_send ( mon->comm, msg, BSP_CPUID );
+	Msg_destroy ( msg );
+
+	while ( page_mode_change.is_waiting_commit ) {
+		handle_next_msg ( mon );
+	}
+}
+
+/* A LOCK-prefixed instruction is executed natively once its pages are
+ * writable, which is atomic only under the single-writer protocol.  The
+ * multiple-writer pages it accesses are therefore switched back. */
+static void
+switch_locked_pages_to_single_writer ( struct mon_t *mon, struct instruction_t *i )
+{
+	struct mem_access_t *p, *q;
+
+	if ( i->maccess == NULL ) {
+		return;
+	}
+
+	p = i->maccess ( mon, i );
+
+	for ( q = p; q != NULL; q = q->next ) {
+		const bit32u_t vaddrs[2] = { q->vaddr, q->vaddr + q->len - 1 };
+		int j;
+
+		for ( j = 0; j < 2; j++ ) {
+			bit32u_t paddr;
+			bool_t is_ok, read_write;
+			int page_no;
+
+			paddr = Monitor_try_vaddr_to_paddr2 ( q->sreg_index, vaddrs[j], &is_ok, &read_write );
+			if ( ! is_ok ) {
+				continue;
+			}
+
+			page_no = paddr_to_page_no ( paddr );
+			if ( ( page_no >= mon->num_of_pages ) || ( ! is_multiple_writer_page ( page_no ) ) ) {
+				continue;
+			}
+
+			set_page_mode ( mon, page_no, page_no, FALSE );
+			emulate_shared_memory_with_paddr ( mon, MEM_ACCESS_WRITE, paddr );
+		}
+	}
+
+	MemAccess_destroy_all ( p );
+}
+
+/****************************************************************/
+
+/* Remote atomic operations
+ *
+ * A LOCK-prefixed instruction normally migrates the pages it accesses to
+ * this node and is then executed natively, so a lock word contended among
+ * nodes bounces at every acquisition.  Once this node has fetched such a
+ * page REMOTE_ATOMIC_THRESHOLD times recently, a read-modify-write on it
+ * is instead shipped to the owner, which applies it to its exclusive copy
+ * while its guest is stopped and returns the old value.  The registers
+ * and the arithmetic flags are then updated here.  The owner declines if
+ * it does not hold the page exclusively, and the page is migrated.
+ */
+
+enum {
+	REMOTE_ATOMIC_THRESHOLD = 2
+};
+
+enum {
+	EFLAGS_CF	= 1 << 0,
+	EFLAGS_PF	= 1 << 2,
+	EFLAGS_AF	= 1 << 4,
+	EFLAGS_ZF	= 1 << 6,
+	EFLAGS_SF	= 1 << 7,
+	EFLAGS_OF	= 1 << 11,
+	EFLAGS_ARITH	= EFLAGS_CF | EFLAGS_PF | EFLAGS_AF | EFLAGS_ZF | EFLAGS_SF | EFLAGS_OF
+};
+
+struct remote_atomic_t {
+	bool_t				is_waiting;
+	struct msg_remote_atomic_ack_t	ack;
+};
+
+static struct remote_atomic_t remote_atomic = { FALSE, { FALSE, 0 } };
+
+static bit32u_t
+get_operand_mask ( size_t len )
+{
+	return ( len == 4 ) ? 0xffffffff : BIT_MASK ( len * 8 );
+}
+
+static bit32u_t
+eval_atomic_op ( const struct msg_remote_atomic_t *x, bit32u_t old_val )
+{
+	bit32u_t retval = 0;
+
+	switch ( x->op ) {
+	case ATOMIC_OP_XCHG:	retval = x->src; break;
+	case ATOMIC_OP_CMPXCHG:	retval = ( old_val == x->cmp ) ? x->src : old_val; break;
+	case ATOMIC_OP_XADD:
+	case ATOMIC_OP_ADD:	retval = old_val + x->src; break;
+	case ATOMIC_OP_OR:	retval = old_val | x->src; break;
+	case ATOMIC_OP_AND:	retval = old_val & x->src; break;
+	case ATOMIC_OP_INC:	retval = old_val + 1; break;
+	case ATOMIC_OP_DEC:	retval = old_val - 1; break;
+	case ATOMIC_OP_BTS:	retval = old_val | ( 1U << x->src ); break;
+	case ATOMIC_OP_BTR:	retval = old_val & ~( 1U << x->src ); break;
+	default:		Match_failure ( "eval_atomic_op\n" );
+	}
+
+	return retval & get_operand_mask ( x->len );
+}
+
+/* ZF, SF and PF of a result */
+static bit32u_t
+get_result_flags ( bit32u_t r, size_t len )
+{
+	bit32u_t flags = 0;
+	bit32u_t p;
+
+	r &= get_operand_mask ( len );
+
+	if ( r == 0 ) 				{ flags |= EFLAGS_ZF; }
+	if ( TEST_BIT ( r, len * 8 - 1 ) ) 	{ flags |= EFLAGS_SF; }
+
+	p = r & 0xff;
+	p ^= p >> 4;
+	p ^= p >> 2;
+	p ^= p >> 1;
+	if ( ( p & 1 ) == 0 ) 			{ flags |= EFLAGS_PF; }
+
+	return flags;
+}
+
+/* Flags of <r> = <a> + <b> (or <a> - <b> if <is_sub>) */
+static bit32u_t
+get_arith_flags ( bit32u_t a, bit32u_t b, bit32u_t r, size_t len, bool_t is_sub )
+{
+	const bit32u_t mask = get_operand_mask ( len );
+	bit32u_t flags, ov;
+
+	a &= mask;
+	b &= mask;
+	r &= mask;
+
+	flags = get_result_flags ( r, len );
+
+	if ( ( is_sub ) ? ( a < b ) : ( r < a ) ) { flags |= EFLAGS_CF; }
+
+	ov = ( is_sub ) ? ( ( a ^ b ) & ( a ^ r ) ) : ( ~( a ^ b ) & ( a ^ r ) );
+	if ( TEST_BIT ( ov, len * 8 - 1 ) ) 	{ flags |= EFLAGS_OF; }
+
+	if ( ( a ^ b ^ r ) & 0x10 ) 		{ flags |= EFLAGS_AF; }
+
+	return flags;
+}
+
+/* Decode the instruction into a remote atomic operation.  Return FALSE if
+ * it is not one of the supported forms with a memory destination. */
+static bool_t
+decode_atomic_op ( struct mon_t *mon, struct instruction_t *i, 
+		   struct msg_remote_atomic_t *x, bit32u_t *vaddr )
+{
+	struct user_regs_struct *uregs = &mon->regs->user;
+	const size_t len = ( i->opsize_override ) ? 2 : 4;
+	bool_t use_reg = TRUE;
+
+	if ( i->mod == 3 ) {
+		return FALSE;
+	}
+
+	x->len = len;
+	x->src = 0;
+	x->cmp = 0;
+	*vaddr = i->resolve ( i, uregs );
+
+	switch ( i->opcode ) {
+	case 0x86:   x->op = ATOMIC_OP_XCHG; x->len = 1; break;
+	case 0x87:   x->op = ATOMIC_OP_XCHG; break;
+	case 0x0fb0: x->op = ATOMIC_OP_CMPXCHG; x->len = 1; break;
+	case 0x0fb1: x->op = ATOMIC_OP_CMPXCHG; break;
+	case 0x0fc0: x->op = ATOMIC_OP_XADD; x->len = 1; break;
+	case 0x0fc1: x->op = ATOMIC_OP_XADD; break;
+	case 0x00:   x->op = ATOMIC_OP_ADD; x->len = 1; break;
+	case 0x01:   x->op = ATOMIC_OP_ADD; break;
+	case 0x08:   x->op = ATOMIC_OP_OR; x->len = 1; break;
+	case 0x09:   x->op = ATOMIC_OP_OR; break;
+	case 0x20:   x->op = ATOMIC_OP_AND; x->len = 1; break;
+	case 0x21:   x->op = ATOMIC_OP_AND; break;
+	case 0x0fab: x->op = ATOMIC_OP_BTS; break;
+	case 0x0fb3: x->op = ATOMIC_OP_BTR; break;
+
+	case 0x80:
+	case 0x81:
+	case 0x83:
+		switch ( i->reg ) {
+		case 0:  x->op = ATOMIC_OP_ADD; break;
+		case 1:  x->op = ATOMIC_OP_OR; break;
+		case 4:  x->op = ATOMIC_OP_AND; break;
+		default: return FALSE;
+		}
+		use_reg = FALSE;
+		if ( i->opcode == 0x80 ) {
+			x->len = 1;
+			x->src = i->immediate[0];
+		} else if ( i->opcode == 0x81 ) {
+			x->src = i->immediate[0];
+		} else {
+			x->src = ( bit32u_t ) ( int ) ( signed char ) i->immediate[0];
+		}
+		break;
+
+	case 0xfe:
+	case 0xff:
+		switch ( i->reg ) {
+		case 0:  x->op = ATOMIC_OP_INC; break;
+		case 1:  x->op = ATOMIC_OP_DEC; break;
+		default: return FALSE;
+		}
+		use_reg = FALSE;
+		if ( i->opcode == 0xfe ) {
+			x->len = 1;
+		}
+		break;
+
+	case 0x0fba:
+		switch ( i->reg ) {
+		case 5:  x->op = ATOMIC_OP_BTS; break;
+		case 6:  x->op = ATOMIC_OP_BTR; break;
+		default: return FALSE;
+		}
+		use_reg = FALSE;
+		x->src = i->immediate[0] & ( len * 8 - 1 );
+		break;
+
+	default:
+		return FALSE;
+	}
+
+	if ( use_reg ) {
+		/* The byte forms with AH, CH, DH or BH are executed
+		 * locally. */
+		if ( ( x->len == 1 ) && ( i->reg >= 4 ) ) {
+			return FALSE;
+		}
+		x->src = UserRegs_get2 ( uregs, i->reg, x->len );
+	}
 
-			__send_invalidate_request ( mon, msg, i );
+	if ( ( x->op == ATOMIC_OP_BTS || x->op == ATOMIC_OP_BTR ) && ( use_reg ) ) {
+		/* The bit offset in a register is signed and may select
+		 * another operand than the one addressed. */
+		const int n = len * 8;
+		int offset = ( int ) UserRegs_get ( uregs, i->reg );
 
-		} else {
-			DP ( stderr,
-				"not send invalidate request to %d: src_id=%d, copyset=%#x\n",
-				i , src_id, copyset );
+		if ( len == 2 ) {
+			offset = ( short ) offset;
 		}
+		*vaddr += ( offset >> ( ( len == 4 ) ? 5 : 4 ) ) * ( int ) len;
+		x->src = offset & ( n - 1 );
+	}
+
+	if ( x->op == ATOMIC_OP_CMPXCHG ) {
+		x->cmp = UserRegs_get2 ( uregs, GEN_REG_EAX, x->len );
 	}
+
+	x->src &= get_operand_mask ( x->len );
+
+	return TRUE;
 }
 
+/* Update the registers and the flags as the instruction would have, given
+ * the value that the operand held before it. */
 static void
-send_invalidate_request ( struct mon_t *mon, struct msg_page_fetch_request_t *x,
-			  struct page_descr_t *pdescr )
+complete_atomic_op ( struct mon_t *mon, struct instruction_t *i,
+		     const struct msg_remote_atomic_t *x, bit32u_t old_val )
 {
-	struct msg_t *msg;
-
-	msg = Msg_create3 ( MSG_KIND_PAGE_INVALIDATE_REQUEST,
-			    x->page_no,
-			    x->kind,
-			    x->src_id,
-			    pdescr->seq );
-	
-	switch ( x->kind ) {
-	case MEM_ACCESS_READ:
-		assert ( x->src_id != pdescr->owner );
-		__send_invalidate_request ( mon, msg, pdescr->owner );
+	struct user_regs_struct *uregs = &mon->regs->user;
+	const bit32u_t new_val = eval_atomic_op ( x, old_val );
+	bit32u_t flags = 0, mask = EFLAGS_ARITH;
+
+	switch ( x->op ) {
+	case ATOMIC_OP_XCHG:
+		UserRegs_set2 ( uregs, i->reg, old_val, x->len );
+		mask = 0;
 		break;
-	 
-	case MEM_ACCESS_WRITE:
-		send_invalidate_request_to_copyset ( mon, msg, pdescr->copyset, x->src_id, pdescr->owner );
+	case ATOMIC_OP_CMPXCHG:
+		flags = get_arith_flags ( x->cmp, old_val, x->cmp - old_val, x->len, TRUE );
+		if ( ! ( flags & EFLAGS_ZF ) ) {
+			UserRegs_set2 ( uregs, GEN_REG_EAX, old_val, x->len );
+		}
+		break;
+	case ATOMIC_OP_XADD:
+		UserRegs_set2 ( uregs, i->reg, old_val, x->len );
+		flags = get_arith_flags ( old_val, x->src, new_val, x->len, FALSE );
+		break;
+	case ATOMIC_OP_ADD:
+		flags = get_arith_flags ( old_val, x->src, new_val, x->len, FALSE );
+		break;
+	case ATOMIC_OP_OR:
+	case ATOMIC_OP_AND:
+		flags = get_result_flags ( new_val, x->len );
+		break;
+	case ATOMIC_OP_INC:
+		flags = get_arith_flags ( old_val, 1, new_val, x->len, FALSE );
+		mask &= ~EFLAGS_CF;
+		break;
+	case ATOMIC_OP_DEC:
+		flags = get_arith_flags ( old_val, 1, new_val, x->len, TRUE );
+		mask &= ~EFLAGS_CF;
+		break;
+	case ATOMIC_OP_BTS:
+	case ATOMIC_OP_BTR:
+		flags = ( TEST_BIT ( old_val, x->src ) ) ? EFLAGS_CF : 0;
+		mask = EFLAGS_CF;
 		break;
-	 
 	default:
-		Match_failure ( "send_invalidate_request\n" );
+		Match_failure ( "complete_atomic_op\n" );
 	}
 
-	Msg_destroy ( msg );	
+	uregs->eflags = ( uregs->eflags & ~mask ) | ( flags & mask );
+	skip_instr ( mon, i );
 }
 
 void
-handle_fetch_request ( struct mon_t *mon, struct msg_t *msg )
+handle_remote_atomic ( struct mon_t *mon, struct msg_t *msg )
 {
-	struct msg_page_fetch_request_t *x = Msg_to_msg_page_fetch_request ( msg );
+	struct msg_remote_atomic_t *x = Msg_to_msg_remote_atomic ( msg );
 	struct page_descr_t *pdescr = get_pdescr ( mon, x->page_no );
+	struct msg_remote_atomic_ack_t ack;
+	struct msg_t *reply;
 
-	if ( pdescr->requesting ) {
-		struct msg_t *m = Msg_dup ( msg );
-		Comm_add_msg ( mon->comm, m, x->src_id );
+	ack.is_done = ( ( pdescr->state == PAGE_STATE_EXCLUSIVELY_SHARED ) &&
+			( ! is_multiple_writer_page ( x->page_no ) ) &&
+			( ! page_mode_is_changing ( x->page_no ) ) );
+	ack.old_val = 0;
 
-		DP ( stderr, 
-		     "save: (no=%#x,seq=%lld,owner=%d,copyset=%#x,%s), from=%d,%d\n",
-		     x->page_no, pdescr->seq, pdescr->owner, pdescr->copyset,
-		     MemAccessKind_to_string ( x->kind ),
-		     x->src_id, m->hdr.src_id );
+	if ( ack.is_done ) {
+		bit8u_t *p = ( bit8u_t * ) get_page_paddr ( mon, x->page_no ) + x->offset;
+		bit32u_t new_val;
 
-		return;
+		Mmove ( &ack.old_val, p, x->len );
+		new_val = eval_atomic_op ( x, ack.old_val );
+		Mmove ( p, &new_val, x->len );
 	}
 
-	DP ( stderr, "requesting: TRUE %#x (%lld --> %lld)\n", x->page_no, 
-		pdescr->seq, pdescr->seq + 1LL );
-	pdescr->seq++;
-	pdescr->requesting = TRUE;
-	
-	DP ( stderr, "handle fetch_request: (no=%#x,seq=%lld,owner=%d,copyset=%#x,%s), from=%d,%d\n",
-		x->page_no, pdescr->seq, pdescr->owner, pdescr->copyset,
-		MemAccessKind_to_string ( x->kind ),
-		x->src_id, msg->hdr.src_id );
-
-	send_invalidate_request ( mon, x, pdescr );
+	reply = Msg_create ( MSG_KIND_REMOTE_ATOMIC_ACK, sizeof ( ack ), &ack );
+	Comm_send ( mon->comm, reply, msg->hdr.src_id );
+	Msg_destroy ( reply );
 }
 
-/*************************************/
-
-static void
-send_or_handle_fetch_request ( struct mon_t *mon, struct shm_arg_t *x )
+void
+handle_remote_atomic_ack ( struct mon_t *mon, struct msg_t *msg )
 {
-	const int mid = get_manager_id ( x->page_no );
-	struct msg_t *msg;
-
-	msg = Msg_create3 ( MSG_KIND_PAGE_FETCH_REQUEST,
-			    x->page_no,
-			    x->kind,
-			    mon->cpuid /* requestor's cpuid */ );
-	
-	send_or_handle ( mon, msg, mid, &handle_fetch_request );
+	ASSERT ( remote_atomic.is_waiting );
 
-	Msg_destroy ( msg );     	
+	remote_atomic.ack = *Msg_to_msg_remote_atomic_ack ( msg );
+	remote_atomic.is_waiting = FALSE;
 }
 
-/********************/
- 
-static void
-recv_and_handle_fetch_ack ( struct mon_t *mon, struct shm_arg_t *x )
+/* Return TRUE if the LOCK-prefixed instruction <i> has been executed at
+ * the owner of the page it modifies. */
+bool_t
+try_execute_atomic_remotely ( struct mon_t *mon, struct instruction_t *i )
 {
-	DP ( stderr, "wait for fetch_ack: begin (no=%#x, kind=%s)\n",
-		x->page_no, MemAccessKind_to_string ( x->kind ) );
-//	Print ( stderr, "wait for fetch_ack: begin (no=%#x, kind=%s)\n", x->page_no, MemAccessKind_to_string ( x->kind ) );
+	struct msg_remote_atomic_t x;
+	struct page_descr_t *pdescr;
+	struct msg_t *msg;
+	bit32u_t vaddr, paddr;
+	bool_t is_ok, read_write;
 
-	static_mon = mon;
+	ASSERT ( mon != NULL );
+	ASSERT ( i != NULL );
+	ASSERT ( i->is_locked );
 
-	while ( ! page_is_accesible ( x->pdescr, x->kind ) ) {
-		struct msg_t *msg;
+	if ( ( ! cpl_is_supervisor_mode ( mon->regs ) ) || ( ! decode_atomic_op ( mon, i, &x, &vaddr ) ) ) {
+		return FALSE;
+	}
 
-		msg = Comm_remove_msg2 ( mon->comm, &is_not_requesting_page );
+	if ( BIT_ALIGN ( vaddr, 12 ) != BIT_ALIGN ( vaddr + x.len - 1, 12 ) ) {
+		return FALSE;
+	}
 
-		handle_msg ( mon, msg );
-		Msg_destroy ( msg );
+	/* Let a fault of the guest be raised by the usual path. */
+	paddr = Monitor_try_vaddr_to_paddr2 ( i->sreg_index, vaddr, &is_ok, &read_write );
+	if ( ( ! is_ok ) || ( ! read_write ) ) {
+		return FALSE;
 	}
 
-	DP ( stderr, "wake up fetch_ack: end (no=%#x, kind=%s)\n",
-		x->page_no, MemAccessKind_to_string ( x->kind ) );
-//	Print ( stderr, "wake up fetch_ack: end (no=%#x, kind=%s)\n",x->page_no, MemAccessKind_to_string ( x->kind ) );
-}
+	x.page_no = paddr_to_page_no ( paddr );
+	if ( x.page_no >= mon->num_of_pages ) {
+		return FALSE;
+	}
+	x.offset = paddr - page_no_to_paddr ( x.page_no );
+
+	pdescr = get_pdescr ( mon, x.page_no );
+	if ( ( page_is_accesible ( pdescr, MEM_ACCESS_WRITE ) ) ||
+	     ( pdescr->owner == mon->cpuid ) ||
+	     ( is_multiple_writer_page ( x.page_no ) ) ||
+	     ( page_mode_is_changing ( x.page_no ) ) ||
+	     ( get_fetch_count ( mon, x.page_no )->count < REMOTE_ATOMIC_THRESHOLD ) ) {
+		return FALSE;
+	}
 
-/********************/
+	flush_page_diffs ( mon );
 
-static void
-fetch_page ( struct mon_t *mon, struct shm_arg_t *x )
-{
-	DP_color ( stderr, GREEN, "fetch_page: begin (no=%#x, kind=%s)\n",
-		   x->page_no, MemAccessKind_to_string ( x->kind ) );
-//	Print_color ( stderr, GREEN, "fetch_page: begin (no=%#x, kind=%s)\n",     x->page_no, MemAccessKind_to_string ( x->kind ) );
+	remote_atomic.is_waiting = TRUE;
+	msg = Msg_create ( MSG_KIND_REMOTE_ATOMIC, sizeof ( x ), &x );
+	Comm_send ( mon->comm, msg, pdescr->owner );
+	Msg_destroy ( msg );
 
-	send_or_handle_fetch_request ( mon, x );
-	recv_and_handle_fetch_ack ( mon, x );
+	while ( remote_atomic.is_waiting ) {
+		handle_next_msg ( mon );
+	}
 
-	DP_color ( stderr, GREEN, "fetch_page: end (no=%#x, kind=%s)\n",
-		   x->page_no, MemAccessKind_to_string ( x->kind ) );
-//	Print_color ( stderr, GREEN, "fetch_page: end (no=%#x, kind=%s)\n",     x->page_no, MemAccessKind_to_string ( x->kind ) );
+	if ( ! remote_atomic.ack.is_done ) {
+		mon->stat.nr_remote_atomic_declines++; /* [STAT] */
+		return FALSE;
+	}
+
+	complete_atomic_op ( mon, i, &x, remote_atomic.ack.old_val );
+	mon->stat.nr_remote_atomics++; /* [STAT] */
+
+	return TRUE;
 }
 
 /****************************************************************/
@@ -571,10 +2744,121 @@ update_fetch_history ( struct mon_t *mon, struct shm_arg_t *x,
 	stat->nr_fetch_requests++;
 }
 
+/****************************************************************/
+
+/* Immutable pages
+ *
+ * The pages of the "immutable:" ranges are not expected to be written
+ * once the APs start.  When the BSP sends its memory image to an AP,
+ * it also grants the AP a READ_ONLY_SHARED copy of each of those pages
+ * that it still owns, adds the AP to the copyset, and lists the pages
+ * in an IMMUTABLE_PAGES bitmap, which the AP applies to its page
+ * descriptors.  The pages are thus never fetched nor invalidated.
+ *
+ * A write to one of them is reported, and the page is demoted to the
+ * single-writer protocol: the write fault that follows invalidates the
+ * copies granted above as usual. */
+
+static bool_t
+can_grant_immutable_page ( struct mon_t *mon, int page_no, int dest_id )
+{
+	const struct page_descr_t *pdescr = get_pdescr ( mon, page_no );
+	const int mid = get_manager_id ( page_no );
+
+	if ( ! is_immutable_page ( page_no ) ) {
+		return FALSE;
+	}
+
+	if ( ( pdescr->owner != mon->cpuid ) || ( pdescr->state == PAGE_STATE_INVALID ) ||
+	     ( pdescr->requesting ) ) {
+		return FALSE;
+	}
+
+	/* any other static manager would not know the new copy */
+	if ( ( page_manager_is_static ( ) ) && ( mid != mon->cpuid ) && ( mid != dest_id ) ) {
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* Called by the BSP after it has sent its memory image to <dest_id> */
+void
+grant_immutable_pages ( struct mon_t *mon, int dest_id )
+{
+	const size_t len = ( mon->num_of_pages + 7 ) / 8;
+	bit8u_t *bitmap = Calloct ( len, bit8u_t );
+	struct msg_t *msg;
+	int i;
+
+	ASSERT ( mon != NULL );
+
+	for ( i = 0; i < mon->num_of_pages; i++ ) {
+		struct page_descr_t *pdescr = get_pdescr ( mon, i );
+
+		if ( ! can_grant_immutable_page ( mon, i, dest_id ) ) {
+			continue;
+		}
+
+		SET_BIT ( bitmap[i / 8], i % 8 );
+		Cpuset_add ( &pdescr->copyset, dest_id );
+		if ( pdescr->state == PAGE_STATE_EXCLUSIVELY_SHARED ) {
+			pdescr->state = PAGE_STATE_READ_ONLY_SHARED;
+			change_page_prot ( mon, i );
+		}
+
+		mon->stat.nr_immutable_pages++;
+	}
+
+	msg = Msg_create ( MSG_KIND_IMMUTABLE_PAGES, len, bitmap );
+	Comm_send ( mon->comm, msg, dest_id );
+	Msg_destroy ( msg );
+	Free ( bitmap );
+}
+
+/* Called by an AP on the IMMUTABLE_PAGES message that follows the
+ * memory image */
+void
+accept_immutable_pages ( struct mon_t *mon, struct msg_t *msg )
+{
+	const bit8u_t *bitmap = ( const bit8u_t * ) msg->body;
+	int i;
+
+	ASSERT ( mon != NULL );
+	ASSERT ( msg->hdr.kind == MSG_KIND_IMMUTABLE_PAGES );
+	ASSERT ( msg->hdr.len * 8 >= mon->num_of_pages );
+
+	for ( i = 0; i < mon->num_of_pages; i++ ) {
+		struct page_descr_t *pdescr = get_pdescr ( mon, i );
+
+		if ( ! TEST_BIT ( bitmap[i / 8], i % 8 ) ) {
+			continue;
+		}
+
+		pdescr->state = PAGE_STATE_READ_ONLY_SHARED;
+		pdescr->owner = msg->hdr.src_id;
+		Cpuset_add ( &pdescr->copyset, mon->cpuid );
+		change_page_prot ( mon, i );
+
+		mon->stat.nr_immutable_pages++;
+	}
+}
+
+static void
+demote_immutable_page ( struct mon_t *mon, int page_no )
+{
+	Warning ( "write to the immutable page %#x at eip=%#x\n", page_no, mon->regs->user.eip );
+
+	page_modes[page_no] = PAGE_MODE_SINGLE_WRITER;
+	mon->stat.nr_immutable_page_demotions++;
+}
+
+/****************************************************************/
+
 /* return TRUE if the cause of pagefault is shared memory emulation. */
 static bool_t
 emulate_shared_memory ( struct mon_t *mon, mem_access_kind_t kind, bit32u_t paddr,
-			bit32u_t vaddr, bool_t is_paddr_access )
+			bit32u_t vaddr, bool_t is_paddr_access, bool_t no_data )
 {
 	struct shm_arg_t x;
 
@@ -587,17 +2871,49 @@ emulate_shared_memory ( struct mon_t *mon, mem_access_kind_t kind, bit32u_t padd
 
 	x.pdescr = get_pdescr ( mon, x.page_no );
 	x.kind = kind;
+	x.no_data = no_data;
 
 	if ( ! is_access_violation ( &x ) ) {
 		return FALSE;		
 	}
 
+	if ( ( x.kind == MEM_ACCESS_WRITE ) && ( is_immutable_page ( x.page_no ) ) ) {
+		demote_immutable_page ( mon, x.page_no );
+	}
+
+	if ( add_batched_fetch ( &x, vaddr, is_paddr_access ) ) {
+		return TRUE;
+	}
+
+	if ( ( x.kind == MEM_ACCESS_WRITE ) && ( is_falsely_shared_page ( mon, x.page_no ) ) ) {
+		set_page_mode ( mon, x.page_no, x.page_no, TRUE );
+	}
+
+	if ( x.kind == MEM_ACCESS_WRITE ) {
+		/* wait until the protocol of the page has been switched */
+		while ( page_mode_is_changing ( x.page_no ) ) {
+			handle_next_msg ( mon );
+		}
+
+		if ( ! is_access_violation ( &x ) ) {
+			return TRUE;
+		}
+	}
 
 	/* [STAT] */
 	mon->stat.comm_counter_flag = TRUE;
 	start_time_counter ( &mon->stat.comm_counter );
 
-	fetch_page ( mon, &x );
+	if ( ( x.kind == MEM_ACCESS_WRITE ) && ( is_multiple_writer_page ( x.page_no ) ) ) {
+		make_twin ( mon, &x );
+	} else {
+		fetch_page ( mon, &x );
+	}
+
+	/* [STAT] */
+	if ( x.no_data ) {
+		mon->stat.nr_ownership_only_fetches++;
+	}
 
 	/* [STAT] */
 	stop_time_counter ( &mon->stat.comm_counter );
@@ -611,15 +2927,118 @@ bool_t
 emulate_shared_memory_with_vaddr ( struct mon_t *mon, mem_access_kind_t kind, bit32u_t paddr,
 				   bit32u_t vaddr )
 {
-	return emulate_shared_memory ( mon, kind, paddr, vaddr, FALSE );
+	return emulate_shared_memory ( mon, kind, paddr, vaddr, FALSE, FALSE );
 }
 
 bool_t
 emulate_shared_memory_with_paddr ( struct mon_t *mon, mem_access_kind_t kind, bit32u_t paddr )
 {
-	return emulate_shared_memory ( mon, kind, paddr, 0, TRUE );
+	return emulate_shared_memory ( mon, kind, paddr, 0, TRUE, FALSE );
+}
+
+/* The instruction is going to overwrite the whole page at PADDR
+ * before reading any of it.  Obtain the exclusive ownership
+ * without the transfer of the page contents. */
+bool_t
+emulate_shared_memory_to_overwrite_page ( struct mon_t *mon, bit32u_t paddr, bit32u_t vaddr )
+{
+	bool_t no_data = ! is_multiple_writer_page ( paddr_to_page_no ( paddr ) );
+
+	return emulate_shared_memory ( mon, MEM_ACCESS_WRITE, paddr, vaddr, FALSE, no_data );
+}
+
+/* Between begin_shared_memory_batch () and end_shared_memory_batch (),
+ * emulate_shared_memory_with_* () only record the pages to be fetched.
+ * end_shared_memory_batch () sends all the FETCH_REQUESTs before it
+ * waits for any FETCH_ACK, so that the pages touched by an instruction
+ * arrive in about one round trip.  Then the accesses are emulated one
+ * by one again: this fetches the pages taken away by other nodes in
+ * the meantime, and the writes to the pages of the multiple-writer
+ * protocol or being switched, which are not batched. */
+void
+begin_shared_memory_batch ( struct mon_t *mon )
+{
+	ASSERT ( ! fetch_batch.is_active );
+
+	fetch_batch.is_active = TRUE;
+	fetch_batch.n = 0;
+}
+
+void
+end_shared_memory_batch ( struct mon_t *mon )
+{
+	struct fetch_batch_t *b = &fetch_batch;
+	int nr_sent = 0;
+	int i;
+
+	ASSERT ( b->is_active );
+	b->is_active = FALSE;
+
+	if ( b->n == 0 ) {
+		return;
+	}
+
+	/* [STAT] */
+	mon->stat.comm_counter_flag = TRUE;
+	start_time_counter ( &mon->stat.comm_counter );
+
+	fetching_page = TRUE;
+
+	for ( i = 0; i < b->n; i++ ) {
+		struct batched_fetch_t *f = &b->fetches[i];
+		struct shm_arg_t *x = &f->arg;
+
+		if ( ( x->kind == MEM_ACCESS_WRITE ) &&
+		     ( is_multiple_writer_page ( x->page_no ) || page_mode_is_changing ( x->page_no ) ) ) {
+			continue;
+		}
+
+		f->is_sent = TRUE;
+		get_fetch_count ( mon, x->page_no )->count++;
+		nr_demand_fetches++;
+		send_or_handle_fetch_request ( mon, x, 0 );
+		nr_sent++;
+	}
+
+	for ( i = 0; i < b->n; i++ ) {
+		struct batched_fetch_t *f = &b->fetches[i];
+
+		while ( ( f->is_sent ) && ( ! f->has_arrived ) ) {
+			handle_next_msg ( mon );
+		}
+	}
+
+	fetching_page = FALSE;
+	apply_held_page_diffs ( mon );
+
+	/* [STAT] */
+	stop_time_counter ( &mon->stat.comm_counter );
+	mon->stat.comm_counter_flag = FALSE;
+	if ( nr_sent > 1 ) {
+		mon->stat.nr_fetch_batches++;
+		mon->stat.nr_batched_fetches += nr_sent;
+	}
+
+	for ( i = 0; i < b->n; i++ ) {
+		struct batched_fetch_t *f = &b->fetches[i];
+
+		/* [STAT] */
+		if ( f->is_sent ) {
+			if ( f->arg.no_data ) {
+				mon->stat.nr_ownership_only_fetches++;
+			}
+			update_fetch_history ( mon, &f->arg, f->vaddr, f->is_paddr_access );
+		}
+
+		emulate_shared_memory ( mon, f->arg.kind, page_no_to_paddr ( f->arg.page_no ),
+					f->vaddr, f->is_paddr_access, f->arg.no_data );
+	}
+
+	b->n = 0;
 }
 
+/****************************************************************/
+
 void
 sync_shared_memory ( struct mon_t *mon, struct instruction_t *i )
 {
@@ -628,10 +3047,19 @@ sync_shared_memory ( struct mon_t *mon, struct instruction_t *i )
 	ASSERT ( i->opcode != -1 );
      
 	DPRINT ( "Sync memory!!!\n" );
+
+	flush_page_diffs ( mon );
+	switch_locked_pages_to_single_writer ( mon, i );
 }
 
 #else /* !ENABLE_MP */
 
+bool_t
+try_execute_atomic_remotely ( struct mon_t *mon, struct instruction_t *i )
+{
+	return FALSE;
+}
+
 bool_t
 emulate_shared_memory_with_vaddr ( struct mon_t *mon, mem_access_kind_t kind, bit32u_t paddr, bit32u_t vaddr )
 {
@@ -647,11 +3075,54 @@ emulate_shared_memory_with_paddr ( struct mon_t *mon, mem_access_kind_t kind, bi
 	return FALSE;
 }
 
+bool_t
+emulate_shared_memory_to_overwrite_page ( struct mon_t *mon, bit32u_t paddr, bit32u_t vaddr )
+{
+	/* Do nothing */     
+	return FALSE;
+}
+
+void
+begin_shared_memory_batch ( struct mon_t *mon )
+{
+	/* Do nothing */     
+}
+
+void
+end_shared_memory_batch ( struct mon_t *mon )
+{
+	/* Do nothing */     
+}
+
 void
 sync_shared_memory ( struct mon_t *mon, struct instruction_t *i )
 {
 	/* Do nothing */
 }
 
+void
+init_page_modes ( struct mon_t *mon, const struct config_t *config )
+{
+	/* Do nothing */
+}
+
+void
+set_page_mode ( struct mon_t *mon, int from_page_no, int to_page_no, bool_t is_multiple_writer )
+{
+	/* Do nothing */
+}
+
+void
+flush_page_diffs ( struct mon_t *mon )
+{
+	/* Do nothing */
+}
+
+void
+close_home_trace ( void )
+{
+	/* Do nothing */
+}
+
 #endif /* ENABLE_MP */
 
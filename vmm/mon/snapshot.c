@@ -108,6 +108,11 @@ Monitor_resume ( struct mon_t *mon, const char *filename )
 
 	unpack_page_descrs ( mon, fd ); 
 
+	/* The memory and the page tables have been replaced. */
+	Monitor_flush_tlb ( );
+	DecodeCache_flush ( );
+	flush_pgtable_permission_cache ( );
+
 #ifdef ENABLE_MP
 	Comm_unpack_msgs ( mon->comm, fd );
 #endif
@@ -66,6 +66,45 @@ Stat_init ( struct stat_t *x )
 	x->nr_hlts = 0LL;
 	x->nr_irets = 0LL;
 
+	x->nr_decode_cache_hits = 0LL;
+	x->nr_decode_cache_misses = 0LL;
+	x->nr_fp_regs_fetches = 0LL;
+	x->nr_fp_regs_fetches_avoided = 0LL;
+	x->nr_getregs_avoided = 0LL;
+	x->nr_soft_tlb_hits = 0LL;
+	x->nr_soft_tlb_misses = 0LL;
+	x->nr_page_prot_changes = 0LL;
+	x->nr_page_prot_changes_merged = 0LL;
+	x->nr_halt_wakeups = 0LL;
+	x->nr_prefetches = 0LL;
+	x->nr_prefetch_hits = 0LL;
+	x->nr_prefetch_wastes = 0LL;
+	x->nr_prefetch_rejects = 0LL;
+	x->nr_twins = 0LL;
+	x->nr_page_diffs = 0LL;
+	x->nr_page_diff_bytes = 0LL;
+	x->nr_page_mode_changes = 0LL;
+	x->nr_remote_atomics = 0LL;
+	x->nr_remote_atomic_declines = 0LL;
+	x->nr_demand_fetches = 0LL;
+	x->nr_fetch_hops = 0LL;
+	x->nr_fetch_forwards = 0LL;
+	x->nr_ownership_only_fetches = 0LL;
+	x->nr_raw_page_acks = 0LL;
+	x->nr_zero_page_acks = 0LL;
+	x->nr_delta_page_acks = 0LL;
+	x->nr_page_ack_bytes_saved = 0LL;
+	x->nr_fetch_batches = 0LL;
+	x->nr_batched_fetches = 0LL;
+	x->nr_immutable_pages = 0LL;
+	x->nr_immutable_page_demotions = 0LL;
+	x->nr_home_migrations = 0LL;
+	x->nr_pgtable_checks_full = 0LL;
+	x->nr_pgtable_checks_diff = 0LL;
+	x->nr_pgtable_checks_skipped = 0LL;
+	x->halt_wakeup_latency_count = 0LL;
+	x->max_halt_wakeup_latency_count = 0LL;
+
 	x->kernel_state = -1;
 	for ( i = 0; i < 256; i++ ) {
 		x->nr_interrupts [ i ] = 0LL;
@@ -107,6 +146,16 @@ print_execution_time ( FILE *stream, struct stat_t *stat )
 			stat->nr_emulation_enter[INVALIDATE_TLB] +
 			stat->nr_emulation_enter[CHANGE_PAGE_PROT] );
 
+	Print ( stream, "Halt-to-Wakeup Latency: avg = %f, max = %f (# of wakeups = %lld)\n",
+		count_to_sec ( stat->halt_wakeup_latency_count ) / ( double ) stat->nr_halt_wakeups,
+		count_to_sec ( stat->max_halt_wakeup_latency_count ),
+		stat->nr_halt_wakeups );
+
+	Print ( stream, "Page Table Permission Checks: full = %lld, incremental = %lld, skipped = %lld\n",
+		stat->nr_pgtable_checks_full,
+		stat->nr_pgtable_checks_diff,
+		stat->nr_pgtable_checks_skipped );
+
     	Print ( stream, "                 +-- (Emu)    = %f (%lld x %f)\n",
 		time_counter_to_sec ( &stat->emu_counter ),
 		n,
@@ -136,10 +185,75 @@ print_execution_time ( FILE *stream, struct stat_t *stat )
 		count_to_sec ( stat->min_dev_rd_count ),
 		count_to_sec ( stat->max_dev_rd_count ) );
 
-	Print ( stream, "Device Write Time: min = %f, max = %f",
+	Print ( stream, "Device Write Time: min = %f, max = %f\n",
 		count_to_sec ( stat->min_dev_wr_count ),
 		count_to_sec ( stat->max_dev_wr_count ) );
 
+	Print ( stream, "Decode Cache: hits = %lld, misses = %lld\n",
+		stat->nr_decode_cache_hits,
+		stat->nr_decode_cache_misses );
+
+	Print ( stream, "FPU State: fetches = %lld, avoided = %lld\n",
+		stat->nr_fp_regs_fetches,
+		stat->nr_fp_regs_fetches_avoided );
+
+	Print ( stream, "Registers handed over by the emulation code = %lld\n",
+		stat->nr_getregs_avoided );
+
+	Print ( stream, "Software TLB: hits = %lld, misses = %lld, hit rate = %f\n",
+		stat->nr_soft_tlb_hits,
+		stat->nr_soft_tlb_misses,
+		( ( stat->nr_soft_tlb_hits + stat->nr_soft_tlb_misses > 0 )
+		  ? ( double ) stat->nr_soft_tlb_hits / ( stat->nr_soft_tlb_hits + stat->nr_soft_tlb_misses )
+		  : 0.0 ) );
+
+	Print ( stream, "Page Protection Changes: queued = %lld, merged = %lld, emulation entries = %lld\n",
+		stat->nr_page_prot_changes,
+		stat->nr_page_prot_changes_merged,
+		stat->nr_emulation_enter[CHANGE_PAGE_PROT] );
+
+	Print ( stream, "Page Prefetches: requested = %lld, hits = %lld, wastes = %lld, rejected = %lld\n",
+		stat->nr_prefetches,
+		stat->nr_prefetch_hits,
+		stat->nr_prefetch_wastes,
+		stat->nr_prefetch_rejects );
+
+	Print ( stream, "Multiple-Writer Pages: twins = %lld, diffs = %lld (%lld bytes), mode changes = %lld\n",
+		stat->nr_twins,
+		stat->nr_page_diffs,
+		stat->nr_page_diff_bytes,
+		stat->nr_page_mode_changes );
+
+	Print ( stream, "Remote Atomics: %lld (declined: %lld)\n",
+		stat->nr_remote_atomics,
+		stat->nr_remote_atomic_declines );
+
+	Print ( stream, "Page Fetch Hops: %f on average (fetches = %lld, forwarded requests = %lld)\n",
+		( ( stat->nr_demand_fetches > 0 ) 
+		  ? ( double ) stat->nr_fetch_hops / stat->nr_demand_fetches
+		  : 0.0 ),
+		stat->nr_demand_fetches,
+		stat->nr_fetch_forwards );
+
+	Print ( stream, "Ownership-only Fetches: %lld\n",
+		stat->nr_ownership_only_fetches );
+
+	Print ( stream, "Page Encodings: raw = %lld, zero = %lld, delta = %lld (%lld bytes saved)\n",
+		stat->nr_raw_page_acks,
+		stat->nr_zero_page_acks,
+		stat->nr_delta_page_acks,
+		stat->nr_page_ack_bytes_saved );
+
+	Print ( stream, "Batched Fetches: %lld pages in %lld batches\n",
+		stat->nr_batched_fetches,
+		stat->nr_fetch_batches );
+
+	Print ( stream, "Immutable Pages: %lld (demoted: %lld)\n",
+		stat->nr_immutable_pages,
+		stat->nr_immutable_page_demotions );
+
+	Print ( stream, "Home Migrations: %lld\n", stat->nr_home_migrations );
+
 	Print ( stream, "\n" );
 
 	for ( i = 0; i < 256; i++ ) {
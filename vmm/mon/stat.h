@@ -59,6 +59,26 @@ struct stat_t {
 
 	unsigned long long	nr_pit_interrupts, nr_apic_timer_interrupts, nr_other_sigs, 
 		nr_instr_emu, nr_traps_at_kernel, nr_hlts, nr_irets;
+
+	unsigned long long	nr_decode_cache_hits, nr_decode_cache_misses;
+	unsigned long long	nr_fp_regs_fetches, nr_fp_regs_fetches_avoided;
+	unsigned long long	nr_getregs_avoided;
+	unsigned long long	nr_soft_tlb_hits, nr_soft_tlb_misses;
+	unsigned long long	nr_page_prot_changes, nr_page_prot_changes_merged;
+	unsigned long long	nr_halt_wakeups;
+	unsigned long long	nr_prefetches, nr_prefetch_hits, nr_prefetch_wastes,
+				nr_prefetch_rejects;
+	unsigned long long	nr_twins, nr_page_diffs, nr_page_diff_bytes, nr_page_mode_changes;
+	unsigned long long	nr_remote_atomics, nr_remote_atomic_declines;
+	unsigned long long	nr_demand_fetches, nr_fetch_hops, nr_fetch_forwards;
+	unsigned long long	nr_ownership_only_fetches;
+	unsigned long long	nr_raw_page_acks, nr_zero_page_acks, nr_delta_page_acks;
+	unsigned long long	nr_page_ack_bytes_saved;
+	unsigned long long	nr_fetch_batches, nr_batched_fetches;
+	unsigned long long	nr_immutable_pages, nr_immutable_page_demotions;
+	unsigned long long	nr_home_migrations;
+	unsigned long long	nr_pgtable_checks_full, nr_pgtable_checks_diff, nr_pgtable_checks_skipped;
+	bit64u_t		halt_wakeup_latency_count, max_halt_wakeup_latency_count;
 	int kernel_state;	
 };
 
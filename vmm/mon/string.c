@@ -32,6 +32,66 @@ movs ( struct mon_t *mon, struct instruction_t *instr, size_t len )
 
 void movsb_xb_yb ( struct mon_t *mon, struct instruction_t *instr ) { movs ( mon, instr, 1 ); }
 void movsw_xv_yv ( struct mon_t *mon, struct instruction_t *instr ) { movs ( mon, instr, ((instr->opsize_override) ? 2 : 4) ); }
+
+/* Return TRUE if the rest of the string instruction writes every
+ * byte of the page that contains the destination (ES:EDI). */
+static bool_t
+overwrites_whole_page ( struct mon_t *mon, struct instruction_t *instr, size_t len )
+{
+	bit32u_t laddr, delta;
+
+	ASSERT ( mon != NULL );
+	ASSERT ( instr != NULL );
+
+	if ( ! instr->rep_repe_repz ) {
+		return FALSE;
+	}
+
+	if ( get_rep_count ( mon, instr ) < PAGE_SIZE_4K / len ) {
+		return FALSE;
+	}
+
+	laddr = Monitor_vaddr_to_laddr ( SEG_REG_ES, mon->regs->user.edi );
+	delta = FlagReg_get_delta ( &mon->regs->eflags, len );
+
+	/* The first write must be at the beginning of the page (or at
+	 * the end of the page if the direction flag is set). */
+	return ( ( delta == len ) 
+		 ? ( laddr % PAGE_SIZE_4K == 0 )
+		 : ( ( laddr + len ) % PAGE_SIZE_4K == 0 ) );
+}
+
+/* Return TRUE if none of the bytes read by the rest of the
+ * instruction is in the destination page. */
+static bool_t
+reads_other_page ( struct mon_t *mon, seg_reg_index_t seg, size_t len )
+{
+	bit32u_t src_first, src_last, delta;
+	bit32u_t src_paddr1, src_paddr2, dest_paddr;
+	bool_t is_ok1, is_ok2, is_ok3;
+
+	ASSERT ( mon != NULL );
+
+	delta = FlagReg_get_delta ( &mon->regs->eflags, len );
+	if ( delta == len ) {
+		src_first = mon->regs->user.esi;
+		src_last = mon->regs->user.esi + PAGE_SIZE_4K - 1;
+	} else {
+		src_first = mon->regs->user.esi + len - PAGE_SIZE_4K;
+		src_last = mon->regs->user.esi + len - 1;
+	}
+
+	src_paddr1 = Monitor_try_vaddr_to_paddr ( seg, src_first, &is_ok1 );
+	src_paddr2 = Monitor_try_vaddr_to_paddr ( seg, src_last, &is_ok2 );
+	dest_paddr = Monitor_try_vaddr_to_paddr ( SEG_REG_ES, mon->regs->user.edi, &is_ok3 );
+
+	if ( ( ! is_ok1 ) || ( ! is_ok2 ) || ( ! is_ok3 ) ) {
+		return FALSE;
+	}
+
+	return ( ( BIT_ALIGN ( src_paddr1, 12 ) != BIT_ALIGN ( dest_paddr, 12 ) ) &&
+		 ( BIT_ALIGN ( src_paddr2, 12 ) != BIT_ALIGN ( dest_paddr, 12 ) ) );
+}
 static struct mem_access_t *
 movs_mem ( struct mon_t *mon, struct instruction_t *instr, size_t len ) 
 {
@@ -48,6 +108,8 @@ movs_mem ( struct mon_t *mon, struct instruction_t *instr, size_t len )
 
 	maccess = MemAccess_create_read ( seg, src_vaddr, len );
 	maccess->next = MemAccess_create_write ( SEG_REG_ES, dest_vaddr, len );
+	maccess->next->overwrites_page = ( ( overwrites_whole_page ( mon, instr, len ) ) &&
+					   ( reads_other_page ( mon, seg, len ) ) );
 
 	return maccess;   
 }
@@ -110,7 +172,12 @@ stos_mem ( struct mon_t *mon, struct instruction_t *instr, size_t len )
 	}
 	*/
 
-	return MemAccess_create_write ( SEG_REG_ES, mon->regs->user.edi, len );
+	struct mem_access_t *maccess;
+
+	maccess = MemAccess_create_write ( SEG_REG_ES, mon->regs->user.edi, len );
+	maccess->overwrites_page = overwrites_whole_page ( mon, instr, len );
+
+	return maccess;
 }
 
 struct mem_access_t *stosb_yb_al_mem ( struct mon_t *mon, struct instruction_t *instr ) { return stos_mem ( mon, instr, 1 ); }
@@ -7,6 +7,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdarg.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 
 int
 Open ( const char *pathname, int oflag )
@@ -71,6 +73,21 @@ Open2_fmt ( int oflag, mode_t mode, const char *fmt, ... )
 	return Open2 ( path, oflag, mode );
 }
 
+int
+Shm_open ( const char *name, int oflag, mode_t mode )
+{
+	int retval;
+	ASSERT ( name != NULL );
+
+	retval = shm_open ( name, oflag, mode );
+	if ( retval == -1 ) {
+		Print ( stderr, "shm_open(\"%s\")\n", name );
+		Sys_failure ( "shm_open" );
+	}
+
+	return retval;
+}
+
 int
 Creat ( const char *pathname, mode_t mode )
 {
@@ -305,6 +322,42 @@ Fd_is_readable ( int fd )
 	return FD_ISSET ( fd, &fds );
 }
 
+/* Create a non-blocking eventfd used as a wake-up counter. */
+int
+Eventfd ( void )
+{
+	int retval;
+
+	retval = eventfd ( 0, EFD_NONBLOCK );
+	if ( retval == -1 )
+		Sys_failure ( "eventfd" );
+
+	return retval;
+}
+
+void
+Eventfd_signal ( int fd )
+{
+	bit64u_t one = 1;
+	ssize_t retval;
+
+	retval = write ( fd, &one, sizeof ( one ) );
+	if ( ( retval == -1 ) && ( errno != EINTR ) && ( errno != EAGAIN ) )
+		Sys_failure ( "write" );
+}
+
+/* Reset the counter of <fd>.  Do nothing if it has not been signaled. */
+void
+Eventfd_reset ( int fd )
+{
+	bit64u_t val;
+	ssize_t retval;
+
+	retval = read ( fd, &val, sizeof ( val ) );
+	if ( ( retval == -1 ) && ( errno != EINTR ) && ( errno != EAGAIN ) )
+		Sys_failure ( "read" );
+}
+
 void
 Mkfifo ( const char *pathname, mode_t mode )
 {
@@ -353,6 +406,17 @@ Remove ( const char *pathname )
 		Sys_failure ( "remove" );	
 }
 
+void
+Shm_unlink ( const char *name )
+{
+	int retval;
+
+	retval = shm_unlink ( name );
+
+	if ( retval == -1 )
+		Sys_failure ( "shm_unlink" );
+}
+
 void
 Pack ( const void *p, size_t len, int fd )
 {
@@ -9,6 +9,7 @@ int    Open ( const char *pathname, int oflag );
 int    Open_fmt ( int oflag, const char *fmt, ... );
 int    Open2 ( const char *pathname, int oflag, mode_t mode );
 int    Open2_fmt ( int oflag, mode_t mode, const char *fmt, ... );
+int    Shm_open ( const char *name, int oflag, mode_t mode );
 int    Creat ( const char *pathname, mode_t mode );
 int    Creat_fmt ( mode_t mode, const char *fmt, ... );
 void   Close ( int fd );
@@ -28,10 +29,14 @@ FILE   *Fopen_fmt ( const char *mode, const char *fmt, ... );
 void   Fclose ( FILE *fp );
 int    Select ( int n, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, struct timeval *timeout );
 bool_t Fd_is_readable ( int fd );
+int    Eventfd ( void );
+void   Eventfd_signal ( int fd );
+void   Eventfd_reset ( int fd );
 
 void   Mkfifo ( const char *pathname, mode_t mode );
 void   Copy_file ( const char *from, const char *to );
 void   Remove ( const char *pathname );
+void   Shm_unlink ( const char *name );
 
 void Pack ( const void *p, size_t len, int fd );
 void Unpack ( void *p, size_t len, int fd );
@@ -33,6 +33,16 @@ Memchr ( const void *s, int c, size_t n )
 	return memchr ( s, c, n );
 }
 
+int
+Memcmp ( const void *s1, const void *s2, size_t n )
+{
+	ASSERT ( s1 != NULL );
+	ASSERT ( s2 != NULL );
+	ASSERT ( n > 0 );
+
+	return memcmp ( s1, s2, n );
+}
+
 void *
 Mdup ( const void *s, size_t n )
 {
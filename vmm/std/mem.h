@@ -6,6 +6,7 @@
 void  Mmove ( void *dest, const void *src, size_t n );
 void *Memset ( void *s, int c, size_t n );
 void *Memchr ( const void *s, int c, size_t n );
+int   Memcmp ( const void *s1, const void *s2, size_t n );
 void *Mdup ( const void *s, size_t n );
 void  Mzero ( void *s, size_t n );
 void *Malloc ( size_t size );
@@ -10,6 +10,7 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/tcp.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 
 
@@ -122,6 +123,36 @@ Sendn ( int fd, const void *buf, size_t count, int flags )
 	}
 }
 
+/* Send all the buffers of <iov> with as few system calls as possible.
+ * [Note] <iov> is modified. */
+void
+Sendvn ( int fd, struct iovec *iov, int iovcnt )
+{
+	assert ( iov != NULL );
+
+	while ( iovcnt > 0 ) {
+		ssize_t n;
+
+		n = writev ( fd, iov, iovcnt );
+		if ( n == -1 ) {
+			if ( ( errno != EAGAIN ) && ( errno != EINTR ) )
+				Sys_failure ( "sendvn" );
+			continue;
+		}
+
+		/* skip the buffers that have been sent */
+		while ( ( iovcnt > 0 ) && ( ( size_t ) n >= iov->iov_len ) ) {
+			n -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if ( iovcnt > 0 ) {
+			iov->iov_base = ( char * ) iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+}
+
 ssize_t
 Recv ( int s, void *buf, size_t len, int flags )
 {
@@ -3,6 +3,7 @@
 
 #include "vmm/std/types.h"
 #include <netdb.h>
+#include <sys/uio.h>
 
 #ifndef INADDR_NONE
 #define INADDR_NONE              ( ( in_addr_t ) 0xffffffff )
@@ -16,6 +17,7 @@ int     Accept ( int fd, struct sockaddr *addr, socklen_t *addrlen );
 void    Shutdown ( int s, int how );
 ssize_t Send ( int s, const void *buf, size_t len, int flags );
 void    Sendn ( int fd, const void *buf, size_t count, int flags );
+void    Sendvn ( int fd, struct iovec *iov, int iovcnt );
 ssize_t Recv ( int s, void *buf, size_t len, int flags );
 void    Recvn ( int fd, void *buf, size_t count, int flags );
 int     Recvn2 ( int fd, void *buf, size_t count, int flags );
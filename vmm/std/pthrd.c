@@ -1,5 +1,7 @@
 #include "vmm/std/types.h"
 #include "vmm/std/debug.h"
+#include "vmm/std/pthrd.h"
+#include "vmm/std/timespec.h"
 #include <pthread.h>
 
 
@@ -206,3 +208,72 @@ Pthread_cond_destroy ( pthread_cond_t *cond )
 	if ( retval != 0 )
 		Sys_failure ( "pthread_cond_destroy" );
 }
+
+/****************************************************************/
+
+void
+Event_init ( struct event_t *x )
+{
+	ASSERT ( x != NULL );
+
+	Pthread_mutex_init ( &x->mp, NULL );
+	Pthread_cond_init ( &x->cond, NULL );
+	x->is_signaled = FALSE;
+	x->signaled_at = 0;
+}
+
+void
+Event_signal ( struct event_t *x )
+{
+	ASSERT ( x != NULL );
+
+	Pthread_mutex_lock ( &x->mp );
+
+	if ( ! x->is_signaled ) {
+		x->is_signaled = TRUE;
+		rdtsc ( x->signaled_at );
+		Pthread_cond_signal ( &x->cond );
+	}
+
+	Pthread_mutex_unlock ( &x->mp );
+}
+
+/* Drop a signal that has not been waited for. */
+void
+Event_reset ( struct event_t *x )
+{
+	ASSERT ( x != NULL );
+
+	Pthread_mutex_lock ( &x->mp );
+	x->is_signaled = FALSE;
+	Pthread_mutex_unlock ( &x->mp );
+}
+
+/* Wait until <x> is signaled or <usec> micro seconds elapse, and
+ * reset <x>.  Return TRUE if <x> has been signaled, in which case the
+ * TSC at the signal is stored in <*signaled_at>. */
+bool_t
+Event_timedwait ( struct event_t *x, long long usec, bit64u_t *signaled_at )
+{
+	struct timespec ts;
+	bool_t ret;
+
+	ASSERT ( x != NULL );
+	ASSERT ( signaled_at != NULL );
+
+	ts = Timespec_add2 ( Timespec_current ( ), usec );
+
+	Pthread_mutex_lock ( &x->mp );
+
+	if ( ! x->is_signaled ) {
+		Pthread_cond_timedwait ( &x->cond, &x->mp, &ts );
+	}
+
+	ret = x->is_signaled;
+	*signaled_at = x->signaled_at;
+	x->is_signaled = FALSE;
+
+	Pthread_mutex_unlock ( &x->mp );
+
+	return ret;
+}
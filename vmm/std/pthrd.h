@@ -6,6 +6,15 @@
 
 typedef void *pthread_start_routine_t ( void *);
 
+/* A wait object that remembers whether it has been signaled, so that
+ * a signal sent before the wait is not lost. */
+struct event_t {
+	pthread_mutex_t		mp;
+	pthread_cond_t		cond;
+	bool_t			is_signaled;
+	bit64u_t		signaled_at;	/* TSC at the first signal */
+};
+
 
 void Pthread_create ( pthread_t *thread, pthread_attr_t *attr, void * ( *start_routine ) ( void * ), void *arg );
 void Pthread_join ( pthread_t th, void **thread_return );
@@ -25,4 +34,9 @@ void Pthread_cond_timedwait ( pthread_cond_t *cond, pthread_mutex_t *mutex,
 			      const struct timespec *abstime );
 void Pthread_cond_destroy ( pthread_cond_t *cond ) ;
 
+void   Event_init ( struct event_t *x );
+void   Event_signal ( struct event_t *x );
+void   Event_reset ( struct event_t *x );
+bool_t Event_timedwait ( struct event_t *x, long long usec, bit64u_t *signaled_at );
+
 #endif /* _VMM_STD_PTHRD_H */
@@ -0,0 +1,170 @@
+/* Microbenchmark of Ptrace_readv/Ptrace_writev against the word-by-word
+ * PEEKTEXT/POKETEXT loop that they replace, for 4 bytes to 64 KB.
+ *
+ * Usage: ptrace_bench [nr_iterations] */
+
+#include "vmm/std.h"
+#include <unistd.h>
+#include <sys/wait.h>
+#include <signal.h>
+
+enum {
+	MIN_LEN = 4,
+	MAX_LEN = 64 * 1024,
+	DEFAULT_NR_ITERATIONS = 200
+};
+
+/* The child and the parent have this buffer at the same address. */
+static bit8u_t child_buf[MAX_LEN];
+static bit8u_t local_buf[MAX_LEN];
+static bit8u_t check_buf[MAX_LEN];
+
+static void
+fill_pattern ( bit8u_t *buf, size_t len, int seed )
+{
+	size_t i;
+
+	/* [Note] Avoid words of -1, which Ptrace_peektext () reports as errors. */
+	for ( i = 0; i < len; i++ ) {
+		buf[i] = ( bit8u_t ) ( ( i + seed ) & 0x7f );
+	}
+}
+
+/* The word loop of the former Ptrace_getmem () */
+static void
+peek_words ( pid_t pid, void *addr, bit8u_t *to, size_t len )
+{
+	size_t i;
+
+	for ( i = 0; i < len; i += sizeof ( long ) ) {
+		long value = Ptrace_peektext ( pid, addr + i );
+		Mmove ( to + i, &value, sizeof ( long ) );
+	}
+}
+
+/* The word loop of the former Ptrace_setmem () */
+static void
+poke_words ( pid_t pid, void *addr, bit8u_t *from, size_t len )
+{
+	size_t i;
+
+	for ( i = 0; i < len; i += sizeof ( long ) ) {
+		long value = * ( ( long * ) ( from + i ) );
+		Ptrace_poketext ( pid, addr + i, ( void * ) value );
+	}
+}
+
+static pid_t
+start_child ( void )
+{
+	pid_t pid;
+	int status;
+
+	fill_pattern ( child_buf, MAX_LEN, 0 );
+
+	pid = Fork ( );
+	if ( pid == 0 ) {
+		Ptrace_traceme ( );
+		Raise ( SIGSTOP );
+		for ( ; ; ) {
+			pause ( );
+		}
+	}
+
+	Waitpid ( pid, &status, 0 );
+	if ( ! WIFSTOPPED ( status ) ) {
+		Fatal_failure ( "start_child: the child is not stopped\n" );
+	}
+	return pid;
+}
+
+/* Check that the child has <expected> in its buffer */
+static void
+check_child ( pid_t pid, const bit8u_t *expected, size_t len )
+{
+	Mzero ( check_buf, len );
+	Ptrace_readv ( pid, child_buf, Fptr_create ( check_buf, len ) );
+	if ( Memcmp ( check_buf, expected, len ) != 0 ) {
+		Fatal_failure ( "check_child: len=%#lx\n", ( unsigned long ) len );
+	}
+}
+
+/* Return the time of an iteration in micro seconds */
+static double
+bench_read ( pid_t pid, size_t len, int n, bool_t is_vector )
+{
+	struct timespec start;
+	int i;
+
+	start = Timespec_current ( );
+	for ( i = 0; i < n; i++ ) {
+		if ( is_vector ) {
+			Ptrace_readv ( pid, child_buf, Fptr_create ( local_buf, len ) );
+		} else {
+			peek_words ( pid, child_buf, local_buf, len );
+		}
+	}
+	return Timespec_elapsed ( start ) * 1000000.0 / n;
+}
+
+static double
+bench_write ( pid_t pid, size_t len, int n, bool_t is_vector )
+{
+	struct timespec start;
+	int i;
+
+	fill_pattern ( local_buf, len, 1 );
+
+	start = Timespec_current ( );
+	for ( i = 0; i < n; i++ ) {
+		if ( is_vector ) {
+			Ptrace_writev ( pid, child_buf, Fptr_create ( local_buf, len ) );
+		} else {
+			poke_words ( pid, child_buf, local_buf, len );
+		}
+	}
+	return Timespec_elapsed ( start ) * 1000000.0 / n;
+}
+
+int
+main ( int argc, char *argv[] )
+{
+	int nr_iterations = DEFAULT_NR_ITERATIONS;
+	size_t len;
+	pid_t pid;
+
+	if ( argc > 1 ) {
+		nr_iterations = atoi ( argv[1] );
+	}
+
+	pid = start_child ( );
+
+	Print ( stdout, "%8s %12s %12s %12s %12s  (usec per transfer)\n",
+		"len", "peek", "readv", "poke", "writev" );
+
+	for ( len = MIN_LEN; len <= MAX_LEN; len *= 4 ) {
+		double peek, readv, poke, writev;
+
+		/* Scale the iterations down so that the loops do not dominate. */
+		int n = ( len <= 1024 ) ? nr_iterations * 10 : nr_iterations;
+
+		check_child ( pid, child_buf, len );
+		peek = bench_read ( pid, len, n, FALSE );
+		readv = bench_read ( pid, len, n, TRUE );
+		poke = bench_write ( pid, len, n, FALSE );
+		writev = bench_write ( pid, len, n, TRUE );
+		check_child ( pid, local_buf, len );
+
+		/* Restore the buffer of the child, including the bytes
+		 * after <len> that the word loops may have written */
+		Ptrace_writev ( pid, child_buf, Fptr_create ( child_buf, MAX_LEN ) );
+
+		Print ( stdout, "%8lu %12.2f %12.2f %12.2f %12.2f\n",
+			( unsigned long ) len, peek, readv, poke, writev );
+	}
+
+	Kill ( pid, SIGKILL );
+	Waitpid ( pid, NULL, 0 );
+
+	return 0;
+}
@@ -8,6 +8,8 @@
 #include <sys/types.h>
 #include <sys/ptrace.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
+#include <errno.h>
 #include <linux/user.h>
 #include <asm/unistd.h>
 
@@ -142,36 +144,129 @@ Ptrace_setfpregs ( pid_t pid, struct user_i387_struct *regs )
 		Sys_failure ( "ptrace" ); 
 }
 
+/* Transfer <len> bytes between <local> and the location <remote> in
+ * the child's memory with a single process_vm_readv/writev system call.
+ * Return the number of bytes transferred, or -1 if the system call is
+ * not available. */
+static ssize_t
+process_vm_rw ( pid_t pid, void *local, void *remote, size_t len, bool_t is_write )
+{
+#if defined ( __NR_process_vm_readv ) && defined ( __NR_process_vm_writev )
+	static bool_t is_unavailable = FALSE;
+	struct iovec liov, riov;
+	long retval;
+
+	if ( is_unavailable )
+		return -1;
+
+	liov.iov_base = local;
+	liov.iov_len = len;
+	riov.iov_base = remote;
+	riov.iov_len = len;
+
+	retval = syscall ( ( is_write ) ? __NR_process_vm_writev : __NR_process_vm_readv,
+			   pid, &liov, 1UL, &riov, 1UL, 0UL );
+
+	if ( ( retval == -1 ) && ( errno == ENOSYS ) ) {
+		is_unavailable = TRUE;
+	}
+
+	/* [Note] A partial transfer is completed by the caller. */
+	return ( retval == -1 ) ? 0 : retval;
+#else
+	return -1;
+#endif
+}
+
+static void
+peek_loop ( pid_t pid, void *addr, void *to_addr, size_t len )
+{
+	size_t i;
+
+	for ( i = 0; i < len; i += sizeof ( long ) ) {
+		long value = Ptrace_peektext ( pid, addr + i );
+		size_t n = ( len - i < sizeof ( long ) ) ? len - i : sizeof ( long );
+		Mmove ( to_addr + i, &value, n );
+	}
+}
+
+static void
+poke_loop ( pid_t pid, void *addr, void *from_addr, size_t len )
+{
+	size_t i;
+
+	for ( i = 0; i < len; i += sizeof ( long ) ) {
+		long value;
+		size_t n = ( len - i < sizeof ( long ) ) ? len - i : sizeof ( long );
+
+		/* [Note] Preserve the bytes following the last partial word. */
+		if ( n < sizeof ( long ) ) {
+			value = Ptrace_peektext ( pid, addr + i );
+		}
+		Mmove ( &value, from_addr + i, n );
+		Ptrace_poketext ( pid, addr + i, ( void * )value );
+	}
+}
+
 /* read from the location <addr> in the child's memory,
-   and copy it to <src> */
+   and copy it to <dest>
+
+   [Note] The monitor does not call Ptrace_readv () nor Ptrace_writev ():
+   it reads and writes the guest memory through the pmem mapping that
+   it shares with the guest process (see mon/mon_maccess.c), which costs
+   no system call at all.  They serve the memory of a traced process
+   that is not mapped in the caller. */
 void
-Ptrace_getmem ( pid_t pid, void *addr, const struct fptr_t src )
+Ptrace_readv ( pid_t pid, void *addr, struct fptr_t dest )
 {
-	size_t i;
+	ssize_t n;
+
+	ASSERT ( dest.base != NULL );
 
-	Fptr_zero ( src );
+	n = process_vm_rw ( pid, dest.base, addr, dest.offset, FALSE );
+	if ( n < 0 ) 
+		n = 0;
 
-	for ( i = 0; i < src.offset; i += sizeof ( int ) ) {
-		void *p = addr + i;
-		void *q = src.base + i;
-		int value = Ptrace_peektext ( pid, p );
-		Mmove ( q, &value, sizeof ( int ) );
+	if ( n < dest.offset ) {
+		peek_loop ( pid, addr + n, dest.base + n, dest.offset - n );
 	}
 }
 
-/* copy the <data> to location <addr> in the child's memory */
+/* copy <src> to the location <addr> in the child's memory */
 void
-Ptrace_setmem ( pid_t pid, void *addr, struct fptr_t dest )
+Ptrace_writev ( pid_t pid, void *addr, const struct fptr_t src )
 {
-	int i;
+	ssize_t n;
+
+	ASSERT ( src.base != NULL );
 
-	for ( i = 0; i < dest.offset; i += sizeof ( int ) ) {
-		int value = * ( ( int * ) ( dest.base + i ) ); 
-		void *p = addr + i;
-		Ptrace_poketext ( pid, p, ( void * )value );
+	/* [Note] process_vm_writev() cannot write to read-only pages,
+	 * whereas PTRACE_POKETEXT can.  Such pages are written by the
+	 * fallback loop. */
+	n = process_vm_rw ( pid, src.base, addr, src.offset, TRUE );
+	if ( n < 0 ) 
+		n = 0;
+
+	if ( n < src.offset ) {
+		poke_loop ( pid, addr + n, src.base + n, src.offset - n );
 	}
 }
 
+/* read from the location <addr> in the child's memory,
+   and copy it to <src> */
+void
+Ptrace_getmem ( pid_t pid, void *addr, const struct fptr_t src )
+{
+	Ptrace_readv ( pid, addr, src );
+}
+
+/* copy the <data> to location <addr> in the child's memory */
+void
+Ptrace_setmem ( pid_t pid, void *addr, struct fptr_t dest )
+{
+	Ptrace_writev ( pid, addr, dest );
+}
+
 int
 Ptrace_trap ( pid_t pid )
 {
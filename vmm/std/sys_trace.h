@@ -17,6 +17,8 @@ void        Ptrace_getregs ( pid_t pid, struct user_regs_struct *regs );
 void        Ptrace_setregs ( pid_t pid, struct user_regs_struct *regs );
 void	    Ptrace_getfpregs ( pid_t pid, struct user_i387_struct *regs );
 void        Ptrace_setfpregs ( pid_t pid, struct user_i387_struct *regs );
+void        Ptrace_readv ( pid_t pid, void *addr, struct fptr_t dest );
+void        Ptrace_writev ( pid_t pid, void *addr, const struct fptr_t src );
 void        Ptrace_getmem ( pid_t pid, void *addr, const struct fptr_t src );
 void        Ptrace_setmem ( pid_t pid, void *addr, struct fptr_t dest );
 int         Ptrace_trap ( pid_t pid );
@@ -122,12 +122,16 @@ start_emulation ( struct vm_t *vm, int sig, struct sigcontext *sc )
 
 	/* restore the esp register */
 	sc->esp = vm->shi->saved_esp;
+
+	/* The queued protection changes are applied on every entry, so
+	 * that the handlers below see the up-to-date mappings. */
+	change_page_prot ( vm );
 		
 	switch ( vm->shi->kind ) {
 	case HANDLE_PAGEFAULT: 	emulate_pagefault ( vm, vm->shi->args.cr2 );break;
 	case SET_CNTL_REG:      set_cntl_reg ( vm, sig ); break;
 	case INVALIDATE_TLB:    invalidate_tlb ( vm ); break;
-	case CHANGE_PAGE_PROT:  change_page_prot ( vm, vm->shi->args.page_no ); break;
+	case CHANGE_PAGE_PROT:  /* already applied above */ break;
 	case UNMAP_ALL:		Vm_unmap_all ( vm ); break;
 	case RAISE_INT:		Vm_raise_interrupt ( vm, sc->trapno ); break;
 	case PRINT_CR2:		fprintf ( stderr, "cr2 = %#x\n", sc->cr2 ); break;
@@ -135,6 +139,10 @@ start_emulation ( struct vm_t *vm, int sig, struct sigcontext *sc )
 	};
 }
 
+/* [Note]
+ * The monitor takes the registers of the interrupted context from
+ * <vm->shi->retval> without PTRACE_GETREGS, so <retval> must be
+ * filled in before SIGSTOP is raised. */
 static void
 quit_emulation ( struct vm_t *vm, struct sigcontext *sc )
 {
@@ -0,0 +1,133 @@
+#include "vmm/vm/vm.h"
+
+void
+MemMap_init ( struct mem_map_t *map )
+{
+	ASSERT ( map != NULL );
+
+	map->tables = Calloct ( NUM_OF_PDIR_ENTRIES, struct mem_map_entry_t * );
+	map->head = NULL;
+}
+
+static struct mem_map_entry_t *
+MemMap_lookup ( struct mem_map_t *map, bit32u_t laddr, bool_t need_alloc )
+{
+	struct linear_addr_t p;
+	struct mem_map_entry_t *table;
+
+	ASSERT ( map != NULL );
+
+	p = LinearAddr_of_bit32u ( laddr );
+	table = map->tables[p.dir];
+
+	if ( table == NULL ) {
+		if ( ! need_alloc ) 
+			return NULL;
+
+		table = Calloct ( NUM_OF_PTBL_ENTRIES, struct mem_map_entry_t );
+		map->tables[p.dir] = table;
+	}
+
+	return &table[p.table];
+}
+
+static void
+MemMap_link ( struct mem_map_t *map, struct mem_map_entry_t *x )
+{
+	ASSERT ( map != NULL );
+	ASSERT ( x != NULL );
+	ASSERT ( ! x->is_mapped );
+
+	x->is_mapped = TRUE;
+	x->prev = NULL;
+	x->next = map->head;
+	if ( map->head != NULL ) 
+		map->head->prev = x;
+	map->head = x;
+}
+
+void
+MemMap_remove ( struct mem_map_t *map, struct mem_map_entry_t *x )
+{
+	ASSERT ( map != NULL );
+	ASSERT ( x != NULL );
+	ASSERT ( x->is_mapped );
+
+	if ( x->prev != NULL ) 
+		x->prev->next = x->next;
+	else 
+		map->head = x->next;
+
+	if ( x->next != NULL ) 
+		x->next->prev = x->prev;
+
+	x->is_mapped = FALSE;
+	x->prev = x->next = NULL;
+}
+
+void
+MemMap_destroy ( struct mem_map_t *map )
+{
+	int i;
+
+	ASSERT ( map != NULL );
+
+	for ( i = 0; i < NUM_OF_PDIR_ENTRIES; i++ ) {
+		if ( map->tables[i] != NULL ) {
+			Free ( map->tables[i] );
+			map->tables[i] = NULL;
+		}
+	}
+
+	map->head = NULL;
+}
+
+/* Add the mapping from <laddr> to <paddr>.  If <laddr> has already
+ * been mapped to another physical page, <*b> is set to TRUE and the
+ * old physical address is returned. */
+bit32u_t
+MemMap_add ( struct mem_map_t *map, bit32u_t laddr, bit32u_t paddr, bool_t read_write, bool_t *b )
+{
+	struct mem_map_entry_t *x;
+	bit32u_t ret;
+
+	ASSERT ( map != NULL );
+	ASSERT ( b != NULL );
+
+	x = MemMap_lookup ( map, laddr, TRUE );
+
+	if ( x->is_mapped ) {
+		*b = ( paddr != x->paddr );
+		ret = x->paddr;
+	} else {
+		MemMap_link ( map, x );
+		*b = FALSE;
+		ret = 0;
+	}
+
+	x->laddr = laddr;
+	x->paddr = paddr;
+	x->read_write = read_write;
+
+	return ret;
+}
+
+struct mem_map_entry_t *
+MemMap_find ( struct mem_map_t *map, bit32u_t laddr )
+{
+	struct mem_map_entry_t *x;
+
+	x = MemMap_lookup ( map, laddr, FALSE );
+
+	return ( ( x != NULL ) && ( x->is_mapped ) ) ? x : NULL;
+}
+
+void
+MemMap_print ( FILE *fp, struct mem_map_t *map )
+{
+	struct mem_map_entry_t *p;
+
+	for ( p = map->head; p != NULL; p = p->next ) {
+		Print ( fp, "%#x ---> %#x (%d)\n", p->laddr, p->paddr, p->read_write );
+	}
+}
@@ -0,0 +1,393 @@
+/* Benchmark of MemMap against the sorted list of the page mappings
+ * that it replaced.  Both replay the same sequence of operations:
+ *
+ *   a <laddr> <paddr> <rw>	map a page (MemMap_add)
+ *   f <laddr>			look up a page (MemMap_find, as fault-around and invlpg do)
+ *   i <laddr>			the page table entry of <laddr> is changed
+ *   o				unmap the changed pages (Vm_unmap_obsolete)
+ *   x				unmap all the pages (Vm_unmap_all, on a CR3 reload)
+ *
+ * The sequence is read from a file, one operation per line, or is
+ * made up of the faults of a few processes switched in turn.
+ *
+ * Usage: mem_map_bench [-w file] [trace_file] [nr_iterations] */
+
+#include "vmm/vm/vm.h"
+#include <string.h>
+
+enum {
+	NR_PAGES = NUM_OF_PDIR_ENTRIES * NUM_OF_PTBL_ENTRIES,
+	DEFAULT_NR_ITERATIONS = 5
+};
+
+/****************************************************************/
+
+/* The list of the former vm_maccess.c, sorted by laddr in the
+ * descending order. */
+
+struct old_entry_t {
+	bit32u_t		laddr;
+	bit32u_t		paddr;
+	bool_t			read_write;
+	struct old_entry_t	*next;
+};
+
+struct old_list_t {
+	struct old_entry_t *head;
+};
+
+static struct old_entry_t *
+OldEntry_create ( bit32u_t laddr, bit32u_t paddr, bool_t read_write )
+{
+	struct old_entry_t *x;
+
+	x = Malloct ( struct old_entry_t );
+	x->laddr = laddr;
+	x->paddr = paddr;
+	x->read_write = read_write;
+	x->next = NULL;
+	return x;
+}
+
+static bit32u_t
+OldList_add ( struct old_list_t *list, bit32u_t laddr, bit32u_t paddr, bool_t read_write, bool_t *b )
+{
+	struct old_entry_t **pp, *p;
+	bit32u_t ret;
+
+	p = list->head;
+	pp = &list->head;
+	while ( p != NULL ) {
+		if ( laddr >= p->laddr ) {
+			break;
+		}
+		pp = &p->next;
+		p = *pp;
+	}
+
+	if ( ( p != NULL ) &&  ( laddr == p->laddr ) ) {
+		*b = ( paddr != p->paddr );
+		ret = p->paddr;
+		p->paddr = paddr;
+	} else {
+		struct old_entry_t *e;
+
+		e = OldEntry_create ( laddr, paddr, read_write );
+		e->next = p;
+		*pp = e;
+		*b = FALSE;
+		ret = 0;
+	}
+
+	return ret;
+}
+
+static struct old_entry_t *
+OldList_find ( struct old_list_t *list, bit32u_t laddr )
+{
+	struct old_entry_t *p;
+
+	for ( p = list->head; p != NULL; p = p->next ) {
+		if ( p->laddr == laddr ) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+/****************************************************************/
+
+struct op_t {
+	char		kind;
+	bit32u_t	laddr;
+	bit32u_t	paddr;
+	bool_t		read_write;
+};
+
+static struct op_t *ops = NULL;
+static int nr_ops = 0, max_ops = 0;
+
+/* The pages marked by 'i' and not yet unmapped by 'o' */
+static bool_t is_changed[NR_PAGES];
+static bit32u_t *changed = NULL;
+static int nr_changed = 0;
+
+/* To keep the compiler from dropping the lookups */
+static volatile int nr_found = 0;
+
+static void
+add_op ( char kind, bit32u_t laddr, bit32u_t paddr, bool_t read_write )
+{
+	struct op_t *x;
+
+	if ( nr_ops == max_ops ) {
+		max_ops = ( max_ops == 0 ) ? 4096 : max_ops * 2;
+		ops = Realloc ( ops, max_ops * sizeof ( struct op_t ) );
+	}
+
+	x = &ops[nr_ops++];
+	x->kind = kind;
+	x->laddr = laddr & 0xfffff000;
+	x->paddr = paddr & 0xfffff000;
+	x->read_write = read_write;
+}
+
+static void
+read_trace ( const char *path )
+{
+	FILE *fp;
+	char line[128];
+
+	fp = Fopen ( path, "r" );
+	while ( fgets ( line, sizeof ( line ), fp ) != NULL ) {
+		unsigned long laddr = 0, paddr = 0;
+		int read_write = 0;
+		char kind;
+
+		if ( sscanf ( line, " %c %lx %lx %d", &kind, &laddr, &paddr, &read_write ) < 1 ) {
+			continue;
+		}
+		if ( strchr ( "afiox", kind ) == NULL ) {
+			Fatal_failure ( "read_trace: bad line: %s", line );
+		}
+		add_op ( kind, laddr, paddr, read_write );
+	}
+	Fclose ( fp );
+}
+
+static void
+write_trace ( const char *path )
+{
+	FILE *fp;
+	int i;
+
+	fp = Fopen ( path, "w" );
+	for ( i = 0; i < nr_ops; i++ ) {
+		struct op_t *x = &ops[i];
+
+		switch ( x->kind ) {
+		case 'a': Print ( fp, "a %#x %#x %d\n", x->laddr, x->paddr, x->read_write ); break;
+		case 'f': case 'i': Print ( fp, "%c %#x\n", x->kind, x->laddr ); break;
+		default: Print ( fp, "%c\n", x->kind ); break;
+		}
+	}
+	Fclose ( fp );
+}
+
+/* A process of <nr_pages> pages faults them in from a few regions in
+ * runs of up to 16 pages.  Each run looks up its neighbours before
+ * mapping them, as the fault-around does, and some page table updates
+ * are flushed on the way. */
+static void
+make_process ( int nr_pages )
+{
+	static const bit32u_t regions[] = { 0x08048000, 0x0a000000, 0x40000000, 0xbfc00000, 0xc0000000 };
+	const int nr_regions = sizeof ( regions ) / sizeof ( regions[0] );
+	int n = 0;
+
+	add_op ( 'x', 0, 0, 0 );
+
+	while ( n < nr_pages ) {
+		bit32u_t base = regions[rand ( ) % nr_regions] + ( rand ( ) % 1024 ) * 16 * PAGE_SIZE_4K;
+		bit32u_t paddr = ( rand ( ) % 0x8000 ) * PAGE_SIZE_4K;
+		int len = 1 + rand ( ) % 16;
+		int j;
+
+		for ( j = 0; j < len; j++ ) {
+			add_op ( 'f', base + j * PAGE_SIZE_4K, 0, 0 );
+		}
+		for ( j = 0; j < len; j++ ) {
+			add_op ( 'a', base + j * PAGE_SIZE_4K, paddr + j * PAGE_SIZE_4K, rand ( ) % 2 );
+		}
+		n += len;
+
+		if ( rand ( ) % 32 == 0 ) {
+			add_op ( 'i', base, 0, 0 );
+			add_op ( 'o', 0, 0, 0 );
+		}
+	}
+}
+
+static void
+make_trace ( void )
+{
+	int i;
+
+	srand ( 1 );
+	for ( i = 0; i < 40; i++ ) {
+		make_process ( 500 + rand ( ) % 4000 );
+	}
+}
+
+static void
+mark_changed ( bit32u_t laddr )
+{
+	if ( ! is_changed[laddr >> 12] ) {
+		is_changed[laddr >> 12] = TRUE;
+		changed[nr_changed++] = laddr;
+	}
+}
+
+static void
+clear_changed ( void )
+{
+	int i;
+
+	for ( i = 0; i < nr_changed; i++ ) {
+		is_changed[changed[i] >> 12] = FALSE;
+	}
+	nr_changed = 0;
+}
+
+/****************************************************************/
+
+static void
+replay_old ( void )
+{
+	struct old_list_t list;
+	struct old_entry_t **pp;
+	int i;
+
+	list.head = NULL;
+
+	for ( i = 0; i < nr_ops; i++ ) {
+		struct op_t *x = &ops[i];
+		bool_t b;
+
+		switch ( x->kind ) {
+		case 'a':
+			OldList_add ( &list, x->laddr, x->paddr, x->read_write, &b );
+			break;
+		case 'f':
+			if ( OldList_find ( &list, x->laddr ) != NULL )
+				nr_found++;
+			break;
+		case 'i':
+			mark_changed ( x->laddr );
+			break;
+		case 'o':
+		case 'x':
+			pp = &list.head;
+			while ( *pp != NULL ) {
+				struct old_entry_t *p = *pp;
+
+				if ( ( x->kind == 'x' ) || ( is_changed[p->laddr >> 12] ) ) {
+					*pp = p->next;
+					Free ( p );
+				} else {
+					pp = &p->next;
+				}
+			}
+			clear_changed ( );
+			break;
+		}
+	}
+
+	while ( list.head != NULL ) {
+		struct old_entry_t *p = list.head;
+		list.head = p->next;
+		Free ( p );
+	}
+}
+
+static void
+replay_new ( void )
+{
+	struct mem_map_t map;
+	struct mem_map_entry_t *p;
+	int i;
+
+	MemMap_init ( &map );
+
+	for ( i = 0; i < nr_ops; i++ ) {
+		struct op_t *x = &ops[i];
+		bool_t b;
+
+		switch ( x->kind ) {
+		case 'a':
+			MemMap_add ( &map, x->laddr, x->paddr, x->read_write, &b );
+			break;
+		case 'f':
+			if ( MemMap_find ( &map, x->laddr ) != NULL )
+				nr_found++;
+			break;
+		case 'i':
+			mark_changed ( x->laddr );
+			break;
+		case 'o':
+		case 'x':
+			p = map.head;
+			while ( p != NULL ) {
+				struct mem_map_entry_t *next = p->next;
+
+				if ( ( x->kind == 'x' ) || ( is_changed[p->laddr >> 12] ) ) {
+					MemMap_remove ( &map, p );
+				}
+				p = next;
+			}
+			clear_changed ( );
+			break;
+		}
+	}
+
+	MemMap_destroy ( &map );
+	Free ( map.tables );
+}
+
+/* Return the time of a replay in milli seconds */
+static double
+bench ( void ( *replay ) ( void ), int n, int *found )
+{
+	struct timespec start;
+	int i;
+
+	nr_found = 0;
+	start = Timespec_current ( );
+	for ( i = 0; i < n; i++ ) {
+		replay ( );
+	}
+	*found = nr_found / n;
+	return Timespec_elapsed ( start ) * 1000.0 / n;
+}
+
+int
+main ( int argc, char *argv[] )
+{
+	int nr_iterations = DEFAULT_NR_ITERATIONS;
+	const char *out = NULL;
+	double t_old, t_new;
+	int found_old, found_new;
+	int i = 1;
+
+	if ( ( argc > 2 ) && ( strcmp ( argv[1], "-w" ) == 0 ) ) {
+		out = argv[2];
+		i = 3;
+	}
+
+	if ( ( argc > i ) && ( strcmp ( argv[i], "-" ) != 0 ) ) {
+		read_trace ( argv[i] );
+	} else {
+		make_trace ( );
+	}
+	if ( argc > i + 1 ) {
+		nr_iterations = atoi ( argv[i + 1] );
+	}
+	if ( out != NULL ) {
+		write_trace ( out );
+	}
+
+	changed = Calloct ( nr_ops, bit32u_t );
+
+	t_old = bench ( replay_old, nr_iterations, &found_old );
+	t_new = bench ( replay_new, nr_iterations, &found_new );
+
+	if ( found_old != found_new ) {
+		Fatal_failure ( "mem_map_bench: lookups differ: %d != %d\n", found_old, found_new );
+	}
+
+	Print ( stdout, "%d operations, %d lookups hit\n", nr_ops, found_new );
+	Print ( stdout, "list:   %10.3f msec\n", t_old );
+	Print ( stdout, "MemMap: %10.3f msec\n", t_new );
+
+	return 0;
+}
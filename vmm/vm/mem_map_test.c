@@ -0,0 +1,206 @@
+/* Unit test of MemMap: random map/unmap/flush sequences are applied
+ * both to a mem_map_t and to a flat array of the page mappings, and
+ * the results of each operation and the list of the mapped entries
+ * are checked against the array.
+ *
+ * Usage: mem_map_test [nr_steps] [seed] */
+
+#include "vmm/vm/vm.h"
+
+enum {
+	NR_PAGES = NUM_OF_PDIR_ENTRIES * NUM_OF_PTBL_ENTRIES,
+	DEFAULT_NR_STEPS = 200000,
+
+	/* The pages are taken from a few windows so that the same
+	 * entries are hit again and some tables stay empty. */
+	NR_WINDOWS = 4,
+	WINDOW_PAGES = 3 * NUM_OF_PTBL_ENTRIES
+};
+
+struct ref_entry_t {
+	bit32u_t	paddr;
+	bool_t		read_write;
+	bool_t		is_mapped;
+};
+
+static struct ref_entry_t ref[NR_PAGES];
+static int nr_ref_mapped = 0;
+
+static const bit32u_t windows[NR_WINDOWS] = {
+	0x00000000, 0x08048000, 0xbff00000, 0xff400000
+};
+
+static bit32u_t
+random_laddr ( void )
+{
+	int w = rand ( ) % NR_WINDOWS;
+	return windows[w] + ( rand ( ) % WINDOW_PAGES ) * PAGE_SIZE_4K;
+}
+
+static bit32u_t
+random_paddr ( void )
+{
+	return ( rand ( ) % 0x4000 ) * PAGE_SIZE_4K;
+}
+
+static void
+check ( bool_t cond, const char *what, bit32u_t laddr )
+{
+	if ( ! cond ) {
+		Fatal_failure ( "mem_map_test: %s: laddr = %#x\n", what, laddr );
+	}
+}
+
+static void
+do_add ( struct mem_map_t *map, bit32u_t laddr, bit32u_t paddr, bool_t read_write )
+{
+	struct ref_entry_t *r = &ref[laddr >> 12];
+	bit32u_t old;
+	bool_t b;
+
+	old = MemMap_add ( map, laddr, paddr, read_write, &b );
+
+	if ( r->is_mapped ) {
+		check ( b == ( paddr != r->paddr ), "dup flag", laddr );
+		check ( old == r->paddr, "old paddr", laddr );
+	} else {
+		check ( ! b, "new entry flagged as dup", laddr );
+		r->is_mapped = TRUE;
+		nr_ref_mapped++;
+	}
+
+	r->paddr = paddr;
+	r->read_write = read_write;
+}
+
+static void
+do_remove ( struct mem_map_t *map, bit32u_t laddr )
+{
+	struct ref_entry_t *r = &ref[laddr >> 12];
+	struct mem_map_entry_t *x;
+
+	x = MemMap_find ( map, laddr );
+
+	if ( ! r->is_mapped ) {
+		check ( x == NULL, "found an unmapped page", laddr );
+		return;
+	}
+
+	check ( x != NULL, "lost a mapped page", laddr );
+	MemMap_remove ( map, x );
+	check ( MemMap_find ( map, laddr ) == NULL, "found a removed page", laddr );
+
+	r->is_mapped = FALSE;
+	nr_ref_mapped--;
+}
+
+/* The walk of Vm_unmap_obsolete (): remove the entries in the list
+ * that satisfy <is_obsolete> while following the links. */
+static void
+do_unmap_obsolete ( struct mem_map_t *map, bit32u_t mask )
+{
+	struct mem_map_entry_t *p;
+
+	p = map->head;
+	while ( p != NULL ) {
+		struct mem_map_entry_t *next = p->next;
+
+		if ( ( p->paddr & mask ) != 0 ) {
+			struct ref_entry_t *r = &ref[p->laddr >> 12];
+
+			MemMap_remove ( map, p );
+			r->is_mapped = FALSE;
+			nr_ref_mapped--;
+		}
+		p = next;
+	}
+}
+
+/* The walk of Vm_unmap_all () */
+static void
+do_unmap_all ( struct mem_map_t *map )
+{
+	while ( map->head != NULL ) {
+		struct mem_map_entry_t *p = map->head;
+		struct ref_entry_t *r = &ref[p->laddr >> 12];
+
+		check ( r->is_mapped, "stale entry in the list", p->laddr );
+		MemMap_remove ( map, p );
+		r->is_mapped = FALSE;
+		nr_ref_mapped--;
+	}
+
+	check ( nr_ref_mapped == 0, "pages left after unmap all", 0 );
+}
+
+/* Every entry in the list is mapped in the reference, once, and the
+ * list has as many entries as the reference. */
+static void
+check_list ( struct mem_map_t *map )
+{
+	struct mem_map_entry_t *p, *prev = NULL;
+	int n = 0;
+
+	for ( p = map->head; p != NULL; p = p->next ) {
+		struct ref_entry_t *r = &ref[p->laddr >> 12];
+
+		check ( p->is_mapped, "unmapped entry in the list", p->laddr );
+		check ( p->prev == prev, "broken prev link", p->laddr );
+		check ( r->is_mapped, "entry not in the reference", p->laddr );
+		check ( r->paddr == p->paddr, "paddr", p->laddr );
+		check ( r->read_write == p->read_write, "read_write", p->laddr );
+		check ( MemMap_find ( map, p->laddr ) == p, "find", p->laddr );
+
+		prev = p;
+		n++;
+		check ( n <= nr_ref_mapped, "loop in the list", p->laddr );
+	}
+
+	check ( n == nr_ref_mapped, "number of entries", 0 );
+}
+
+int
+main ( int argc, char *argv[] )
+{
+	struct mem_map_t map;
+	int nr_steps = DEFAULT_NR_STEPS;
+	int i;
+
+	if ( argc > 1 ) {
+		nr_steps = atoi ( argv[1] );
+	}
+	srand ( ( argc > 2 ) ? atoi ( argv[2] ) : 1 );
+
+	MemMap_init ( &map );
+
+	for ( i = 0; i < nr_steps; i++ ) {
+		int r = rand ( ) % 1000;
+
+		if ( r < 600 ) {
+			do_add ( &map, random_laddr ( ), random_paddr ( ), rand ( ) % 2 );
+		} else if ( r < 950 ) {
+			do_remove ( &map, random_laddr ( ) );
+		} else if ( r < 998 ) {
+			do_unmap_obsolete ( &map, 1 << ( 12 + rand ( ) % 14 ) );
+		} else {
+			do_unmap_all ( &map );
+		}
+
+		if ( ( i % 1000 ) == 0 ) {
+			check_list ( &map );
+		}
+	}
+	check_list ( &map );
+
+	/* MemMap_destroy () drops all the tables, as after the initial mapping. */
+	MemMap_destroy ( &map );
+	check ( map.head == NULL, "head after destroy", 0 );
+	check ( MemMap_find ( &map, windows[1] ) == NULL, "find after destroy", windows[1] );
+	Mzero ( ref, sizeof ( ref ) );
+	nr_ref_mapped = 0;
+	do_add ( &map, windows[1], 0x1000, TRUE );
+	check_list ( &map );
+
+	Print ( stdout, "mem_map_test: %d steps OK\n", nr_steps );
+	return 0;
+}
@@ -8,14 +8,29 @@ struct mem_map_entry_t {
 	bit32u_t			laddr;
 	bit32u_t			paddr;
 	bool_t				read_write;
+	bool_t				is_mapped;
 
-	struct mem_map_entry_t 		*next;
+	/* the list of the mapped entries */
+	struct mem_map_entry_t 		*prev, *next;
 };
 
-struct mem_map_list_t {
-	struct mem_map_entry_t *head;
+/* Page mappings of the guest process, indexed by the linear page
+ * number in the same way as the page directory/table.  The
+ * second-level tables are allocated on demand.  The mapped entries
+ * are also linked so that unmapping them does not scan the tables. */
+struct mem_map_t {
+	struct mem_map_entry_t	**tables; /* NUM_OF_PDIR_ENTRIES tables of
+					   * NUM_OF_PTBL_ENTRIES entries */
+	struct mem_map_entry_t	*head;
 };
 
+void MemMap_init ( struct mem_map_t *map );
+void MemMap_destroy ( struct mem_map_t *map );
+bit32u_t MemMap_add ( struct mem_map_t *map, bit32u_t laddr, bit32u_t paddr, bool_t read_write, bool_t *b );
+void MemMap_remove ( struct mem_map_t *map, struct mem_map_entry_t *x );
+struct mem_map_entry_t *MemMap_find ( struct mem_map_t *map, bit32u_t laddr );
+void MemMap_print ( FILE *fp, struct mem_map_t *map );
+
 struct vm_t {
 	int			cpuid;
 	struct pmem_t		pmem; 	/* physical memory */
@@ -23,7 +38,7 @@ struct vm_t {
 	struct shared_info_t	*shi;
 	size_t			num_of_pages; /* = PMEM_SIZE / PAGE_SIZE_4K */
 	
-	struct mem_map_list_t	mem_map_list;
+	struct mem_map_t	mem_map;
 	struct page_descr_t	*page_descrs;
 };
 
@@ -74,7 +89,7 @@ void set_cr0(struct vm_t *vm, bit32u_t val);
 void set_cr3(struct vm_t *vm, bit32u_t val);
 void set_cr4(struct vm_t *vm, bit32u_t val);
 void invalidate_tlb(struct vm_t *vm);
-void change_page_prot(struct vm_t *vm, int page_no);
+void change_page_prot(struct vm_t *vm);
 bool_t try_add_new_mem_map ( struct vm_t *vm, bit32u_t laddr, bit32u_t paddr, bool_t read_write );
 void allow_access_to_descr_tables ( struct regs_t *regs );
 void restore_permission_of_descr_tables ( struct regs_t *regs );
@@ -29,114 +29,6 @@ get_pdescr_by_paddr ( struct vm_t *vm, bit32u_t paddr )
 
 /********************************************************************************/
 
-struct mem_map_entry_t *
-MemMapEntry_create ( bit32u_t laddr, bit32u_t paddr, bool_t read_write )
-{
-	struct mem_map_entry_t *x;
-
-	x = Malloct ( struct mem_map_entry_t );
-
-	x->laddr = laddr;
-	x->paddr = paddr;
-	x->read_write = read_write;
-
-	x->next = NULL;
-	
-	return x;
-}
-
-static void
-MemMapEntry_destroy ( struct mem_map_entry_t *x )
-{
-	ASSERT ( x != NULL );
-
-	Free ( x );
-}
-
-static void
-MemMapList_init ( struct mem_map_list_t *list )
-{
-	list->head = NULL;
-}
-
-static void 
-MemMapList_destroy ( struct mem_map_list_t *list )
-{
-	struct mem_map_entry_t *p;
-
-	p = list->head;
-	while ( p != NULL ) {
-		struct mem_map_entry_t *next = p->next;
-		MemMapEntry_destroy ( p );
-		p = next;
-	}
-
-	list->head = NULL;
-}
-
-static bit32u_t 
-MemMapList_add ( struct mem_map_list_t *list, bit32u_t laddr, bit32u_t paddr, bool_t read_write, bool_t *b )
-{
-	struct mem_map_entry_t **pp, *p;
-	bit32u_t ret;
-
-	p = list->head;
-	pp = &list->head;
-	while ( p != NULL ) {
-	
-		if ( laddr >= p->laddr ) {
-			break;
-		}
-
-		pp = &p->next;
-		p = *pp;
-	}
-
-	if ( ( p != NULL ) &&  ( laddr == p->laddr ) ) {
-		*b = ( paddr != p->paddr );
-		ret = p->paddr;
-
-		p->paddr = paddr;
-	} else {
-		struct mem_map_entry_t *e;
-
-		e = MemMapEntry_create ( laddr, paddr, read_write );
-		e->next = p;
-		*pp = e;
-
-		*b = FALSE;
-		ret = 0;
-	}
-
-	return ret;
-}
-
-static struct mem_map_entry_t *
-MemMapList_find ( struct mem_map_list_t *list, bit32u_t laddr )
-{
-	struct mem_map_entry_t *p;
-
-	for ( p = list->head; p != NULL; p = p->next ) {
-		if ( p->laddr == laddr ) {
-			return p;
-		}
-	}
-
-	return NULL;
-}
-
-static void
-MemMapList_print ( FILE *fp, struct mem_map_list_t *list )
-{
-	struct mem_map_entry_t *p;
-
-	for ( p = list->head; p != NULL; p = p->next ) {
-		Print ( fp, "%#x ---> %#x (%d)\n", p->laddr, p->paddr, p->read_write );
-	}
-}
-
-/********************************************************************************/
-
 static void
 workspace_init_for_vm ( void )
 {
@@ -269,7 +161,7 @@ Vm_init_mem ( int cpuid )
 	init_page_descrs ( vm );
 	p += vm->num_of_pages * ( sizeof ( struct page_descr_t ) );
 
-	MemMapList_init ( &vm->mem_map_list );
+	MemMap_init ( &vm->mem_map );
 }
 
 /********************************************************************************/
@@ -565,40 +457,61 @@ remove_laddr_of_page_descr ( struct vm_t *vm, bit32u_t laddr, bit32u_t paddr )
 	PageDescr_remove_laddr ( pdescr, laddr );
 }
 
+/* Map [<laddr>, <laddr> + <size>) to [<paddr>, <paddr> + <size>).
+ * Consecutive pages with the same protection are mapped by a single
+ * mmap call, while the bookkeeping is still done page by page so that
+ * a part of the run can be unmapped or reprotected later. */
 static void
 Vm_mmap ( struct vm_t *vm, bit32u_t laddr, bit32u_t paddr, size_t size, bool_t read_write )
 {
-	bit32u_t i;
+	bit32u_t i, n;
 
 	ASSERT ( vm != NULL );
 
-	for ( i = 0; i < size; i += PAGE_SIZE_4K ) {
+	for ( i = 0; i < size; i += n ) {
 		bit32u_t laddr2 = laddr + i;
 		bit32u_t paddr2 = paddr + i;
+		bit32u_t j;
 		int prot;
 
 		if ( paddr2 >= vm->pmem.offset ) { 
 //			Print ( stderr, "map: offset over: %#x, %#x\n",	laddr + i , paddr + i );
+			n = PAGE_SIZE_4K;
 			continue;
 		}
 
 		prot = get_page_prot ( vm, paddr2, read_write );
+
+		/* extend the run as long as the protection is the same */
+		for ( n = PAGE_SIZE_4K; i + n < size; n += PAGE_SIZE_4K ) {
+			if ( ( paddr2 + n >= vm->pmem.offset ) ||
+			     ( get_page_prot ( vm, paddr2 + n, read_write ) != prot ) ) {
+				break;
+			}
+		}
+
 		Mmap ( ( void * )laddr2, 
-		       PAGE_SIZE_4K,
+		       n,
 		       prot, 
 		       MAP_FIXED | MAP_SHARED, 
 		       vm->pmem.fd, 
 		       paddr2 );
 
-		add_laddr_to_page_descr ( vm, laddr2, paddr2, read_write );
-		
-		{
+		/* [STAT] */
+		vm->shi->nr_mmaps++;
+		vm->shi->nr_mmaps_saved += n / PAGE_SIZE_4K - 1;
+		vm->shi->nr_mmapped_pages += n / PAGE_SIZE_4K;
+
+		for ( j = 0; j < n; j += PAGE_SIZE_4K ) {
 			bit32u_t p;
 			bool_t b;
-			p = MemMapList_add ( &vm->mem_map_list, laddr2 , paddr2, read_write, &b );
+
+			add_laddr_to_page_descr ( vm, laddr2 + j, paddr2 + j, read_write );
+
+			p = MemMap_add ( &vm->mem_map, laddr2 + j, paddr2 + j, read_write, &b );
 			if ( b ) {
-				Print ( stderr, "dup add: laddr = %#x,  paddr = %#x", laddr2 , p  );
-				remove_laddr_of_page_descr ( vm, laddr2 , p );
+				Print ( stderr, "dup add: laddr = %#x,  paddr = %#x", laddr2 + j, p  );
+				remove_laddr_of_page_descr ( vm, laddr2 + j, p );
 			}
 		}
 	}
@@ -618,25 +531,53 @@ Vm_unmap ( struct vm_t *vm, bit32u_t laddr, bit32u_t paddr, size_t size )
 	}
 }
 
+/* Return TRUE if <pte> is present and maps the physical page next to
+ * the one mapped by <prev> with the same R/W bit. */
+static inline bool_t
+is_contiguous_pte ( const struct ptbl_entry_t *prev, const struct ptbl_entry_t *pte )
+{
+	ASSERT ( prev != NULL );
+	ASSERT ( pte != NULL );
+
+	return ( ( pte->present ) &&
+		 ( pte->base == prev->base + 1 ) &&
+		 ( pte->read_write == prev->read_write ) );
+}
+
+/* Map the 4KB pages of the entries [<from>, <to>) of the page table
+ * pointed by <pde>.  The entries must map contiguous physical pages
+ * with the same R/W bit, so that they are mapped by a single mmap call. */
 static void
-Vm_map_4k_page ( struct vm_t *vm, bit32u_t laddr, struct ptbl_entry_t *pte )
+Vm_map_4k_pages ( struct vm_t *vm, struct linear_addr_t addr, struct pdir_entry_t *pde, int from, int to )
 {
-	bit32u_t laddr2, paddr;
+	struct ptbl_entry_t pte;
+	int i;
 
 	ASSERT ( vm != NULL );
-	ASSERT ( pte != NULL );
+	ASSERT ( pde != NULL );
+	ASSERT ( from < to );
 
-	laddr2 = BIT_ALIGN ( laddr, 12 );
-	paddr = pte->base << 12;
+	for ( i = from; i < to; i++ ) {
+		pte = Vm_lookup_page_table ( pde, i );
+		ASSERT ( pte.present );
 
-	/* [TODO] */
-	PtblEntry_set_accessed_flag ( pte, &Vm_paddr_to_raddr );
-	if ( pte->read_write ) 
-		PtblEntry_set_dirty_flag ( pte, &Vm_paddr_to_raddr ); 
+		/* [TODO] */
+		PtblEntry_set_accessed_flag ( &pte, &Vm_paddr_to_raddr );
+		if ( pte.read_write ) 
+			PtblEntry_set_dirty_flag ( &pte, &Vm_paddr_to_raddr ); 
+	}
 
-	DPRINT ( "mmap: %#x --> %#x\n", laddr2, paddr );
+	addr.table = from;
+	pte = Vm_lookup_page_table ( pde, from );
+
+	DPRINT ( "mmap: %#x --> %#x (%d pages)\n", 
+		 LinearAddr_to_bit32u ( addr ), pte.base << 12, to - from );
 
-	Vm_mmap ( vm, laddr2, paddr, PAGE_SIZE_4K, pte->read_write );
+	Vm_mmap ( vm, 
+		  LinearAddr_to_bit32u ( addr ), 
+		  pte.base << 12, 
+		  ( to - from ) * PAGE_SIZE_4K, 
+		  pte.read_write );
 }
 
 static void
@@ -661,6 +602,75 @@ Vm_map_4m_page ( struct vm_t *vm, bit32u_t laddr, struct pdir_entry_t *pde )
 	Vm_mmap ( vm, laddr2, paddr, PAGE_SIZE_4M, pde->read_write );
 }
 
+/* [Note] On a page fault, the unmapped neighbours of the faulting
+ * page that continue its run of physical pages are mapped together
+ * (within the aligned window of FAULT_AROUND_PAGES pages), which saves
+ * the mmap calls and the page faults that would follow.  Only the
+ * neighbours that the guest has already accessed (and written, if
+ * writable) are taken, since Vm_map_4k_pages () sets the A/D bits of
+ * all the entries it maps and the guest must not see them on pages it
+ * has not touched. */
+enum {
+	FAULT_AROUND_PAGES = 16
+};
+
+/* <pte> is the neighbour at <addr>. */
+static bool_t
+can_fault_around ( struct vm_t *vm, struct linear_addr_t addr, const struct ptbl_entry_t *pte )
+{
+	ASSERT ( vm != NULL );
+	ASSERT ( pte != NULL );
+
+	return ( ( pte->accessed ) &&
+		 ( ( ! pte->read_write ) || ( pte->dirty ) ) &&
+		 ( MemMap_find ( &vm->mem_map, LinearAddr_to_bit32u ( addr ) ) == NULL ) );
+}
+
+static void
+Vm_map_4k_page_around ( struct vm_t *vm, struct linear_addr_t p, struct pdir_entry_t *pde )
+{
+	struct ptbl_entry_t pte, prev;
+	struct linear_addr_t addr;
+	int from, to, lower, upper;
+
+	ASSERT ( vm != NULL );
+	ASSERT ( pde != NULL );
+
+	lower = p.table - ( p.table % FAULT_AROUND_PAGES );
+	upper = lower + FAULT_AROUND_PAGES;
+
+	addr = p;
+	prev = Vm_lookup_page_table ( pde, p.table );
+	assert ( prev.present );
+
+	for ( from = p.table; from > lower; from-- ) {
+		addr.table = from - 1;
+		pte = Vm_lookup_page_table ( pde, from - 1 );
+
+		/* <pte> is below <prev>: is_contiguous_pte () checks that
+		 * <prev> maps the page next to <pte>, but checks the present
+		 * bit of <prev> only.  A non-present <pte> (e.g. swapped
+		 * out) may still look accessed and dirty. */
+		if ( ( ! pte.present ) ||
+		     ( ! is_contiguous_pte ( &pte, &prev ) ) ||
+		     ( ! can_fault_around ( vm, addr, &pte ) ) )
+			break;
+		prev = pte;
+	}
+
+	prev = Vm_lookup_page_table ( pde, p.table );
+	for ( to = p.table + 1; to < upper; to++ ) {
+		addr.table = to;
+		pte = Vm_lookup_page_table ( pde, to );
+		if ( ( ! is_contiguous_pte ( &prev, &pte ) ) ||
+		     ( ! can_fault_around ( vm, addr, &pte ) ) )
+			break;
+		prev = pte;
+	}
+
+	Vm_map_4k_pages ( vm, p, pde, from, to );
+}
+
 void
 Vm_map_page ( struct vm_t *vm, bit32u_t laddr )
 {
@@ -677,11 +687,7 @@ Vm_map_page ( struct vm_t *vm, bit32u_t laddr )
 		ASSERT ( vm->regs->sys.cr4.page_size_extension );
 		Vm_map_4m_page ( vm, laddr, &pde );
 	} else {
-		struct ptbl_entry_t pte;
-
-		pte = Vm_lookup_page_table ( &pde, p.table );
-		assert ( pte.present );
-		Vm_map_4k_page ( vm, laddr, &pte );
+		Vm_map_4k_page_around ( vm, p, &pde );
 	}
 }
 
@@ -716,7 +722,7 @@ Vm_init_page_mapping ( struct vm_t *vm )
 		bool_t b;
 
 		add_laddr_to_page_descr ( vm, i, i, read_write );
-		MemMapList_add ( &vm->mem_map_list, i, i, read_write, &b );
+		MemMap_add ( &vm->mem_map, i, i, read_write, &b );
 	}
 }
 
@@ -733,7 +739,7 @@ Vm_unmap_initial_page_mapping ( struct vm_t *vm )
 		remove_laddr_of_page_descr ( vm, i, i );  
 	}
 
-	MemMapList_destroy ( &vm->mem_map_list );
+	MemMap_destroy ( &vm->mem_map );
 }
 
 static void
@@ -750,15 +756,27 @@ Vm_map_all_pages_sub ( struct vm_t *vm, struct linear_addr_t addr, struct pdir_e
 		return;
 	}
 
-	for ( addr.table = 0; addr.table < NUM_OF_PTBL_ENTRIES; addr.table++ ) {
-		struct ptbl_entry_t pte;
+	addr.table = 0;
+	while ( addr.table < NUM_OF_PTBL_ENTRIES ) {
+		struct ptbl_entry_t pte, prev;
+		int to;
 	 
-		pte = Vm_lookup_page_table ( &pde, addr.table );
-		if ( ! pte.present ) {
+		prev = Vm_lookup_page_table ( &pde, addr.table );
+		if ( ! prev.present ) {
+			addr.table++;
 			continue;
 		}
 
-		Vm_map_4k_page ( vm, LinearAddr_to_bit32u ( addr ), &pte );
+		/* find the run of the entries that map contiguous physical pages */
+		for ( to = addr.table + 1; to < NUM_OF_PTBL_ENTRIES; to++ ) {
+			pte = Vm_lookup_page_table ( &pde, to );
+			if ( ! is_contiguous_pte ( &prev, &pte ) )
+				break;
+			prev = pte;
+		}
+
+		Vm_map_4k_pages ( vm, addr, &pde, addr.table, to );
+		addr.table = to;
 	}
 }
 
@@ -798,43 +816,32 @@ is_obsolete ( struct vm_t *vm, struct mem_map_entry_t *x )
 static void
 Vm_unmap_obsolete ( struct vm_t *vm )
 {
-	struct mem_map_entry_t **pp;
+	struct mem_map_entry_t *p;
 
 	ASSERT ( vm != NULL );
 
-	pp = &vm->mem_map_list.head;
-
-	while ( *pp != NULL ) {
-		struct mem_map_entry_t *p = *pp;
+	p = vm->mem_map.head;
+	while ( p != NULL ) {
+		struct mem_map_entry_t *next = p->next;
 
 		if ( is_obsolete ( vm, p ) ) {
-			struct mem_map_entry_t *next = p->next;
-
 			Vm_unmap ( vm, p->laddr, p->paddr, PAGE_SIZE_4K );
-			MemMapEntry_destroy ( p );
-			*pp = next;
-		} else {
-			pp = &p->next;
+			MemMap_remove ( &vm->mem_map, p );
 		}
+		p = next;
 	}
 }
 
 void
 Vm_unmap_all ( struct vm_t *vm )
 {
-	struct mem_map_entry_t **pp;
-
 	ASSERT ( vm != NULL );
 
-	pp = &vm->mem_map_list.head;
-
-	while ( *pp != NULL ) {
-		struct mem_map_entry_t *p = *pp;
-		struct mem_map_entry_t *next = p->next;
+	while ( vm->mem_map.head != NULL ) {
+		struct mem_map_entry_t *p = vm->mem_map.head;
 
 		Vm_unmap ( vm, p->laddr, p->paddr, PAGE_SIZE_4K );
-		MemMapEntry_destroy ( p );
-		*pp = next;
+		MemMap_remove ( &vm->mem_map, p );
 	}	
 }
 
@@ -913,26 +920,20 @@ invalidate_tlb ( struct vm_t *vm )
 #ifdef ENABLE_MP
 
 static void
-__change_page_prot ( struct vm_t *vm, int page_no, struct page_descr_t *pdescr, int i )
+__change_page_prot ( struct vm_t *vm, bit32u_t paddr, struct page_descr_t *pdescr, int i )
 {
-	bit32u_t laddr, paddr;
-	bool_t read_write;
+	bit32u_t laddr;
 	int prot;
-	
+
+	ASSERT ( vm != NULL );
+	ASSERT ( pdescr != NULL );
+
 	laddr = pdescr->laddrs[i];
-	paddr = page_no_to_paddr ( page_no );
-	read_write = pdescr->read_write[i];
-	prot = get_page_prot ( vm, paddr, read_write );
-	
+	prot = get_page_prot ( vm, paddr, pdescr->read_write[i] );
 
-	Munmap ( ( void * )laddr, PAGE_SIZE_4K );
-	
-	Mmap ( ( void * )laddr, 
-	       PAGE_SIZE_4K,
-	       prot, 
-	       MAP_FIXED | MAP_SHARED, 
-	       vm->pmem.fd, 
-	       paddr );
+	/* [Note] The page has already been mapped, so that changing the
+	 * protection of the existing mapping is sufficient. */
+	Mprotect ( ( void * )laddr, PAGE_SIZE_4K, prot );
 
 #if 0
 	Print ( stderr,
@@ -942,30 +943,59 @@ __change_page_prot ( struct vm_t *vm, int page_no, struct page_descr_t *pdescr,
 #endif
 }
 
-void
-change_page_prot ( struct vm_t *vm, int page_no )
+static void
+change_page_prot_of_paddr ( struct vm_t *vm, bit32u_t paddr )
 {
 	struct page_descr_t *pdescr;
 	int i;
 
+	DPRINT ( " ( vm )\t" "change page prot: paddr=%#x\n", paddr );
+
+	pdescr = get_pdescr_by_paddr ( vm, paddr );
+
+	for ( i = 0; i < pdescr->num_of_laddrs; i++ ) {
+		__change_page_prot ( vm, paddr, pdescr, i );
+	}
+}
+
+/* Apply the protection changes queued by the monitor. */
+void
+change_page_prot ( struct vm_t *vm )
+{
+	struct page_prot_ring_t *r;
+
 	ASSERT ( vm != NULL );
-	ASSERT ( page_no < vm->num_of_pages );
 
-	DPRINT ( " ( vm )\t" "change page prot: page_no=%#x\n", page_no );
+	r = &vm->shi->prot_ring;
 
-	pdescr = get_pdescr_by_page_no ( vm, page_no );
+	if ( r->is_overflowed ) {
+		int page_no;
 
-	for ( i = 0; i < pdescr->num_of_laddrs; i++ ) {
-		__change_page_prot ( vm, page_no, pdescr, i );
+		for ( page_no = 0; page_no < vm->num_of_pages; page_no++ ) {
+			change_page_prot_of_paddr ( vm, page_no_to_paddr ( page_no ) );
+		}
+		r->head = r->tail;
+		r->is_overflowed = FALSE;
+		return;
+	}
+
+	while ( r->head != r->tail ) {
+		change_page_prot_of_paddr ( vm, r->paddrs[r->head % PAGE_PROT_RING_SIZE] );
+		r->head++;
 	}
 }
 
 #else /* !ENABLE_MP */
 
 void
-change_page_prot ( struct vm_t *vm, int page_no )
+change_page_prot ( struct vm_t *vm )
 {
-	Fatal_failure ( "The change_page_prot() function must not be called.\n" );
+	ASSERT ( vm != NULL );
+
+	if ( ( vm->shi->prot_ring.head != vm->shi->prot_ring.tail ) ||
+	     ( vm->shi->prot_ring.is_overflowed ) ) {
+		Fatal_failure ( "The change_page_prot() function must not be called.\n" );
+	}
 }
 
 #endif /* ENABLE_MP */
@@ -1082,7 +1112,7 @@ restore_permission_of_descr_table ( bit32u_t base, bit16u_t limit )
 		struct page_descr_t *pdescr;
 		bool_t read_write;
 
-		p = MemMapList_find ( &vm->mem_map_list, laddr );
+		p = MemMap_find ( &vm->mem_map, laddr );
 		
 		if ( p == NULL ) 
 			continue;